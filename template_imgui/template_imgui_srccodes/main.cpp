@@ -11,12 +11,16 @@
 // This define is set in the example .vcxproj file and need to be replicated in your app or by adding it to your imconfig.h file.
 
 #include "ReceiverClass.h"
+#include "Benchmarks.h"
+#include "SyntheticSource.h"
 #include "imgui.h"
 #include "imgui_impl_win32.h"
 #include "imgui_impl_dx12.h"
 #include <d3d12.h>
 #include <dxgi1_4.h>
 #include <tchar.h>
+#include <cmath>
+#include <functional>
 
 
 #define _SILENCE_NONFLOATING_COMPLEX_DEPRECATION_WARNING
@@ -124,6 +128,7 @@ int main(int, char**)
 
     // Our state
     std::thread tmpthread;
+    std::thread recthread;
     ReceiverClass MyReceiver;
     bool ConnectInitflag = false;
     bool show_demo_window = false;
@@ -138,6 +143,21 @@ int main(int, char**)
     static int clocksrc_curridx = 0;
     const char* combo_preview_value = clocksrcoptions[clocksrc_curridx];
 
+    // Radio-free pipeline benchmarks, run from the Debug window
+    std::thread benchthread;
+    std::atomic<bool> BenchRunningflag = false;
+    std::string BenchTxt;
+    // One benchmark at a time on benchthread; what it returns is shown in BenchTxt
+    auto runBench = [&](std::function<std::string()> bench) {
+        if (benchthread.joinable())
+            benchthread.join();
+        BenchRunningflag = true;
+        benchthread = std::thread([&, bench] {
+            BenchTxt = bench();
+            BenchRunningflag = false;
+        });
+    };
+
     //Additional ImGUI variables
     ImGuiStyle& style = ImGui::GetStyle();
     ImGuiWindowFlags window_flags = 0;
@@ -223,12 +243,308 @@ int main(int, char**)
                 ImGui::EndDisabled();
             }
 
-            if (!MyReceiver.getUSRPinitflag())
+            static int numchans_input = 1;
+            static bool interleaved_input = false, perchanfiles_input = false;
+            ImGui::InputInt("Channels", &numchans_input);
+            numchans_input = numchans_input < 1 ? 1 : numchans_input;
+            if (numchans_input > 1) {
+                ImGui::Checkbox("Interleaved buffers", &interleaved_input);
+                ImGui::SameLine();
+                ImGui::Checkbox("File per channel", &perchanfiles_input);
+            }
+
+            static int otw_curridx = 0;
+            static bool narrowhost_input = false;
+            const char* otw_items[] = { "sc16", "sc12", "sc8" };
+            ImGui::Combo("Wire format", &otw_curridx, otw_items, IM_ARRAYSIZE(otw_items));
+            if (otw_curridx == 2) {
+                ImGui::SameLine();
+                ImGui::Checkbox("8-bit host samples", &narrowhost_input);
+            }
+
+            static float latency_ms_input = 1.0f;
+            static bool autotune_input = false;
+            ImGui::InputFloat("Block latency (ms)", &latency_ms_input);
+            latency_ms_input = latency_ms_input < 0.01f ? 0.01f : latency_ms_input;
+            ImGui::SameLine();
+            ImGui::Checkbox("Auto-tune recv size", &autotune_input);
+
+            static int rxcpu_input = -1, writercpu_input = -1, dspcpu_input = -1, rtprio_input = 0;
+            static bool lockmem_input = false, hugepages_input = false;
+            if (ImGui::TreeNode("Threads and memory")) {
+                ImGui::InputInt("Receive CPU (-1 any)", &rxcpu_input);
+                ImGui::InputInt("Writer CPU (-1 any)", &writercpu_input);
+                ImGui::InputInt("DSP CPU (-1 any)", &dspcpu_input);
+                ImGui::InputInt("Receive RT priority (0 off)", &rtprio_input);
+                rtprio_input = rtprio_input < 0 ? 0 : rtprio_input > 99 ? 99 : rtprio_input;
+                ImGui::Checkbox("Lock ring memory", &lockmem_input);
+                ImGui::SameLine();
+                ImGui::Checkbox("Huge pages", &hugepages_input);
+                ImGui::TreePop();
+            }
+
+            static bool directio_input = true;
+            static int queuedepth_input = 8, diskbufs_input = 16;
+            static int segmb_input = 0, segsecs_input = 0, compress_input = 1, storage_curridx = 0;
+            static float journal_input = 0;
+            if (ImGui::TreeNode("Disk writes")) {
+                ImGui::Checkbox("Direct I/O (bypass page cache)", &directio_input);
+                ImGui::InputInt("Writes in flight", &queuedepth_input);
+                ImGui::InputInt("1 MB staging buffers per file", &diskbufs_input);
+                diskbufs_input = diskbufs_input < 2 ? 2 : diskbufs_input;
+                queuedepth_input = queuedepth_input < 1 ? 1 : queuedepth_input >= diskbufs_input ? diskbufs_input - 1 : queuedepth_input;
+                ImGui::InputInt("Segment size (MB, 0 off)", &segmb_input);
+                ImGui::InputInt("Segment length (s, 0 off)", &segsecs_input);
+                segmb_input = segmb_input < 0 ? 0 : segmb_input;
+                segsecs_input = segsecs_input < 0 ? 0 : segsecs_input;
+                const char* storage_items[] = { "sc16 raw", "Lossless .iqz", "8-bit block float .iqz", "4-bit block float .iqz" };
+                ImGui::Combo("Storage", &storage_curridx, storage_items, IM_ARRAYSIZE(storage_items));
+                if (storage_curridx > 0) {
+                    ImGui::InputInt("Coding threads", &compress_input);
+                    compress_input = compress_input < 1 ? 1 : compress_input;
+                }
+                ImGui::InputFloat("Journal sync interval (s, 0 off)", &journal_input);
+                journal_input = journal_input < 0 ? 0 : journal_input;
+                // Cut a capture that ended without Stop back to its last journal commit
+                static char recover_input[256] = "";
+                static std::string RecoverTxt;
+                ImGui::InputText("Recording to recover", recover_input, sizeof(recover_input));
+                ImGui::SameLine();
+                if (ImGui::Button("Recover")) {
+                    RecordJournal::RecoveryReport report;
+                    RecordJournal::recover(recover_input, report);
+                    RecoverTxt = report.message;
+                }
+                if (!RecoverTxt.empty())
+                    ImGui::TextWrapped("%s", RecoverTxt.c_str());
+                ImGui::TreePop();
+            }
+
+            // Backpressure ladder, in order of rising queue fill
+            static bool blockfull_input = false;
+            static bool bpstage_input[BP_NUM_ACTIONS] = {};
+            static int bpengage_input[BP_NUM_ACTIONS] = { 50, 60, 75, 90 };
+            static char spilldir_input[256] = "";
+            static int decim_input = 4;
+            static float keepdbfs_input = 0;
+            if (ImGui::TreeNode("Backpressure")) {
+                ImGui::Checkbox("Block instead of dropping when the ring is full", &blockfull_input);
+                for (int a = 0; a < BP_NUM_ACTIONS; a++) {
+                    ImGui::PushID(a);
+                    ImGui::Checkbox(BackpressurePolicy::actionName((BackpressureAction)a), &bpstage_input[a]);
+                    ImGui::SameLine();
+                    ImGui::InputInt("engage at % ring fill", &bpengage_input[a]);
+                    bpengage_input[a] = bpengage_input[a] < 30 ? 30 : bpengage_input[a] > 100 ? 100 : bpengage_input[a];
+                    ImGui::PopID();
+                }
+                ImGui::InputText("Spill directory", spilldir_input, sizeof(spilldir_input));
+                ImGui::InputInt("Decimate: keep 1 block in", &decim_input);
+                decim_input = decim_input < 2 ? 2 : decim_input;
+                ImGui::InputFloat("Always keep blocks above (dBFS, 0 off)", &keepdbfs_input);
+                keepdbfs_input = keepdbfs_input > 0 ? 0 : keepdbfs_input;
+                ImGui::TreePop();
+            }
+
+            // DDC bands: record these instead of the full rate
+            static bool ddcband_input[4] = {};
+            static int ddcchan_input[4] = {};
+            static float ddcoffset_input[4] = {};   // kHz
+            static float ddcbw_input[4] = {};       // kHz, 0 = 0.8 of the output rate
+            static int ddcdecim_input = 16;
+            static float ddcgain_input = 0;
+            static float ddcstop_input = 80;        // dB
+            if (ImGui::TreeNode("DDC")) {
+                for (int b = 0; b < 4; b++) {
+                    ImGui::PushID(b);
+                    ImGui::Checkbox("Band", &ddcband_input[b]);
+                    ImGui::SameLine();
+                    ImGui::SetNextItemWidth(80);
+                    ImGui::InputInt("channel", &ddcchan_input[b]);
+                    ddcchan_input[b] = ddcchan_input[b] < 0 ? 0 : ddcchan_input[b];
+                    ImGui::SameLine();
+                    ImGui::SetNextItemWidth(100);
+                    ImGui::InputFloat("offset (kHz)", &ddcoffset_input[b]);
+                    ImGui::SameLine();
+                    ImGui::SetNextItemWidth(100);
+                    ImGui::InputFloat("bandwidth (kHz)", &ddcbw_input[b]);
+                    ImGui::PopID();
+                }
+                ImGui::InputInt("Decimation", &ddcdecim_input);
+                ddcdecim_input = ddcdecim_input < 2 ? 2 : ddcdecim_input;
+                ImGui::InputFloat("Gain (dB)", &ddcgain_input);
+                ImGui::InputFloat("Rejection (dB)", &ddcstop_input);
+                ddcstop_input = ddcstop_input < 20 ? 20 : ddcstop_input;
+                ImGui::TreePop();
+            }
+
+            // Filter-bank channelizer: record some of M uniform channels instead (takes the DDC's place)
+            static bool chz_input = false;
+            static int chzchan_input = 0;
+            static int chzm_input = 64;
+            static bool chzover_input = false;
+            static char chzkeep_input[256] = "";    // "0,5,12-20", empty = all
+            static int chzthreads_input = 2;
+            static float chzgain_input = 0;
+            if (ImGui::TreeNode("Channelizer")) {
+                ImGui::Checkbox("Channelize", &chz_input);
+                ImGui::InputInt("Input channel", &chzchan_input);
+                chzchan_input = chzchan_input < 0 ? 0 : chzchan_input;
+                ImGui::InputInt("Channels (M)", &chzm_input);
+                chzm_input = chzm_input < 2 ? 2 : chzm_input;
+                ImGui::Checkbox("2x oversampled", &chzover_input);
+                ImGui::InputText("Keep channels (empty = all)", chzkeep_input, sizeof(chzkeep_input));
+                std::vector<size_t> chzkeep;
+                if (!Channelizer::parseChannels(chzkeep_input, chzkeep))
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Not a channel list (e.g. 0,5,12-20): keeping all");
+                ImGui::InputInt("Threads", &chzthreads_input);
+                chzthreads_input = chzthreads_input < 1 ? 1 : chzthreads_input;
+                ImGui::InputFloat("Gain (dB)", &chzgain_input);
+                ImGui::TreePop();
+            }
+
+            // Channel extractor: channels of any width watched alongside the recording,
+            // added and removed while it runs
+            static bool ext_input = false;
+            static int extchan_input = 0;
+            static int extfft_input = 16384;
+            static float extoffset_input = 0;       // kHz
+            static float extbw_input = 100;         // kHz
+            if (ImGui::TreeNode("Channel extractor")) {
+                ImGui::Checkbox("Extract", &ext_input);
+                ImGui::InputInt("Input channel", &extchan_input);
+                extchan_input = extchan_input < 0 ? 0 : extchan_input;
+                ImGui::InputInt("DFT length (power of 2)", &extfft_input);
+                extfft_input = extfft_input < 64 ? 64 : extfft_input;
+                ImGui::SetNextItemWidth(100);
+                ImGui::InputFloat("offset (kHz)", &extoffset_input);
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(100);
+                ImGui::InputFloat("bandwidth (kHz)", &extbw_input);
+                ImGui::SameLine();
+                if (ImGui::Button("Add channel")) {
+                    ExtractChannel c;
+                    c.offsetHz = extoffset_input * 1e3;
+                    c.bandwidth = extbw_input * 1e3;
+                    MyReceiver.getExtractor().addChannel(c);
+                }
+                for (const ExtractStatus& s : MyReceiver.getExtractor().getChannels()) {
+                    ImGui::PushID(s.id);
+                    if (ImGui::Button("Remove"))
+                        MyReceiver.getExtractor().removeChannel(s.id);
+                    ImGui::SameLine();
+                    if (s.outRate > 0)
+                        ImGui::Text("%.1f kHz, %.1f kHz wide: %.0f S/s, %zu taps, %.1f dBFS", s.cfg.offsetHz / 1e3,
+                            s.cfg.bandwidth / 1e3, s.outRate, s.numTaps, s.powerDb);
+                    else
+                        ImGui::Text("%.1f kHz, %.1f kHz wide", s.cfg.offsetHz / 1e3, s.cfg.bandwidth / 1e3);
+                    ImGui::PopID();
+                }
+                if (MyReceiver.getExtractorSkipped() > 0)
+                    ImGui::Text("%llu blocks skipped to keep up", (unsigned long long)MyReceiver.getExtractorSkipped());
+                ImGui::TreePop();
+            }
+
+            static bool padgaps = false;
+            if (ImGui::Checkbox("Pad overflow gaps with zeros", &padgaps))
+                MyReceiver.setGapPolicy(padgaps ? GAP_PAD : GAP_TAG);
+            ImGui::SameLine();
+            static bool sigmf_input = false;
+            if (ImGui::Checkbox("SigMF output", &sigmf_input))
+                MyReceiver.setSigmf(sigmf_input);
+
+            const bool recording = recthread.joinable();
+            if (!MyReceiver.getUSRPinitflag() || recording)
                 ImGui::BeginDisabled();
-            if (ImGui::Button("Start Recording."))
+            if (ImGui::Button("Start Recording.")) {
+                std::vector<size_t> chs(numchans_input);
+                std::iota(chs.begin(), chs.end(), 0);
+                MyReceiver.setChannels(chs);
+                MyReceiver.setLayout(interleaved_input, perchanfiles_input);
+                MyReceiver.setStreamFormat((WireFormat)otw_curridx, narrowhost_input);
+                MyReceiver.setLatencyTarget(latency_ms_input / 1e3);
+                MyReceiver.setRecvAutotune(autotune_input);
+                ThreadPolicy rxpolicy, writerpolicy, dsppolicy;
+                rxpolicy.cpu = rxcpu_input;
+                rxpolicy.rtPriority = rtprio_input;
+                writerpolicy.cpu = writercpu_input;
+                dsppolicy.cpu = dspcpu_input;
+                MyReceiver.setThreadPolicies(rxpolicy, writerpolicy, dsppolicy);
+                MemPolicy mempolicy;
+                mempolicy.lock = lockmem_input;
+                mempolicy.hugePages = hugepages_input;
+                MyReceiver.setMemPolicy(mempolicy);
+                DiskWriterConfig diskcfg;
+                diskcfg.direct = directio_input;
+                diskcfg.queueDepth = queuedepth_input;
+                diskcfg.numBufs = diskbufs_input;
+                diskcfg.mem = mempolicy;
+                MyReceiver.setDiskConfig(diskcfg);
+                MyReceiver.setSegments((uint64_t)segmb_input * 1000000, segsecs_input);
+                MyReceiver.setCompression(storage_curridx > 0 ? compress_input : 0, (IqzCodec)(storage_curridx > 0 ? storage_curridx - 1 : 0));
+                MyReceiver.setJournal(journal_input);
+                BackpressureConfig bpcfg;
+                bpcfg.blockWhenFull = blockfull_input;
+                for (int a = 0; a < BP_NUM_ACTIONS; a++) {
+                    if (!bpstage_input[a])
+                        continue;
+                    BackpressureStage stage;
+                    stage.action = (BackpressureAction)a;
+                    stage.engage = bpengage_input[a] / 100.0;
+                    stage.release = stage.engage - 0.25;
+                    bpcfg.stages.push_back(stage);
+                }
+                bpcfg.fallbackCodec = storage_curridx == 3 ? IQZ_BFP4 : IQZ_BFP8;
+                bpcfg.spillDir = spilldir_input;
+                bpcfg.decimation = decim_input;
+                bpcfg.keepDbfs = keepdbfs_input;
+                MyReceiver.setBackpressure(bpcfg);
+                DdcConfig ddccfg;
+                for (int b = 0; b < 4; b++) {
+                    if (!ddcband_input[b])
+                        continue;
+                    DdcChannel band;
+                    band.input = ddcchan_input[b];
+                    band.offsetHz = ddcoffset_input[b] * 1e3;
+                    band.bandwidth = ddcbw_input[b] * 1e3;
+                    ddccfg.channels.push_back(band);
+                }
+                ddccfg.decimation = ddcdecim_input;
+                ddccfg.gainDb = ddcgain_input;
+                ddccfg.stopDb = ddcstop_input;
+                MyReceiver.setDdc(ddccfg);
+                ChannelizerConfig chzcfg;
+                if (chz_input) {
+                    chzcfg.numChannels = chzm_input;
+                    chzcfg.oversampled = chzover_input;
+                    chzcfg.input = chzchan_input;
+                    chzcfg.numThreads = chzthreads_input;
+                    chzcfg.gainDb = chzgain_input;
+                    if (!Channelizer::parseChannels(chzkeep_input, chzcfg.channels))
+                        chzcfg.channels.clear();
+                }
+                MyReceiver.setChannelizer(chzcfg);
+                ExtractorConfig extcfg;
+                extcfg.enabled = ext_input;
+                extcfg.input = extchan_input;
+                extcfg.fftLen = extfft_input;
+                MyReceiver.setExtractor(extcfg);
                 MyReceiver.USRPconfigure(fc_input * 1e6, int(fs_input * 1e6), gain_input, lo_offset_input, clocksrc_curridx);
-            if (!MyReceiver.getUSRPinitflag())
+                MyReceiver.prepare();
+                recthread = std::thread(&ReceiverClass::start, &MyReceiver);
+            }
+            if (!MyReceiver.getUSRPinitflag() || recording)
                 ImGui::EndDisabled();
+            if (recording) {
+                ImGui::SameLine();
+                if (ImGui::Button("Stop Recording.")) {
+                    MyReceiver.cancel();
+                    recthread.join();
+                }
+                // New capture segment in a SigMF recording
+                ImGui::SameLine();
+                if (ImGui::Button("Retune"))
+                    MyReceiver.retune(fc_input * 1e6, gain_input);
+            }
             ImGui::SameLine();
             if (MyReceiver.getUSRPconfiguredflag())
             {
@@ -239,6 +555,70 @@ int main(int, char**)
                 else
                     ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), StatusTxt);
             }
+            if (MyReceiver.getWriter().getBlocksWritten() > 0) {
+                const RecordWriter& writer = MyReceiver.getWriter();
+                ImGui::Text("%s: %.1f MB at %.1f MB/s", writer.getNumDataFiles() > 0 ? writer.getDataFileName(0).c_str() : "",
+                    writer.getBytesWritten() / 1e6, writer.getMBps());
+                ImGui::Text("Gaps: %llu (%llu samples lost), ring overruns: %llu, ring fill: %zu/%zu",
+                    writer.getGapCount(), writer.getLostSamps(), MyReceiver.getRing().getOverruns(),
+                    MyReceiver.getRing().getFill(), MyReceiver.getRing().getNumSlots());
+                ImGui::TextWrapped("%s", MyReceiver.getRxStats().summary().c_str());
+                if (writer.getRotations() > 0)
+                    ImGui::Text("Segments: %llu rotations, %llu waited for the next segment",
+                        (unsigned long long)writer.getRotations(), (unsigned long long)writer.getRotationStalls());
+                if (writer.isCompressed()) {
+                    IqCompressor::Stats cs = writer.getCompressionStats();
+                    ImGui::Text("Compression (%s): ratio %.2f, %.0f MB/s per core", iqzCodecName(writer.getCompressionCodec()),
+                        cs.ratio(), cs.mbpsPerCore());
+                    if (cs.quality.errEnergy > 0) {
+                        ImGui::SameLine();
+                        ImGui::Text(", SNR %.1f dB", cs.quality.snrDb());
+                    }
+                }
+                RecordJournal::Stats js = writer.getJournalStats();
+                if (js.commits > 0)
+                    ImGui::Text("Journal: %llu commits, %.1f s committed, last sync %.1f ms",
+                        (unsigned long long)js.commits, js.committedSamps / writer.getTimeMap().getRate(), js.lastSyncSeconds * 1e3);
+                if (writer.getShedBlocks() > 0 || writer.getSpilledSegments() > 0 || MyReceiver.getRingWaits() > 0)
+                    ImGui::Text("Backpressure: %llu blocks left out (%.1f s), %llu segments spilled, %llu ring waits",
+                        (unsigned long long)writer.getShedBlocks(), writer.getShedSamps() / writer.getTimeMap().getRate(),
+                        (unsigned long long)writer.getSpilledSegments(), (unsigned long long)MyReceiver.getRingWaits());
+                if (writer.isOpen() && writer.getNumDataFiles() > 0) {
+                    DiskWriter::Stats ds = writer.getDiskStats(0);
+                    ImGui::Text("Disk (%s): %zu/%zu writes in flight, latency p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+                        writer.getDiskBackend().c_str(), ds.inFlight, ds.maxInFlight, ds.p50 * 1e3, ds.p99 * 1e3, ds.max * 1e3);
+                }
+                const BlockPool& pool = MyReceiver.getRing().getPool();
+                ImGui::Text("Sample blocks: %zu/%zu in use (peak %zu), %.0f%% of the bytes written in place",
+                    pool.getHeld(), pool.getNumBlocks(), pool.getPeakHeld(),
+                    writer.getBytesWritten() > 0 ? 100.0 * writer.getSharedBytes() / writer.getBytesWritten() : 0.0);
+                if (MyReceiver.getDdc().getSamplesIn() > 0)
+                    ImGui::Text("DDC: %.1f M samples in, %.1f M out per band at %.0f S/s",
+                        MyReceiver.getDdc().getSamplesIn() / 1e6, MyReceiver.getDdc().getSamplesOut() / 1e6, writer.getTimeMap().getRate());
+                if (MyReceiver.getChannelizer().getSamplesIn() > 0)
+                    ImGui::Text("Channelizer: %.1f M samples in, %.1f M out per channel, %zu channels at %.0f S/s",
+                        MyReceiver.getChannelizer().getSamplesIn() / 1e6, MyReceiver.getChannelizer().getSamplesOut() / 1e6,
+                        MyReceiver.getChannelizer().getNumChans(), writer.getTimeMap().getRate());
+                // Scope: |x| of channel 0 from the last block written, read in place
+                if (BlockRef snap = MyReceiver.getSnapshot()) {
+                    static float scope[512];
+                    const size_t step = snap->stride == 0 ? snap->numChans : 1;
+                    const size_t n = snap->nsamps < 512 ? snap->nsamps : 512;
+                    for (size_t i = 0; i < n; i++) {
+                        const Ipp16sc& s = snap->data[i * step];
+                        scope[i] = sqrtf((float)s.re * s.re + (float)s.im * s.im);
+                    }
+                    ImGui::PlotLines("##scope", scope, (int)n, 0, "Channel 0", 0.0f, 32768.0f, ImVec2(0, 80));
+                }
+                if (auto merge = MyReceiver.getMerge()) {
+                    for (size_t b = 0; b < merge->getNumBoards(); b++) {
+                        const MergeSource::BoardStats& bs = merge->getBoardStats(b);
+                        ImGui::Text("Board %zu: %llu overflows, %llu ring overruns, %llu realignments (%llu samples skipped)", b,
+                            (unsigned long long)bs.overflows, (unsigned long long)bs.overruns, (unsigned long long)bs.misalignments,
+                            (unsigned long long)bs.skippedSamps);
+                    }
+                }
+            }
             ImGui::End();
         }
 
@@ -249,6 +629,229 @@ int main(int, char**)
             if (show_demo_window)
                 ImGui::ShowDemoWindow(&show_demo_window);
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+
+            // Read once: a click below starts a bench, and one may finish meanwhile
+            const bool benchRunning = BenchRunningflag;
+            if (benchRunning)
+                ImGui::BeginDisabled();
+            if (ImGui::Button("Benchmark sample ring")) {
+                runBench([&] {
+                    return benchRing(16, 1 << 20, 2.0).summary() + "\n"
+                        + benchRing(16, 1 << 20, 2.0, 200).summary();
+                });
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Benchmark recorder")) {
+                runBench([&] {
+                    return benchRecorder("bench_recorder", 16, 1 << 20, 5.0).summary() + "\n"
+                        + benchRecorder("bench_recorder", 16, 1 << 20, 5.0, 50, 20, 4096).summary();
+                });
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Benchmark synthetic pipeline")) {
+                runBench([&] {
+                    SyntheticConfig cfg;
+                    cfg.rate = 200e6;
+                    SyntheticSource gen(cfg);
+                    std::string txt = benchSource(gen, 2000, 2.0).summary() + "\n";
+                    cfg.rate = 50e6;
+                    cfg.paced = true;
+                    cfg.overflowEvery = 100000000;
+                    cfg.overflowSamps = 5000;
+                    txt += benchReceiver(std::make_shared<SyntheticSource>(cfg), "bench_pipeline", 5.0).summary();
+                    return txt;
+                });
+            }
+            if (ImGui::Button("Benchmark 4-channel receive")) {
+                runBench([&] {
+                    SyntheticConfig cfg;
+                    cfg.rate = 25e6;
+                    cfg.numChannels = 4;
+                    cfg.paced = true;
+                    return benchReceiver(std::make_shared<SyntheticSource>(cfg), "bench_4ch", 5.0, false, true).summary() + "\n"
+                        + benchReceiver(std::make_shared<SyntheticSource>(cfg), "bench_4ch", 5.0, true, false).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark sample conversion")) {
+                runBench([&] {
+                    std::string txt;
+                    for (size_t nsamps : { 4096, 1 << 20 }) {
+                        txt += benchConvert(WIRE_SC16, false, nsamps, 1.0).summary() + "\n";
+                        txt += benchConvert(WIRE_SC8, false, nsamps, 1.0).summary() + "\n";
+                        txt += benchConvert(WIRE_SC16, true, nsamps, 1.0).summary() + "\n";
+                        txt += benchConvert(WIRE_SC8, true, nsamps, 1.0).summary() + "\n";
+                    }
+                    return txt;
+                });
+            }
+            if (ImGui::Button("Benchmark file replay")) {
+                runBench([&] {
+                    return benchReplay("bench_replay", 1, false, false, 0, 2.0).summary() + "\n"
+                        + benchReplay("bench_replay", 4, false, true, 0, 2.0).summary() + "\n"
+                        + benchReplay("bench_replay", 4, true, false, 0, 2.0).summary() + "\n"
+                        + benchReplay("bench_replay", 4, false, false, 32000000, 2.0).summary() + "\n"
+                        + benchReplay("bench_replay", 2, true, true, 16000000, 2.0).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark recv sizing")) {
+                runBench([&] {
+                    SyntheticConfig cfg;
+                    cfg.rate = 50e6;
+                    cfg.paced = true;
+                    std::string txt;
+                    for (double latency : { 0.0001, 0.001, 0.01 })
+                        txt += benchRecvSizing(std::make_shared<SyntheticSource>(cfg), "bench_sizing", 3.0, latency, false).summary() + "\n";
+                    txt += benchRecvSizing(std::make_shared<SyntheticSource>(cfg), "bench_sizing", 3.0, 0.001, true).summary();
+                    return txt;
+                });
+            }
+            if (ImGui::Button("Benchmark ring placement")) {
+                runBench([&] {
+                    ThreadPolicy producer, consumer;
+                    producer.cpu = 0;
+                    consumer.cpu = std::thread::hardware_concurrency() > 1 ? 1 : 0;
+                    MemPolicy mem;
+                    mem.lock = true;
+                    mem.hugePages = true;
+                    return benchRing(256, 1 << 16, 2.0, 200).summary() + "\n"
+                        + benchRing(256, 1 << 16, 2.0, 200, producer, consumer).summary() + "\n"
+                        + benchRing(256, 1 << 16, 2.0, 200, producer, consumer, mem).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark disk writes")) {
+                runBench([&] {
+                    DiskWriterConfig direct, pwrite, buffered;
+                    pwrite.useUring = false;
+                    buffered.useUring = false;
+                    buffered.direct = false;
+                    return benchDisk("bench_disk.bin", 5.0, direct).summary() + "\n"
+                        + benchDisk("bench_disk.bin", 5.0, pwrite).summary() + "\n"
+                        + benchDisk("bench_disk.bin", 5.0, buffered).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark segment rotation")) {
+                runBench([&] {
+                    return benchRecorder("bench_segments", 16, 1 << 16, 10.0, 50).summary() + "\n"
+                        + benchRecorder("bench_segments", 16, 1 << 16, 10.0, 50, 0, 0, 64000000).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark compression")) {
+                runBench([&] {
+                    const size_t workers = std::thread::hardware_concurrency() > 2 ? std::thread::hardware_concurrency() / 2 : 1;
+                    std::string txt = benchCompress(WIRE_SC16, 1, 3.0).summary() + "\n"
+                        + benchCompress(WIRE_SC16, workers, 3.0).summary() + "\n"
+                        + benchCompress(WIRE_SC12, workers, 3.0).summary() + "\n"
+                        + benchCompress(WIRE_SC8, workers, 3.0).summary() + "\n"
+                        + benchCompress(WIRE_SC16, workers, 3.0, 0.3f).summary();
+                    // The last raw recording, if there is one
+                    const RecordWriter& writer = MyReceiver.getWriter();
+                    if (!writer.isOpen() && !writer.getBasename().empty() && !writer.isCompressed() && !writer.isSigmf())
+                        txt += "\n" + benchCompressFile(writer.getBasename() + ".bin", workers, 3.0).summary();
+                    return txt;
+                });
+            }
+            if (ImGui::Button("Benchmark requantization")) {
+                runBench([&] {
+                    std::string txt;
+                    for (float noise : { 0.001f, 0.01f, 0.1f }) {
+                        txt += benchCompress(WIRE_SC16, 1, 2.0, noise, IQZ_BFP8).summary() + "\n";
+                        txt += benchCompress(WIRE_SC16, 1, 2.0, noise, IQZ_BFP4).summary() + "\n";
+                    }
+                    const RecordWriter& writer = MyReceiver.getWriter();
+                    if (!writer.isOpen() && !writer.getBasename().empty() && !writer.isCompressed() && !writer.isSigmf())
+                        txt += benchCompressFile(writer.getBasename() + ".bin", 1, 2.0, IQZ_BFP8).summary();
+                    return txt;
+                });
+            }
+            if (ImGui::Button("Benchmark index seeks")) {
+                runBench([&] {
+                    return benchSeek("bench_seek", 250000000, 50000, false).summary() + "\n"
+                        + benchSeek("bench_seek", 250000000, 50000, false, 100000000).summary() + "\n"
+                        + benchSeek("bench_seek", 250000000, 50000, true, 100000000).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark DDC")) {
+                runBench([&] {
+                    return benchDdc(1, 8, 2.0).summary() + "\n"
+                        + benchDdc(1, 64, 2.0).summary() + "\n"
+                        + benchDdc(4, 16, 2.0).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark decimator")) {
+                runBench([&] {
+                    return benchDecimator(8, 2.0).summary() + "\n"
+                        + benchDecimator(64, 2.0).summary() + "\n"
+                        + benchDecimator(250, 2.0).summary() + "\n"
+                        + benchDecimator(1000, 2.0, 0.4, 100).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark fast convolution")) {
+                runBench([&] {
+                    return benchFastFir(1024, 1, 4.0).summary() + "\n"
+                        + benchFastFir(8192, 1, 4.0).summary() + "\n"
+                        + benchFastFir(65536, 1, 4.0).summary() + "\n"
+                        + benchFastFir(65536, 8, 4.0).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark channelizer")) {
+                runBench([&] {
+                    const size_t threads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() : 1;
+                    return benchChannelizer(threads, false, 8.0).summary() + "\n"
+                        + benchChannelizer(threads, true, 8.0).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark channel extractor")) {
+                runBench([&] {
+                    return benchExtractor(10, 4.0).summary() + "\n"
+                        + benchExtractor(100, 4.0).summary() + "\n"
+                        + benchExtractor(100, 4.0, 65536).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark mapped reader")) {
+                runBench([&] {
+                    return benchRecordMap("bench_map", 100000000, 1).summary() + "\n"
+                        + benchRecordMap("bench_map", 50000000, 4).summary() + "\n"
+                        + benchRecordMap("bench_map", 50000000, 4, true, 100000000).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark journal overhead")) {
+                runBench([&] {
+                    return benchJournal("bench_journal", 5.0, 1.0).summary() + "\n"
+                        + benchJournal("bench_journal", 5.0, 1.0, 64000000).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark backpressure")) {
+                runBench([&] {
+                    BackpressureConfig shed;
+                    shed.stages.resize(1);
+                    shed.stages[0].engage = 0.5;
+                    shed.stages[0].release = 0.25;
+                    shed.keepDbfs = -20;
+                    BackpressureConfig ladder = BackpressurePolicy::defaultLadder("bench_spill");
+                    ladder.keepDbfs = -20;
+                    return benchBackpressure("bench_bp", 3.0, 50, 40, 20, BackpressureConfig()).summary() + "\n"
+                        + benchBackpressure("bench_bp", 3.0, 50, 40, 20, shed).summary() + "\n"
+                        + benchBackpressure("bench_bp", 3.0, 50, 40, 20, ladder, 64000000).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark zero-copy writes")) {
+                runBench([&] {
+                    return benchZeroCopy("bench_zerocopy", 3.0).summary();
+                });
+            }
+            if (ImGui::Button("Benchmark 4-board merge")) {
+                runBench([&] {
+                    return benchMerge(4, 2, 10e6, 5.0, 1000, 10000000, 3000).summary() + "\n"
+                        + benchMerge(8, 1, 5e6, 5.0, 777, 5000000, 1234).summary();
+                });
+            }
+            if (benchRunning) {
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(0.7f, 0.35f, 0.0f, 1.0f), "Running...");
+            }
+            else if (!BenchTxt.empty())
+                ImGui::TextWrapped("%s", BenchTxt.c_str());
             ImGui::End();
         }
 
@@ -305,6 +908,12 @@ int main(int, char**)
     ::UnregisterClassW(wc.lpszClassName, wc.hInstance);
 
     tmpthread.join();
+    if (recthread.joinable()) {
+        MyReceiver.cancel();
+        recthread.join();
+    }
+    if (benchthread.joinable())
+        benchthread.join();
 
     return 0;
 }
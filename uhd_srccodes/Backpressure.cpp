@@ -0,0 +1,119 @@
+#include "Backpressure.h"
+#include <iostream>
+#include <boost/format.hpp>
+
+const char* BackpressurePolicy::actionName(BackpressureAction action)
+{
+	switch (action) {
+	case BP_COMPRESS: return "compress";
+	case BP_SPILL: return "spill";
+	case BP_DECIMATE: return "decimate";
+	case BP_SHED: return "shed";
+	default: return "unknown";
+	}
+}
+
+BackpressureConfig BackpressurePolicy::defaultLadder(const std::string& spillDir)
+{
+	BackpressureConfig cfg;
+	cfg.spillDir = spillDir;
+	const BackpressureAction ladder[] = { BP_COMPRESS, BP_SPILL, BP_DECIMATE, BP_SHED };
+	const double engage[] = { 0.5, 0.6, 0.75, 0.9 };
+	for (int i = 0; i < 4; i++) {
+		BackpressureStage st;
+		st.action = ladder[i];
+		st.engage = engage[i];
+		st.release = engage[i] - 0.25;
+		cfg.stages.push_back(st);
+	}
+	return cfg;
+}
+
+bool BackpressurePolicy::open(const std::string& basename, const BackpressureConfig& in_cfg, unsigned in_available)
+{
+	close();
+	cfg = in_cfg;
+	available = in_available;
+	active = 0;
+	tOpen = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		stats = Stats();
+	}
+	if (cfg.stages.empty())
+		return true;
+	logfile.open(basename + ".backpressure.csv", std::ios::out | std::ios::trunc);
+	logfile << "host_secs,seq,samp_offset,queue_fill,action,decision\n";
+	SampleBlock none;
+	for (const BackpressureStage& st : cfg.stages)
+		if (!(available & (1u << st.action))) {
+			std::cerr << boost::format("Backpressure stage '%s' is not available for this recording\n")
+				% actionName(st.action);
+			log(none, 0, st.action, "unavailable");
+		}
+	return logfile.good();
+}
+
+void BackpressurePolicy::close()
+{
+	if (!logfile.is_open())
+		return;
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		for (int a = 0; a < BP_NUM_ACTIONS; a++)
+			if (active & (1u << a))
+				stats.engagedSeconds[a] += std::chrono::duration<double>(now - engagedAt[a]).count();
+	}
+	active = 0;
+	logfile.close();
+}
+
+void BackpressurePolicy::log(const SampleBlock& blk, double fill, BackpressureAction action, const char* decision)
+{
+	// Decisions are rare (hysteresis), so each line is flushed
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - tOpen).count();
+	logfile << boost::format("%.6f,%d,%d,%.3f,%s,%s\n") % t % blk.seq % blk.sampOffset % fill % actionName(action) % decision;
+	logfile.flush();
+}
+
+unsigned BackpressurePolicy::update(double fill, const SampleBlock& blk)
+{
+	if (cfg.stages.empty())
+		return 0;
+	unsigned next = active;
+	for (const BackpressureStage& st : cfg.stages) {
+		const unsigned bit = 1u << st.action;
+		if (!(available & bit))
+			continue;
+		if (!(active & bit) && fill >= st.engage)
+			next |= bit;
+		else if ((active & bit) && fill <= st.release)
+			next &= ~bit;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(statMut);
+	if (fill > stats.peakFill)
+		stats.peakFill = fill;
+	for (int a = 0; a < BP_NUM_ACTIONS; a++) {
+		const unsigned bit = 1u << a;
+		if ((next & bit) == (active & bit))
+			continue;
+		if (next & bit) {
+			engagedAt[a] = now;
+			stats.engagements[a]++;
+		}
+		else
+			stats.engagedSeconds[a] += std::chrono::duration<double>(now - engagedAt[a]).count();
+		log(blk, fill, (BackpressureAction)a, (next & bit) ? "engage" : "release");
+	}
+	active = next;
+	return active;
+}
+
+BackpressurePolicy::Stats BackpressurePolicy::getStats() const
+{
+	std::lock_guard<std::mutex> lock(statMut);
+	return stats;
+}
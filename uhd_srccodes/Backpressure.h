@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "SampleRing.h"
+#include "IqCodec.h"
+
+// What the recorder does when the disk falls behind the radio.
+// The writer reports how full its input queue (the ring) is with every
+// block; the policy steps through a ladder of stages as the fill crosses
+// each stage's engage level, and releases a stage once the fill is back
+// under its release level. From least to most destructive:
+//   BP_COMPRESS  code the next blocks with a smaller codec (.iqz recordings)
+//   BP_SPILL     start a new segment on a secondary volume (segmented recordings)
+//   BP_DECIMATE  keep one block in N
+//   BP_SHED      leave blocks out
+// Blocks louder than keepDbfs have priority: decimation and shedding never
+// leave them out, so a signal is still recorded whole over a noise floor.
+// Skipped blocks are logged in the gap log like any other loss, so a
+// degraded recording says exactly what is missing. Past the last stage the
+// ring is full and the receive loop either drops the incoming block (the
+// default, counted as a ring overrun) or, with blockWhenFull, waits for the
+// writer and leaves the loss to the device's overflow accounting.
+// Every engage and release is appended to <basename>.backpressure.csv.
+enum BackpressureAction { BP_COMPRESS, BP_SPILL, BP_DECIMATE, BP_SHED, BP_NUM_ACTIONS };
+
+struct BackpressureStage
+{
+	BackpressureAction action = BP_SHED;
+	double engage = 0.9;    // queue fill fraction
+	double release = 0.5;
+};
+
+struct BackpressureConfig
+{
+	std::vector<BackpressureStage> stages;  // none = write every block, drop at a full ring
+	bool blockWhenFull = false;
+	IqzCodec fallbackCodec = IQZ_BFP8;      // BP_COMPRESS
+	std::string spillDir;                   // BP_SPILL
+	size_t decimation = 4;                  // BP_DECIMATE
+	float keepDbfs = 0;                     // priority level; 0 dBFS = none
+};
+
+class BackpressurePolicy
+{
+public:
+	struct Stats
+	{
+		uint64_t engagements[BP_NUM_ACTIONS] = {};
+		double engagedSeconds[BP_NUM_ACTIONS] = {};
+		double peakFill = 0;
+	};
+
+private:
+	BackpressureConfig cfg;
+	unsigned available = 0;         // actions this recording supports
+	unsigned active = 0;            // engaged actions, bit per BackpressureAction
+	std::chrono::steady_clock::time_point tOpen, engagedAt[BP_NUM_ACTIONS];
+	std::ofstream logfile;
+	Stats stats;                    // guarded by statMut
+	mutable std::mutex statMut;
+
+	void log(const SampleBlock& blk, double fill, BackpressureAction action, const char* decision);
+
+public:
+	// Stages whose action is not in in_available (bit per action) are logged
+	// as unavailable and never engage
+	bool open(const std::string& basename, const BackpressureConfig& in_cfg, unsigned in_available);
+	void close();
+	bool isEnabled() const { return !cfg.stages.empty(); }
+	const BackpressureConfig& getConfig() const { return cfg; }
+
+	// Writer thread, once per block: engage and release stages for the
+	// queue fill (0..1) and return the engaged actions
+	unsigned update(double fill, const SampleBlock& blk);
+	bool isActive(BackpressureAction action) const { return (active & (1u << action)) != 0; }
+	Stats getStats() const;
+
+	static const char* actionName(BackpressureAction action);
+	// Compress, spill, decimate, shed at rising fill, each released 0.25 lower
+	static BackpressureConfig defaultLadder(const std::string& spillDir = "");
+};
@@ -0,0 +1,1560 @@
+#include "Benchmarks.h"
+#include "SampleRing.h"
+#include "RecordWriter.h"
+#include "ReceiverClass.h"
+#include "MergeSource.h"
+#include "SyntheticSource.h"
+#include "FileSource.h"
+#include "IqCompressor.h"
+#include "RecordMap.h"
+#include "Ddc.h"
+#include "Decimator.h"
+#include "FastFir.h"
+#include "Channelizer.h"
+#include "FftExtractor.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <thread>
+#include <boost/format.hpp>
+
+std::string BenchResult::summary() const
+{
+	return str(boost::format("%s: %.1f Msps, %.1f MB/s over %.2f s, %d dropped")
+		% name % msps() % mbps() % seconds % dropped);
+}
+
+void genTone16sc(Ipp16sc* dst, size_t nsamps, float relFreq, float* phase)
+{
+	ippsTone_16sc(dst, (int)nsamps, 32000, relFreq, phase, ippAlgHintFast);
+}
+
+BenchResult benchRing(size_t numSlots, size_t blockSamps, double seconds, double paceMsps,
+	const ThreadPolicy& producerPolicy, const ThreadPolicy& consumerPolicy, const MemPolicy& mem)
+{
+	BenchResult res;
+	res.name = str(boost::format("SampleRing %d x %d") % numSlots % blockSamps);
+	if (paceMsps > 0)
+		res.name += str(boost::format(" @ %.0f Msps") % paceMsps);
+	if (!producerPolicy.isDefault() || !consumerPolicy.isDefault())
+		res.name += str(boost::format(" [producer %s, consumer %s]") % producerPolicy.describe() % consumerPolicy.describe());
+	if (mem.lock || mem.hugePages || mem.numaNode >= 0)
+		res.name += str(boost::format(" [%s]") % mem.describe());
+
+	SampleRing ring;
+	std::atomic<bool> ready{ false }, producing{ true };
+	uint64_t consumed = 0, seqGaps = 0, produced = 0;
+	std::chrono::steady_clock::time_point t0;
+
+	// Producer: stands in for rx_stream->recv() filling the block. It owns
+	// the ring memory, as the receive thread does.
+	std::thread producer([&] {
+		applyThreadPolicy(producerPolicy, "bench_producer");
+		ring.init(numSlots, blockSamps, 1, false, mem);
+		const size_t bs = ring.getBlockSamps();
+		Ipp16sc* src = ippsMalloc_16sc_L(bs);
+		float phase = 0;
+		genTone16sc(src, bs, 0.01f, &phase);
+		ready = true;
+
+		t0 = std::chrono::steady_clock::now();
+		auto tEnd = t0 + std::chrono::duration<double>(seconds);
+		const double blockPeriod = paceMsps > 0 ? bs / (paceMsps * 1e6) : 0;
+		while (std::chrono::steady_clock::now() < tEnd) {
+			if (paceMsps > 0) {
+				// A radio does not wait: release blocks on the line-rate schedule
+				auto due = t0 + std::chrono::duration<double>(produced * blockPeriod);
+				while (std::chrono::steady_clock::now() < due)
+					std::this_thread::yield();
+			}
+			else if (ring.isFull()) {
+				// Unpaced: measure the lossless ceiling, so wait for the consumer
+				std::this_thread::yield();
+				continue;
+			}
+			SampleBlock* blk = ring.beginWrite();
+			ippsCopy_16sc(src, blk->data, (int)bs);
+			blk->nsamps = bs;
+			ring.endWrite();
+			produced++;
+		}
+		producing = false;
+		ippsFree(src);
+	});
+	while (!ready)
+		std::this_thread::yield();
+	blockSamps = ring.getBlockSamps();
+
+	// Consumer: copy out every block, as the disk writer or DSP would
+	std::thread consumer([&] {
+		applyThreadPolicy(consumerPolicy, "bench_consumer");
+		Ipp16sc* dst = ippsMalloc_16sc_L(blockSamps);
+		uint64_t expectSeq = 0;
+		while (true) {
+			SampleBlock* blk = ring.beginRead();
+			if (blk == nullptr) {
+				if (!producing)
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			if (blk->seq != expectSeq)
+				seqGaps += blk->seq - expectSeq;
+			expectSeq = blk->seq + 1;
+			ippsCopy_16sc(blk->data, dst, (int)blk->nsamps);
+			consumed += blk->nsamps;
+			ring.endRead();
+		}
+		ippsFree(dst);
+	});
+	producer.join();
+	consumer.join();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	res.samples = consumed;
+	res.bytes = consumed * sizeof(Ipp16sc);
+	res.dropped = ring.getOverruns();
+	if (consumed / blockSamps + ring.getOverruns() != produced || seqGaps > ring.getOverruns())
+		res.name += " (SEQUENCE MISMATCH)";
+	return res;
+}
+
+BenchResult benchRecorder(const std::string& basename, size_t numSlots, size_t blockSamps,
+	double seconds, double paceMsps, size_t gapEvery, size_t gapSamps, uint64_t segBytes, double syncInterval,
+	const DiskWriterConfig& disk)
+{
+	BenchResult res;
+	res.name = str(boost::format("RecordWriter %d x %d") % numSlots % blockSamps);
+	if (paceMsps > 0)
+		res.name += str(boost::format(" @ %.0f Msps") % paceMsps);
+
+	SampleRing ring;
+	ring.init(numSlots, blockSamps);
+	blockSamps = ring.getBlockSamps();
+	// Device clock for the generated blocks; samples lost to injected gaps
+	// and overruns still advance it, so the time map needs a single anchor
+	const double timeRate = paceMsps > 0 ? paceMsps * 1e6 : 1e6;
+	RecordWriter writer;
+	writer.setDiskConfig(disk);
+	writer.setSegments(segBytes, 0);
+	writer.setJournal(syncInterval);
+	if (!writer.open(basename, timeRate)) {
+		res.name += " (OPEN FAILED)";
+		return res;
+	}
+
+	Ipp16sc* src = ippsMalloc_16sc_L(blockSamps);
+	float phase = 0;
+	genTone16sc(src, blockSamps, 0.01f, &phase);
+
+	// Writer thread, same loop shape as ReceiverClass::savefile(); the time
+	// each writeBlock() takes is what a rotation must not disturb
+	std::atomic<bool> producing{ true };
+	std::vector<float> writeTimes;
+	std::thread consumer([&] {
+		const double cpu0 = threadCpuSeconds();
+		while (true) {
+			SampleBlock* blk = ring.beginRead();
+			if (blk == nullptr) {
+				if (!producing)
+					break;
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				continue;
+			}
+			auto tw = std::chrono::steady_clock::now();
+			writer.writeBlock(*blk);
+			writeTimes.push_back(std::chrono::duration<float>(std::chrono::steady_clock::now() - tw).count());
+			ring.endRead();
+		}
+		res.busySeconds = threadCpuSeconds() - cpu0;
+	});
+
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	const double blockPeriod = paceMsps > 0 ? blockSamps / (paceMsps * 1e6) : 0;
+	uint64_t produced = 0, sampCount = 0, injected = 0;
+	while (std::chrono::steady_clock::now() < tEnd) {
+		if (paceMsps > 0) {
+			auto due = t0 + std::chrono::duration<double>(produced * blockPeriod);
+			while (std::chrono::steady_clock::now() < due)
+				std::this_thread::yield();
+		}
+		else if (ring.isFull()) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (gapEvery > 0 && produced > 0 && produced % gapEvery == 0) {
+			sampCount += gapSamps;
+			injected += gapSamps;
+		}
+		SampleBlock* blk = ring.beginWrite();
+		blk->sampOffset = sampCount;
+		blk->time = DeviceTime().plus(sampCount / timeRate);
+		blk->hasTime = true;
+		ippsCopy_16sc(src, blk->data, (int)blockSamps);
+		blk->nsamps = blockSamps;
+		sampCount += blk->nsamps;
+		ring.endWrite();
+		produced++;
+	}
+	producing = false;
+	consumer.join();
+	writer.close();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	res.samples = writer.getBytesWritten() / sizeof(Ipp16sc);
+	res.bytes = writer.getBytesWritten();
+	res.dropped = ring.getOverruns();
+	if (writer.getSharedBytes() > 0)
+		res.name += str(boost::format(", %.0f%% in place") % (100.0 * writer.getSharedBytes() / writer.getBytesWritten()));
+	if (!writeTimes.empty()) {
+		std::sort(writeTimes.begin(), writeTimes.end());
+		res.name += str(boost::format(", writeBlock p99 %.2f / max %.2f ms")
+			% (writeTimes[writeTimes.size() * 99 / 100] * 1e3) % (writeTimes.back() * 1e3));
+	}
+	if (segBytes > 0)
+		res.name += str(boost::format(", %d segments of %.0f MB (%d stalls)")
+			% (writer.getRotations() + 1) % (segBytes / 1e6) % writer.getRotationStalls());
+	const RecordJournal::Stats js = writer.getJournalStats();
+	if (syncInterval > 0)
+		res.name += str(boost::format(", %d commits (sync %.1f ms avg)")
+			% js.commits % (js.commits > 0 ? js.syncSeconds / js.commits * 1e3 : 0));
+
+	// Every sample is either on disk or accounted for as lost. Blocks dropped
+	// after the last written one never reach the gap log, hence the <=.
+	// Segments must add up, as listed in the index.
+	boost::system::error_code ec;
+	uint64_t fileBytes = 0;
+	bool indexOk = true;
+	if (segBytes > 0) {
+		std::ifstream index(basename + ".segments.csv");
+		std::string line;
+		std::getline(index, line);
+		uint64_t indexSamps = 0;
+		while (indexOk && !ec && std::getline(index, line)) {
+			std::vector<std::string> col;
+			boost::split(col, line, boost::is_any_of(","));
+			indexOk = col.size() == 7 && std::stoull(col[1]) == indexSamps;
+			if (indexOk) {
+				indexSamps += std::stoull(col[2]);
+				fileBytes += boost::filesystem::file_size(boost::filesystem::path(basename).parent_path() / col[6], ec);
+			}
+		}
+		indexOk = indexOk && indexSamps * sizeof(Ipp16sc) == writer.getBytesWritten();
+	}
+	else
+		fileBytes = boost::filesystem::file_size(basename + ".bin", ec);
+	if (ec || !indexOk || fileBytes != writer.getBytesWritten()
+		|| res.samples + injected + ring.getDroppedSamps() != sampCount
+		|| writer.getLostSamps() > injected + ring.getDroppedSamps()
+		|| writer.getTimeMap().getAnchors().size() != 1
+		|| (syncInterval > 0 && js.committedSamps * sizeof(Ipp16sc) != writer.getBytesWritten()))
+		res.name += " (ACCOUNTING MISMATCH)";
+
+	ippsFree(src);
+	return res;
+}
+
+BenchResult benchJournal(const std::string& basename, double seconds, double syncInterval, uint64_t segBytes, int rounds)
+{
+	// Alternating runs, so drift in the disk's speed (device cache, other
+	// I/O) hits both sides alike; medians, as one lucky run is common
+	std::vector<BenchResult> plain, journaled;
+	for (int r = 0; r < rounds; r++) {
+		plain.push_back(benchRecorder(basename, 16, 1 << 20, seconds, 0, 0, 0, segBytes));
+		journaled.push_back(benchRecorder(basename, 16, 1 << 20, seconds, 0, 0, 0, segBytes, syncInterval));
+	}
+	bool ok = true;
+	for (int r = 0; r < rounds; r++)
+		ok = ok && plain[r].name.find("MISMATCH") == std::string::npos
+			&& journaled[r].name.find("MISMATCH") == std::string::npos;
+	auto byRate = [](const BenchResult& a, const BenchResult& b) { return a.mbps() < b.mbps(); };
+	std::sort(plain.begin(), plain.end(), byRate);
+	std::sort(journaled.begin(), journaled.end(), byRate);
+	const BenchResult& p = plain[rounds / 2];
+	BenchResult res = journaled[rounds / 2];
+	const double overhead = p.mbps() > 0 ? 100.0 * (1.0 - res.mbps() / p.mbps()) : 0;
+	res.name = str(boost::format("Journal every %.1f s: %.0f vs %.0f MB/s unjournaled (medians of %d), overhead %.2f%%")
+		% syncInterval % res.mbps() % p.mbps() % rounds % overhead);
+	if (!ok)
+		res.name += " (ACCOUNTING MISMATCH)";
+	return res;
+}
+
+BenchResult benchZeroCopy(const std::string& basename, double seconds, size_t blockSamps, int rounds)
+{
+	// Alternating medians as in benchJournal()
+	DiskWriterConfig copyCfg, sharedCfg;
+	copyCfg.zeroCopy = false;
+	std::vector<BenchResult> copied, shared;
+	for (int r = 0; r < rounds; r++) {
+		copied.push_back(benchRecorder(basename, 64, blockSamps, seconds, 0, 0, 0, 0, 0, copyCfg));
+		shared.push_back(benchRecorder(basename, 64, blockSamps, seconds, 0, 0, 0, 0, 0, sharedCfg));
+	}
+	bool ok = true;
+	for (int r = 0; r < rounds; r++)
+		ok = ok && copied[r].name.find("MISMATCH") == std::string::npos
+			&& shared[r].name.find("MISMATCH") == std::string::npos && shared[r].name.find("in place") != std::string::npos;
+	auto perGB = [](const BenchResult& a) { return a.bytes > 0 ? a.busySeconds / a.bytes * 1e12 : 0; }; // ms per GB
+	auto byCost = [&](const BenchResult& a, const BenchResult& b) { return perGB(a) < perGB(b); };
+	auto byRate = [](const BenchResult& a, const BenchResult& b) { return a.mbps() < b.mbps(); };
+	std::sort(copied.begin(), copied.end(), byCost);
+	std::sort(shared.begin(), shared.end(), byCost);
+	const double copyCost = perGB(copied[rounds / 2]), sharedCost = perGB(shared[rounds / 2]);
+	std::sort(copied.begin(), copied.end(), byRate);
+	std::sort(shared.begin(), shared.end(), byRate);
+	BenchResult res = shared[rounds / 2];
+	res.name = str(boost::format("Zero-copy writes, %d-sample blocks: writer %.0f vs %.0f ms/GB copied, "
+		"%.0f vs %.0f MB/s (medians of %d)") % blockSamps % sharedCost % copyCost % res.mbps()
+		% copied[rounds / 2].mbps() % rounds);
+	if (!ok)
+		res.name += " (ACCOUNTING MISMATCH)";
+	return res;
+}
+
+BenchResult benchBackpressure(const std::string& basename, double seconds, double paceMsps, double stallMs,
+	size_t stallEvery, const BackpressureConfig& cfg, uint64_t segBytes, size_t numSlots, size_t blockSamps)
+{
+	BenchResult res;
+	res.name = str(boost::format("Backpressure, %.0f ms stall every %d blocks @ %.0f Msps")
+		% stallMs % stallEvery % paceMsps);
+	for (const BackpressureStage& st : cfg.stages)
+		res.name += str(boost::format(" %s@%.0f%%") % BackpressurePolicy::actionName(st.action) % (st.engage * 100));
+	if (cfg.stages.empty())
+		res.name += " (no policy)";
+
+	SampleRing ring;
+	ring.init(numSlots, blockSamps);
+	blockSamps = ring.getBlockSamps();
+	const double rate = paceMsps * 1e6;
+	RecordWriter writer;
+	writer.setSegments(segBytes, 0);
+	writer.setBackpressure(cfg);
+	if (!writer.open(basename, rate)) {
+		res.name += " (OPEN FAILED)";
+		return res;
+	}
+
+	Ipp16sc* loud = ippsMalloc_16sc_L(blockSamps);
+	Ipp16sc* quiet = ippsMalloc_16sc_L(blockSamps);
+	float phase = 0;
+	genTone16sc(loud, blockSamps, 0.01f, &phase);
+	ippsCopy_16sc(loud, quiet, (int)blockSamps);
+	ippsRShiftC_16s_I(10, (Ipp16s*)quiet, (int)(2 * blockSamps));   // -60 dB
+	// Every 4th block of the stream is loud, keyed by its sample offset so
+	// producer and checker agree across the blocks lost while blocked
+	auto isLoud = [blockSamps](uint64_t sampOffset) { return (sampOffset / blockSamps) % 4 == 0; };
+
+	// The stall is per block written: skipping a block costs the disk nothing
+	std::atomic<bool> producing{ true };
+	uint64_t loudShed = 0;
+	std::thread consumer([&] {
+		uint64_t stalls = 0;
+		while (true) {
+			SampleBlock* blk = ring.beginRead();
+			if (blk == nullptr) {
+				if (!producing)
+					break;
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				continue;
+			}
+			const uint64_t before = writer.getShedBlocks();
+			writer.writeBlock(*blk, (double)ring.getFill() / ring.getNumSlots());
+			if (isLoud(blk->sampOffset) && writer.getShedBlocks() > before && cfg.keepDbfs < -10.0f)
+				loudShed++;
+			ring.endRead();
+			if (stallEvery > 0 && writer.getBlocksWritten() / stallEvery > stalls) {
+				stalls++;
+				std::this_thread::sleep_for(std::chrono::duration<double>(stallMs / 1e3));
+			}
+		}
+	});
+
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	const double blockPeriod = blockSamps / rate;
+	uint64_t produced = 0, sampCount = 0, deviceLost = 0;
+	while (std::chrono::steady_clock::now() < tEnd) {
+		auto due = t0 + std::chrono::duration<double>(produced * blockPeriod);
+		while (std::chrono::steady_clock::now() < due)
+			std::this_thread::yield();
+		if (cfg.blockWhenFull && ring.isFull()) {
+			// The receive loop waits; the blocks due meanwhile are lost at the device
+			while (ring.isFull())
+				std::this_thread::yield();
+			const uint64_t now = (uint64_t)(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / blockPeriod);
+			if (now > produced) {
+				sampCount += (now - produced) * blockSamps;
+				deviceLost += (now - produced) * blockSamps;
+				produced = now;
+			}
+		}
+		SampleBlock* blk = ring.beginWrite();
+		blk->sampOffset = sampCount;
+		blk->time = DeviceTime().plus(sampCount / rate);
+		blk->hasTime = true;
+		ippsCopy_16sc(isLoud(sampCount) ? loud : quiet, blk->data, (int)blockSamps);
+		blk->nsamps = blockSamps;
+		sampCount += blockSamps;
+		ring.endWrite();
+		produced++;
+	}
+	producing = false;
+	consumer.join();
+	writer.close();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.samples = writer.getBytesWritten() / sizeof(Ipp16sc);
+	res.bytes = writer.getBytesWritten();
+	res.dropped = ring.getOverruns();
+
+	BackpressurePolicy::Stats bs = writer.getBackpressureStats();
+	res.name += str(boost::format(", peak fill %.0f%%, %d blocks left out")
+		% (100.0 * ring.getHighWater() / ring.getNumSlots()) % writer.getShedBlocks());
+	for (int a = 0; a < BP_NUM_ACTIONS; a++)
+		if (bs.engagements[a] > 0)
+			res.name += str(boost::format(", %s %dx/%.2f s") % BackpressurePolicy::actionName((BackpressureAction)a)
+				% bs.engagements[a] % bs.engagedSeconds[a]);
+	if (writer.getSpilledSegments() > 0)
+		res.name += str(boost::format(", %d segments spilled") % writer.getSpilledSegments());
+	res.dropped += deviceLost / blockSamps;
+	if (res.samples + writer.getShedSamps() + ring.getDroppedSamps() + deviceLost != sampCount || loudShed > 0)
+		res.name += " (ACCOUNTING MISMATCH)";
+	ippsFree(loud);
+	ippsFree(quiet);
+	return res;
+}
+
+BenchResult benchSource(SampleSource& source, size_t chunkSamps, double seconds)
+{
+	BenchResult res;
+	res.name = str(boost::format("SampleSource %d ch x %d") % source.getNumChannels() % chunkSamps);
+
+	std::vector<Ipp16sc*> chans(source.getNumChannels());
+	std::vector<void*> buffs(source.getNumChannels());
+	for (size_t ch = 0; ch < chans.size(); ch++) {
+		chans[ch] = ippsMalloc_16sc_L(chunkSamps);
+		buffs[ch] = chans[ch];
+	}
+
+	uhd::rx_metadata_t md;
+	source.startStream();
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	while (std::chrono::steady_clock::now() < tEnd && !source.isFinished()) {
+		res.samples += source.recv(buffs, chunkSamps, md, 0.1);
+		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW)
+			res.dropped++;
+	}
+	source.stopStream();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.bytes = res.samples * sizeof(Ipp16sc) * chans.size();
+
+	for (size_t ch = 0; ch < chans.size(); ch++)
+		ippsFree(chans[ch]);
+	return res;
+}
+
+// Runs a configured receiver on source for the given time (or until the
+// source runs out) and fills in what reached the disk
+static void runReceiver(ReceiverClass& receiver, SampleSource::sptr source, double seconds, BenchResult& res)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	receiver.prepare();
+	std::thread rx(&ReceiverClass::startFromSource, &receiver, source);
+
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	while (std::chrono::steady_clock::now() < tEnd && !source->isFinished())
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	receiver.cancel();
+	rx.join();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	const RecordWriter& writer = receiver.getWriter();
+	res.bytes = writer.getBytesWritten();
+	res.samples = res.bytes / sizeof(Ipp16sc); // all channels
+	res.dropped = writer.getLostSamps();
+}
+
+BenchResult benchReceiver(SampleSource::sptr source, const std::string& prefix, double seconds,
+	bool interleaved, bool perChannelFiles)
+{
+	BenchResult res;
+	res.name = str(boost::format("Receiver pipeline %d ch @ %.0f Msps") % source->getNumChannels() % (source->getRate() / 1e6));
+	if (source->getNumChannels() > 1)
+		res.name += str(boost::format(" (%s blocks, %s)") % (interleaved ? "interleaved" : "planar")
+			% (perChannelFiles ? "file per channel" : "interleaved file"));
+
+	ReceiverClass receiver;
+	receiver.setRecordPrefix(prefix);
+	receiver.setLayout(interleaved, perChannelFiles);
+	runReceiver(receiver, source, seconds, res);
+	return res;
+}
+
+BenchResult benchReplay(const std::string& prefix, size_t numChans, bool interleaved, bool perChannelFiles,
+	uint64_t segBytes, double seconds)
+{
+	BenchResult res;
+	res.name = str(boost::format("Replay %d ch (%s blocks, %s%s)") % numChans % (interleaved ? "interleaved" : "planar")
+		% (perChannelFiles ? "file per channel" : "interleaved file") % (segBytes > 0 ? ", segmented" : ""));
+
+	SyntheticConfig cfg;
+	cfg.rate = 5e6;
+	cfg.numChannels = numChans;
+	cfg.paced = true;
+	cfg.overflowEvery = 3000000;
+	cfg.overflowSamps = 1234;
+	cfg.startTime = DeviceTime().plus(1000.25);
+	ReceiverClass original;
+	original.setRecordPrefix(prefix + "_orig");
+	original.setLayout(interleaved, perChannelFiles);
+	original.setSegments(segBytes, 0);
+	BenchResult recorded;
+	runReceiver(original, std::make_shared<SyntheticSource>(cfg), seconds, recorded);
+	const std::string origName = original.getWriter().getBasename();
+
+	// As fast as it reads, into a receiver that waits for the disk rather than drop
+	std::shared_ptr<FileSource> replay = std::make_shared<FileSource>(origName, false);
+	if (!replay->isOpen()) {
+		res.name += " (NO INDEX)";
+		return res;
+	}
+	ReceiverClass copy;
+	copy.setRecordPrefix(prefix + "_replay");
+	copy.setLayout(interleaved, perChannelFiles);
+	BackpressureConfig bp;
+	bp.blockWhenFull = true;
+	copy.setBackpressure(bp);
+	runReceiver(copy, replay, 10 * seconds + 10, res);
+	const std::string copyName = copy.getWriter().getBasename();
+
+	// Same length, gaps and channels
+	RecordReader a, b;
+	bool ok = a.open(origName) && b.open(copyName);
+	const size_t nch = a.getNumChans();
+	ok = ok && a.getNumSamps() > 0 && a.getNumSamps() == b.getNumSamps() && b.getNumChans() == nch
+		&& copy.getWriter().getLostSamps() == original.getWriter().getLostSamps();
+
+	// Device times of the first and last samples
+	RecordIndex& ia = a.getIndex();
+	RecordIndex& ib = b.getIndex();
+	RecordIndexEntry firstA, lastA, firstB, lastB;
+	ok = ok && ia.entry(0, 0, firstA) && ia.entry(ia.getNumBlocks() - 1, 0, lastA)
+		&& ib.entry(0, 0, firstB) && ib.entry(ib.getNumBlocks() - 1, 0, lastB);
+	const double rate = ia.getRate();
+	if (ok) {
+		const DeviceTime endA = lastA.time().plus((lastA.nsamps - 1) / rate);
+		const DeviceTime endB = lastB.time().plus((lastB.nsamps - 1) / rate);
+		ok = std::fabs(firstB.time().minus(firstA.time())) < 0.5 / rate && std::fabs(endB.minus(endA)) < 0.5 / rate;
+	}
+
+	// Every sample
+	const size_t chunk = 1 << 16;
+	std::vector<Ipp16sc> bufA(chunk * nch), bufB(chunk * nch);
+	for (uint64_t s = 0; ok && s < a.getNumSamps(); s += chunk) {
+		size_t got = a.read(s, chunk, bufA.data());
+		ok = got > 0 && b.read(s, chunk, bufB.data()) == got
+			&& memcmp(bufA.data(), bufB.data(), got * nch * sizeof(Ipp16sc)) == 0;
+	}
+
+	res.name += str(boost::format(", %d samples per channel, %d lost in %d gaps")
+		% a.getNumSamps() % original.getWriter().getLostSamps() % original.getWriter().getGapCount());
+	if (!ok)
+		res.name += " (REPLAY MISMATCH)";
+	return res;
+}
+
+BenchResult benchRecvSizing(SampleSource::sptr source, const std::string& prefix, double seconds,
+	double latencyTarget, bool autotune)
+{
+	ReceiverClass receiver;
+	receiver.setRecordPrefix(prefix);
+	receiver.setLatencyTarget(latencyTarget);
+	receiver.setRecvAutotune(autotune);
+
+	BenchResult res;
+	runReceiver(receiver, source, seconds, res);
+	const SampleRing& ring = receiver.getRing();
+	res.name = str(boost::format("Receiver @ %.0f Msps, %s recv() %d samples, block %.3f ms, ring %d slots")
+		% (source->getRate() / 1e6) % (autotune ? "tuned" : "fixed") % receiver.getRecvSamps()
+		% (ring.getBlockSamps() / source->getRate() * 1e3) % ring.getNumSlots());
+	if (ring.getOverruns() > 0)
+		res.name += str(boost::format(" (%d RING OVERRUNS)") % ring.getOverruns());
+	return res;
+}
+
+BenchResult benchMerge(size_t numBoards, size_t chansPerBoard, double rate, double seconds,
+	size_t skewSamps, uint64_t overflowEvery, size_t overflowSamps)
+{
+	std::vector<SampleSource::sptr> sources;
+	for (size_t b = 0; b < numBoards; b++) {
+		SyntheticConfig cfg;
+		cfg.rate = rate;
+		cfg.numChannels = chansPerBoard;
+		cfg.paced = true;
+		cfg.startTime = DeviceTime().plus(b * skewSamps / rate);
+		if (b == 1) {
+			cfg.overflowEvery = overflowEvery;
+			cfg.overflowSamps = overflowSamps;
+		}
+		sources.push_back(std::make_shared<SyntheticSource>(cfg));
+	}
+	auto merge = std::make_shared<MergeSource>(sources);
+
+	BenchResult res = benchReceiver(merge, "bench_merge", seconds, false, true);
+	res.name = str(boost::format("Merge %d boards x %d ch @ %.0f Msps") % numBoards % chansPerBoard % (rate / 1e6));
+
+	// Every board but the last starts early and is realigned once by the
+	// skew; every overflow of board 1 realigns all the others. Overflows at
+	// the very end may not have reached the merge yet.
+	uint64_t ovf = numBoards > 1 ? merge->getBoardStats(1).overflows.load() : 0;
+	bool ok = res.dropped % std::max<size_t>(overflowSamps, 1) == 0
+		&& res.dropped <= ovf * overflowSamps && res.dropped + overflowSamps >= ovf * overflowSamps;
+	for (size_t b = 0; b < numBoards; b++) {
+		const MergeSource::BoardStats& bs = merge->getBoardStats(b);
+		uint64_t startSkip = (numBoards - 1 - b) * skewSamps;
+		uint64_t expect = startSkip + (b == 1 ? 0 : res.dropped);
+		ok = ok && bs.skippedSamps == expect;
+	}
+	if (!ok)
+		res.name += " (ALIGNMENT MISMATCH)";
+	return res;
+}
+
+BenchResult benchConvert(WireFormat from, bool toFloat, size_t nsamps, double seconds)
+{
+	BenchResult res;
+	res.name = str(boost::format("Convert %s -> %s, %d samples") % wireFormatName(from)
+		% (toFloat ? "fc32" : "sc16") % nsamps);
+
+	Ipp16sc* src16 = ippsMalloc_16sc_L(nsamps);
+	Ipp8sc* src8 = (Ipp8sc*)ippsMalloc_8s_L(2 * nsamps);
+	Ipp16sc* dst16 = ippsMalloc_16sc_L(nsamps);
+	Ipp32fc* dst32 = ippsMalloc_32fc_L(nsamps);
+	float phase = 0;
+	genTone16sc(src16, nsamps, 0.01f, &phase);
+	for (size_t i = 0; i < nsamps; i++) {
+		src8[i].re = (Ipp8s)(src16[i].re >> 8);
+		src8[i].im = (Ipp8s)(src16[i].im >> 8);
+	}
+	const size_t inBytes = nsamps * (from == WIRE_SC8 ? sizeof(Ipp8sc) : sizeof(Ipp16sc));
+	const size_t outBytes = nsamps * (toFloat ? sizeof(Ipp32fc) : sizeof(Ipp16sc));
+
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	uint64_t calls = 0;
+	do {
+		// Check the clock every few calls only, small buffers convert in microseconds
+		for (int i = 0; i < 16; i++) {
+			if (from == WIRE_SC8 && toFloat)
+				widenSc8To32fc(src8, dst32, nsamps);
+			else if (from == WIRE_SC8)
+				widenSc8ToSc16(src8, dst16, nsamps);
+			else if (toFloat)
+				widenSc16To32fc(src16, dst32, nsamps);
+			else
+				ippsCopy_16sc(src16, dst16, (int)nsamps);
+		}
+		calls += 16;
+	} while (std::chrono::steady_clock::now() < tEnd);
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.samples = calls * nsamps;
+	res.bytes = calls * (inBytes + outBytes);
+
+	// Spot check against the plain definition
+	bool ok = true;
+	for (size_t i = 0; i < nsamps && ok; i += 97) {
+		if (from == WIRE_SC8 && toFloat)
+			ok = dst32[i].re == src8[i].re / 128.0f && dst32[i].im == src8[i].im / 128.0f;
+		else if (from == WIRE_SC8)
+			ok = dst16[i].re == src8[i].re * 256 && dst16[i].im == src8[i].im * 256;
+		else if (toFloat)
+			ok = dst32[i].re == src16[i].re / 32768.0f && dst32[i].im == src16[i].im / 32768.0f;
+	}
+	if (!ok)
+		res.name += " (WRONG OUTPUT)";
+
+	ippsFree(src16);
+	ippsFree(src8);
+	ippsFree(dst16);
+	ippsFree(dst32);
+	return res;
+}
+
+BenchResult benchDisk(const std::string& path, double seconds, const DiskWriterConfig& cfg, size_t chunkBytes)
+{
+	BenchResult res;
+	const size_t chunkSamps = std::max<size_t>(1, chunkBytes / sizeof(Ipp16sc));
+	Ipp16sc* chunk = ippsMalloc_16sc_L(chunkSamps);
+	float phase = 0;
+	genTone16sc(chunk, chunkSamps, 0.01f, &phase);
+
+	DiskWriter disk;
+	if (!disk.open(path, cfg)) {
+		res.name = "Disk " + path + " (OPEN FAILED)";
+		ippsFree(chunk);
+		return res;
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	uint64_t chunks = 0;
+	bool ok = true;
+	while (ok && std::chrono::steady_clock::now() < tEnd) {
+		ok = disk.write(chunk, chunkSamps * sizeof(Ipp16sc));
+		chunks++;
+	}
+	ok = disk.close() && ok;
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.samples = chunks * chunkSamps;
+	res.bytes = res.samples * sizeof(Ipp16sc);
+
+	DiskWriter::Stats st = disk.getStats();
+	res.name = str(boost::format("Disk %s, %.0f KB chunks, %d x %.1f MB buffers: latency p50 %.2f / p99 %.2f / p99.9 %.2f ms, queue max %d")
+		% disk.getBackend() % (chunkSamps * sizeof(Ipp16sc) / 1e3) % cfg.numBufs % (cfg.bufBytes / 1e6)
+		% (st.p50 * 1e3) % (st.p99 * 1e3) % (st.p999 * 1e3) % st.maxInFlight);
+	boost::system::error_code ec;
+	if (!ok || st.errors > 0)
+		res.name += " (WRITE ERRORS)";
+	else if (boost::filesystem::file_size(path, ec) != res.bytes)
+		res.name += " (WRONG SIZE)";
+	boost::filesystem::remove(path, ec);
+	ippsFree(chunk);
+	return res;
+}
+
+// Compresses the blocks of data (nblocks of blockSamps) over and over for
+// the given time, then decodes the frames of the first pass against data
+static void runCompress(BenchResult& res, const Ipp16sc* data, size_t nblocks, size_t blockSamps,
+	size_t numWorkers, double seconds, IqzCodec codec)
+{
+	std::vector<std::vector<uint8_t>> firstPass;
+	IqCompressor comp;
+	comp.start(numWorkers, 1, false, codec, [&](size_t, const uint8_t* frame, size_t nbytes) {
+		if (firstPass.size() < nblocks)
+			firstPass.emplace_back(frame, frame + nbytes);
+		return true;
+	});
+
+	SampleBlock blk;
+	blk.nsamps = blockSamps;
+	blk.stride = blockSamps;
+	auto t0 = std::chrono::steady_clock::now();
+	auto tEnd = t0 + std::chrono::duration<double>(seconds);
+	uint64_t blocks = 0;
+	while (blocks < nblocks || std::chrono::steady_clock::now() < tEnd) {
+		blk.data = const_cast<Ipp16sc*>(data) + (blocks % nblocks) * blockSamps;
+		blk.seq = blocks;
+		blk.sampOffset = blocks * blockSamps;
+		comp.submit(blk, blk.sampOffset);
+		blocks++;
+	}
+	comp.flush();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	IqCompressor::Stats st = comp.getStats();
+	comp.stop();
+	res.samples = blocks * blockSamps;
+	res.bytes = res.samples * sizeof(Ipp16sc);
+	res.name += str(boost::format(", %s, %d workers: ratio %.2f, %.0f MB/s per core")
+		% iqzCodecName(codec) % numWorkers % st.ratio() % st.mbpsPerCore());
+	if (codec != IQZ_LOSSLESS)
+		res.name += str(boost::format(", SNR %.1f dB") % st.quality.snrDb());
+
+	std::vector<Ipp16sc> out(blockSamps);
+	bool ok = firstPass.size() == nblocks;
+	for (size_t b = 0; b < firstPass.size() && ok; b++) {
+		IqzFrameHeader hdr;
+		memcpy(&hdr, firstPass[b].data(), sizeof(hdr));
+		const Ipp16sc* orig = data + b * blockSamps;
+		ok = hdr.magic == IQZ_MAGIC && hdr.nsamps == blockSamps && hdr.fileSample == b * blockSamps
+			&& iqzCodec(hdr) == codec && sizeof(hdr) + hdr.payloadBytes == firstPass[b].size()
+			&& iqzDecodeFrame(hdr, firstPass[b].data() + sizeof(hdr), out.data());
+		if (ok && codec == IQZ_LOSSLESS)
+			ok = memcmp(out.data(), orig, blockSamps * sizeof(Ipp16sc)) == 0;
+		else if (ok) {
+			// Half a step of the block's scale, plus the rounding back to sc16
+			Ipp16s peak = 0;
+			ippsMaxAbs_16s(reinterpret_cast<const Ipp16s*>(orig), (int)(2 * blockSamps), &peak);
+			const double tol = peak / double(codec == IQZ_BFP8 ? 127 : 7) / 2 + 1;
+			for (size_t i = 0; i < blockSamps && ok; i++)
+				ok = std::abs(out[i].re - orig[i].re) <= tol && std::abs(out[i].im - orig[i].im) <= tol;
+		}
+	}
+	if (!ok)
+		res.name += codec == IQZ_LOSSLESS ? " (NOT LOSSLESS)" : " (DECODE MISMATCH)";
+}
+
+BenchResult benchCompress(WireFormat wire, size_t numWorkers, double seconds, float noiseAmp, IqzCodec codec,
+	size_t blockSamps)
+{
+	BenchResult res;
+	res.name = str(boost::format("IqCompressor %s tone, noise %.3f") % wireFormatName(wire) % noiseAmp);
+
+	SyntheticConfig cfg;
+	cfg.wireFormat = wire;
+	cfg.noiseAmp = noiseAmp;
+	SyntheticSource gen(cfg);
+	const size_t nblocks = 16;
+	Ipp16sc* data = ippsMalloc_16sc_L(nblocks * blockSamps);
+	std::vector<void*> buffs(1);
+	uhd::rx_metadata_t md;
+	gen.startStream();
+	for (size_t got = 0; got < nblocks * blockSamps;) {
+		buffs[0] = data + got;
+		got += gen.recv(buffs, nblocks * blockSamps - got, md, 0.1);
+	}
+	gen.stopStream();
+
+	runCompress(res, data, nblocks, blockSamps, numWorkers, seconds, codec);
+	ippsFree(data);
+	return res;
+}
+
+BenchResult benchCompressFile(const std::string& path, size_t numWorkers, double seconds, IqzCodec codec,
+	size_t blockSamps)
+{
+	BenchResult res;
+	res.name = "IqCompressor " + boost::filesystem::path(path).filename().string();
+	std::ifstream infile(path, std::ios::in | std::ios::binary);
+	boost::system::error_code ec;
+	const uint64_t fileSamps = boost::filesystem::file_size(path, ec) / sizeof(Ipp16sc);
+	const size_t nblocks = (size_t)std::min<uint64_t>(fileSamps / blockSamps, 64000000 / sizeof(Ipp16sc) / blockSamps);
+	if (ec || !infile.is_open() || nblocks == 0) {
+		res.name += " (NO DATA)";
+		return res;
+	}
+	Ipp16sc* data = ippsMalloc_16sc_L(nblocks * blockSamps);
+	infile.read(reinterpret_cast<char*>(data), nblocks * blockSamps * sizeof(Ipp16sc));
+	runCompress(res, data, nblocks, blockSamps, numWorkers, seconds, codec);
+	ippsFree(data);
+	return res;
+}
+
+// Test pattern that encodes the stream index of each sample
+static inline Ipp16sc seekPattern(uint64_t s)
+{
+	Ipp16sc v;
+	v.re = (Ipp16s)(s & 0x7FFF);
+	v.im = (Ipp16s)((s >> 15) & 0x7FFF);
+	return v;
+}
+
+BenchResult benchSeek(const std::string& basename, uint64_t totalSamps, size_t blockSamps, bool compressed,
+	uint64_t segBytes, size_t numSeeks, size_t readSamps)
+{
+	BenchResult res;
+	res.name = str(boost::format("RecordIndex %.0f MB %s%s") % (totalSamps * sizeof(Ipp16sc) / 1e6)
+		% (compressed ? "iqz" : "raw") % (segBytes > 0 ? " segmented" : ""));
+
+	const double rate = 10e6;
+	const size_t gapSamps = 777;
+	RecordWriter writer;
+	writer.setSegments(segBytes, 0);
+	writer.setCompression(compressed ? 2 : 0);
+	if (!writer.open(basename, rate)) {
+		res.name += " (OPEN FAILED)";
+		return res;
+	}
+	Ipp16sc* blkbuf = ippsMalloc_16sc_L(blockSamps);
+	SampleBlock blk;
+	blk.data = blkbuf;
+	blk.stride = blockSamps;
+	blk.hasTime = true;
+	uint64_t offset = 0;
+	for (uint64_t written = 0; written < totalSamps; blk.seq++) {
+		if (blk.seq > 0 && blk.seq % 100 == 0)
+			offset += gapSamps;
+		blk.nsamps = (size_t)std::min<uint64_t>(blockSamps, totalSamps - written);
+		for (size_t i = 0; i < blk.nsamps; i++)
+			blkbuf[i] = seekPattern(offset + i);
+		blk.sampOffset = offset;
+		blk.time = DeviceTime().plus(offset / rate);
+		writer.writeBlock(blk);
+		offset += blk.nsamps;
+		written += blk.nsamps;
+	}
+	writer.close();
+	ippsFree(blkbuf);
+
+	// Random device times over the whole capture, gaps included
+	RecordReader reader;
+	if (!reader.open(basename)) {
+		res.name += " (NO INDEX)";
+		return res;
+	}
+	std::vector<Ipp16sc> buf(readSamps);
+	std::vector<float> seekTimes;
+	uint64_t rng = 12345;
+	bool ok = reader.getNumSamps() == totalSamps;
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < numSeeks && ok; k++) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		DeviceTime t = DeviceTime().plus((rng >> 11) % offset / rate);
+		auto ts = std::chrono::steady_clock::now();
+		size_t got = reader.readTime(t, readSamps, buf.data());
+		seekTimes.push_back(std::chrono::duration<float>(std::chrono::steady_clock::now() - ts).count());
+		res.samples += got;
+
+		// The first sample read is at or right after t, the rest follow it
+		// in the stream apart from the gaps
+		if (got > 0) {
+			uint64_t s = (uint64_t)buf[0].re | ((uint64_t)buf[0].im << 15);
+			double d = (s / rate) - t.minus(DeviceTime());
+			ok = d > -0.5 / rate && d < (gapSamps + 0.5) / rate;
+			for (size_t i = 1; i < got && ok; i++) {
+				uint64_t next = (uint64_t)buf[i].re | ((uint64_t)buf[i].im << 15);
+				ok = next == s + 1 || next == s + 1 + gapSamps;
+				s = next;
+			}
+		}
+	}
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.bytes = res.samples * sizeof(Ipp16sc);
+	std::sort(seekTimes.begin(), seekTimes.end());
+	if (!seekTimes.empty())
+		res.name += str(boost::format(", %d seeks of %d samples: p50 %.3f / p99 %.3f ms")
+			% seekTimes.size() % readSamps % (seekTimes[seekTimes.size() / 2] * 1e3)
+			% (seekTimes[seekTimes.size() * 99 / 100] * 1e3));
+	if (!ok)
+		res.name += " (WRONG SAMPLES)";
+	return res;
+}
+
+BenchResult benchRecordMap(const std::string& basename, uint64_t totalSamps, size_t numChans, bool perChannelFiles,
+	uint64_t segBytes, size_t blockSamps)
+{
+	BenchResult res;
+	res.name = str(boost::format("RecordMap %.0f MB, %d ch%s%s") % (totalSamps * numChans * sizeof(Ipp16sc) / 1e6)
+		% numChans % (perChannelFiles ? " per-channel files" : "") % (segBytes > 0 ? " segmented" : ""));
+
+	// Planar blocks, channel c offset by c in the pattern, a gap every 100th
+	const double rate = 10e6;
+	const size_t gapSamps = 777;
+	RecordWriter writer;
+	writer.setSegments(segBytes, 0);
+	if (!writer.open(basename, rate, numChans, perChannelFiles)) {
+		res.name += " (OPEN FAILED)";
+		return res;
+	}
+	Ipp16sc* blkbuf = ippsMalloc_16sc_L(blockSamps * numChans);
+	SampleBlock blk;
+	blk.data = blkbuf;
+	blk.numChans = numChans;
+	blk.stride = blockSamps;
+	blk.hasTime = true;
+	uint64_t offset = 0;
+	for (uint64_t written = 0; written < totalSamps; blk.seq++) {
+		if (blk.seq > 0 && blk.seq % 100 == 0)
+			offset += gapSamps;
+		blk.nsamps = (size_t)std::min<uint64_t>(blockSamps, totalSamps - written);
+		for (size_t c = 0; c < numChans; c++)
+			for (size_t i = 0; i < blk.nsamps; i++)
+				blkbuf[c * blockSamps + i] = seekPattern(offset + i + c);
+		blk.sampOffset = offset;
+		blk.time = DeviceTime().plus(offset / rate);
+		writer.writeBlock(blk);
+		offset += blk.nsamps;
+		written += blk.nsamps;
+	}
+	writer.close();
+	ippsFree(blkbuf);
+
+	// Front to back, every channel to fc32: through RecordReader (a read into
+	// an interleaved buffer, then convert), then in place through the map
+	RecordReader reader;
+	RecordMap map;
+	if (!reader.open(basename) || !map.open(basename)) {
+		res.name += " (NO INDEX)";
+		return res;
+	}
+	const size_t chunk = 1 << 16;
+	std::vector<Ipp16sc> inter(chunk * numChans);
+	std::vector<Ipp32fc> viaRead(chunk * numChans), viaMap(chunk);
+	bool ok = map.getNumSamps() == totalSamps;
+	// The writer bypassed the page cache; one pass first brings the files in,
+	// so both timed passes measure the reader rather than the disk
+	for (uint64_t s = 0; s < totalSamps && ok; s += chunk)
+		ok = reader.read(s, chunk, inter.data()) > 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint64_t s = 0; s < totalSamps && ok; s += chunk) {
+		size_t got = reader.read(s, chunk, inter.data());
+		widenSc16To32fc(inter.data(), viaRead.data(), got * numChans);
+		ok = got == std::min<uint64_t>(chunk, totalSamps - s);
+	}
+	const double readSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	map.setSequential(true);
+	t0 = std::chrono::steady_clock::now();
+	for (uint64_t s = 0; s < totalSamps && ok; s += chunk) {
+		for (size_t c = 0; c < numChans && ok; c++) {
+			size_t got = map.readFloat(c, s, chunk, viaMap.data());
+			ok = got == std::min<uint64_t>(chunk, totalSamps - s);
+			res.samples += got;
+		}
+	}
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	res.bytes = res.samples * sizeof(Ipp16sc);
+
+	// Both readers agree sample for sample, and the pattern runs on across
+	// the gaps, every 10th chunk
+	for (uint64_t s = 0; s < totalSamps && ok; s += 10 * chunk) {
+		size_t got = reader.read(s, chunk, inter.data());
+		widenSc16To32fc(inter.data(), viaRead.data(), got * numChans);
+		for (size_t c = 0; c < numChans && ok; c++) {
+			ok = map.readFloat(c, s, got, viaMap.data()) == got;
+			uint64_t prev = 0;
+			for (size_t i = 0; i < got && ok; i++) {
+				const Ipp32fc& v = viaMap[i];
+				ok = v.re == viaRead[i * numChans + c].re && v.im == viaRead[i * numChans + c].im;
+				uint64_t p = (uint64_t)(v.re * 32768.0f) | ((uint64_t)(v.im * 32768.0f) << 15);
+				ok = ok && (i == 0 || p == prev + 1 || p == prev + 1 + gapSamps);
+				prev = p;
+			}
+		}
+	}
+	res.name += str(boost::format(", RecordReader %.0f MB/s") % (readSeconds > 0 ? res.bytes / readSeconds / 1e6 : 0));
+	if (!ok)
+		res.name += " (WRONG SAMPLES)";
+	return res;
+}
+
+// Test input for the DSP benches: numBlocks planar blocks of a half-scale
+// tone per channel, cycled through as the stream goes on
+struct ToneInput
+{
+	static const size_t numBlocks = 16;
+	size_t numChans, blockSamps;
+	Ipp16sc* data;
+	ToneInput(size_t in_numChans, size_t in_blockSamps)
+		: numChans(in_numChans), blockSamps(in_blockSamps),
+		data(ippsMalloc_16sc_L(numBlocks * in_blockSamps * in_numChans)) {}
+	~ToneInput() { ippsFree(data); }
+	// The tone in channel c, f in cycles per input sample
+	void setTone(size_t c, double f)
+	{
+		float phase = 0;
+		for (size_t b = 0; b < numBlocks; b++)
+			ippsTone_16sc(data + (b * numChans + c) * blockSamps, (int)blockSamps, 16384, (Ipp32f)(f - std::floor(f)), &phase,
+				ippAlgHintAccurate);
+	}
+};
+
+// Block i of the stream
+static SampleBlock toneBlock(const ToneInput& in, size_t i)
+{
+	SampleBlock blk;
+	blk.data = in.data + (i % in.numBlocks) * in.numChans * in.blockSamps;
+	blk.numChans = in.numChans;
+	blk.stride = in.blockSamps;
+	blk.nsamps = in.blockSamps;
+	blk.seq = i;
+	blk.sampOffset = i * in.blockSamps;
+	return blk;
+}
+
+// The first numBlocks blocks again, in odd-sized pieces that straddle the
+// block boundaries of the first pass
+static void refeedInPieces(const ToneInput& in, const std::function<void(const SampleBlock&)>& feed)
+{
+	const size_t piece = in.blockSamps / 3 + 7;
+	for (size_t s = 0; s < in.numBlocks * in.blockSamps;) {
+		const size_t at = s % in.blockSamps;
+		SampleBlock blk = toneBlock(in, s / in.blockSamps);
+		blk.data += at;
+		blk.nsamps = std::min(piece, in.blockSamps - at);
+		blk.sampOffset = s;
+		feed(blk);
+		s += blk.nsamps;
+	}
+}
+
+// Each channel of out appended to to
+static void keepChannels(std::vector<std::vector<Ipp16sc>>& to, const SampleBlock* out)
+{
+	if (out == nullptr)
+		return;
+	to.resize(out->numChans);
+	for (size_t c = 0; c < out->numChans; c++)
+		to[c].insert(to[c].end(), out->chan(c), out->chan(c) + out->nsamps);
+}
+
+// Power of s[from..n) relative to a tone of the given amplitude
+template <typename T>
+static double toneLevelDb(const T* s, size_t n, size_t from, double amplitude)
+{
+	double power = 0;
+	for (size_t k = from; k < n; k++)
+		power += (double)s[k].re * s[k].re + (double)s[k].im * s[k].im;
+	return n > from ? 10 * std::log10(power / (n - from) / (amplitude * amplitude) + 1e-30) : -999;
+}
+
+BenchResult benchDdc(size_t numChans, size_t decimation, double seconds, size_t numTaps, size_t blockSamps)
+{
+	BenchResult res;
+	const double rate = 50e6;
+	const double outRate = rate / decimation;
+	DdcConfig cfg;
+	cfg.decimation = decimation;
+	cfg.numTaps = numTaps;
+	for (size_t c = 0; c < numChans; c++) {
+		DdcChannel band;
+		band.input = c;
+		band.offsetHz = rate * (0.05 + 0.1 * (c % 4)) * (c % 2 ? -1 : 1);
+		cfg.channels.push_back(band);
+	}
+
+	// A tone a tenth of the output rate above each band centre
+	ToneInput in(numChans, blockSamps);
+	for (size_t c = 0; c < numChans; c++)
+		in.setTone(c, (cfg.channels[c].offsetHz + 0.1 * outRate) / rate);
+
+	Ddc ddc;
+	if (!ddc.init(cfg, rate, numChans, blockSamps)) {
+		res.name = "DDC (INIT FAILED)";
+		return res;
+	}
+	res.name = str(boost::format("DDC %d band(s), decimation %d, %.1f MACs per input") % numChans % decimation
+		% ddc.getDesign().macsPerInput);
+
+	// The first pass through the blocks, kept to check against below
+	std::vector<std::vector<Ipp16sc>> first;
+	for (size_t i = 0; i < in.numBlocks; i++)
+		keepChannels(first, ddc.process(toneBlock(in, i)));
+
+	auto t0 = std::chrono::steady_clock::now();
+	const double cpu0 = threadCpuSeconds();
+	size_t i = in.numBlocks;
+	do {
+		for (size_t k = 0; k < in.numBlocks; k++, i++)
+			ddc.process(toneBlock(in, i));
+		res.samples += in.numBlocks * blockSamps * numChans;
+		res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	} while (res.seconds < seconds);
+	res.busySeconds = threadCpuSeconds() - cpu0;
+	res.bytes = res.samples * sizeof(Ipp16sc);
+
+	// The same input in odd-sized pieces must give the same output (to the
+	// last bit but for float rounding in the filter), and the tone must come
+	// out at its level once the filter has filled
+	Ddc other;
+	other.init(cfg, rate, numChans, blockSamps);
+	std::vector<std::vector<Ipp16sc>> again;
+	refeedInPieces(in, [&](const SampleBlock& blk) { keepChannels(again, other.process(blk)); });
+	bool ok = !first.empty() && again.size() == first.size();
+	for (size_t c = 0; c < first.size() && ok; c++) {
+		const size_t n = std::min(first[c].size(), again[c].size());
+		for (size_t k = 0; k < n && ok; k++)
+			ok = std::abs(first[c][k].re - again[c][k].re) <= 1 && std::abs(first[c][k].im - again[c][k].im) <= 1;
+	}
+	const size_t settled = (size_t)(2 * ddc.getDesign().groupDelay) / decimation + 1;
+	const double levelDb = first.empty() ? -999 : toneLevelDb(first[0].data(), first[0].size(), settled, 16384);
+	ok = ok && std::fabs(levelDb) < 0.5;
+
+	res.name += str(boost::format(": %.1f Msps per core per band, tone at %+.2f dB")
+		% (res.busySeconds > 0 ? res.samples / res.busySeconds / 1e6 : 0) % levelDb);
+	if (!ok)
+		res.name += " (MISMATCH)";
+	return res;
+}
+
+BenchResult benchDecimator(size_t decimation, double seconds, double passband, double stopDb, size_t blockSamps)
+{
+	BenchResult res;
+	DecimSpec spec;
+	spec.decimation = decimation;
+	spec.passband = passband;
+	spec.stopDb = stopDb;
+	DecimDesign chain = Decimator::design(spec);
+	DecimDesign single = Decimator::designSingle(spec);
+	res.name = str(boost::format("Decimation %d, %.0f dB") % decimation % stopDb);
+	if (!chain.valid()) {
+		res.name += " (SPEC NOT MET)";
+		return res;
+	}
+	const size_t n = blockSamps / decimation * decimation;
+	Ipp32fc* in = ippsMalloc_32fc_L(n);
+	Ipp32fc* out = ippsMalloc_32fc_L(n / decimation + 1);
+
+	// Full rate through each design, one block over and over
+	float phase = 0;
+	ippsTone_32fc(in, (int)n, 0.5f, 0.01f, &phase, ippAlgHintAccurate);
+	auto run = [&](const DecimDesign& d, BenchResult& r) {
+		Decimator dec;
+		if (!dec.init(d, 1, n))
+			return;
+		auto t0 = std::chrono::steady_clock::now();
+		const double cpu0 = threadCpuSeconds();
+		do {
+			for (int k = 0; k < 16; k++)
+				dec.process(0, in, n, out);
+			r.samples += 16 * n;
+			r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		} while (r.seconds < seconds / 2);
+		r.busySeconds = threadCpuSeconds() - cpu0;
+		r.bytes = r.samples * sizeof(Ipp32fc);
+	};
+	run(chain, res);
+	BenchResult yard;
+	if (single.valid())
+		run(single, yard);
+	auto perCore = [](const BenchResult& r) { return r.busySeconds > 0 ? r.samples / r.busySeconds / 1e6 : 0; };
+	res.name += str(boost::format(": %s, %.0f Msps per core") % chain.describe() % perCore(res));
+	if (single.valid())
+		res.name += str(boost::format("; single %s, %.0f Msps per core") % single.describe() % perCore(yard));
+	else
+		res.name += "; no single FIR meets it";
+
+	// A tone at half the passband edge, then one that folds onto the same
+	// frequency, each measured once the chain has filled
+	auto levelDb = [&](double f) {
+		Decimator dec;
+		dec.init(chain, 1, n);
+		const size_t settled = (size_t)(2 * chain.groupDelay) / decimation + 1;
+		std::vector<Ipp32fc> kept;
+		float ph = 0;
+		for (int pass = 0; pass < 64 && kept.size() < settled + 4096; pass++) {
+			ippsTone_32fc(in, (int)n, 0.5f, (Ipp32f)(f - std::floor(f)), &ph, ippAlgHintAccurate);
+			const size_t m = dec.process(0, in, n, out);
+			kept.insert(kept.end(), out, out + m);
+		}
+		return toneLevelDb(kept.data(), kept.size(), settled, 0.5);
+	};
+	const double inBand = levelDb(0.5 * passband / decimation);
+	const double folded = levelDb((1 - 0.5 * passband) / decimation);
+	res.name += str(boost::format("; passband tone %+.3f dB, folded tone %.1f dB") % inBand % folded);
+	if (std::fabs(inBand) > spec.rippleDb || folded > -stopDb)
+		res.name += " (MISMATCH)";
+	ippsFree(in);
+	ippsFree(out);
+	return res;
+}
+
+BenchResult benchFastFir(size_t blockSamps, size_t factor, double seconds)
+{
+	BenchResult res;
+	const size_t n = blockSamps / factor * factor;
+	const int minTaps = 16, maxTaps = 8192;
+	const int numSteps = 10;   // doublings from minTaps to maxTaps
+	Ipp32fc* in = ippsMalloc_32fc_L(n);
+	Ipp32fc* outDirect = ippsMalloc_32fc_L(n / factor + 1);
+	Ipp32fc* outFast = ippsMalloc_32fc_L(n / factor + 1);
+	Ipp32fc* taps = ippsMalloc_32fc_L(maxTaps);
+	float phase = 0;
+	ippsTone_32fc(in, (int)n, 0.5f, 0.013f, &phase, ippAlgHintAccurate);
+	res.name = str(boost::format("FIR on blocks of %d, decimation %d, direct/FFT Msps per core:") % n % factor);
+
+	int measured = 0, predicted = 0;
+	bool ok = true;
+	for (int numTaps = minTaps; numTaps <= maxTaps; numTaps *= 2) {
+		// Low-pass taps; what they are does not change the cost
+		for (int k = 0; k < numTaps; k++) {
+			const double m = k - (numTaps - 1) / 2.0;
+			taps[k].re = (Ipp32f)(m == 0 ? 0.8 / factor : std::sin(IPP_PI * 0.8 / factor * m) / (IPP_PI * m));
+			taps[k].im = 0;
+		}
+		int specSize = 0, bufSize = 0;
+		ippsFIRMRGetSize(numTaps, 1, (int)factor, ipp32fc, &specSize, &bufSize);
+		IppsFIRSpec_32fc* pSpec = (IppsFIRSpec_32fc*)ippsMalloc_8u_L(specSize);
+		Ipp8u* pBuffer = ippsMalloc_8u_L(bufSize);
+		ippsFIRMRInit_32fc(taps, numTaps, 1, 0, (int)factor, 0, pSpec);
+		Ipp32fc* pDlySrc[2] = { ippsMalloc_32fc_L(numTaps), ippsMalloc_32fc_L(numTaps) };
+		ippsZero_32fc(pDlySrc[0], numTaps);
+		int dly = 0;
+		FastFir fast;
+		fast.init(taps, numTaps, 1, factor, n);
+
+		// The first block both ways from silence must agree
+		ippsFIRMR_32fc(in, outDirect, (int)(n / factor), pSpec, pDlySrc[dly], pDlySrc[dly ^ 1], pBuffer);
+		dly ^= 1;
+		fast.process(0, in, n, outFast);
+		double peak = 0, err = 0;
+		for (size_t k = 0; k < n / factor; k++) {
+			peak = std::max(peak, (double)std::hypot(outDirect[k].re, outDirect[k].im));
+			err = std::max(err, (double)std::hypot(outDirect[k].re - outFast[k].re, outDirect[k].im - outFast[k].im));
+		}
+		ok = ok && err <= 1e-4 * std::max(peak, 1.0);
+
+		auto timed = [&](bool useFast) {
+			const double cpu0 = threadCpuSeconds();
+			auto t0 = std::chrono::steady_clock::now();
+			uint64_t samps = 0;
+			double elapsed = 0;
+			do {
+				if (useFast)
+					fast.process(0, in, n, outFast);
+				else {
+					ippsFIRMR_32fc(in, outDirect, (int)(n / factor), pSpec, pDlySrc[dly], pDlySrc[dly ^ 1], pBuffer);
+					dly ^= 1;
+				}
+				samps += n;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			} while (elapsed < seconds / (2 * numSteps));
+			const double busy = threadCpuSeconds() - cpu0;
+			if (useFast) {
+				res.samples += samps;
+				res.seconds += elapsed;
+				res.busySeconds += busy;
+			}
+			return busy > 0 ? samps / busy / 1e6 : 0;
+		};
+		const double direct = timed(false);
+		const double viaFft = timed(true);
+		res.name += str(boost::format(" %d taps %.0f/%.0f,") % numTaps % direct % viaFft);
+		if (viaFft > direct && measured == 0)
+			measured = numTaps;
+		if (FastFir::beatsDirect(numTaps, factor, n) && predicted == 0)
+			predicted = numTaps;
+
+		ippsFree(pDlySrc[0]);
+		ippsFree(pDlySrc[1]);
+		ippsFree(pSpec);
+		ippsFree(pBuffer);
+	}
+	res.bytes = res.samples * sizeof(Ipp32fc);
+	res.name += str(boost::format(" FFT faster from %s taps, predicted from %s")
+		% (measured > 0 ? std::to_string(measured) : "no") % (predicted > 0 ? std::to_string(predicted) : "no"));
+	if (!ok)
+		res.name += " (MISMATCH)";
+	ippsFree(in);
+	ippsFree(outDirect);
+	ippsFree(outFast);
+	ippsFree(taps);
+	return res;
+}
+
+BenchResult benchChannelizer(size_t numThreads, bool oversampled, double seconds, size_t blockSamps)
+{
+	BenchResult res;
+	const double rate = 50e6;
+	const size_t sizes[] = { 8, 64, 512, 4096 };
+	const size_t numSizes = sizeof(sizes) / sizeof(sizes[0]);
+	numThreads = std::max<size_t>(numThreads, 1);
+	res.name = str(boost::format("PFB %s, Msps on 1/%d thread(s):") % (oversampled ? "2x oversampled" : "critically sampled")
+		% numThreads);
+	ToneInput in(1, blockSamps);
+	bool ok = true;
+
+	for (size_t si = 0; si < numSizes; si++) {
+		const size_t M = sizes[si];
+		// A tone a tenth of a channel above the centre of channel k0
+		const size_t k0 = M / 4 + 1;
+		in.setTone(0, (k0 + 0.1) / M);
+		ChannelizerConfig cfg;
+		cfg.numChannels = M;
+		cfg.oversampled = oversampled;
+
+		double msps[2] = { 0, 0 };
+		std::vector<std::vector<Ipp16sc>> first;
+		for (int pass = 0; pass < 2; pass++) {
+			cfg.numThreads = pass == 0 ? 1 : numThreads;
+			Channelizer chz;
+			if (!chz.init(cfg, rate, 1, blockSamps)) {
+				res.name += " (INIT FAILED)";
+				return res;
+			}
+			// The first pass through the blocks, kept to check against below
+			if (pass == 1)
+				for (size_t i = 0; i < in.numBlocks; i++)
+					keepChannels(first, chz.process(toneBlock(in, i)));
+			uint64_t samps = 0;
+			double elapsed = 0;
+			auto t0 = std::chrono::steady_clock::now();
+			size_t i = in.numBlocks;
+			do {
+				for (size_t k = 0; k < in.numBlocks; k++, i++)
+					chz.process(toneBlock(in, i));
+				samps += in.numBlocks * blockSamps;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			} while (elapsed < seconds / (2 * numSizes));
+			msps[pass] = samps / elapsed / 1e6;
+			if (pass == 1 && si == numSizes - 1) {
+				res.samples = samps;
+				res.seconds = elapsed;
+			}
+		}
+		res.name += str(boost::format(" %d ch %.0f/%.0f,") % M % msps[0] % msps[1]);
+
+		// The same input in odd-sized pieces on one thread must give the same
+		// output, and the tone must be in channel k0 only once the filter has
+		// filled
+		Channelizer other;
+		cfg.numThreads = 1;
+		other.init(cfg, rate, 1, blockSamps);
+		std::vector<std::vector<Ipp16sc>> again;
+		refeedInPieces(in, [&](const SampleBlock& blk) { keepChannels(again, other.process(blk)); });
+		ok = ok && again.size() == M && first.size() == M;
+		const size_t n = ok ? again[0].size() : 0;
+		ok = ok && n > 0 && first[0].size() == n;
+		for (size_t c = 0; c < M && ok; c++)
+			for (size_t k = 0; k < n && ok; k++)
+				ok = std::abs(first[c][k].re - again[c][k].re) <= 1 && std::abs(first[c][k].im - again[c][k].im) <= 1;
+		const size_t settled = M * cfg.tapsPerBranch / cfg.decimation() + 1;
+		ok = ok && std::fabs(toneLevelDb(again[k0].data(), n, settled, 16384)) < 0.5
+			&& toneLevelDb(again[k0 + 2].data(), n, settled, 16384) < -60;
+	}
+	res.bytes = res.samples * sizeof(Ipp16sc);
+	res.name.pop_back();
+	if (!ok)
+		res.name += " (MISMATCH)";
+	return res;
+}
+
+BenchResult benchExtractor(size_t numChannels, double seconds, int fftLen, size_t blockSamps)
+{
+	BenchResult res;
+	const double rate = 50e6;
+	const double widths[] = { 12.5e3, 25e3, 50e3, 100e3, 200e3, 500e3, 1e6 };
+	numChannels = std::max<size_t>(numChannels, 3);
+	std::vector<ExtractChannel> plan(numChannels);
+	for (size_t i = 0; i < numChannels; i++) {
+		plan[i].offsetHz = -20e6 + 40e6 * i / (numChannels - 1);
+		plan[i].bandwidth = widths[i % (sizeof(widths) / sizeof(widths[0]))];
+	}
+
+	// A tone a tenth of its bandwidth above channel 0's centre
+	ToneInput in(1, blockSamps);
+	in.setTone(0, (plan[0].offsetHz + 0.1 * plan[0].bandwidth) / rate);
+	ExtractorConfig cfg;
+	cfg.enabled = true;
+	cfg.fftLen = fftLen;
+
+	// Outputs of a channel by output index, from the first pass through the blocks
+	typedef std::map<uint64_t, Ipp32fc> Outputs;
+	std::map<int, Outputs> first, again;
+	bool collect = true;
+	auto keep = [](std::map<int, Outputs>& to, int id, const Ipp32fc* s, size_t n, uint64_t at) {
+		Outputs& o = to[id];
+		for (size_t k = 0; k < n; k++)
+			o[at + k] = s[k];
+	};
+	FftExtractor ex;
+	for (const ExtractChannel& c : plan)
+		ex.addChannel(c);
+	ex.init(cfg, rate, 1, blockSamps, [&](int id, const Ipp32fc* s, size_t n, uint64_t at) {
+		if (collect && id <= 3)
+			keep(first, id, s, n, at);
+	});
+	const std::vector<ExtractStatus> planned = ex.getChannels();
+	bool ok = planned.size() == numChannels;
+	for (const ExtractStatus& s : planned)
+		ok = ok && s.outRate > 0;
+	for (size_t i = 0; i < in.numBlocks; i++)
+		ex.process(toneBlock(in, i));
+	collect = false;
+
+	auto t0 = std::chrono::steady_clock::now();
+	double cpu0 = threadCpuSeconds();
+	size_t i = in.numBlocks;
+	do {
+		for (size_t k = 0; k < in.numBlocks; k++, i++)
+			ex.process(toneBlock(in, i));
+		res.samples += in.numBlocks * blockSamps;
+		res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	} while (res.seconds < seconds / 2);
+	res.busySeconds = threadCpuSeconds() - cpu0;
+	res.bytes = res.samples * sizeof(Ipp16sc);
+	const double exMsps = res.busySeconds > 0 ? res.samples / res.busySeconds / 1e6 : 0;
+
+	// The forward DFT on its own, a block's new samples per transform
+	IppsDFTSpec_C_32fc* spec = nullptr;
+	Ipp8u* buf = nullptr;
+	Ipp8u* memInit = nullptr;
+	double dftMsps = 0;
+	if (initDft(fftLen, spec, buf, memInit)) {
+		Ipp32fc* dftIn = ippsMalloc_32fc_L(fftLen);
+		Ipp32fc* out = ippsMalloc_32fc_L(fftLen);
+		widenSc16To32fc(in.data, dftIn, fftLen);
+		uint64_t samps = 0;
+		double elapsed = 0;
+		cpu0 = threadCpuSeconds();
+		t0 = std::chrono::steady_clock::now();
+		do {
+			ippsDFTFwd_CToC_32fc(dftIn, out, spec, buf);
+			samps += fftLen - fftLen / 4;
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		} while (elapsed < seconds / 4);
+		const double busy = threadCpuSeconds() - cpu0;
+		dftMsps = busy > 0 ? samps / busy / 1e6 : 0;
+		ippsFree(dftIn);
+		ippsFree(out);
+		freeDft(spec, buf, memInit);
+	}
+
+	// One DDC band at the middle width, for what numChannels of them would cost
+	double ddcMsps = 0;
+	{
+		DdcConfig dcfg;
+		dcfg.decimation = 128;
+		DdcChannel band;
+		band.offsetHz = plan[0].offsetHz;
+		dcfg.channels.push_back(band);
+		Ddc ddc;
+		if (ddc.init(dcfg, rate, 1, blockSamps)) {
+			uint64_t samps = 0;
+			double elapsed = 0;
+			cpu0 = threadCpuSeconds();
+			t0 = std::chrono::steady_clock::now();
+			size_t k = 0;
+			do {
+				ddc.process(toneBlock(in, k++));
+				samps += blockSamps;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			} while (elapsed < seconds / 4);
+			const double busy = threadCpuSeconds() - cpu0;
+			ddcMsps = busy > 0 ? samps / busy / 1e6 / numChannels : 0;
+		}
+	}
+	res.name = str(boost::format("Extractor %d channels, DFT %d: %.1f Msps per core (the DFT alone %.1f), %d DDC bands %.2f")
+		% numChannels % fftLen % exMsps % dftMsps % numChannels % ddcMsps);
+
+	// Channel 0 added a quarter of the way in and channel 1 removed half way,
+	// all of it fed in odd-sized pieces: channel 0 from where it joins, and
+	// channel 2 throughout, must match the first pass to the last bit
+	FftExtractor other;
+	for (size_t c = 1; c < numChannels; c++)
+		other.addChannel(plan[c]);
+	other.init(cfg, rate, 1, blockSamps, [&](int id, const Ipp32fc* s, size_t n, uint64_t at) {
+		if (id == 2 || id >= (int)numChannels)
+			keep(again, id, s, n, at);
+	});
+	const size_t total = in.numBlocks * blockSamps;
+	int late = -1;
+	refeedInPieces(in, [&](const SampleBlock& blk) {
+		if (late < 0 && blk.sampOffset >= total / 4)
+			late = other.addChannel(plan[0]);
+		if (blk.sampOffset >= total / 2)
+			other.removeChannel(1);
+		other.process(blk);
+	});
+	auto same = [&](const Outputs& a, const Outputs& b) {
+		size_t n = 0;
+		for (const auto& o : b) {
+			auto it = a.find(o.first);
+			if (it == a.end())
+				continue;
+			if (it->second.re != o.second.re || it->second.im != o.second.im)
+				return false;
+			n++;
+		}
+		return n > 0;
+	};
+	ok = ok && late > 0 && same(first[1], again[late]) && same(first[3], again[2]);
+
+	// The tone, once the filters have filled
+	auto levelDb = [&](const Outputs& o) {
+		std::vector<Ipp32fc> v;
+		for (const auto& s : o)
+			v.push_back(s.second);
+		return toneLevelDb(v.data(), v.size(), v.size() / 4, 0.5);
+	};
+	ok = ok && std::fabs(levelDb(first[1])) < 0.5 && levelDb(first[2]) < -60;
+	if (!ok)
+		res.name += " (MISMATCH)";
+	return res;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "ipp.h"
+#include "SampleSource.h"
+#include "SampleConvert.h"
+#include "ThreadPolicy.h"
+#include "DiskWriter.h"
+#include "IqCodec.h"
+#include "Backpressure.h"
+
+// Radio-free throughput benchmarks for the receive pipeline stages.
+// Each one drives a stage with generated samples as fast as it will go and
+// reports the achieved rate, so it can be compared against the line rate
+// the stage has to sustain (e.g. 50 Msps sc16 = 200 MB/s).
+struct BenchResult
+{
+	std::string name;
+	double seconds = 0;
+	uint64_t samples = 0;   // samples pushed through the stage
+	uint64_t bytes = 0;     // bytes pushed through the stage
+	uint64_t dropped = 0;   // blocks lost (overruns, sequence gaps)
+	double busySeconds = 0; // CPU time of the stage's own thread, where measured
+
+	double msps() const { return seconds > 0 ? samples / seconds / 1e6 : 0; }
+	double mbps() const { return seconds > 0 ? bytes / seconds / 1e6 : 0; }
+	std::string summary() const;
+};
+
+// Fill a buffer with a full-scale sc16 test tone
+void genTone16sc(Ipp16sc* dst, size_t nsamps, float relFreq, float* phase);
+
+// SampleRing: one producer thread copies generated blocks into the ring, one
+// consumer thread drains them and checks sequence numbers. With paceMsps = 0
+// the producer runs flat out and waits when the ring is full, giving the
+// lossless ceiling; with paceMsps > 0 it releases blocks on that schedule the
+// way a radio would and any overruns are reported as dropped. Both threads
+// run with the given scheduling; the producer allocates the ring per mem.
+BenchResult benchRing(size_t numSlots, size_t blockSamps, double seconds, double paceMsps = 0,
+	const ThreadPolicy& producerPolicy = ThreadPolicy(), const ThreadPolicy& consumerPolicy = ThreadPolicy(),
+	const MemPolicy& mem = MemPolicy());
+
+// RecordWriter fed from the ring in place of rx_stream->recv(). Blocks are
+// generated at paceMsps (0 = unpaced, lossless) and every gapEvery-th block
+// the producer skips gapSamps samples, as an overflow at the device would.
+// The result is marked if the gap log or file size disagree with what was
+// injected and dropped. With segBytes > 0 the recording rotates to a new
+// preallocated segment every segBytes and the segment index must account
+// for every sample. With syncInterval > 0 the recording is journaled and
+// the final commit must cover every sample. The name reports writeBlock()
+// latency; busySeconds is the writer thread's CPU time.
+BenchResult benchRecorder(const std::string& basename, size_t numSlots, size_t blockSamps,
+	double seconds, double paceMsps = 0, size_t gapEvery = 0, size_t gapSamps = 0, uint64_t segBytes = 0,
+	double syncInterval = 0, const DiskWriterConfig& disk = DiskWriterConfig());
+
+// Ring blocks written in place against copied through the DiskWriter
+// staging buffers: unpaced benchRecorder() runs with and without
+// DiskWriterConfig::zeroCopy, alternating, median of each. The name reports
+// the writer thread's CPU time per GB, which is where the copy goes, and
+// the throughput of both.
+BenchResult benchZeroCopy(const std::string& basename, double seconds, size_t blockSamps = 1 << 18, int rounds = 5);
+
+// Cost of the crash-consistency journal: unpaced benchRecorder() runs with
+// and without a commit every syncInterval, alternating, median of each. The
+// name reports the throughput lost to journaling.
+BenchResult benchJournal(const std::string& basename, double seconds, double syncInterval, uint64_t segBytes = 0,
+	int rounds = 5);
+
+// RecordWriter behind a disk that stalls: blocks arrive at paceMsps and the
+// writer thread stops for stallMs every stallEvery blocks, as a contended
+// disk would. One block in four is a loud tone, the rest quiet noise, so
+// priority shedding has something to keep. Reports what the policy left out
+// against what the ring dropped, and is marked unless every sample is
+// written, left out or dropped, and (with shedding) no loud block is shed.
+BenchResult benchBackpressure(const std::string& basename, double seconds, double paceMsps, double stallMs,
+	size_t stallEvery, const BackpressureConfig& cfg, uint64_t segBytes = 0, size_t numSlots = 64,
+	size_t blockSamps = 1 << 16);
+
+// Raw rate of a sample source: recv() into a scratch buffer, nothing else
+BenchResult benchSource(SampleSource& source, size_t chunkSamps, double seconds);
+
+// Full receive pipeline (recv loop, overflow recovery, ring, RecordWriter)
+// driven by a non-radio source for the given time or until the source
+// runs out. Reports what reached the disk; lost samples from injected
+// overflows are reported as dropped. Multi-channel sources are received
+// into planar or interleaved ring blocks and written to per-channel files or
+// one interleaved file, as selected.
+BenchResult benchReceiver(SampleSource::sptr source, const std::string& prefix, double seconds,
+	bool interleaved = false, bool perChannelFiles = false);
+
+// File replay: a paced synthetic capture of numChans channels with injected
+// overflows, starting at an odd device time, is recorded with the given
+// block and file layout (segmented with segBytes > 0), then replayed through
+// FileSource into a second receiver as fast as it reads. Rates are of the
+// replay. It is marked unless the copy has the same samples, the same gaps
+// and the same device times of its first and last samples as the original.
+BenchResult benchReplay(const std::string& prefix, size_t numChans, bool interleaved, bool perChannelFiles,
+	uint64_t segBytes, double seconds);
+
+// Receive pipeline with recv() chunks and ring blocks sized for a latency
+// target (seconds of samples per block), optionally picking the chunk size
+// by measuring recv() cost. Reports the chosen sizes and any ring overruns.
+BenchResult benchRecvSizing(SampleSource::sptr source, const std::string& prefix, double seconds,
+	double latencyTarget, bool autotune);
+
+// Multi-board capture: numBoards synthetic boards of chansPerBoard channels,
+// merged by MergeSource and run through the full receive pipeline. Board b
+// starts b * skewSamps samples late in device time, as boards that missed
+// the timed start would, and board 1 overflows every overflowEvery samples.
+// The result is marked if the merge did not realign the boards by exactly
+// the injected skew and losses.
+BenchResult benchMerge(size_t numBoards, size_t chansPerBoard, double rate, double seconds,
+	size_t skewSamps = 0, uint64_t overflowEvery = 0, size_t overflowSamps = 0);
+
+// Host-side sample conversion kernels (SampleConvert.h) on a buffer of
+// nsamps samples, repeated for the given time. from = WIRE_SC8 widens sc8
+// to sc16 or, with toFloat, to fc32; from = WIRE_SC16 converts sc16 to fc32
+// (toFloat) or just copies, as the baseline. bytes counts input plus output.
+BenchResult benchConvert(WireFormat from, bool toFloat, size_t nsamps, double seconds);
+
+// DiskWriter alone: sc16 chunks of chunkBytes written to path as fast as the
+// disk takes them for the given time, close() (drain and truncate) included.
+// The name reports the backend actually used, the write latency percentiles
+// and the deepest queue; it is marked if the file size is wrong. The file is
+// removed afterwards.
+BenchResult benchDisk(const std::string& path, double seconds, const DiskWriterConfig& cfg,
+	size_t chunkBytes = 200000);
+
+// IqCompressor on generated samples: a full-scale tone over gaussian noise
+// of noiseAmp (fraction of full scale) from SyntheticSource, quantized to
+// the wire format, cut into blockSamps blocks and coded by numWorkers
+// threads for the given time. The name reports the compression ratio, MB/s
+// per core and for block floating point the SNR against the original. It
+// is marked if a lossless block does not decode bit-exact, or a requantized
+// one decodes off by more than half a quantization step.
+BenchResult benchCompress(WireFormat wire, size_t numWorkers, double seconds, float noiseAmp = 0.01f,
+	IqzCodec codec = IQZ_LOSSLESS, size_t blockSamps = 1 << 16);
+
+// The same on the first 64 MB of a recorded raw sc16 file
+BenchResult benchCompressFile(const std::string& path, size_t numWorkers, double seconds,
+	IqzCodec codec = IQZ_LOSSLESS, size_t blockSamps = 1 << 16);
+
+// Seeking through the block index: totalSamps samples are recorded in
+// blocks of blockSamps, raw or compressed, optionally segmented, with a
+// gap after every 100th block. Then readSamps samples are read at numSeeks
+// random device times through RecordReader and compared with what was
+// written there. The name reports the seek-and-read latency; it is marked
+// if any read returned the wrong samples.
+BenchResult benchSeek(const std::string& basename, uint64_t totalSamps, size_t blockSamps, bool compressed,
+	uint64_t segBytes = 0, size_t numSeeks = 1000, size_t readSamps = 10000);
+
+// Whole-recording pass, every channel to fc32: totalSamps samples of
+// numChans channels are recorded raw (optionally per-channel, segmented)
+// with a gap after every 100th block, then read front to back through
+// RecordReader and convert, and through RecordMap::readFloat() with
+// sequential readahead. Rates are of the map, with RecordReader's in the
+// name; both read from the page cache, so this is the cost of the reader
+// rather than the disk. It is marked if the two readers disagree or
+// the samples do not run on across the gaps.
+BenchResult benchRecordMap(const std::string& basename, uint64_t totalSamps, size_t numChans,
+	bool perChannelFiles = false, uint64_t segBytes = 0, size_t blockSamps = 1 << 16);
+
+// Ddc on numChans planar channels of a half-scale tone, one band per
+// channel at its own offset, on one thread for the given time. The name
+// reports input samples per second per band per core of CPU time (the rate
+// one band can be taken out of a stream at on one core) and the tone level
+// at the output. It is marked if the same input cut into odd-sized blocks
+// gives a different output, or the tone is not at its level within 0.5 dB.
+BenchResult benchDdc(size_t numChans, size_t decimation, double seconds, size_t numTaps = 0,
+	size_t blockSamps = 1 << 16);
+
+// Decimator chain from Decimator::design() against the single FIR that
+// meets the same spec, each on one thread for half the given time on a
+// complex tone. The result is the chain's; the name gives both designs,
+// their MACs per input sample and the input rate each sustains per core of
+// CPU time, which is what decides how many cores a full-rate stream needs.
+// It is marked if no chain meets the spec, or if a tone in the passband
+// does not come out within the ripple or one folding onto the passband is
+// not down by the rejection.
+BenchResult benchDecimator(size_t decimation, double seconds, double passband = 0.4, double stopDb = 80,
+	size_t blockSamps = 1 << 16);
+
+// Direct-form FIR (ippsFIRMR) against overlap-save (FastFir) on one thread,
+// at tap counts from 16 to 8192, a block of blockSamps samples per call,
+// decimating by factor. The name gives each tap count's input rate per core
+// of CPU time both ways, and the tap count from which overlap-save is
+// faster as measured and as FastFir::beatsDirect() predicts it. It is
+// marked if the two outputs differ beyond float rounding.
+BenchResult benchFastFir(size_t blockSamps, size_t factor, double seconds);
+
+// Channelizer splitting a half-scale tone into M channels, all kept, for M
+// from 8 to 4096, on one thread and on numThreads, for the given time split
+// between them. The name gives each M's input rate (wall clock) both ways,
+// which is how far the filter bank scales across cores. The result is that
+// of numThreads at M = 4096. It is marked if the same input cut into
+// odd-sized blocks on one thread gives a different output, or the tone is
+// not at its level in its channel within 0.5 dB or not down 60 dB two
+// channels away.
+BenchResult benchChannelizer(size_t numThreads, bool oversampled, double seconds, size_t blockSamps = 1 << 16);
+
+// FftExtractor taking numChannels channels of 12.5 kHz to 1 MHz spread over
+// a 50 Msps stream through a DFT of fftLen, on one thread for half the given
+// time; the forward DFT alone and a Ddc band get a quarter each. The name
+// gives the input rate per core of CPU time the extractor sustains, the DFT
+// alone would, and numChannels DDC bands would. It is marked if a channel
+// added mid-stream, fed in odd-sized blocks, or one beside a channel
+// removed mid-stream, does not give the same output as from the start, or
+// if a tone in channel 0 is not at its level within 0.5 dB or not down
+// 60 dB in channel 1.
+BenchResult benchExtractor(size_t numChannels, double seconds, int fftLen = 16384, size_t blockSamps = 1 << 16);
@@ -0,0 +1,338 @@
+#include "Channelizer.h"
+#include "SampleConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <boost/format.hpp>
+
+std::string ChannelizerConfig::describe() const
+{
+	std::string kept = channels.empty() ? "all" : std::to_string(channels.size());
+	return (boost::format("PFB %d ch, %s, %d taps per branch, %s kept, %d thread%s")
+		% numChannels % (oversampled ? "2x oversampled" : "critically sampled") % tapsPerBranch % kept % numThreads
+		% (numThreads == 1 ? "" : "s")).str();
+}
+
+bool Channelizer::parseChannels(const std::string& text, std::vector<size_t>& channels)
+{
+	channels.clear();
+	std::istringstream ss(text);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		item.erase(0, item.find_first_not_of(" \t"));
+		item.erase(item.find_last_not_of(" \t") + 1);
+		if (item.empty())
+			continue;
+		char* end = nullptr;
+		const unsigned long first = std::strtoul(item.c_str(), &end, 10);
+		if (end == item.c_str())
+			return false;
+		unsigned long last = first;
+		if (*end == '-') {
+			const char* from = end + 1;
+			last = std::strtoul(from, &end, 10);
+			if (end == from || last < first)
+				return false;
+		}
+		if (*end != '\0')
+			return false;
+		for (unsigned long k = first; k <= last; k++)
+			channels.push_back(k);
+	}
+	return true;
+}
+
+bool Channelizer::init(const ChannelizerConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps)
+{
+	free();
+	cfg = in_cfg;
+	if (!cfg.enabled())
+		return true;
+	rate = in_rate;
+	numInChans = in_numChans;
+	maxBlockSamps = in_maxBlockSamps;
+	if (cfg.numChannels < 2 || (cfg.oversampled && cfg.numChannels % 2 != 0) || cfg.tapsPerBranch < 1
+		|| cfg.input >= numInChans || rate <= 0) {
+		std::cerr << boost::format("Channelizer: cannot split input %d of %d into %d channels%s, %d taps per branch\n")
+			% cfg.input % numInChans % cfg.numChannels % (cfg.oversampled ? " oversampled" : "") % cfg.tapsPerBranch;
+		return false;
+	}
+	kept = cfg.channels;
+	if (kept.empty())
+		for (size_t k = 0; k < cfg.numChannels; k++)
+			kept.push_back(k);
+	for (size_t k : kept)
+		if (k >= cfg.numChannels) {
+			std::cerr << boost::format("Channelizer: no channel %d of %d\n") % k % cfg.numChannels;
+			return false;
+		}
+
+	const size_t numM = cfg.numChannels;
+	const size_t numD = cfg.decimation();
+	const size_t numP = cfg.tapsPerBranch;
+	const int len = (int)(numM * numP);
+
+	// Prototype: low-pass to the channel edge, unit gain at DC, times the gain
+	std::vector<Ipp64f> proto(len);
+	int genSize = 0;
+	ippsFIRGenGetBufferSize(len, &genSize);
+	Ipp8u* genBuf = ippsMalloc_8u(genSize);
+	const IppStatus st = ippsFIRGenLowpass_64f(0.5 / numM, proto.data(), len, ippWinBlackman, ippTrue, genBuf);
+	ippsFree(genBuf);
+	if (st != ippStsNoErr) {
+		std::cerr << boost::format("Channelizer: no %d-tap prototype for %d channels\n") % len % numM;
+		return false;
+	}
+	const double gain = std::pow(10.0, cfg.gainDb / 20);
+	// Branch p weighs the M inputs from pM + M - 1 back to pM back, oldest first
+	branchTaps = ippsMalloc_32f_L(2 * len);
+	for (size_t p = 0; p < numP; p++)
+		for (size_t j = 0; j < numM; j++) {
+			const Ipp32f t = (Ipp32f)(gain * proto[p * numM + numM - 1 - j]);
+			branchTaps[2 * (p * numM + j)] = t;
+			branchTaps[2 * (p * numM + j) + 1] = t;
+		}
+
+	// Bin k of output step o, the newest input o * D, is channel k times
+	// e^(-2 pi i k (o D + 1) / M): o D mod M only takes M / D values
+	const size_t phases = numM / numD;
+	rotation = ippsMalloc_32fc_L((int)(phases * kept.size()));
+	for (size_t ph = 0; ph < phases; ph++)
+		for (size_t i = 0; i < kept.size(); i++) {
+			const double a = -IPP_2PI * (double)((kept[i] * (ph * numD + 1)) % numM) / numM;
+			rotation[ph * kept.size() + i] = { (Ipp32f)std::cos(a), (Ipp32f)std::sin(a) };
+		}
+
+	int sizeSpec = 0, sizeInit = 0, sizeBuf = 0;
+	if (ippsDFTGetSize_C_32fc((int)numM, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, &sizeSpec, &sizeInit, &sizeBuf)
+		!= ippStsNoErr) {
+		std::cerr << boost::format("Channelizer: DFT of %d failed\n") % numM;
+		return false;
+	}
+	pDFTSpec = (IppsDFTSpec_C_32fc*)ippMalloc(sizeSpec);
+	pDFTMemInit = (Ipp8u*)ippMalloc(sizeInit);
+	if (ippsDFTInit_C_32fc((int)numM, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, pDFTSpec, pDFTMemInit) != ippStsNoErr) {
+		std::cerr << boost::format("Channelizer: DFT of %d failed\n") % numM;
+		ippFree(pDFTSpec);
+		ippFree(pDFTMemInit);
+		pDFTSpec = nullptr;
+		pDFTMemInit = nullptr;
+		return false;
+	}
+	scratch.resize(std::max<size_t>(cfg.numThreads, 1));
+	for (Scratch& s : scratch) {
+		s.sum = ippsMalloc_32fc_L((int)numM);
+		s.spec = ippsMalloc_32fc_L((int)numM);
+		s.pDFTBuffer = (Ipp8u*)ippMalloc(std::max(sizeBuf, 1));
+	}
+
+	M = numM;
+	D = numD;
+	P = numP;
+	histLen = M * P - 1;
+	gathered = ippsMalloc_16sc_L(maxBlockSamps);
+	line = ippsMalloc_32fc_L(histLen + maxBlockSamps);
+	outStride = maxBlockSamps / D + 1;
+	outF = ippsMalloc_32fc_L(outStride * kept.size());
+	outbuf = ippsMalloc_16sc_L(outStride * kept.size());
+	out.data = outbuf;
+	out.numChans = kept.size();
+	out.stride = outStride;
+	reset();
+
+	Stopflag = false;
+	jobGen = 0;
+	for (size_t part = 1; part < scratch.size(); part++)
+		workers.emplace_back(&Channelizer::workerLoop, this, part);
+	return true;
+}
+
+void Channelizer::free()
+{
+	if (!workers.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			Stopflag = true;
+		}
+		released.notify_all();
+		for (auto& t : workers)
+			t.join();
+		workers.clear();
+	}
+	for (Scratch& s : scratch) {
+		ippsFree(s.sum);
+		ippsFree(s.spec);
+		ippFree(s.pDFTBuffer);
+	}
+	scratch.clear();
+	ippFree(pDFTSpec);
+	ippFree(pDFTMemInit);
+	ippsFree(branchTaps);
+	ippsFree(rotation);
+	ippsFree(gathered);
+	ippsFree(line);
+	ippsFree(outF);
+	ippsFree(outbuf);
+	pDFTSpec = nullptr;
+	pDFTMemInit = nullptr;
+	branchTaps = nullptr;
+	rotation = nullptr;
+	gathered = nullptr;
+	line = nullptr;
+	outF = nullptr;
+	outbuf = nullptr;
+	kept.clear();
+	M = D = P = 0;
+	out = SampleBlock();
+}
+
+void Channelizer::reset()
+{
+	Startedflag = false;
+	outSeq = 0;
+	outNext = 0;
+	pendingFlags = 0;
+	pendingLost = 0;
+	samplesIn = 0;
+	samplesOut = 0;
+}
+
+void Channelizer::restart(uint64_t in_start)
+{
+	// On a multiple of the decimation, behind a history of silence
+	const uint64_t alignAt = (in_start + D - 1) / D * D;
+	ippsZero_32fc(line, (int)histLen);
+	have = histLen;
+	lineBase = alignAt - histLen;
+	nextOut = alignAt / D;
+}
+
+void Channelizer::workerLoop(size_t part)
+{
+	applyThreadPolicy(cfg.workerPolicy, "uhd_pfb");
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			released.wait(lock, [&] { return Stopflag || jobGen != seen; });
+			if (Stopflag)
+				return;
+			seen = jobGen;
+		}
+		runSteps(part);
+		std::lock_guard<std::mutex> lock(mut);
+		if (--jobBusy == 0)
+			finished.notify_one();
+	}
+}
+
+void Channelizer::runSteps(size_t part)
+{
+	// This thread's share of the block's output steps
+	const size_t from = jobSteps * part / scratch.size();
+	const size_t to = jobSteps * (part + 1) / scratch.size();
+	if (from == to)
+		return;
+	Scratch& s = scratch[part];
+	const size_t numKept = kept.size();
+	const size_t phases = M / D;
+	Ipp32f* sum = (Ipp32f*)s.sum;
+	for (size_t i = from; i < to; i++) {
+		// Step i's newest input is line[histLen + i D]; branch p takes the M
+		// inputs ending p M before it
+		const Ipp32fc* newest = line + histLen + i * D;
+		ippsMul_32f(branchTaps, (const Ipp32f*)(newest + 1 - M), sum, (int)(2 * M));
+		for (size_t p = 1; p < P; p++)
+			ippsAddProduct_32f(branchTaps + 2 * p * M, (const Ipp32f*)(newest + 1 - M - p * M), sum, (int)(2 * M));
+		ippsDFTFwd_CToC_32fc(s.sum, s.spec, pDFTSpec, s.pDFTBuffer);
+
+		const Ipp32fc* rot = rotation + ((nextOut + i) % phases) * numKept;
+		for (size_t c = 0; c < numKept; c++) {
+			const Ipp32fc a = s.spec[kept[c]];
+			const Ipp32fc r = rot[c];
+			outF[c * outStride + i] = { a.re * r.re - a.im * r.im, a.re * r.im + a.im * r.re };
+		}
+	}
+	for (size_t c = 0; c < numKept; c++)
+		ippsConvert_32f16s_Sfs((const Ipp32f*)(outF + c * outStride + from), (Ipp16s*)(outbuf + c * outStride + from),
+			(int)(2 * (to - from)), ippRndNear, -15);
+}
+
+const SampleBlock* Channelizer::process(const SampleBlock& in)
+{
+	if (M == 0 || in.nsamps > maxBlockSamps)
+		return nullptr;
+	if (!Startedflag || in.sampOffset != nextIn) {
+		restart(in.sampOffset);
+		if (Startedflag)
+			pendingFlags |= BLOCK_FLAG_DISCONT;
+		Startedflag = true;
+	}
+	else if (in.lostBefore > 0)
+		pendingLost += in.lostBefore / D;   // padded: zeros filtered like samples
+	pendingFlags |= in.flags;
+	nextIn = in.sampOffset + in.nsamps;
+
+	// What is left of the block from the restart point on, behind the line
+	const uint64_t lineEnd = lineBase + have;
+	const size_t from = lineEnd > in.sampOffset ? (size_t)std::min<uint64_t>(lineEnd - in.sampOffset, in.nsamps) : 0;
+	const size_t n = in.nsamps - from;
+	samplesIn.fetch_add(n, std::memory_order_relaxed);
+	if (n > 0) {
+		const Ipp16sc* src;
+		if (in.interleaved()) {
+			for (size_t i = 0; i < n; i++)
+				gathered[i] = in.data[(from + i) * in.numChans + cfg.input];
+			src = gathered;
+		}
+		else
+			src = in.chan(cfg.input) + from;
+		widenSc16To32fc(src, line + have, n);
+		have += n;
+	}
+
+	// Every step whose newest input is in: the calling thread takes the
+	// first share, the workers the rest
+	const size_t steps = have > histLen ? (have - histLen - 1) / D + 1 : 0;
+	if (steps == 0)
+		return nullptr;
+	jobSteps = steps;
+	if (!workers.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			jobGen++;
+			jobBusy = workers.size();
+		}
+		released.notify_all();
+	}
+	runSteps(0);
+	if (!workers.empty()) {
+		std::unique_lock<std::mutex> lock(mut);
+		finished.wait(lock, [this] { return jobBusy == 0; });
+	}
+
+	// The next step's history to the front
+	const uint64_t firstOut = nextOut;
+	const size_t drop = steps * D;
+	if (have > drop)
+		ippsMove_32fc(line + drop, line, (int)(have - drop));
+	have -= drop;
+	lineBase += drop;
+	nextOut += steps;
+
+	const uint64_t firstIn = firstOut * D;
+	out.nsamps = steps;
+	out.seq = outSeq++;
+	out.sampOffset = firstOut;
+	out.hasTime = in.hasTime;
+	out.time = in.time.plus(((double)(int64_t)(firstIn - in.sampOffset) - histLen / 2.0) / rate);
+	out.flags = pendingFlags;
+	out.lostBefore = (pendingFlags & BLOCK_FLAG_DISCONT) ? out.sampOffset - outNext : pendingLost;
+	outNext = out.sampOffset + out.nsamps;
+	pendingFlags = 0;
+	pendingLost = 0;
+	samplesOut.fetch_add(steps, std::memory_order_relaxed);
+	return &out;
+}
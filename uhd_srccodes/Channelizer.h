@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ipp.h"
+#include "SampleRing.h"
+#include "ThreadPolicy.h"
+
+// Polyphase filter-bank channelizer: splits one input channel into M
+// uniform channels, channel k centred k * rate / M above the tuned frequency
+// (k > M / 2 are below it, at (k - M) * rate / M), and keeps any subset of
+// them. Where a DDC per channel filters the whole input once per channel,
+// the filter bank filters it once for all of them: the prototype low-pass
+// of M * tapsPerBranch taps is split into M branches, each output step sums
+// tapsPerBranch segments of M inputs weighted by the branches, and one DFT
+// of M turns that into every channel at once. Critically sampled, a channel
+// comes out at rate / M, one DFT per M inputs; oversampled, at 2 * rate / M,
+// one DFT per M / 2 inputs, so bands near a channel's edge do not alias.
+// Channel k is what a DDC shifting k * rate / M to 0 Hz with the prototype
+// as its filter would give, phase and all, so channels of consecutive
+// output steps join up and adjacent ones can be combined.
+// Output steps of a block are independent given the input, so they are
+// split across numThreads threads, each with its own DFT buffer.
+// Streams like Ddc: the input short of an output step and the prototype's
+// history carry over to the next block, output o stands for input
+// o * decimation() stamped with that sample's time less the prototype's
+// group delay, and after samples are lost the state restarts on the next
+// multiple of decimation().
+
+struct ChannelizerConfig
+{
+	size_t numChannels = 0;        // M; 0 = no channelizer
+	bool oversampled = false;      // outputs at 2 * rate / M, M even
+	size_t tapsPerBranch = 12;     // prototype length / M: sharper channel edges, more work
+	size_t input = 0;              // input channel
+	std::vector<size_t> channels;  // channels kept, in this order; none = all M
+	size_t numThreads = 1;
+	double gainDb = 0;             // applied before requantizing to sc16
+	ThreadPolicy workerPolicy;     // of the threads past the calling one
+
+	bool enabled() const { return numChannels > 0; }
+	size_t decimation() const { return oversampled ? numChannels / 2 : numChannels; }
+	// "PFB 256 ch, critically sampled, 12 taps per branch, 8 kept, 4 threads"
+	std::string describe() const;
+};
+
+class Channelizer
+{
+private:
+	// DFT work of one thread
+	struct Scratch
+	{
+		Ipp32fc* sum = nullptr;       // branches summed, the DFT's input
+		Ipp32fc* spec = nullptr;
+		Ipp8u* pDFTBuffer = nullptr;
+	};
+
+	ChannelizerConfig cfg;
+	std::vector<size_t> kept;          // channel numbers, in output order
+	double rate = 0;
+	size_t numInChans = 0;
+	size_t maxBlockSamps = 0;
+	size_t M = 0, D = 0, P = 0;
+	size_t histLen = 0;                // M * P - 1 inputs before each output's own
+	Ipp32f* branchTaps = nullptr;      // P branches of M, reversed, each tap twice for re and im
+	Ipp32fc* rotation = nullptr;       // per kept channel and output phase (o mod M / D)
+	IppsDFTSpec_C_32fc* pDFTSpec = nullptr;   // shared by the threads
+	Ipp8u* pDFTMemInit = nullptr;
+	std::vector<Scratch> scratch;      // [0] is the calling thread's
+
+	// Input: history then new samples, line[0] being input lineBase
+	Ipp16sc* gathered = nullptr;
+	Ipp32fc* line = nullptr;
+	size_t have = 0;
+	uint64_t lineBase = 0;
+
+	// Stream position
+	bool Startedflag = false;
+	uint64_t nextIn = 0;
+	uint64_t nextOut = 0;              // output step computed next
+	uint64_t outNext = 0;              // output stream index after the last block out
+	uint64_t outSeq = 0;
+	uint32_t pendingFlags = 0;
+	uint64_t pendingLost = 0;
+	SampleBlock out;
+	Ipp32fc* outF = nullptr;           // kept channels, planar, before requantizing
+	Ipp16sc* outbuf = nullptr;
+	size_t outStride = 0;
+
+	// Worker threads, released once per block
+	std::vector<std::thread> workers;
+	std::mutex mut;
+	std::condition_variable released, finished;
+	uint64_t jobGen = 0;               // guarded by mut
+	size_t jobBusy = 0;
+	bool Stopflag = false;
+	size_t jobSteps = 0;               // the block's output steps, set before release
+
+	std::atomic<uint64_t> samplesIn{ 0 };
+	std::atomic<uint64_t> samplesOut{ 0 };
+
+	void restart(uint64_t in_start);
+	void runSteps(size_t part);
+	void workerLoop(size_t part);
+
+public:
+	Channelizer() {}
+	~Channelizer() { free(); }
+	Channelizer(const Channelizer&) = delete;
+	Channelizer& operator=(const Channelizer&) = delete;
+
+	// For blocks of in_numChans channels at in_rate, at most in_maxBlockSamps long
+	bool init(const ChannelizerConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps);
+	void free();
+	void reset();
+	bool isEnabled() const { return M > 0; }
+	const ChannelizerConfig& getConfig() const { return cfg; }
+
+	// Next input block, in stream order. Returns the planar block of the
+	// kept channels, or null while no output step is complete. The block,
+	// and getChannel(), stay valid until the next call.
+	const SampleBlock* process(const SampleBlock& in);
+	// Kept channel i of the last block out, before requantizing, for analysis
+	const Ipp32fc* getChannel(size_t i) const { return outF + i * outStride; }
+
+	size_t getNumChans() const { return kept.size(); }
+	size_t getChannelNumber(size_t i) const { return kept[i]; }
+	double getOutputRate() const { return rate / D; }
+	double getChannelSpacing() const { return rate / M; }
+	// Centre of channel k relative to the tuned frequency
+	double getChannelOffset(size_t k) const { return (k <= M / 2 ? (double)k : (double)k - M) * rate / M; }
+	double getGroupDelay() const { return histLen / 2.0 / rate; }   // seconds
+	uint64_t getSamplesIn() const { return samplesIn.load(std::memory_order_relaxed); }
+	uint64_t getSamplesOut() const { return samplesOut.load(std::memory_order_relaxed); }
+
+	// "0,5,12-20" into channel numbers; false on anything else
+	static bool parseChannels(const std::string& text, std::vector<size_t>& channels);
+};
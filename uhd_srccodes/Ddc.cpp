@@ -0,0 +1,185 @@
+#include "Ddc.h"
+#include "SampleConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+
+bool Ddc::init(const DdcConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps)
+{
+	free();
+	cfg = in_cfg;
+	if (!cfg.enabled())
+		return true;
+	rate = in_rate;
+	numInChans = in_numChans;
+	maxBlockSamps = in_maxBlockSamps;
+	if (cfg.decimation < 2 || rate <= 0) {
+		std::cerr << boost::format("DDC: bad decimation %d at %.0f S/s\n") % cfg.decimation % rate;
+		return false;
+	}
+	const double outRate = rate / cfg.decimation;
+	double widest = 0;
+	for (const DdcChannel& c : cfg.channels) {
+		const double bw = c.bandwidth > 0 ? c.bandwidth : 0.8 * outRate;
+		if (c.input >= numInChans || std::fabs(c.offsetHz) + bw / 2 > rate / 2 || bw >= outRate) {
+			std::cerr << boost::format("DDC: channel %d at %.0f Hz, %.0f Hz wide does not fit %.0f S/s in, %.0f S/s out\n")
+				% c.input % c.offsetHz % bw % rate % outRate;
+			return false;
+		}
+		widest = std::max(widest, bw);
+	}
+
+	// Passband to the widest band's edge, gain folded into the last stage
+	DecimSpec spec;
+	spec.decimation = cfg.decimation;
+	spec.passband = widest / 2 / outRate;
+	spec.rippleDb = cfg.rippleDb;
+	spec.stopDb = cfg.stopDb;
+	DecimDesign chain = cfg.numTaps > 0 ? Decimator::designSingle(spec, cfg.numTaps) : Decimator::design(spec);
+	if (!chain.valid()) {
+		std::cerr << boost::format("DDC: no filter meets %.2f dB ripple and %.0f dB rejection at decimation %d\n")
+			% spec.rippleDb % spec.stopDb % cfg.decimation;
+		return false;
+	}
+	if (!decim.init(chain, cfg.channels.size(), maxBlockSamps + cfg.decimation, std::pow(10.0, cfg.gainDb / 20)))
+		return false;
+
+	chans.resize(cfg.channels.size());
+	for (size_t c = 0; c < chans.size(); c++) {
+		Chan& ch = chans[c];
+		ch.cfg = cfg.channels[c];
+		// Shift down by offsetHz: a tone at -offsetHz, as a fraction in [0, 1)
+		double f = -ch.cfg.offsetHz / rate;
+		ch.rFreq = (Ipp32f)(f - std::floor(f));
+		ch.carry = ippsMalloc_32fc_L(cfg.decimation);
+	}
+	gathered = ippsMalloc_16sc_L(maxBlockSamps);
+	rx_32fc = ippsMalloc_32fc_L(maxBlockSamps + cfg.decimation);
+	nco = ippsMalloc_32fc_L(maxBlockSamps);
+	outStride = maxBlockSamps / cfg.decimation + 1;
+	downsampled = ippsMalloc_32fc_L(outStride);
+	outbuf = ippsMalloc_16sc_L(outStride * chans.size());
+	out.data = outbuf;
+	out.numChans = chans.size();
+	out.stride = outStride;
+	reset();
+	return true;
+}
+
+void Ddc::free()
+{
+	for (Chan& ch : chans)
+		ippsFree(ch.carry);
+	chans.clear();
+	decim.free();
+	ippsFree(gathered);
+	ippsFree(rx_32fc);
+	ippsFree(nco);
+	ippsFree(downsampled);
+	ippsFree(outbuf);
+	gathered = nullptr;
+	rx_32fc = nullptr;
+	nco = nullptr;
+	downsampled = nullptr;
+	outbuf = nullptr;
+	out = SampleBlock();
+}
+
+void Ddc::reset()
+{
+	Startedflag = false;
+	outSeq = 0;
+	outNext = 0;
+	pendingFlags = 0;
+	pendingLost = 0;
+	samplesIn = 0;
+	samplesOut = 0;
+}
+
+void Ddc::restart(uint64_t in_start)
+{
+	// On a multiple of the decimation, with the NCO where it would have been
+	// had nothing been lost
+	const uint64_t D = cfg.decimation;
+	alignAt = (in_start + D - 1) / D * D;
+	numCarry = 0;
+	decim.reset();
+	for (Chan& ch : chans) {
+		double cycles = (double)ch.rFreq * (double)alignAt;
+		ch.phase = (Ipp32f)(IPP_2PI * (cycles - std::floor(cycles)));
+	}
+}
+
+const SampleBlock* Ddc::process(const SampleBlock& in)
+{
+	if (chans.empty() || in.nsamps > maxBlockSamps)
+		return nullptr;
+	if (!Startedflag || in.sampOffset != nextIn) {
+		restart(in.sampOffset);
+		if (Startedflag)
+			pendingFlags |= BLOCK_FLAG_DISCONT;
+		Startedflag = true;
+	}
+	else if (in.lostBefore > 0)
+		pendingLost += in.lostBefore / cfg.decimation;   // padded: zeros filtered like samples
+	pendingFlags |= in.flags;
+	nextIn = in.sampOffset + in.nsamps;
+
+	// What is left of the block from the restart point on
+	const size_t from = alignAt > in.sampOffset ? (size_t)std::min<uint64_t>(alignAt - in.sampOffset, in.nsamps) : 0;
+	const size_t n = in.nsamps - from;
+	samplesIn.fetch_add(n, std::memory_order_relaxed);
+	const size_t D = cfg.decimation;
+	const size_t total = numCarry + n;
+	const size_t iters = total / D;
+	const size_t rest = total - iters * D;
+
+	for (size_t c = 0; c < chans.size(); c++) {
+		Chan& ch = chans[c];
+		// sc16 -> fc32 behind the carried samples, then shift the new ones
+		const Ipp16sc* src;
+		if (in.interleaved()) {
+			for (size_t i = 0; i < n; i++)
+				gathered[i] = in.data[(from + i) * in.numChans + ch.cfg.input];
+			src = gathered;
+		}
+		else
+			src = in.chan(ch.cfg.input) + from;
+		if (numCarry > 0)
+			ippsCopy_32fc(ch.carry, rx_32fc, (int)numCarry);
+		if (n > 0) {
+			widenSc16To32fc(src, rx_32fc + numCarry, n);
+			ippsTone_32fc(nco, (int)n, 1.0f, ch.rFreq, &ch.phase, ippAlgHintAccurate);
+			ippsMul_32fc_I(nco, rx_32fc + numCarry, (int)n);
+		}
+
+		// Filter and keep every D-th, whole decimation steps only
+		if (iters > 0) {
+			decim.process(c, rx_32fc, iters * D, downsampled);
+			ippsConvert_32f16s_Sfs((const Ipp32f*)downsampled, (Ipp16s*)(outbuf + c * outStride),
+				(int)(2 * iters), ippRndNear, -15);
+		}
+		if (rest > 0)
+			ippsCopy_32fc(rx_32fc + iters * D, ch.carry, (int)rest);
+	}
+
+	// The first output is input sample (first processed - carried), a multiple of D
+	const uint64_t firstIn = in.sampOffset + from - numCarry;
+	numCarry = rest;
+	if (iters == 0)
+		return nullptr;
+	out.nsamps = iters;
+	out.seq = outSeq++;
+	out.sampOffset = firstIn / D;
+	out.hasTime = in.hasTime;
+	out.time = in.time.plus(((double)(int64_t)(firstIn - in.sampOffset) - decim.getDesign().groupDelay) / rate);
+	out.flags = pendingFlags;
+	out.lostBefore = (pendingFlags & BLOCK_FLAG_DISCONT) ? out.sampOffset - outNext : pendingLost;
+	outNext = out.sampOffset + out.nsamps;
+	pendingFlags = 0;
+	pendingLost = 0;
+	samplesOut.fetch_add(iters, std::memory_order_relaxed);
+	return &out;
+}
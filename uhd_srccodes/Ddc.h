@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "ipp.h"
+#include "Decimator.h"
+#include "SampleRing.h"
+
+// Streaming digital down-converter: turns full-rate sc16 ring blocks into
+// narrow-band sc16 blocks at rate / decimation, so only the bands of
+// interest reach the disk. Each output channel takes one input channel,
+// shifts offsetHz down to 0 Hz with an NCO, low-pass filters it and keeps
+// one sample in decimation; filter and decimation are a multistage chain
+// (Decimator.h) designed for the passband, ripple and rejection asked for,
+// each stage computing only the samples it keeps. The NCO phase, the
+// stages' state and the input samples short of a whole decimation step
+// carry over to the next block, so the output is the same however the
+// input is cut into blocks.
+// Output sample o stands for input sample o * decimation, stamped with
+// that sample's time less the filter's group delay. After samples are lost
+// the state restarts on the next multiple of decimation, so output gaps
+// line up with input gaps and the time map stays exact.
+// All output channels share the decimation, since they go into one
+// recording at one rate, and so the chain: it is designed for the widest
+// passband, which also gives every channel the same group delay.
+
+struct DdcChannel
+{
+	size_t input = 0;       // input channel
+	double offsetHz = 0;    // band centre relative to the tuned frequency
+	double bandwidth = 0;   // passband, Hz; 0 = 0.8 of the output rate
+};
+
+struct DdcConfig
+{
+	std::vector<DdcChannel> channels;  // none = no DDC, full rate to disk
+	size_t decimation = 8;
+	size_t numTaps = 0;     // 0 = the cheapest multistage chain; else one FIR of this many taps
+	double rippleDb = 0.1;  // passband ripple, peak to peak
+	double stopDb = 80;     // rejection of what would alias into the passband
+	double gainDb = 0;      // applied before requantizing to sc16
+
+	bool enabled() const { return !channels.empty(); }
+};
+
+class Ddc
+{
+private:
+	// Per output channel
+	struct Chan
+	{
+		DdcChannel cfg;
+		Ipp32f rFreq = 0;                 // NCO, cycles per input sample in [0, 1)
+		Ipp32f phase = 0;
+		Ipp32fc* carry = nullptr;         // shifted input short of a decimation step
+	};
+
+	DdcConfig cfg;
+	std::vector<Chan> chans;
+	double rate = 0;
+	size_t numInChans = 0;
+	size_t maxBlockSamps = 0;
+	Decimator decim;                     // one line of state per channel
+
+	// Work buffers, one channel at a time
+	Ipp16sc* gathered = nullptr;         // interleaved input channel
+	Ipp32fc* rx_32fc = nullptr;          // carry + block, shifted
+	Ipp32fc* nco = nullptr;
+	Ipp32fc* downsampled = nullptr;
+
+	// Stream position
+	bool Startedflag = false;
+	uint64_t nextIn = 0;                 // input stream index expected next
+	uint64_t alignAt = 0;                // first input sample to process after a restart
+	size_t numCarry = 0;                 // the same for every channel
+	uint64_t outNext = 0;                // output stream index of the next output sample
+	uint64_t outSeq = 0;
+	uint32_t pendingFlags = 0;           // of input blocks not yet in an output block
+	uint64_t pendingLost = 0;
+	SampleBlock out;
+	Ipp16sc* outbuf = nullptr;
+	size_t outStride = 0;
+
+	std::atomic<uint64_t> samplesIn{ 0 };   // per channel; read by other threads
+	std::atomic<uint64_t> samplesOut{ 0 };
+
+	void restart(uint64_t in_start);
+
+public:
+	Ddc() {}
+	~Ddc() { free(); }
+	Ddc(const Ddc&) = delete;
+	Ddc& operator=(const Ddc&) = delete;
+
+	// For blocks of in_numChans channels at in_rate, at most in_maxBlockSamps long
+	bool init(const DdcConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps);
+	void free();
+	void reset();
+	bool isEnabled() const { return !chans.empty(); }
+	const DdcConfig& getConfig() const { return cfg; }
+
+	// Next input block, in stream order. Returns the planar output block, or
+	// null while fewer than decimation input samples have built up. The
+	// block stays valid until the next call.
+	const SampleBlock* process(const SampleBlock& in);
+
+	size_t getNumChans() const { return chans.size(); }
+	double getOutputRate() const { return rate / cfg.decimation; }
+	const DecimDesign& getDesign() const { return decim.getDesign(); }
+	double getGroupDelay() const { return decim.getDesign().groupDelay / rate; }  // seconds
+	uint64_t getSamplesIn() const { return samplesIn.load(std::memory_order_relaxed); }
+	uint64_t getSamplesOut() const { return samplesOut.load(std::memory_order_relaxed); }
+};
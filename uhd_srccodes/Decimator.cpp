@@ -0,0 +1,527 @@
+#include "Decimator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <boost/format.hpp>
+
+static const double CIC_ONE = 1048576.0;      // 1.0 into the CIC, 2^20
+static const double CIC_GROWTH_BITS = 41;     // 63 bits less the input's 22
+static const size_t MAX_CIC_ORDER = 6;
+static const size_t MAX_HALFBAND_TAPS = 1023;
+static const size_t MAX_FIR_TAPS = 16383;
+static const double MAX_MARGIN_DB = 30;       // over stopDb, to make up for the length estimate
+static const int PASS_POINTS = 64;
+static const int ALIAS_POINTS = 16;           // across each band that folds onto the passband
+static const int COMP_PANELS = 4096;          // compensator integral, Simpson
+
+static double besselI0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; k < 100 && term > 1e-14 * sum; k++) {
+		const double h = x / (2 * k);
+		term *= h * h;
+		sum += term;
+	}
+	return sum;
+}
+
+static double kaiserBeta(double A)
+{
+	if (A > 50)
+		return 0.1102 * (A - 8.7);
+	if (A > 21)
+		return 0.5842 * std::pow(A - 21, 0.4) + 0.07886 * (A - 21);
+	return 0;
+}
+
+// Kaiser's estimate for A dB in both bands across a transition in cycles per sample
+static size_t kaiserTaps(double A, double transition)
+{
+	return (size_t)std::ceil((A - 7.95) / (14.36 * transition)) + 1;
+}
+
+static std::vector<double> kaiserWindow(size_t n, double beta)
+{
+	std::vector<double> w(n);
+	const double c = (n - 1) / 2.0, i0 = besselI0(beta);
+	for (size_t k = 0; k < n; k++) {
+		const double r = c > 0 ? (k - c) / c : 0;
+		w[k] = besselI0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / i0;
+	}
+	return w;
+}
+
+// Magnitudes at f cycles per stage input sample
+static double cicResponse(size_t R, size_t N, double f)
+{
+	const double d = R * std::sin(IPP_PI * f);
+	if (std::fabs(d) < 1e-12)
+		return 1;
+	return std::pow(std::fabs(std::sin(IPP_PI * f * R) / d), (double)N);
+}
+
+static double firResponse(const std::vector<double>& h, double f)
+{
+	// Symmetric taps: zero phase about the centre
+	const double c = (h.size() - 1) / 2.0;
+	double sum = 0;
+	for (size_t k = 0; k < h.size(); k++)
+		sum += h[k] * std::cos(IPP_2PI * f * (k - c));
+	return std::fabs(sum);
+}
+
+static double stageResponse(const DecimStage& s, double f)
+{
+	return s.type == DECIM_CIC ? cicResponse(s.factor, s.order, f) : firResponse(s.taps, f);
+}
+
+static void normalize(std::vector<double>& h)
+{
+	double sum = 0;
+	for (double t : h)
+		sum += t;
+	for (double& t : h)
+		t /= sum;
+}
+
+// Smallest CIC order with A dB on the first band that folds onto a passband
+// of fp cycles per input sample
+static bool designCic(double A, double fp, size_t R, DecimStage& s)
+{
+	const double edge = 1.0 / R - fp;
+	if (edge <= fp)
+		return false;
+	const double perSection = -20 * std::log10(cicResponse(R, 1, edge));
+	const size_t N = (size_t)std::ceil(A / perSection);
+	if (N > MAX_CIC_ORDER || N * std::log2((double)R) > CIC_GROWTH_BITS)
+		return false;
+	s.type = DECIM_CIC;
+	s.factor = R;
+	s.order = N;
+	s.macs = 0;
+	s.adds = N + (double)N / R;   // integrators at the input rate, combs at the output
+	return true;
+}
+
+// Half-band for a passband of fpn cycles per stage input sample: 4k + 3 taps,
+// every even offset from the centre but the centre itself zero
+static bool designHalfband(double A, double fpn, DecimStage& s)
+{
+	const double transition = 0.5 - 2 * fpn;
+	if (transition <= 0)
+		return false;
+	const size_t est = kaiserTaps(A, transition);
+	const size_t k = est > 3 ? est / 4 : 0;   // 4k + 3 >= est
+	const size_t n = 4 * k + 3;
+	if (n > MAX_HALFBAND_TAPS)
+		return false;
+	std::vector<double> w = kaiserWindow(n, kaiserBeta(A));
+	const long c = (long)(2 * k + 1);
+	s.type = DECIM_HALFBAND;
+	s.factor = 2;
+	s.taps.assign(n, 0);
+	for (long j = 0; j < (long)n; j++) {
+		const long m = j - c;
+		if (m == 0)
+			s.taps[j] = 0.5;
+		else if (m % 2 != 0)
+			s.taps[j] = std::sin(IPP_PI * m / 2) / (IPP_PI * m) * w[j];
+	}
+	normalize(s.taps);
+	return true;
+}
+
+// Final FIR decimating by F with a passband to fpn and stopband from fsn,
+// both in cycles per stage input sample, flattening the droop of a CIC of
+// cicR x cicN scale input samples per stage input sample before it
+static bool designFir(double A, double fpn, double fsn, size_t F, size_t numTaps, size_t cicR, size_t cicN, double scale,
+	DecimStage& s)
+{
+	if (fsn <= fpn)
+		return false;
+	const size_t n = numTaps > 0 ? numTaps : kaiserTaps(A, fsn - fpn) | 1;
+	if (n > MAX_FIR_TAPS)
+		return false;
+	std::vector<double> w = kaiserWindow(n, kaiserBeta(A));
+	const double fc = (fpn + fsn) / 2, c = (n - 1) / 2.0;
+	s.type = DECIM_FIR;
+	s.factor = F;
+	s.taps.assign(n, 0);
+	if (cicR <= 1) {
+		// Ideal low-pass cut at the middle of the transition
+		for (size_t j = 0; j < n; j++) {
+			const double m = j - c;
+			s.taps[j] = (m == 0 ? 2 * fc : std::sin(IPP_2PI * fc * m) / (IPP_PI * m)) * w[j];
+		}
+	}
+	else {
+		// The inverse of the droop to the band edge, held on to the cut:
+		// h[m] = 2 * integral over [0, fc] of Hd(f) cos(2 pi f m), with the
+		// cosines of each f stepped through m by their recurrence
+		const size_t half = n / 2 + 1;
+		std::vector<double> acc(half, 0);
+		for (int i = 0; i <= COMP_PANELS; i++) {
+			const double f = fc * i / COMP_PANELS;
+			const double weight = (i == 0 || i == COMP_PANELS) ? 1 : (i % 2 ? 4 : 2);
+			const double hd = weight / cicResponse(cicR, cicN, std::min(f, fpn) / scale);
+			const double c1 = std::cos(IPP_2PI * f);
+			double prev = c1, cur = 1;   // cos(-1 theta), cos(0)
+			for (size_t m = 0; m < half; m++) {
+				acc[m] += hd * cur;
+				const double next = 2 * c1 * cur - prev;
+				prev = cur;
+				cur = next;
+			}
+		}
+		const double step = fc / COMP_PANELS / 3;
+		for (size_t j = 0; j < n; j++)
+			s.taps[j] = 2 * step * acc[(size_t)std::fabs(j - c)] * w[j];
+	}
+	normalize(s.taps);
+	return true;
+}
+
+// The chain CIC R x 2^halfbands x FIR F for spec, each stage designed for
+// stopDb + margin
+static bool designChain(const DecimSpec& spec, size_t R, size_t halfbands, size_t F, double margin, size_t numTaps,
+	DecimDesign& d)
+{
+	d = DecimDesign();
+	d.spec = spec;
+	const double fp = spec.passband / spec.decimation;   // cycles per input sample
+	const double A = spec.stopDb + margin;
+	double scale = 1;   // input samples per stage input sample
+	size_t cicN = 0;
+	if (R > 1) {
+		DecimStage s;
+		if (!designCic(A, fp, R, s))
+			return false;
+		cicN = s.order;
+		d.groupDelay += s.order * (R - 1) / 2.0;
+		d.stages.push_back(s);
+		scale = (double)R;
+	}
+	for (size_t h = 0; h < halfbands; h++) {
+		DecimStage s;
+		if (!designHalfband(A, fp * scale, s))
+			return false;
+		s.macs = ((s.taps.size() + 1) / 2 + 1) / (2 * scale);
+		d.groupDelay += (s.taps.size() - 1) / 2.0 * scale;
+		d.stages.push_back(s);
+		scale *= 2;
+	}
+	if (F > 1 || R > 1) {
+		DecimStage s;
+		const double fpn = fp * scale;
+		if (!designFir(A, fpn, F > 1 ? 1.0 / F - fpn : 0.5, F, numTaps, R, cicN, scale, s))
+			return false;
+		s.macs = s.taps.size() / (scale * F);
+		d.groupDelay += (s.taps.size() - 1) / 2.0 * scale;
+		d.stages.push_back(s);
+	}
+	for (const DecimStage& s : d.stages) {
+		d.macsPerInput += s.macs;
+		d.addsPerInput += s.adds;
+	}
+	return !d.stages.empty();
+}
+
+static bool meets(const DecimDesign& d)
+{
+	return d.stopDb >= d.spec.stopDb && d.rippleDb <= d.spec.rippleDb;
+}
+
+void Decimator::measure(DecimDesign& d)
+{
+	const size_t D = d.spec.decimation;
+	const double fp = d.spec.passband / D;
+	auto gainAt = [&](double f) {
+		double g = 1, scale = 1;
+		for (const DecimStage& s : d.stages) {
+			g *= stageResponse(s, f * scale);
+			scale *= s.factor;
+		}
+		return g;
+	};
+	double lo = 1e9, hi = -1e9;
+	for (int i = 0; i <= PASS_POINTS; i++) {
+		const double g = 20 * std::log10(gainAt(fp * i / PASS_POINTS));
+		lo = std::min(lo, g);
+		hi = std::max(hi, g);
+	}
+	d.rippleDb = hi - lo;
+	double worst = 0;
+	for (size_t k = 1; 2 * k <= D; k++) {
+		for (int i = 0; i <= ALIAS_POINTS; i++) {
+			const double f = (double)k / D + fp * (2.0 * i / ALIAS_POINTS - 1);
+			if (f <= 0.5)
+				worst = std::max(worst, gainAt(f));
+		}
+	}
+	d.stopDb = worst > 0 ? -20 * std::log10(worst / gainAt(0)) : 999;
+}
+
+DecimDesign Decimator::designSingle(const DecimSpec& spec, size_t numTaps)
+{
+	DecimDesign d;
+	if (spec.decimation >= 2)
+		designChain(spec, 1, 0, spec.decimation, 0, numTaps, d);
+	if (d.valid())
+		measure(d);
+	return d;
+}
+
+size_t Decimator::singleTaps(const DecimSpec& spec)
+{
+	const double fp = spec.passband / spec.decimation;
+	return kaiserTaps(spec.stopDb, 1.0 / spec.decimation - 2 * fp) | 1;
+}
+
+DecimDesign Decimator::design(const DecimSpec& spec)
+{
+	DecimDesign best;
+	const size_t D = spec.decimation;
+	if (D < 2 || spec.passband <= 0 || spec.passband >= 0.5)
+		return best;
+	// Large CICs first: those chains are the likely winners, and anything
+	// costing more than the best so far is not measured
+	for (size_t R = D; R >= 1; R--) {
+		if (D % R != 0 || R == 2)   // a CIC by 2 is a worse half-band
+			continue;
+		for (size_t h = 0, rest = D / R; ; h++, rest /= 2) {
+			for (double margin = 0; margin <= MAX_MARGIN_DB; margin += 3) {
+				DecimDesign d;
+				if (!designChain(spec, R, h, rest, margin, 0, d) || (best.valid() && d.cost() >= best.cost()))
+					break;
+				measure(d);
+				if (meets(d)) {
+					best = d;
+					break;
+				}
+			}
+			if (rest % 2 != 0)
+				break;
+		}
+	}
+	return best;
+}
+
+std::string DecimDesign::describe() const
+{
+	if (!valid())
+		return "no design";
+	std::string s;
+	for (const DecimStage& st : stages) {
+		if (!s.empty())
+			s += " > ";
+		if (st.type == DECIM_CIC)
+			s += str(boost::format("CIC%d/%d") % st.order % st.factor);
+		else
+			s += str(boost::format("%s%d/%d") % (st.type == DECIM_HALFBAND ? "HB" : "FIR") % st.taps.size() % st.factor);
+	}
+	return s + str(boost::format(": %.2f MACs + %.2f adds per input, %.3f dB ripple, %.1f dB rejection")
+		% macsPerInput % addsPerInput % rippleDb % stopDb);
+}
+
+bool Decimator::init(const DecimDesign& in_design, size_t in_numChans, size_t in_maxInSamps, double gain)
+{
+	free();
+	if (!in_design.valid()) {
+		std::cerr << boost::format("Decimator: no chain for decimation %d\n") % in_design.spec.decimation;
+		return false;
+	}
+	chain = in_design;
+	maxIn = in_maxInSamps;
+	size_t lastFilter = 0;   // a chain ends in a filter whenever it has a CIC
+	for (size_t i = 0; i < chain.stages.size(); i++) {
+		if (chain.stages[i].type != DECIM_CIC)
+			lastFilter = i;
+	}
+
+	size_t stageIn = maxIn;   // most samples into each stage
+	stages.resize(chain.stages.size());
+	for (size_t i = 0; i < stages.size(); i++) {
+		const DecimStage& ds = chain.stages[i];
+		Stage& s = stages[i];
+		s.type = ds.type;
+		s.factor = ds.factor;
+		s.order = ds.order;
+		s.lines.resize(in_numChans);
+		const double g = i == lastFilter ? gain : 1;
+		if (s.type == DECIM_CIC) {
+			s.cicScale = g / (CIC_ONE * std::pow((double)s.factor, (double)s.order));
+			for (Line& l : s.lines)
+				l.acc.resize(4 * s.order);
+		}
+		else if (s.type == DECIM_HALFBAND) {
+			// The even taps run over the even samples; the centre tap is odd
+			const size_t n = ds.taps.size();
+			s.numTaps = (int)(n + 1) / 2;
+			s.pTaps_c = ippsMalloc_32fc_L(s.numTaps);
+			for (int k = 0; k < s.numTaps; k++) {
+				s.pTaps_c[k].re = (Ipp32f)(ds.taps[2 * k] * g);
+				s.pTaps_c[k].im = 0;
+			}
+			s.centre = (Ipp32f)(ds.taps[(n - 1) / 2] * g);
+			s.centreDelay = (n - 3) / 4 + 1;
+			s.DlyLen = std::max(s.numTaps - 1, 1);
+			int specSize = 0, bufSize = 0;
+			ippsFIRSRGetSize(s.numTaps, ipp32fc, &specSize, &bufSize);
+			s.pSpec = (IppsFIRSpec_32fc*)ippsMalloc_8u_L(specSize);
+			s.pBuffer = ippsMalloc_8u_L(bufSize);
+			ippsFIRSRInit_32fc(s.pTaps_c, s.numTaps, ippAlgAuto, s.pSpec);
+			for (Line& l : s.lines)
+				l.odd = ippsMalloc_32fc_L(s.centreDelay + stageIn / 2);
+		}
+		else {
+			s.numTaps = (int)ds.taps.size();
+			s.pTaps_c = ippsMalloc_32fc_L(s.numTaps);
+			for (int k = 0; k < s.numTaps; k++) {
+				s.pTaps_c[k].re = (Ipp32f)(ds.taps[k] * g);
+				s.pTaps_c[k].im = 0;
+			}
+			if (FastFir::beatsDirect(s.numTaps, s.factor, stageIn)) {
+				s.fast.reset(new FastFir());
+				if (!s.fast->init(s.pTaps_c, s.numTaps, in_numChans, s.factor, stageIn))
+					s.fast.reset();
+			}
+			if (!s.fast) {
+				s.DlyLen = s.numTaps;   // delay line, numTaps for decimation only
+				int specSize = 0, bufSize = 0;
+				ippsFIRMRGetSize(s.numTaps, 1, (int)s.factor, ipp32fc, &specSize, &bufSize);
+				s.pSpec = (IppsFIRSpec_32fc*)ippsMalloc_8u_L(specSize);
+				s.pBuffer = ippsMalloc_8u_L(bufSize);
+				ippsFIRMRInit_32fc(s.pTaps_c, s.numTaps, 1, 0, (int)s.factor, 0, s.pSpec);
+			}
+		}
+		if (s.type != DECIM_CIC && !s.fast) {
+			for (Line& l : s.lines) {
+				l.pDlySrc[0] = ippsMalloc_32fc_L(s.DlyLen);
+				l.pDlySrc[1] = ippsMalloc_32fc_L(s.DlyLen);
+			}
+		}
+		stageIn /= s.factor;
+	}
+	const size_t firstOut = maxIn / chain.stages[0].factor + 1;
+	work[0] = ippsMalloc_32fc_L(firstOut);
+	work[1] = ippsMalloc_32fc_L(firstOut);
+	even = ippsMalloc_32fc_L(maxIn / 2 + 1);
+	reset();
+	return true;
+}
+
+void Decimator::free()
+{
+	for (Stage& s : stages) {
+		for (Line& l : s.lines) {
+			ippsFree(l.pDlySrc[0]);
+			ippsFree(l.pDlySrc[1]);
+			ippsFree(l.odd);
+		}
+		ippsFree(s.pTaps_c);
+		ippsFree(s.pSpec);
+		ippsFree(s.pBuffer);
+		s.fast.reset();
+	}
+	stages.clear();
+	ippsFree(work[0]);
+	ippsFree(work[1]);
+	ippsFree(even);
+	work[0] = work[1] = nullptr;
+	even = nullptr;
+}
+
+void Decimator::reset()
+{
+	if (!stages.empty()) {
+		for (size_t ch = 0; ch < stages[0].lines.size(); ch++)
+			reset(ch);
+	}
+}
+
+void Decimator::reset(size_t ch)
+{
+	for (Stage& s : stages) {
+		Line& l = s.lines[ch];
+		if (s.fast)
+			s.fast->reset(ch);
+		std::fill(l.acc.begin(), l.acc.end(), 0);
+		if (l.pDlySrc[0] != nullptr) {
+			ippsZero_32fc(l.pDlySrc[0], s.DlyLen);
+			ippsZero_32fc(l.pDlySrc[1], s.DlyLen);
+		}
+		if (l.odd != nullptr)
+			ippsZero_32fc(l.odd, (int)s.centreDelay);
+		l.dly = 0;
+	}
+}
+
+void Decimator::runCic(Stage& s, Line& l, const Ipp32fc* in, size_t n, Ipp32fc* out)
+{
+	// Integrators on every sample, combs on the one of each R kept; the
+	// unsigned sums wrap, and wrap back once the combs difference them
+	const size_t R = s.factor, N = s.order;
+	uint64_t* integ = l.acc.data();
+	uint64_t* comb = integ + 2 * N;
+	for (size_t o = 0; o < n / R; o++) {
+		const Ipp32fc* x = in + o * R;
+		for (size_t j = 0; j < R; j++) {
+			uint64_t re = (uint64_t)std::llrint(x[j].re * CIC_ONE);
+			uint64_t im = (uint64_t)std::llrint(x[j].im * CIC_ONE);
+			for (size_t k = 0; k < N; k++) {
+				re = integ[2 * k] += re;
+				im = integ[2 * k + 1] += im;
+			}
+			if (j == 0) {
+				for (size_t k = 0; k < N; k++) {
+					const uint64_t tr = re, ti = im;
+					re -= comb[2 * k];
+					im -= comb[2 * k + 1];
+					comb[2 * k] = tr;
+					comb[2 * k + 1] = ti;
+				}
+				out[o].re = (Ipp32f)((double)(int64_t)re * s.cicScale);
+				out[o].im = (Ipp32f)((double)(int64_t)im * s.cicScale);
+			}
+		}
+	}
+}
+
+void Decimator::runHalfband(Stage& s, Line& l, const Ipp32fc* in, size_t n, Ipp32fc* out)
+{
+	// y[m] = sum h[2i] x[2(m - i)] + centre x[2(m - k - 1) + 1]: an FIR of
+	// the even taps over the even samples at the output rate, plus the odd
+	// samples k + 1 late
+	const int m = (int)(n / 2);
+	int len = 0, phase = 0;
+	ippsSampleDown_32fc(in, (int)n, even, &len, 2, &phase);
+	phase = 1;
+	ippsSampleDown_32fc(in, (int)n, l.odd + s.centreDelay, &len, 2, &phase);
+	ippsFIRSR_32fc(even, out, m, s.pSpec, l.pDlySrc[l.dly], l.pDlySrc[l.dly ^ 1], s.pBuffer);
+	l.dly ^= 1;
+	ippsAddProductC_32f((const Ipp32f*)l.odd, s.centre, (Ipp32f*)out, 2 * m);
+	ippsMove_32fc(l.odd + m, l.odd, (int)s.centreDelay);
+}
+
+size_t Decimator::process(size_t ch, const Ipp32fc* in, size_t n, Ipp32fc* out)
+{
+	const Ipp32fc* src = in;
+	for (size_t i = 0; i < stages.size() && n > 0; i++) {
+		Stage& s = stages[i];
+		Line& l = s.lines[ch];
+		Ipp32fc* dst = i + 1 == stages.size() ? out : work[i & 1];
+		if (s.type == DECIM_CIC)
+			runCic(s, l, src, n, dst);
+		else if (s.type == DECIM_HALFBAND)
+			runHalfband(s, l, src, n, dst);
+		else if (s.fast)
+			s.fast->process(ch, src, n, dst);
+		else {
+			ippsFIRMR_32fc(src, dst, (int)(n / s.factor), s.pSpec, l.pDlySrc[l.dly], l.pDlySrc[l.dly ^ 1], s.pBuffer);
+			l.dly ^= 1;
+		}
+		src = dst;
+		n /= s.factor;
+	}
+	return n;
+}
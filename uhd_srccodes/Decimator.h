@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ipp.h"
+#include "FastFir.h"
+
+// Multistage decimation for the DDC. One FIR that decimates by D in a
+// single step needs a transition band a fraction of the output rate wide at
+// the input rate, so its length, and the work per output, grows with D:
+// thousands of taps for D in the hundreds. A chain of stages gets there far
+// cheaper, each stage only keeping out what would alias into the final
+// passband:
+//   DECIM_CIC       cascaded integrator-comb, no multiplies at all, for the
+//                   bulk of a large decimation at the full input rate
+//   DECIM_HALFBAND  decimate by 2 with a half-band FIR, every other tap of
+//                   which is zero, so it costs a quarter of its length per input
+//   DECIM_FIR       the final, steep stage at the lowest rate, which also
+//                   flattens the CIC's passband droop; run by overlap-save
+//                   (FastFir.h) where that costs less than direct form
+// Decimator::design() factors D every way it can into CIC x 2^k x FIR,
+// sizes each stage for the spec with Kaiser windows, checks the whole
+// chain's passband ripple and alias rejection numerically and keeps the
+// cheapest chain that meets both. Cost is counted per chain input sample:
+// MACs are complex-by-real multiply-adds (four flops), adds are complex
+// adds (two), so a chain costs MACs + adds / 2.
+//
+// The CIC runs in wrapping 64-bit integers, as it must: float integrators
+// would drift. Input is scaled so 1.0 is 2^20 before it, leaving 41 bits
+// of growth for its sections.
+
+enum DecimStageType { DECIM_CIC, DECIM_HALFBAND, DECIM_FIR };
+
+struct DecimSpec
+{
+	size_t decimation = 8;
+	double passband = 0.4;   // passband edge, fraction of the output rate
+	double rippleDb = 0.1;   // passband ripple, peak to peak
+	double stopDb = 80;      // rejection of everything that aliases into the passband
+};
+
+struct DecimStage
+{
+	DecimStageType type = DECIM_FIR;
+	size_t factor = 1;
+	size_t order = 0;              // CIC sections
+	std::vector<double> taps;      // half-band and FIR, unit gain at DC
+	double macs = 0;               // per chain input sample
+	double adds = 0;
+};
+
+struct DecimDesign
+{
+	DecimSpec spec;
+	std::vector<DecimStage> stages;   // none = nothing met the spec
+	double macsPerInput = 0;
+	double addsPerInput = 0;
+	double rippleDb = 0;              // as measured on the chain
+	double stopDb = 0;
+	double groupDelay = 0;            // input samples
+
+	bool valid() const { return !stages.empty(); }
+	double cost() const { return macsPerInput + addsPerInput / 2; }
+	// "CIC4/25 > HB11/2 > FIR63/4: 1.9 MACs + 4.2 adds per input"
+	std::string describe() const;
+};
+
+class Decimator
+{
+private:
+	// Per channel state of a stage
+	struct Line
+	{
+		std::vector<uint64_t> acc;   // CIC: integrators then combs, re and im, wrapping
+		Ipp32fc* pDlySrc[2] = { nullptr, nullptr };   // FIR delay line in and out, swapped every call
+		int dly = 0;
+		Ipp32fc* odd = nullptr;      // half-band: odd samples, the centre tap's delay behind
+	};
+
+	struct Stage
+	{
+		DecimStageType type = DECIM_FIR;
+		size_t factor = 1;
+		size_t order = 0;
+		double cicScale = 1;         // CIC gain and input scaling undone
+		int numTaps = 0;             // FIR, or the half-band's even taps
+		int DlyLen = 0;
+		Ipp32fc* pTaps_c = nullptr;
+		IppsFIRSpec_32fc* pSpec = nullptr;   // shared by the channels
+		Ipp8u* pBuffer = nullptr;
+		std::unique_ptr<FastFir> fast;       // instead of pSpec, for long FIRs
+		Ipp32f centre = 0;           // half-band centre tap
+		size_t centreDelay = 0;      // in odd samples
+		std::vector<Line> lines;
+	};
+
+	DecimDesign chain;
+	std::vector<Stage> stages;
+	size_t maxIn = 0;
+	Ipp32fc* work[2] = { nullptr, nullptr };   // stage outputs, ping-pong
+	Ipp32fc* even = nullptr;                   // half-band even samples
+
+	void runCic(Stage& s, Line& l, const Ipp32fc* in, size_t n, Ipp32fc* out);
+	void runHalfband(Stage& s, Line& l, const Ipp32fc* in, size_t n, Ipp32fc* out);
+
+public:
+	Decimator() {}
+	~Decimator() { free(); }
+	Decimator(const Decimator&) = delete;
+	Decimator& operator=(const Decimator&) = delete;
+
+	// in_numChans independent channels through in_design, at most
+	// in_maxInSamps input samples per call; gain is folded into the last stage
+	bool init(const DecimDesign& in_design, size_t in_numChans, size_t in_maxInSamps, double gain = 1);
+	void free();
+	// Every channel back to silence, decimation phase 0
+	void reset();
+	void reset(size_t ch);
+	const DecimDesign& getDesign() const { return chain; }
+	// DFT length of stage i run by overlap-save, 0 if direct
+	int getFftLen(size_t i) const { return i < stages.size() && stages[i].fast ? stages[i].fast->getFftLen() : 0; }
+
+	// n input samples of channel ch, a multiple of the decimation; returns
+	// n / decimation outputs, output o standing for input o * decimation
+	size_t process(size_t ch, const Ipp32fc* in, size_t n, Ipp32fc* out);
+
+	// The cheapest chain for spec, or !valid() if nothing meets it
+	static DecimDesign design(const DecimSpec& spec);
+	// One FIR of numTaps taps (0 = as many as spec needs) decimating by
+	// spec.decimation in one step, as a yardstick and for fixed-length filters
+	static DecimDesign designSingle(const DecimSpec& spec, size_t numTaps = 0);
+	// Taps designSingle() will give spec, by Kaiser's estimate, without designing
+	static size_t singleTaps(const DecimSpec& spec);
+	// Ripple and rejection of a chain as built: the chain is one filter at
+	// the input rate followed by the decimation, so the passband is measured
+	// on it directly and every band that folds onto the passband for the
+	// rejection
+	static void measure(DecimDesign& d);
+};
@@ -0,0 +1,587 @@
+#include "DiskWriter.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DISKWRITER_URING 1
+#endif
+#endif
+#endif
+
+// Positional file I/O, so writes can complete out of order
+#ifdef _WIN32
+
+static intptr_t osOpen(const std::string& path, bool direct)
+{
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+	HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+	return h == INVALID_HANDLE_VALUE ? -1 : (intptr_t)h;
+}
+
+static int64_t osPwrite(intptr_t fd, const char* buf, size_t len, uint64_t off)
+{
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)off;
+	ov.OffsetHigh = (DWORD)(off >> 32);
+	DWORD n = 0;
+	if (!WriteFile((HANDLE)fd, buf, (DWORD)len, &n, &ov))
+		return -1;
+	return n;
+}
+
+static bool osTruncate(intptr_t fd, uint64_t size)
+{
+	LARGE_INTEGER li;
+	li.QuadPart = (LONGLONG)size;
+	return SetFilePointerEx((HANDLE)fd, li, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)fd);
+}
+
+static bool osPreallocate(intptr_t fd, uint64_t size)
+{
+	// Reserves clusters without moving end of file; close() truncates anyway
+	FILE_ALLOCATION_INFO info;
+	info.AllocationSize.QuadPart = (LONGLONG)size;
+	return SetFileInformationByHandle((HANDLE)fd, FileAllocationInfo, &info, sizeof(info)) != 0;
+}
+
+static bool osSync(intptr_t fd)
+{
+	return FlushFileBuffers((HANDLE)fd) != 0;
+}
+
+static void osClose(intptr_t fd)
+{
+	CloseHandle((HANDLE)fd);
+}
+
+#else
+
+static intptr_t osOpen(const std::string& path, bool direct)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	if (direct) {
+#ifdef O_DIRECT
+		flags |= O_DIRECT;
+#else
+		return -1;
+#endif
+	}
+	return ::open(path.c_str(), flags, 0644);
+}
+
+static int64_t osPwrite(intptr_t fd, const char* buf, size_t len, uint64_t off)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = ::pwrite((int)fd, buf + done, len - done, (off_t)(off + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += (size_t)n;
+	}
+	return (int64_t)done;
+}
+
+static bool osTruncate(intptr_t fd, uint64_t size)
+{
+	return ftruncate((int)fd, (off_t)size) == 0;
+}
+
+static bool osPreallocate(intptr_t fd, uint64_t size)
+{
+#ifdef __linux__
+	// Allocated but unwritten extents; no zero-filling like posix_fallocate()
+	// would fall back to on file systems without fallocate
+	return fallocate((int)fd, 0, 0, (off_t)size) == 0;
+#else
+	return false;
+#endif
+}
+
+static bool osSync(intptr_t fd)
+{
+#ifdef __linux__
+	return fdatasync((int)fd) == 0;
+#else
+	return fsync((int)fd) == 0;
+#endif
+}
+
+static void osClose(intptr_t fd)
+{
+	::close((int)fd);
+}
+
+#endif
+
+#ifdef DISKWRITER_URING
+
+// The three shared rings of one io_uring instance, mapped by hand
+struct DiskWriter::Uring
+{
+	int fd = -1;
+	void* sqPtr = MAP_FAILED;
+	void* cqPtr = MAP_FAILED;
+	void* sqePtr = MAP_FAILED;
+	size_t sqLen = 0, cqLen = 0, sqeLen = 0;
+	unsigned* sqTail = nullptr;
+	unsigned* sqArray = nullptr;
+	unsigned sqMask = 0;
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned cqMask = 0;
+	io_uring_sqe* sqes = nullptr;
+	io_uring_cqe* cqes = nullptr;
+};
+
+bool DiskWriter::setupUring()
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	unsigned entries = 1;
+	while (entries < cfg.queueDepth)
+		entries <<= 1;
+	int rfd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (rfd < 0)
+		return false; // old kernel or blocked by seccomp
+
+	ring = new Uring;
+	ring->fd = rfd;
+	ring->sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single)
+		ring->sqLen = ring->cqLen = std::max(ring->sqLen, ring->cqLen);
+	ring->sqPtr = mmap(nullptr, ring->sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+	ring->cqPtr = single ? ring->sqPtr
+		: mmap(nullptr, ring->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+	ring->sqeLen = p.sq_entries * sizeof(io_uring_sqe);
+	ring->sqePtr = mmap(nullptr, ring->sqeLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES);
+	if (ring->sqPtr == MAP_FAILED || ring->cqPtr == MAP_FAILED || ring->sqePtr == MAP_FAILED) {
+		freeUring();
+		return false;
+	}
+
+	char* sq = (char*)ring->sqPtr;
+	char* cq = (char*)ring->cqPtr;
+	ring->sqTail = (unsigned*)(sq + p.sq_off.tail);
+	ring->sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	ring->sqArray = (unsigned*)(sq + p.sq_off.array);
+	ring->cqHead = (unsigned*)(cq + p.cq_off.head);
+	ring->cqTail = (unsigned*)(cq + p.cq_off.tail);
+	ring->cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	ring->sqes = (io_uring_sqe*)ring->sqePtr;
+	ring->cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+	return true;
+}
+
+void DiskWriter::freeUring()
+{
+	if (ring == nullptr)
+		return;
+	if (ring->sqePtr != MAP_FAILED)
+		munmap(ring->sqePtr, ring->sqeLen);
+	if (ring->cqPtr != MAP_FAILED && ring->cqPtr != ring->sqPtr)
+		munmap(ring->cqPtr, ring->cqLen);
+	if (ring->sqPtr != MAP_FAILED)
+		munmap(ring->sqPtr, ring->sqLen);
+	::close(ring->fd);
+	delete ring;
+	ring = nullptr;
+}
+
+bool DiskWriter::uringSubmit(size_t b)
+{
+	// Only this thread produces SQEs, so the tail needs no atomic read
+	unsigned tail = *ring->sqTail;
+	unsigned idx = tail & ring->sqMask;
+	io_uring_sqe* sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = (int)fd;
+	sqe->addr = (uint64_t)(uintptr_t)bufs[b].data;
+	sqe->len = (uint32_t)bufs[b].len;
+	sqe->off = bufs[b].offset;
+	sqe->user_data = b;
+	ring->sqArray[idx] = idx;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, nullptr, 0) < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			std::cerr << boost::format("io_uring submit failed for %s: %s\n") % path % strerror(errno);
+			return false;
+		}
+		uringReap(false);
+	}
+	return true;
+}
+
+void DiskWriter::uringReap(bool wait)
+{
+	if (wait)
+		while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno == EINTR)
+			;
+	unsigned head = *ring->cqHead;
+	while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+		const io_uring_cqe& cqe = ring->cqes[head & ring->cqMask];
+		size_t b = (size_t)cqe.user_data;
+		int64_t res = cqe.res;
+		head++;
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+		if (res == -EINVAL || res == -EOPNOTSUPP) // no IORING_OP_WRITE (before Linux 5.6)
+			res = osPwrite(fd, bufs[b].data, bufs[b].len, bufs[b].offset);
+		complete(b, res);
+	}
+}
+
+#else
+
+struct DiskWriter::Uring {};
+bool DiskWriter::setupUring() { return false; }
+void DiskWriter::freeUring() {}
+bool DiskWriter::uringSubmit(size_t b) { return false; }
+void DiskWriter::uringReap(bool wait) {}
+
+#endif
+
+bool DiskWriter::open(const std::string& in_path, const DiskWriterConfig& in_cfg)
+{
+	close();
+	cfg = in_cfg;
+	cfg.bufBytes = std::max<size_t>(DISK_ALIGN, (cfg.bufBytes + DISK_ALIGN - 1) / DISK_ALIGN * DISK_ALIGN);
+	cfg.numBufs = std::max<size_t>(2, cfg.numBufs);
+	cfg.queueDepth = std::min(std::max<size_t>(1, cfg.queueDepth), cfg.numBufs - 1);
+	path = in_path;
+
+	fd = osOpen(path, cfg.direct);
+	directIO = cfg.direct && fd >= 0;
+	if (fd < 0 && cfg.direct) {
+		fd = osOpen(path, false);
+		if (fd >= 0)
+			std::cerr << boost::format("Direct I/O not supported for %s, writing through the page cache\n") % path;
+	}
+	if (fd < 0) {
+		std::cerr << boost::format("Could not open %s for writing\n") % path;
+		return false;
+	}
+
+	if (cfg.preallocBytes > 0 && !osPreallocate(fd, cfg.preallocBytes))
+		std::cerr << boost::format("Could not preallocate %.1f MB for %s, the file grows as it is written\n")
+			% (cfg.preallocBytes / 1e6) % path;
+
+	if (!pool.alloc(cfg.numBufs * cfg.bufBytes, cfg.mem)) {
+		osClose(fd);
+		fd = -1;
+		return false;
+	}
+	bufs.assign(2 * cfg.numBufs, Buffer());
+	freeBufs.clear();
+	freeShared.clear();
+	for (size_t b = 0; b < cfg.numBufs; b++) {
+		bufs[b].data = (char*)pool.get() + b * cfg.bufBytes;
+		freeBufs.push_back(cfg.numBufs - 1 - b);
+		freeShared.push_back(2 * cfg.numBufs - 1 - b);
+	}
+	cur = SIZE_MAX;
+	curFill = 0;
+	fileOffset = 0;
+	logicalSize = 0;
+	sharedBytes = 0;
+	doneRanges.clear();
+	completedPrefix = 0;
+	inFlight = 0;
+	maxInFlight = 0;
+	bytesDone = 0;
+	writesDone = 0;
+	writeErrors = 0;
+	latencies.clear();
+	latencyIdx = 0;
+
+	if (cfg.useUring && setupUring())
+		backend = str(boost::format("io_uring x%d") % cfg.queueDepth);
+	else {
+		Stopflag = false;
+		for (size_t i = 0; i < cfg.queueDepth; i++)
+			ioThreads.emplace_back(&DiskWriter::ioLoop, this);
+		backend = str(boost::format("pwrite x%d") % cfg.queueDepth);
+	}
+	backend += directIO ? ", direct" : ", buffered";
+
+	tOpen = std::chrono::steady_clock::now();
+	Openflag = true;
+	return true;
+}
+
+bool DiskWriter::write(const void* src, size_t nbytes)
+{
+	if (!Openflag)
+		return false;
+	const uint64_t errs = writeErrors;
+	const char* p = static_cast<const char*>(src);
+	while (nbytes > 0) {
+		if (cur == SIZE_MAX && !getBuffer())
+			return false;
+		size_t n = std::min(nbytes, cfg.bufBytes - curFill);
+		memcpy(bufs[cur].data + curFill, p, n);
+		curFill += n;
+		p += n;
+		nbytes -= n;
+		logicalSize += n;
+		if (curFill == cfg.bufBytes) {
+			size_t b = cur;
+			cur = SIZE_MAX;
+			if (!submit(b, cfg.bufBytes))
+				return false;
+		}
+	}
+	// Errors of earlier writes that completed meanwhile are reported here too
+	return writeErrors == errs;
+}
+
+bool DiskWriter::writeShared(const BlockRef& hold, const void* src, size_t nbytes)
+{
+	// For direct I/O only whole sectors from a sector-aligned address, at a
+	// sector boundary of the file
+	const bool aligned = !directIO || ((uintptr_t)src % DISK_ALIGN == 0 && nbytes % DISK_ALIGN == 0
+		&& (cur == SIZE_MAX || curFill % DISK_ALIGN == 0));
+	if (!Openflag || !cfg.zeroCopy || !hold || !aligned || nbytes == 0)
+		return write(src, nbytes);
+	const uint64_t errs = writeErrors;
+	// What is staged goes first, short, so the file stays in order
+	if (cur != SIZE_MAX) {
+		size_t b = cur;
+		cur = SIZE_MAX;
+		if (!submit(b, curFill))
+			return false;
+	}
+	size_t b = takeBuffer(freeShared);
+	bufs[b].data = (char*)src;
+	bufs[b].hold = hold;
+	logicalSize += nbytes;
+	sharedBytes.fetch_add(nbytes, std::memory_order_relaxed);
+	if (!submit(b, nbytes))
+		return false;
+	return writeErrors == errs;
+}
+
+bool DiskWriter::getBuffer()
+{
+	cur = takeBuffer(freeBufs);
+	curFill = 0;
+	return true;
+}
+
+size_t DiskWriter::takeBuffer(std::vector<size_t>& list)
+{
+	if (ring != nullptr) {
+		uringReap(false);
+		while (list.empty())
+			uringReap(true);
+	}
+	std::unique_lock<std::mutex> lock(mut);
+	freed.wait(lock, [&list] { return !list.empty(); });
+	size_t b = list.back();
+	list.pop_back();
+	return b;
+}
+
+bool DiskWriter::submit(size_t b, size_t len)
+{
+	Buffer& buf = bufs[b];
+	buf.len = len;
+	buf.offset = fileOffset;
+	fileOffset += len;
+
+	if (ring != nullptr)
+		while (inFlight >= cfg.queueDepth)
+			uringReap(true);
+	size_t q = ++inFlight;
+	if (q > maxInFlight)
+		maxInFlight = q;
+	buf.tSubmit = std::chrono::steady_clock::now();
+
+	if (ring != nullptr) {
+		if (!uringSubmit(b)) {
+			complete(b, osPwrite(fd, buf.data, buf.len, buf.offset));
+			return writeErrors == 0;
+		}
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		ioQueue.push_back(b);
+	}
+	queued.notify_one();
+	return true;
+}
+
+void DiskWriter::complete(size_t b, int64_t result)
+{
+	Buffer& buf = bufs[b];
+	if (result >= 0 && (size_t)result < buf.len) {
+		// Short write: finish the rest synchronously
+		int64_t rest = osPwrite(fd, buf.data + result, buf.len - (size_t)result, buf.offset + (uint64_t)result);
+		result = rest < 0 ? rest : result + rest;
+	}
+	float lat = std::chrono::duration<float>(std::chrono::steady_clock::now() - buf.tSubmit).count();
+	if (result < 0 || (size_t)result != buf.len) {
+		if (writeErrors.fetch_add(1) == 0)
+			std::cerr << boost::format("Write to %s failed at offset %d\n") % path % buf.offset;
+	}
+	else
+		bytesDone.fetch_add(buf.len, std::memory_order_relaxed);
+	writesDone.fetch_add(1, std::memory_order_relaxed);
+	const bool shared = b >= cfg.numBufs;
+	if (shared)
+		buf.hold.reset(); // the block may go back to its pool now
+
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		// Writes complete out of order; the prefix only grows over a run of
+		// completed ones, and never past a failed one
+		if (result >= 0 && (size_t)result == buf.len) {
+			doneRanges[buf.offset] = buf.len;
+			uint64_t prefix = completedPrefix.load(std::memory_order_relaxed);
+			for (auto it = doneRanges.begin(); it != doneRanges.end() && it->first == prefix; it = doneRanges.erase(it))
+				prefix += it->second;
+			completedPrefix.store(prefix, std::memory_order_release);
+		}
+		if (latencies.size() < 4096)
+			latencies.push_back(lat);
+		else
+			latencies[latencyIdx++ % latencies.size()] = lat;
+		(shared ? freeShared : freeBufs).push_back(b);
+		inFlight--;
+	}
+	freed.notify_all();
+}
+
+void DiskWriter::ioLoop()
+{
+	while (true) {
+		size_t b;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			queued.wait(lock, [this] { return Stopflag || !ioQueue.empty(); });
+			if (ioQueue.empty())
+				return;
+			b = ioQueue.front();
+			ioQueue.pop_front();
+		}
+		complete(b, osPwrite(fd, bufs[b].data, bufs[b].len, bufs[b].offset));
+	}
+}
+
+void DiskWriter::waitAll()
+{
+	if (ring != nullptr) {
+		while (inFlight > 0)
+			uringReap(true);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mut);
+	freed.wait(lock, [this] { return inFlight == 0; });
+}
+
+bool DiskWriter::close()
+{
+	if (!Openflag)
+		return true;
+
+	// Tail: direct I/O writes whole aligned blocks, the padding is cut off below
+	if (cur != SIZE_MAX) {
+		size_t b = cur;
+		cur = SIZE_MAX;
+		if (curFill > 0) {
+			size_t len = directIO ? (curFill + DISK_ALIGN - 1) / DISK_ALIGN * DISK_ALIGN : curFill;
+			memset(bufs[b].data + curFill, 0, len - curFill);
+			submit(b, len);
+		}
+		else {
+			std::lock_guard<std::mutex> lock(mut);
+			freeBufs.push_back(b);
+		}
+	}
+	waitAll();
+
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		Stopflag = true;
+	}
+	queued.notify_all();
+	for (auto& t : ioThreads)
+		t.join();
+	ioThreads.clear();
+	freeUring();
+
+	{
+		std::lock_guard<std::mutex> lock(fdMut);
+		if ((fileOffset != logicalSize || cfg.preallocBytes > logicalSize) && !osTruncate(fd, logicalSize)) {
+			std::cerr << boost::format("Could not truncate %s to %d bytes\n") % path % logicalSize;
+			writeErrors++;
+		}
+		if (cfg.syncOnClose && !osSync(fd)) {
+			std::cerr << boost::format("Could not sync %s\n") % path;
+			writeErrors++;
+		}
+		osClose(fd);
+		fd = -1;
+	}
+	pool.free();
+	tClose = std::chrono::steady_clock::now();
+	Openflag = false;
+	return writeErrors == 0;
+}
+
+bool DiskWriter::sync()
+{
+	std::lock_guard<std::mutex> lock(fdMut);
+	if (fd < 0)
+		return cfg.syncOnClose;
+	return osSync(fd);
+}
+
+DiskWriter::Stats DiskWriter::getStats() const
+{
+	Stats st;
+	st.bytes = bytesDone.load(std::memory_order_relaxed);
+	st.sharedBytes = sharedBytes.load(std::memory_order_relaxed);
+	st.writes = writesDone.load(std::memory_order_relaxed);
+	st.errors = writeErrors.load(std::memory_order_relaxed);
+	st.inFlight = inFlight.load(std::memory_order_relaxed);
+	st.maxInFlight = maxInFlight.load(std::memory_order_relaxed);
+	auto tEnd = Openflag ? std::chrono::steady_clock::now() : tClose;
+	double secs = std::chrono::duration<double>(tEnd - tOpen).count();
+	st.mbps = secs > 0 ? st.bytes / secs / 1e6 : 0;
+
+	std::vector<float> lat;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		lat = latencies;
+	}
+	if (!lat.empty()) {
+		std::sort(lat.begin(), lat.end());
+		auto pct = [&](double p) { return (double)lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))]; };
+		st.p50 = pct(0.5);
+		st.p99 = pct(0.99);
+		st.p999 = pct(0.999);
+		st.max = lat.back();
+	}
+	return st;
+}
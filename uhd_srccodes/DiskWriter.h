@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPolicy.h"
+#include "SampleRing.h"
+
+struct DiskWriterConfig
+{
+	bool direct = true;         // O_DIRECT / FILE_FLAG_NO_BUFFERING: bypass the page cache
+	bool useUring = true;       // io_uring where the kernel allows it, else pwrite threads
+	size_t bufBytes = 1 << 20;  // staging buffer size, a multiple of DISK_ALIGN
+	size_t numBufs = 16;        // staging pool; numBufs * bufBytes is the write-behind depth
+	size_t queueDepth = 8;      // writes in flight at most
+	uint64_t preallocBytes = 0; // reserve this much disk up front (fallocate), so writes never extend the file
+	bool syncOnClose = false;   // close() returns only once the file is on stable storage
+	bool zeroCopy = true;       // writeShared() submits held blocks in place
+	MemPolicy mem;              // placement of the staging pool
+};
+
+// Sequential file writer that keeps several large aligned writes in flight.
+// write() copies into the current staging buffer from a page-aligned pool;
+// each full buffer is submitted at its file offset and the pool buffer comes
+// back when the write completes, so the caller only waits when the whole
+// pool is in flight. writeShared() skips the copy for ring blocks: the block
+// is submitted as it is, holding a BlockRef until the write completes.
+// Writes go through io_uring (raw syscalls, no liburing) where available,
+// otherwise through a few threads doing pwrite(). With
+// direct I/O the last partial buffer is written padded to DISK_ALIGN and the
+// file is truncated to its real length on close(), as it is when space was
+// preallocated.
+// Not thread safe: one writer thread per DiskWriter.
+class DiskWriter
+{
+public:
+	static const size_t DISK_ALIGN = 4096;
+
+	struct Stats
+	{
+		uint64_t bytes = 0;         // completed
+		uint64_t sharedBytes = 0;   // given to writeShared() and written in place
+		uint64_t writes = 0;
+		uint64_t errors = 0;
+		size_t inFlight = 0;
+		size_t maxInFlight = 0;
+		double mbps = 0;            // since open()
+		double p50 = 0, p99 = 0, p999 = 0, max = 0; // write latency, seconds, recent writes
+	};
+
+private:
+	struct Buffer
+	{
+		char* data = nullptr;
+		size_t len = 0;             // bytes submitted
+		uint64_t offset = 0;
+		BlockRef hold;              // shared buffers: the block data points into
+		std::chrono::steady_clock::time_point tSubmit;
+	};
+
+	DiskWriterConfig cfg;
+	std::string path;
+	std::string backend;
+	intptr_t fd = -1;
+	bool directIO = false;
+	SampleMem pool;
+	std::vector<Buffer> bufs;        // staging buffers, then as many for shared blocks
+	std::vector<size_t> freeBufs;    // guarded by mut
+	std::vector<size_t> freeShared;  // guarded by mut
+	size_t cur = SIZE_MAX;           // buffer being filled
+	size_t curFill = 0;
+	uint64_t fileOffset = 0;         // next buffer's offset
+	uint64_t logicalSize = 0;
+	std::atomic<uint64_t> sharedBytes{ 0 };
+	std::map<uint64_t, size_t> doneRanges;   // completed writes past completedPrefix, guarded by mut
+	std::atomic<uint64_t> completedPrefix{ 0 };
+	std::mutex fdMut;                // sync() against close()
+
+	mutable std::mutex mut;
+	std::condition_variable freed;
+	std::atomic<size_t> inFlight{ 0 };
+	std::atomic<size_t> maxInFlight{ 0 };
+	std::atomic<uint64_t> bytesDone{ 0 };
+	std::atomic<uint64_t> writesDone{ 0 };
+	std::atomic<uint64_t> writeErrors{ 0 };
+	std::vector<float> latencies;    // ring of recent write latencies, guarded by mut
+	size_t latencyIdx = 0;
+	std::chrono::steady_clock::time_point tOpen, tClose;
+	bool Openflag = false;
+
+	// io_uring state; opaque here so the header needs no Linux includes
+	struct Uring;
+	Uring* ring = nullptr;
+	bool setupUring();
+	void freeUring();
+	bool uringSubmit(size_t b);
+	void uringReap(bool wait);
+
+	// pwrite() threads
+	std::vector<std::thread> ioThreads;
+	std::deque<size_t> ioQueue;      // guarded by mut
+	std::condition_variable queued;
+	bool Stopflag = false;
+	void ioLoop();
+
+	bool submit(size_t b, size_t len);
+	void complete(size_t b, int64_t result);
+	bool getBuffer();
+	size_t takeBuffer(std::vector<size_t>& list);
+	void waitAll();
+
+public:
+	DiskWriter() {}
+	~DiskWriter() { close(); }
+	DiskWriter(const DiskWriter&) = delete;
+	DiskWriter& operator=(const DiskWriter&) = delete;
+
+	// Creates/truncates in_path. Direct I/O falls back to buffered writes if the
+	// file system refuses it, io_uring to pwrite threads.
+	bool open(const std::string& in_path, const DiskWriterConfig& in_cfg = DiskWriterConfig());
+	bool write(const void* src, size_t nbytes);
+	// write() of bytes inside the block held by hold. Written in place when
+	// nothing is staged and, for direct I/O, src and nbytes are sector
+	// aligned; otherwise, or with hold empty, copied as by write().
+	bool writeShared(const BlockRef& hold, const void* src, size_t nbytes);
+	// Waits for all writes and truncates to the bytes given to write()
+	bool close();
+	bool isOpen() const { return Openflag; }
+
+	const std::string& getBackend() const { return backend; } // e.g. "io_uring x8, direct"
+	const std::string& getPath() const { return path; }
+	uint64_t getLogicalSize() const { return logicalSize; }
+	uint64_t getSharedBytes() const { return sharedBytes.load(std::memory_order_relaxed); }
+	// Thread safe. Bytes from the start of the file that have all been
+	// written, i.e. that a sync() would make durable.
+	uint64_t getCompletedBytes() const { return completedPrefix.load(std::memory_order_acquire); }
+	// Thread safe. Flush completed writes to stable storage (fdatasync). A
+	// file closed meanwhile counts as synced when syncOnClose is set.
+	bool sync();
+	Stats getStats() const;
+};
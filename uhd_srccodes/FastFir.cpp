@@ -0,0 +1,215 @@
+#include "FastFir.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <boost/format.hpp>
+
+static const int MIN_FFT_LEN = 64;
+static const int MAX_FFT_LEN = 1 << 18;
+// Overlap-save's copies and extra passes over memory, per flop counted:
+// benchFastFir() puts the crossover about where this makes it
+static const double FAST_OVERHEAD = 2.0;
+
+static bool folds(int fftLen, size_t factor)
+{
+	return factor > 1 && fftLen % factor == 0;
+}
+
+// New samples a block of fftLen takes: past the history and, folded, up to
+// factor - 1 of lead-in to put the kept outputs on multiples of factor
+static size_t blockStep(int numTaps, size_t factor, int fftLen)
+{
+	const long room = (long)fftLen - (numTaps - 1) - (folds(fftLen, factor) ? (long)factor - 1 : 0);
+	if (room < (long)factor)
+		return 0;
+	return factor > 1 ? (size_t)room / factor * factor : (size_t)room;
+}
+
+static double dftCost(double n)
+{
+	return n > 1 ? 2.5 * n * std::log2(n) : 0;
+}
+
+double FastFir::directCost(int numTaps, size_t factor)
+{
+	return 4.0 * numTaps / factor;
+}
+
+double FastFir::fastCost(int numTaps, size_t factor, int fftLen, size_t maxIn)
+{
+	const size_t step = blockStep(numTaps, factor, fftLen);
+	if (step == 0)
+		return 1e30;
+	double block = dftCost(fftLen) + 4.0 * fftLen;
+	if (folds(fftLen, factor))
+		block += fftLen + dftCost((double)fftLen / factor);
+	else
+		block += dftCost(fftLen);
+	// A call shorter than a block still pays for a whole one
+	const double perCall = maxIn > 0 ? (double)maxIn : (double)step;
+	return FAST_OVERHEAD * std::ceil(perCall / step) * block / perCall;
+}
+
+int FastFir::bestFftLen(int numTaps, size_t factor, size_t maxIn)
+{
+	int best = 0;
+	double bestCost = 1e30;
+	for (int n = MIN_FFT_LEN; n <= MAX_FFT_LEN; n *= 2) {
+		const double c = fastCost(numTaps, factor, n, maxIn);
+		if (c < bestCost) {
+			bestCost = c;
+			best = n;
+		}
+	}
+	return best;
+}
+
+bool FastFir::beatsDirect(int numTaps, size_t factor, size_t maxIn)
+{
+	const int n = bestFftLen(numTaps, factor, maxIn);
+	return n > 0 && fastCost(numTaps, factor, n, maxIn) < directCost(numTaps, factor);
+}
+
+bool initDft(int len, IppsDFTSpec_C_32fc*& spec, Ipp8u*& buffer, Ipp8u*& memInit)
+{
+	int sizeSpec = 0, sizeInit = 0, sizeBuf = 0;
+	if (len < 1 || ippsDFTGetSize_C_32fc(len, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, &sizeSpec, &sizeInit, &sizeBuf)
+		!= ippStsNoErr)
+		return false;
+	spec = (IppsDFTSpec_C_32fc*)ippMalloc(sizeSpec);
+	buffer = (Ipp8u*)ippMalloc(std::max(sizeBuf, 1));
+	memInit = (Ipp8u*)ippMalloc(std::max(sizeInit, 1));
+	if (ippsDFTInit_C_32fc(len, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, spec, memInit) != ippStsNoErr) {
+		freeDft(spec, buffer, memInit);
+		return false;
+	}
+	return true;
+}
+
+void freeDft(IppsDFTSpec_C_32fc*& spec, Ipp8u*& buffer, Ipp8u*& memInit)
+{
+	ippFree(spec);
+	ippFree(buffer);
+	ippFree(memInit);
+	spec = nullptr;
+	buffer = memInit = nullptr;
+}
+
+bool FastFir::init(const Ipp32fc* taps, int in_numTaps, size_t in_numChans, size_t in_factor, size_t in_maxIn,
+	int in_fftLen)
+{
+	free();
+	numTaps = in_numTaps;
+	factor = std::max<size_t>(in_factor, 1);
+	fftLen = in_fftLen > 0 ? in_fftLen : bestFftLen(numTaps, factor, in_maxIn);
+	step = fftLen > 0 ? blockStep(numTaps, factor, fftLen) : 0;
+	if (numTaps < 1 || step == 0) {
+		std::cerr << boost::format("FastFir: no block of %d fits %d taps\n") % fftLen % numTaps;
+		return false;
+	}
+	Foldflag = folds(fftLen, factor);
+	if (!initDft(fftLen, pDFTSpec, pDFTBuffer, pDFTMemInit)
+		|| (Foldflag && !initDft(fftLen / (int)factor, pDFTSpecOut, pDFTBufferOut, pDFTMemInitOut))) {
+		std::cerr << boost::format("FastFir: DFT of %d failed\n") % fftLen;
+		free();
+		return false;
+	}
+
+	// Spectrum of the zero-padded taps, with the inverse's 1 / fftLen
+	dft_in = ippsMalloc_32fc_L(fftLen);
+	dft_out = ippsMalloc_32fc_L(fftLen);
+	pTapsSpec = ippsMalloc_32fc_L(fftLen);
+	ippsZero_32fc(dft_in, fftLen);
+	ippsCopy_32fc(taps, dft_in, numTaps);
+	ippsDFTFwd_CToC_32fc(dft_in, pTapsSpec, pDFTSpec, pDFTBuffer);
+	const Ipp32fc scale = { 1.0f / fftLen, 0 };
+	ippsMulC_32fc_I(scale, pTapsSpec, fftLen);
+	if (Foldflag)
+		folded = ippsMalloc_32fc_L(fftLen / factor);
+
+	lines.resize(in_numChans);
+	for (Line& l : lines)
+		l.hist = ippsMalloc_32fc_L(std::max(numTaps - 1, 1));
+	reset();
+	return true;
+}
+
+void FastFir::free()
+{
+	for (Line& l : lines)
+		ippsFree(l.hist);
+	lines.clear();
+	freeDft(pDFTSpec, pDFTBuffer, pDFTMemInit);
+	freeDft(pDFTSpecOut, pDFTBufferOut, pDFTMemInitOut);
+	ippsFree(pTapsSpec);
+	ippsFree(dft_in);
+	ippsFree(dft_out);
+	ippsFree(folded);
+	pTapsSpec = dft_in = dft_out = folded = nullptr;
+}
+
+void FastFir::reset()
+{
+	for (size_t ch = 0; ch < lines.size(); ch++)
+		reset(ch);
+}
+
+void FastFir::reset(size_t ch)
+{
+	ippsZero_32fc(lines[ch].hist, std::max(numTaps - 1, 1));
+	lines[ch].phase = 0;
+}
+
+size_t FastFir::process(size_t ch, const Ipp32fc* in, size_t n, Ipp32fc* out)
+{
+	Line& l = lines[ch];
+	const size_t H = (size_t)numTaps - 1;
+	size_t done = 0, produced = 0;
+	while (done < n) {
+		const size_t len = std::min(step, n - done);
+		// The first input of the block that is kept, and the lead-in that
+		// puts its output on a multiple of factor
+		const size_t firstKept = (factor - l.phase) % factor;
+		const size_t lead = Foldflag ? (factor - (H + firstKept) % factor) % factor : 0;
+		if (lead > 0)
+			ippsZero_32fc(dft_in, (int)lead);
+		if (H > 0)
+			ippsCopy_32fc(l.hist, dft_in + lead, (int)H);
+		ippsCopy_32fc(in + done, dft_in + lead + H, (int)len);
+		const size_t used = lead + H + len;
+		if (used < (size_t)fftLen)
+			ippsZero_32fc(dft_in + used, fftLen - (int)used);
+		// The block's last numTaps - 1 inputs are the next one's history
+		if (H > 0)
+			ippsCopy_32fc(dft_in + lead + len, l.hist, (int)H);
+
+		ippsDFTFwd_CToC_32fc(dft_in, dft_out, pDFTSpec, pDFTBuffer);
+		ippsMul_32fc_I(pTapsSpec, dft_out, fftLen);
+		const size_t kept = len > firstKept ? (len - firstKept + factor - 1) / factor : 0;
+		if (Foldflag) {
+			// Every factor-th output is the short inverse of the spectrum's
+			// factor segments summed
+			const int M = fftLen / (int)factor;
+			ippsCopy_32fc(dft_out, folded, M);
+			for (size_t j = 1; j < factor; j++)
+				ippsAdd_32fc_I(dft_out + j * M, folded, M);
+			ippsDFTInv_CToC_32fc(folded, dft_in, pDFTSpecOut, pDFTBufferOut);
+			ippsCopy_32fc(dft_in + (lead + H + firstKept) / factor, out + produced, (int)kept);
+		}
+		else {
+			ippsDFTInv_CToC_32fc(dft_out, dft_in, pDFTSpec, pDFTBuffer);
+			if (factor == 1)
+				ippsCopy_32fc(dft_in + H, out + produced, (int)len);
+			else if (kept > 0) {
+				int outLen = 0, phase = 0;
+				ippsSampleDown_32fc(dft_in + H + firstKept, (int)(len - firstKept), out + produced, &outLen, (int)factor,
+					&phase);
+			}
+		}
+
+		l.phase = (l.phase + len) % factor;
+		done += len;
+		produced += kept;
+	}
+	return produced;
+}
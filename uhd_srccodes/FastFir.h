@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ipp.h"
+
+// IPP complex DFT of len, unscaled both ways, with its spec, init memory and
+// work buffer: the setup ReceiverClass::FFTfn() has always used, shared by
+// everything here that transforms. False, with nothing left allocated, if
+// IPP will not do len.
+bool initDft(int len, IppsDFTSpec_C_32fc*& spec, Ipp8u*& buffer, Ipp8u*& memInit);
+void freeDft(IppsDFTSpec_C_32fc*& spec, Ipp8u*& buffer, Ipp8u*& memInit);
+
+// Overlap-save fast convolution: an FIR filter run through the DFT, for
+// filters long enough that O(taps) per output costs more than two
+// transforms per block. The taps' spectrum is computed once at init and
+// cached (scaled by 1 / fftLen, so the transforms run unscaled); each
+// block of up to getStep() new samples goes in behind the numTaps - 1
+// before it, is transformed, multiplied by the spectrum and transformed
+// back, and the outputs that did not wrap around are the filter's.
+// A drop-in for ippsFIRSR / ippsFIRMR with a fresh delay line: same
+// outputs (to float rounding), one line of history per channel, any number
+// of input samples per call, every output out of the call that took its
+// input. Decimating by factor keeps the output of every input whose stream
+// index is a multiple of factor; when factor divides fftLen the spectrum is
+// folded onto fftLen / factor bins and only the kept outputs are
+// transformed back.
+// Which one is cheaper depends on taps, factor and the samples per call:
+// beatsDirect() compares the two by a count of real multiply-adds, and
+// benchFastFir() measures where they actually cross.
+class FastFir
+{
+private:
+	struct Line
+	{
+		Ipp32fc* hist = nullptr;    // last numTaps - 1 inputs
+		size_t phase = 0;           // inputs so far, modulo factor
+	};
+
+	int numTaps = 0;
+	size_t factor = 1;
+	int fftLen = 0;
+	size_t step = 0;                // new samples per block
+	bool Foldflag = false;
+	std::vector<Line> lines;
+
+	// DFT of fftLen, and of fftLen / factor for the folded inverse
+	IppsDFTSpec_C_32fc* pDFTSpec = nullptr;
+	Ipp8u* pDFTBuffer = nullptr;
+	Ipp8u* pDFTMemInit = nullptr;
+	IppsDFTSpec_C_32fc* pDFTSpecOut = nullptr;
+	Ipp8u* pDFTBufferOut = nullptr;
+	Ipp8u* pDFTMemInitOut = nullptr;
+	Ipp32fc* pTapsSpec = nullptr;   // cached spectrum of the taps
+	Ipp32fc* dft_in = nullptr;
+	Ipp32fc* dft_out = nullptr;
+	Ipp32fc* folded = nullptr;
+
+public:
+	FastFir() {}
+	~FastFir() { free(); }
+	FastFir(const FastFir&) = delete;
+	FastFir& operator=(const FastFir&) = delete;
+
+	// in_numChans channels through the in_numTaps taps, decimating by
+	// in_factor; in_maxIn (samples per call, 0 = unknown) and in_fftLen
+	// (0 = bestFftLen()) size the blocks
+	bool init(const Ipp32fc* taps, int in_numTaps, size_t in_numChans, size_t in_factor = 1, size_t in_maxIn = 0,
+		int in_fftLen = 0);
+	void free();
+	void reset();
+	void reset(size_t ch);
+	int getFftLen() const { return fftLen; }
+	size_t getStep() const { return step; }
+
+	// n input samples of channel ch; returns the outputs written
+	size_t process(size_t ch, const Ipp32fc* in, size_t n, Ipp32fc* out);
+
+	// Real multiply-adds per input sample: complex taps direct, and the
+	// transforms (2.5 N log2 N for a DFT of N) plus the spectrum product
+	// per block of new samples, with maxIn samples per call, weighted for
+	// the memory traffic direct form does not have
+	static double directCost(int numTaps, size_t factor);
+	static double fastCost(int numTaps, size_t factor, int fftLen, size_t maxIn);
+	// The power of two that makes fastCost() least, 0 if none fits
+	static int bestFftLen(int numTaps, size_t factor, size_t maxIn);
+	static bool beatsDirect(int numTaps, size_t factor, size_t maxIn);
+};
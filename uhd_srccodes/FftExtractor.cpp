@@ -0,0 +1,354 @@
+#include "FftExtractor.h"
+#include "Decimator.h"
+#include "FastFir.h"
+#include "SampleConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <boost/format.hpp>
+
+// Filter designs tried per decimation, each a tenth longer, before a
+// smaller decimation is tried
+static const int DESIGN_TRIES = 4;
+
+FftExtractor::Chan::~Chan()
+{
+	freeDft(pDFTSpec, pDFTBuffer, pDFTMemInit);
+	ippsFree(resp);
+	ippsFree(folded);
+	ippsFree(out);
+	ippsFree(nco);
+}
+
+std::unique_ptr<FftExtractor::Chan> FftExtractor::build(int id, const ExtractChannel& c, const Geometry& g)
+{
+	if (c.bandwidth <= 0 || std::fabs(c.offsetHz) + c.bandwidth / 2 > g.rate / 2) {
+		std::cerr << boost::format("Extractor: channel at %.0f Hz, %.0f Hz wide does not fit %.0f S/s\n")
+			% c.offsetHz % c.bandwidth % g.rate;
+		return nullptr;
+	}
+	// The largest decimation whose filter fits the blocks' history
+	const size_t maxTaps = (size_t)g.N - g.step + 1;
+	DecimDesign d;
+	size_t D = c.decimation > 0 ? c.decimation : (size_t)g.N / 4;
+	for (; D >= 2; D /= 2) {
+		DecimSpec spec;
+		spec.decimation = D;
+		spec.passband = c.bandwidth / 2 / (g.rate / D);
+		spec.rippleDb = c.rippleDb;
+		spec.stopDb = c.stopDb;
+		if (spec.passband < 0.5 && Decimator::singleTaps(spec) <= maxTaps) {
+			d = Decimator::designSingle(spec);
+			for (int t = 1; t < DESIGN_TRIES && d.valid() && d.stopDb < spec.stopDb; t++) {
+				const size_t longer = (size_t)(d.stages[0].taps.size() * 1.1) | 1;
+				d = longer <= maxTaps ? Decimator::designSingle(spec, longer) : DecimDesign();
+			}
+			if (d.valid() && d.stopDb >= spec.stopDb && d.stages[0].taps.size() <= maxTaps)
+				break;
+		}
+		d = DecimDesign();
+		if (c.decimation > 0)
+			break;
+	}
+	if (!d.valid() || (size_t)g.N % D != 0 || (g.N - g.step) % D != 0) {
+		std::cerr << boost::format("Extractor: no filter of %d taps or fewer takes %.0f Hz out of %.0f S/s at %.0f dB%s\n")
+			% maxTaps % c.bandwidth % g.rate % c.stopDb % (c.decimation > 0 ? str(boost::format(", decimation %d") % c.decimation) : "");
+		return nullptr;
+	}
+
+	std::unique_ptr<Chan> ch(new Chan);
+	const std::vector<double>& taps = d.stages[0].taps;
+	ch->decim = D;
+	ch->outLen = g.N / (int)D;
+	ch->groupDelay = (taps.size() - 1) / 2.0;
+	// Nearest bin, and the rest of the offset for the filter and the NCO
+	const long nearest = std::lround(c.offsetHz / g.rate * g.N);
+	ch->bin = (size_t)((nearest % g.N + g.N) % g.N);
+	const double residual = c.offsetHz - (double)nearest * g.rate / g.N;
+	const double f = -residual * D / g.rate;
+	ch->rFreq = (Ipp32f)(f - std::floor(f));
+	// Everything that folds onto the passband, a bin over for the residual
+	const double passband = c.bandwidth / 2 / (g.rate / D);
+	ch->support = std::min((int)std::ceil((1 - passband) * ch->outLen) + 1, g.N / 2 - 1);
+
+	// The filter moved onto the residual, through the big DFT, with the
+	// inverse's 1 / fftLen and the gain
+	IppsDFTSpec_C_32fc* spec = nullptr;
+	Ipp8u* buf = nullptr;
+	Ipp8u* memInit = nullptr;
+	if (!initDft(g.N, spec, buf, memInit) || !initDft(ch->outLen, ch->pDFTSpec, ch->pDFTBuffer, ch->pDFTMemInit)) {
+		std::cerr << boost::format("Extractor: DFT of %d failed\n") % g.N;
+		freeDft(spec, buf, memInit);
+		return nullptr;
+	}
+	const double scale = std::pow(10.0, g.gainDb / 20) / g.N;
+	Ipp32fc* h = ippsMalloc_32fc_L(g.N);
+	Ipp32fc* H = ippsMalloc_32fc_L(g.N);
+	ippsZero_32fc(h, g.N);
+	for (size_t m = 0; m < taps.size(); m++) {
+		const double a = IPP_2PI * residual * m / g.rate;
+		h[m] = { (Ipp32f)(scale * taps[m] * std::cos(a)), (Ipp32f)(scale * taps[m] * std::sin(a)) };
+	}
+	ippsDFTFwd_CToC_32fc(h, H, spec, buf);
+	const int S = ch->support;
+	ch->resp = ippsMalloc_32fc_L(2 * S + 1);
+	for (int r = -S; r <= S; r++)
+		ch->resp[r + S] = H[(r + g.N) % g.N];
+	ippsFree(h);
+	ippsFree(H);
+	freeDft(spec, buf, memInit);
+
+	ch->folded = ippsMalloc_32fc_L(2 * ch->outLen);   // folded, then its inverse
+	ch->out = ippsMalloc_32fc_L(g.step / D);
+	ch->nco = ippsMalloc_32fc_L(g.step / D);
+	ch->status.id = id;
+	ch->status.cfg = c;
+	ch->status.cfg.decimation = D;
+	ch->status.outRate = g.rate / D;
+	ch->status.numTaps = taps.size();
+	ch->status.stopDb = d.stopDb;
+	return ch;
+}
+
+bool FftExtractor::init(const ExtractorConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps,
+	Sink in_sink)
+{
+	free();
+	// Under the plan lock, so an addChannel() on another thread sees either
+	// the old geometry or the new one, and the generation it was built for
+	std::lock_guard<std::mutex> lock(planMut);
+	generation++;
+	cfg = in_cfg;
+	if (!cfg.enabled)
+		return true;
+	rate = in_rate;
+	numInChans = in_numChans;
+	maxBlockSamps = in_maxBlockSamps;
+	if (cfg.fftLen < 64 || (cfg.fftLen & (cfg.fftLen - 1)) != 0 || cfg.input >= numInChans || rate <= 0) {
+		std::cerr << boost::format("Extractor: cannot take input %d of %d through a DFT of %d\n")
+			% cfg.input % numInChans % cfg.fftLen;
+		return false;
+	}
+	if (!initDft(cfg.fftLen, pDFTSpec, pDFTBuffer, pDFTMemInit)) {
+		std::cerr << boost::format("Extractor: DFT of %d failed\n") % cfg.fftLen;
+		return false;
+	}
+	N = cfg.fftLen;
+	step = (size_t)N - N / 4;
+	sink = in_sink;
+	spectrum = ippsMalloc_32fc_L(N);
+	gathered = ippsMalloc_16sc_L(maxBlockSamps);
+	line = ippsMalloc_32fc_L(N);
+	Startedflag = false;
+	samplesIn = 0;
+	blocks = 0;
+
+	status.clear();
+	for (const auto& p : plan) {
+		std::unique_ptr<Chan> ch = build(p.first, p.second, geometry());
+		if (ch) {
+			status.push_back(ch->status);
+			chans.push_back(std::move(ch));
+		}
+	}
+	return true;
+}
+
+void FftExtractor::free()
+{
+	chans.clear();
+	freeDft(pDFTSpec, pDFTBuffer, pDFTMemInit);
+	ippsFree(spectrum);
+	ippsFree(gathered);
+	ippsFree(line);
+	spectrum = nullptr;
+	gathered = nullptr;
+	line = nullptr;
+	std::lock_guard<std::mutex> lock(planMut);
+	N = 0;
+	step = 0;
+	generation++;
+	adding.clear();
+	removing.clear();
+	status.clear();
+	for (const auto& p : plan) {
+		ExtractStatus s;
+		s.id = p.first;
+		s.cfg = p.second;
+		status.push_back(s);
+	}
+}
+
+int FftExtractor::addChannel(const ExtractChannel& c)
+{
+	// Designed here, so the processing thread only swaps it in, and outside
+	// the plan lock, so it never waits out a design. A design for a geometry
+	// that init() or free() replaced meanwhile is thrown away and redone.
+	std::unique_lock<std::mutex> lock(planMut);
+	const int id = nextId++;
+	while (N > 0) {
+		const Geometry g = geometry();
+		const uint64_t gen = generation;
+		lock.unlock();
+		std::unique_ptr<Chan> ch = build(id, c, g);
+		lock.lock();
+		if (generation != gen)
+			continue;
+		if (!ch)
+			return -1;
+		plan.emplace_back(id, c);
+		status.push_back(ch->status);
+		adding.push_back(std::move(ch));
+		return id;
+	}
+	plan.emplace_back(id, c);
+	ExtractStatus s;
+	s.id = id;
+	s.cfg = c;
+	status.push_back(s);
+	return id;
+}
+
+void FftExtractor::removeChannel(int id)
+{
+	std::lock_guard<std::mutex> lock(planMut);
+	auto p = std::find_if(plan.begin(), plan.end(), [id](const std::pair<int, ExtractChannel>& e) { return e.first == id; });
+	if (p == plan.end())
+		return;
+	plan.erase(p);
+	status.erase(std::remove_if(status.begin(), status.end(), [id](const ExtractStatus& s) { return s.id == id; }),
+		status.end());
+	auto a = std::find_if(adding.begin(), adding.end(), [id](const std::unique_ptr<Chan>& c) { return c->status.id == id; });
+	if (a != adding.end())
+		adding.erase(a);
+	else
+		removing.push_back(id);
+}
+
+void FftExtractor::clearChannels()
+{
+	std::lock_guard<std::mutex> lock(planMut);
+	for (const auto& p : plan)
+		removing.push_back(p.first);
+	plan.clear();
+	adding.clear();
+	status.clear();
+}
+
+std::vector<ExtractStatus> FftExtractor::getChannels()
+{
+	std::lock_guard<std::mutex> lock(planMut);
+	return status;
+}
+
+void FftExtractor::restart(uint64_t in_start)
+{
+	// Blocks start on multiples of fftLen / 4, and so on every decimation's
+	// grid, behind a history of silence
+	const uint64_t history = (uint64_t)N - step;
+	const uint64_t alignAt = (in_start + history - 1) / history * history;
+	ippsZero_32fc(line, (int)history);
+	have = (size_t)history;
+	lineBase = alignAt - history;
+}
+
+void FftExtractor::runBlock()
+{
+	// Plan changes since the last block
+	{
+		std::lock_guard<std::mutex> lock(planMut);
+		for (int id : removing)
+			chans.erase(std::remove_if(chans.begin(), chans.end(),
+				[id](const std::unique_ptr<Chan>& c) { return c->status.id == id; }), chans.end());
+		removing.clear();
+		for (auto& ch : adding)
+			chans.push_back(std::move(ch));
+		adding.clear();
+	}
+
+	ippsDFTFwd_CToC_32fc(line, spectrum, pDFTSpec, pDFTBuffer);
+	const size_t history = (size_t)N - step;
+	for (auto& chp : chans) {
+		Chan& ch = *chp;
+		// The passed bins, weighted and folded onto the output's
+		const int S = ch.support, L = ch.outLen;
+		Ipp32fc* folded = ch.folded;
+		ippsZero_32fc(folded, L);
+		for (int r = -S; r <= S; r++) {
+			const Ipp32fc x = spectrum[(ch.bin + N + r) % N];
+			const Ipp32fc w = ch.resp[r + S];
+			Ipp32fc& y = folded[((r % L) + L) % L];
+			y.re += x.re * w.re - x.im * w.im;
+			y.im += x.re * w.im + x.im * w.re;
+		}
+		ippsDFTInv_CToC_32fc(folded, folded + L, ch.pDFTSpec, ch.pDFTBuffer);
+
+		// The outputs that did not wrap, onto the stream's phase: the bin
+		// shift referred to sample 0 rather than the block's first, and the
+		// NCO for the residual
+		const size_t count = step / ch.decim;
+		const uint64_t first = (lineBase + history) / ch.decim;
+		const double binTurns = (double)((ch.bin * (lineBase % (uint64_t)N)) % (uint64_t)N) / N;
+		double turns = (double)ch.rFreq * (double)first - binTurns;
+		turns -= std::floor(turns);
+		Ipp32f phase = (Ipp32f)(IPP_2PI * turns);
+		if (phase >= (Ipp32f)IPP_2PI)
+			phase = 0;
+		ippsTone_32fc(ch.nco, (int)count, 1.0f, ch.rFreq, &phase, ippAlgHintAccurate);
+		ippsMul_32fc(folded + L + history / ch.decim, ch.nco, ch.out, (int)count);
+
+		Ipp32f norm = 0;
+		ippsNorm_L2_32f((const Ipp32f*)ch.out, (int)(2 * count), &norm);
+		ch.status.powerDb = 10 * std::log10((double)norm * norm / count + 1e-30);
+		ch.status.samplesOut += count;
+		if (sink)
+			sink(ch.status.id, ch.out, count, first);
+	}
+	{
+		std::lock_guard<std::mutex> lock(planMut);
+		for (ExtractStatus& s : status)
+			for (const auto& ch : chans)
+				if (ch->status.id == s.id) {
+					s.powerDb = ch->status.powerDb;
+					s.samplesOut = ch->status.samplesOut;
+				}
+	}
+
+	ippsMove_32fc(line + step, line, (int)history);
+	have = history;
+	lineBase += step;
+	blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FftExtractor::process(const SampleBlock& in)
+{
+	if (N == 0 || in.nsamps > maxBlockSamps)
+		return;
+	if (!Startedflag || in.sampOffset != nextIn) {
+		restart(in.sampOffset);
+		Startedflag = true;
+	}
+	nextIn = in.sampOffset + in.nsamps;
+
+	// What is left of the block from the restart point on, behind the line
+	const uint64_t lineEnd = lineBase + have;
+	const size_t from = lineEnd > in.sampOffset ? (size_t)std::min<uint64_t>(lineEnd - in.sampOffset, in.nsamps) : 0;
+	const size_t n = in.nsamps - from;
+	samplesIn.fetch_add(n, std::memory_order_relaxed);
+	const Ipp16sc* src;
+	if (in.interleaved()) {
+		for (size_t i = 0; i < n; i++)
+			gathered[i] = in.data[(from + i) * in.numChans + cfg.input];
+		src = gathered;
+	}
+	else
+		src = in.chan(cfg.input) + from;
+	for (size_t done = 0; done < n;) {
+		const size_t take = std::min((size_t)N - have, n - done);
+		widenSc16To32fc(src + done, line + have, take);
+		have += take;
+		done += take;
+		if (have == (size_t)N)
+			runBlock();
+	}
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ipp.h"
+#include "SampleRing.h"
+
+// Fast-convolution channel extractor: any number of channels of any width
+// and centre out of one input channel, for channel plans the uniform filter
+// bank (Channelizer.h) does not fit. The input goes through one overlap-save
+// forward DFT of fftLen, three quarters of it new samples per block; each
+// channel then takes only the bins its filter passes, weights them by the
+// filter's response, folds them onto fftLen / decimation bins and runs a
+// short inverse DFT there, which gives its output at its own rate
+// rate / decimation. The big transform is shared, so each channel costs a
+// small DFT and a few times its output bins in multiplies, not a DDC's
+// filter at the full input rate.
+// A channel is what a DDC shifting offsetHz to 0 Hz would give through a
+// single FIR (Decimator::designSingle()) of at most fftLen / 4 + 1 taps:
+// the bin nearest offsetHz is shifted down in the spectrum, the filter is
+// moved onto the rest of the offset and an NCO at the output rate takes that
+// out, all referred to the stream's sample 0 so blocks join up. decimation
+// is a power of two up to fftLen / 4, so every channel's outputs fall on
+// every block's grid; narrow channels need fftLen long enough for their
+// filters.
+// Channels can be added and removed while samples flow: the plan changes
+// between blocks, a new channel's first block already has the full history
+// behind it, and no other channel sees any difference. Outputs go to the
+// sink, on the processing thread, one call per channel and block.
+
+struct ExtractChannel
+{
+	double offsetHz = 0;    // band centre relative to the tuned frequency
+	double bandwidth = 0;   // passband, Hz
+	size_t decimation = 0;  // 0 = the largest whose filter fits fftLen
+	double rippleDb = 0.1;
+	double stopDb = 80;
+};
+
+struct ExtractorConfig
+{
+	bool enabled = false;
+	size_t input = 0;       // input channel
+	int fftLen = 16384;     // power of two
+	double gainDb = 0;
+};
+
+// A channel as planned, for display
+struct ExtractStatus
+{
+	int id = 0;
+	ExtractChannel cfg;
+	double outRate = 0;
+	size_t numTaps = 0;
+	double stopDb = 0;      // as measured on the filter
+	double powerDb = -999;  // dBFS over the last block
+	uint64_t samplesOut = 0;
+};
+
+class FftExtractor
+{
+public:
+	// n outputs of channel id, output o standing for input o * decimation
+	typedef std::function<void(int id, const Ipp32fc* samples, size_t n, uint64_t first)> Sink;
+
+private:
+	struct Chan
+	{
+		ExtractStatus status;
+		size_t decim = 0;
+		int outLen = 0;                  // fftLen / decim
+		size_t bin = 0;                  // nearest offsetHz
+		int support = 0;                 // bins each side of it the filter passes
+		double groupDelay = 0;           // input samples
+		Ipp32fc* resp = nullptr;         // filter response at bin - support .. bin + support, scaled
+		Ipp32f rFreq = 0;                // NCO, cycles per output sample
+		IppsDFTSpec_C_32fc* pDFTSpec = nullptr;   // inverse, outLen
+		Ipp8u* pDFTBuffer = nullptr;
+		Ipp8u* pDFTMemInit = nullptr;
+		Ipp32fc* folded = nullptr;
+		Ipp32fc* out = nullptr;
+		Ipp32fc* nco = nullptr;
+
+		~Chan();
+	};
+
+	ExtractorConfig cfg;
+	double rate = 0;
+	size_t numInChans = 0;
+	size_t maxBlockSamps = 0;
+	int N = 0;
+	size_t step = 0;                     // new samples per block
+	Sink sink;
+
+	IppsDFTSpec_C_32fc* pDFTSpec = nullptr;   // forward, fftLen
+	Ipp8u* pDFTBuffer = nullptr;
+	Ipp8u* pDFTMemInit = nullptr;
+	Ipp32fc* spectrum = nullptr;
+	Ipp16sc* gathered = nullptr;
+	Ipp32fc* line = nullptr;             // history then new samples, line[0] being input lineBase
+	size_t have = 0;
+	uint64_t lineBase = 0;
+	bool Startedflag = false;
+	uint64_t nextIn = 0;
+
+	// The plan: specs to build on init(), and while running the changes
+	// for the processing thread to pick up at its next block
+	std::mutex planMut;
+	std::vector<std::pair<int, ExtractChannel>> plan;     // guarded by planMut
+	std::vector<std::unique_ptr<Chan>> adding;            // guarded by planMut
+	std::vector<int> removing;                            // guarded by planMut
+	std::vector<ExtractStatus> status;                    // guarded by planMut
+	int nextId = 1;                                       // guarded by planMut
+	uint64_t generation = 0;                              // bumped by init() and free(), guarded by planMut
+	std::vector<std::unique_ptr<Chan>> chans;             // processing thread only
+
+	std::atomic<uint64_t> samplesIn{ 0 };
+	std::atomic<uint64_t> blocks{ 0 };
+
+	// What a channel is designed for, taken under planMut
+	struct Geometry
+	{
+		int N;
+		size_t step;
+		double rate;
+		double gainDb;
+	};
+	Geometry geometry() const { return { N, step, rate, cfg.gainDb }; }
+	std::unique_ptr<Chan> build(int id, const ExtractChannel& c, const Geometry& g);
+	void restart(uint64_t in_start);
+	void runBlock();
+
+public:
+	FftExtractor() {}
+	~FftExtractor() { free(); }
+	FftExtractor(const FftExtractor&) = delete;
+	FftExtractor& operator=(const FftExtractor&) = delete;
+
+	// For blocks of in_numChans channels at in_rate, at most in_maxBlockSamps
+	// long; builds every channel added so far
+	bool init(const ExtractorConfig& in_cfg, double in_rate, size_t in_numChans, size_t in_maxBlockSamps,
+		Sink in_sink = Sink());
+	void free();
+	bool isEnabled() const { return N > 0; }
+	const ExtractorConfig& getConfig() const { return cfg; }
+
+	// Any thread. Returns the channel's id, or -1 if it does not fit the
+	// running extractor; before init() every channel is taken and checked then
+	int addChannel(const ExtractChannel& c);
+	void removeChannel(int id);
+	void clearChannels();
+	std::vector<ExtractStatus> getChannels();
+
+	// Next input block, in stream order
+	void process(const SampleBlock& in);
+
+	int getFftLen() const { return N; }
+	uint64_t getSamplesIn() const { return samplesIn.load(std::memory_order_relaxed); }
+	uint64_t getBlocks() const { return blocks.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,102 @@
+#include "FileSource.h"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <boost/format.hpp>
+
+FileSource::FileSource(const std::string& in_basename, bool in_paced, bool in_loop)
+	: basename(in_basename), paced(in_paced), loop(in_loop)
+{
+	if (!reader.open(basename)) {
+		std::cerr << boost::format("Could not open %s.idx for replay\n") % basename;
+		return;
+	}
+	RecordIndex& index = reader.getIndex();
+	rate = index.getRate();
+	numChans = reader.getNumChans();
+	RecordIndexEntry first, last;
+	if (index.getNumBlocks() == 0 || !index.entry(0, 0, first) || !index.entry(index.getNumBlocks() - 1, 0, last)) {
+		std::cerr << boost::format("%s has no samples to replay\n") % basename;
+		return;
+	}
+	streamStart = first.sampOffset;
+	streamSpan = last.sampOffset + last.nsamps - first.sampOffset;
+	Openflag = true;
+}
+
+void FileSource::startStream()
+{
+	fileSamp = 0;
+	passes = 0;
+	haveBlock = false;
+	Finishedflag = false;
+	tStart = std::chrono::steady_clock::now();
+	Streamingflag = true;
+}
+
+bool FileSource::findBlock()
+{
+	if (fileSamp >= reader.getNumSamps()) {
+		if (!loop)
+			return false;
+		// Time keeps running across the wrap, like a radio would
+		fileSamp = 0;
+		passes++;
+		haveBlock = false;
+	}
+	if (!haveBlock || fileSamp >= block.fileSample + block.nsamps) {
+		RecordIndex& index = reader.getIndex();
+		haveBlock = index.entry(index.findFileSample(fileSamp), 0, block);
+	}
+	return haveBlock;
+}
+
+size_t FileSource::recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout)
+{
+	md.reset();
+	if (Streamingflag && Openflag && !Finishedflag && !findBlock())
+		Finishedflag = true;
+	if (!Streamingflag || Finishedflag || !Openflag) {
+		std::this_thread::sleep_for(std::chrono::duration<double>(Finishedflag ? 0.0 : timeout));
+		md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+		return 0;
+	}
+
+	// Up to the end of the block, which places the samples in the stream
+	const uint64_t inBlock = fileSamp - block.fileSample;
+	const size_t n = (size_t)std::min<uint64_t>(nsamps, block.nsamps - inBlock);
+	const uint64_t streamSamp = passes * streamSpan + (block.sampOffset - streamStart) + inBlock;
+	if (paced) {
+		auto due = tStart + std::chrono::duration<double>((streamSamp + n) / rate);
+		std::this_thread::sleep_until(due);
+	}
+
+	size_t got;
+	if (numChans == 1)
+		got = reader.read(fileSamp, n, static_cast<Ipp16sc*>(buffs[0]));
+	else {
+		// RecordReader interleaves the channels; recv() hands them out planar
+		scratch.resize(n * numChans);
+		got = reader.read(fileSamp, n, scratch.data());
+		const uint32_t* src = reinterpret_cast<const uint32_t*>(scratch.data());
+		for (size_t c = 0; c < numChans; c++) {
+			uint32_t* out = static_cast<uint32_t*>(buffs[c]);
+			for (size_t i = 0; i < got; i++)
+				out[i] = src[i * numChans + c];
+		}
+	}
+	if (got == 0) {
+		std::cerr << boost::format("Replay of %s stopped: read failed at sample %d\n") % basename % fileSamp;
+		Finishedflag = true;
+		md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+		return 0;
+	}
+
+	DeviceTime t = block.hasTime() ? block.time().plus(inBlock / rate) : DeviceTime().plus((block.sampOffset + inBlock) / rate);
+	t = t.plus(passes * streamSpan / rate);
+	md.has_time_spec = true;
+	md.time_spec = uhd::time_spec_t(t.secs, t.frac);
+	md.error_code = uhd::rx_metadata_t::ERROR_CODE_NONE;
+	fileSamp += got;
+	return got;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "SampleSource.h"
+#include "RecordIndex.h"
+
+// Replays a recording written by RecordWriter, of any layout and format
+// (single or per-channel files, segmented, .iqz, SigMF), through its .idx:
+// rate and channel count come from the index, and so does device time. A
+// recv() never crosses a block, so each sample gets the time of its own
+// block's entry, and where samples were lost or shed the next block's time
+// jumps as it did at the radio. Recordings without timestamps start at
+// zero. With pacing on, samples are released at the recorded rate in
+// wall-clock time, gaps included; otherwise as fast as the disk allows.
+class FileSource : public SampleSource
+{
+private:
+	RecordReader reader;
+	std::string basename;
+	double rate = 0;
+	size_t numChans = 1;
+	bool paced;
+	bool loop;
+	bool Openflag = false;
+
+	bool Streamingflag = false;
+	bool Finishedflag = false;
+	uint64_t fileSamp = 0;      // next recording sample
+	uint64_t streamStart = 0;   // stream offset of the first recorded sample
+	uint64_t streamSpan = 0;    // stream samples of one pass, gaps included
+	uint64_t passes = 0;        // completed loops
+	RecordIndexEntry block;     // entry of the block holding fileSamp
+	bool haveBlock = false;
+	std::vector<Ipp16sc> scratch; // interleaved samples of several channels
+	std::chrono::steady_clock::time_point tStart;
+
+	// Entry of the block holding fileSamp, wrapping around when looping;
+	// false at the end of the recording
+	bool findBlock();
+
+public:
+	// in_basename is the recording name without extensions
+	FileSource(const std::string& in_basename, bool in_paced = true, bool in_loop = false);
+
+	bool isOpen() const { return Openflag; }
+	void startStream() override;
+	void stopStream() override { Streamingflag = false; }
+	size_t recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout) override;
+
+	double getRate() const override { return rate; }
+	size_t getNumChannels() const override { return numChans; }
+	size_t getMaxNumSamps() const override { return 1 << 16; }
+	bool isFinished() const override { return Finishedflag; }
+};
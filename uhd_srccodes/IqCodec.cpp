@@ -0,0 +1,519 @@
+#include "IqCodec.h"
+#include "SampleConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline int bitWidth(uint32_t v)
+{
+	if (v == 0)
+		return 0;
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanReverse(&idx, v);
+	return (int)idx + 1;
+#else
+	return 32 - __builtin_clz(v);
+#endif
+}
+
+static inline int trailingZeros(uint32_t v)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return (int)idx;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+// Little-endian bit packing; every group ends on a byte boundary
+static uint8_t* pack(const uint32_t* v, size_t count, int w, uint8_t* out)
+{
+	uint64_t acc = 0;
+	int n = 0;
+	for (size_t k = 0; k < count; k++) {
+		acc |= (uint64_t)v[k] << n;
+		n += w;
+		if (n >= 32) {
+			out[0] = (uint8_t)acc;
+			out[1] = (uint8_t)(acc >> 8);
+			out[2] = (uint8_t)(acc >> 16);
+			out[3] = (uint8_t)(acc >> 24);
+			out += 4;
+			acc >>= 32;
+			n -= 32;
+		}
+	}
+	for (; n > 0; n -= 8) {
+		*out++ = (uint8_t)acc;
+		acc >>= 8;
+	}
+	return out;
+}
+
+static const uint8_t* unpack(const uint8_t* in, const uint8_t* end, uint32_t* v, size_t count, int w)
+{
+	if ((size_t)(end - in) < (count * w + 7) / 8)
+		return nullptr;
+	const uint32_t mask = w == 0 ? 0 : 0xFFFFFFFFu >> (32 - w);
+	uint64_t acc = 0;
+	int n = 0;
+	for (size_t k = 0; k < count; k++) {
+		while (n < w) {
+			acc |= (uint64_t)*in++ << n;
+			n += 8;
+		}
+		v[k] = (uint32_t)acc & mask;
+		acc >>= w;
+		n -= w;
+	}
+	return in;
+}
+
+static inline void writeU32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t readU32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#define BFP_CHUNK 512   // samples per pass through the float scratch buffers
+
+const char* iqzCodecName(IqzCodec codec)
+{
+	switch (codec) {
+	case IQZ_LOSSLESS: return "lossless";
+	case IQZ_BFP8: return "bfp8";
+	case IQZ_BFP4: return "bfp4";
+	default: return "unknown";
+	}
+}
+
+double IqzQuality::snrDb() const
+{
+	return errEnergy > 0 && sigEnergy > 0 ? 10.0 * std::log10(sigEnergy / errEnergy) : 0;
+}
+
+static size_t bfpChannelBytes(int bits, size_t nsamps)
+{
+	return sizeof(float) + (bits == 8 ? 2 * nsamps : nsamps);
+}
+
+// Scale, then I and Q of every sample rounded to bits bits (4-bit pairs
+// share a byte, I in the low nibble)
+static size_t bfpEncodeChannel(const Ipp16sc* src, size_t nsamps, size_t stride, int bits, uint8_t* dst,
+	IqzQuality* quality)
+{
+	const Ipp16s* s = reinterpret_cast<const Ipp16s*>(src);
+	Ipp16s gather[2 * BFP_CHUNK];
+	Ipp32f f[2 * BFP_CHUNK], g[2 * BFP_CHUNK];
+	Ipp8s q[2 * BFP_CHUNK];
+
+	// The block peak sets the scale, so nothing clips
+	int peak = 0;
+	if (stride == 1) {
+		Ipp16s m = 0;
+		ippsMaxAbs_16s(s, (int)(2 * nsamps), &m);
+		peak = m;
+	}
+	else {
+		for (size_t i = 0; i < nsamps; i++)
+			peak = std::max(peak, std::max(std::abs((int)s[2 * i * stride]), std::abs((int)s[2 * i * stride + 1])));
+	}
+	const int qmax = (1 << (bits - 1)) - 1;
+	const float scale = peak > 0 ? (float)peak / qmax : 1.0f;
+	memcpy(dst, &scale, sizeof(scale));
+	uint8_t* out = dst + sizeof(scale);
+
+	for (size_t from = 0; from < nsamps; from += BFP_CHUNK) {
+		const int k = (int)std::min<size_t>(BFP_CHUNK, nsamps - from);
+		const Ipp16s* c = s + 2 * from * stride;
+		if (stride != 1) {
+			for (int i = 0; i < k; i++) {
+				gather[2 * i] = c[2 * i * stride];
+				gather[2 * i + 1] = c[2 * i * stride + 1];
+			}
+			c = gather;
+		}
+		ippsConvert_16s32f(c, f, 2 * k);
+		ippsMulC_32f(f, 1.0f / scale, g, 2 * k);
+		ippsConvert_32f8s_Sfs(g, q, 2 * k, ippRndNear, 0);
+		if (bits == 8) {
+			memcpy(out, q, 2 * k);
+			out += 2 * k;
+		}
+		else {
+			for (int i = 0; i < k; i++)
+				out[i] = (uint8_t)((q[2 * i] & 0x0F) | (q[2 * i + 1] << 4));
+			out += k;
+		}
+		if (quality) {
+			Ipp32f sigNorm = 0, errNorm = 0;
+			ippsConvert_8s32f(q, g, 2 * k);
+			ippsMulC_32f_I(scale, g, 2 * k);
+			ippsNorm_L2_32f(f, 2 * k, &sigNorm);
+			ippsNormDiff_L2_32f(f, g, 2 * k, &errNorm);
+			quality->sigEnergy += (double)sigNorm * sigNorm;
+			quality->errEnergy += (double)errNorm * errNorm;
+		}
+	}
+	return out - dst;
+}
+
+// Inverse of bfpEncodeChannel() into dst16 (rounded to sc16) or dst32 (full scale 1.0)
+static bool bfpDecodeChannel(const uint8_t* src, size_t srcBytes, int bits, size_t nsamps, size_t stride,
+	Ipp16sc* dst16, Ipp32fc* dst32)
+{
+	if (srcBytes != bfpChannelBytes(bits, nsamps))
+		return false;
+	float scale;
+	memcpy(&scale, src, sizeof(scale));
+	const uint8_t* in = src + sizeof(scale);
+	Ipp8s q[2 * BFP_CHUNK];
+	Ipp32f f[2 * BFP_CHUNK];
+	Ipp16s s16[2 * BFP_CHUNK];
+
+	for (size_t from = 0; from < nsamps; from += BFP_CHUNK) {
+		const int k = (int)std::min<size_t>(BFP_CHUNK, nsamps - from);
+		if (bits == 8) {
+			memcpy(q, in, 2 * k);
+			in += 2 * k;
+		}
+		else {
+			for (int i = 0; i < k; i++) {
+				q[2 * i] = (Ipp8s)(in[i] << 4) >> 4;
+				q[2 * i + 1] = (Ipp8s)in[i] >> 4;
+			}
+			in += k;
+		}
+		ippsConvert_8s32f(q, f, 2 * k);
+		if (dst32) {
+			Ipp32f* d = reinterpret_cast<Ipp32f*>(dst32 + from * stride);
+			if (stride == 1)
+				ippsMulC_32f(f, scale / 32768.0f, d, 2 * k);
+			else {
+				ippsMulC_32f_I(scale / 32768.0f, f, 2 * k);
+				for (int i = 0; i < k; i++) {
+					d[2 * i * stride] = f[2 * i];
+					d[2 * i * stride + 1] = f[2 * i + 1];
+				}
+			}
+		}
+		else {
+			Ipp16s* d = reinterpret_cast<Ipp16s*>(dst16 + from * stride);
+			ippsMulC_32f_I(scale, f, 2 * k);
+			ippsConvert_32f16s_Sfs(f, stride == 1 ? d : s16, 2 * k, ippRndNear, 0);
+			if (stride != 1) {
+				for (int i = 0; i < k; i++) {
+					d[2 * i * stride] = s16[2 * i];
+					d[2 * i * stride + 1] = s16[2 * i + 1];
+				}
+			}
+		}
+	}
+	return true;
+}
+
+size_t iqzMaxChannelBytes(size_t nsamps)
+{
+	// Shift byte, then per component one byte per group and up to 18 bits per value
+	const size_t groups = (nsamps + IQZ_GROUP - 1) / IQZ_GROUP;
+	return 1 + 2 * (groups + (nsamps * 18 + 7) / 8 + groups);
+}
+
+size_t iqzEncodeChannel(const Ipp16sc* src, size_t nsamps, size_t stride, uint8_t* dst)
+{
+	const Ipp16s* s = reinterpret_cast<const Ipp16s*>(src);
+	const size_t step = 2 * stride;
+
+	// Low bits that are zero in every sample (sc8/sc12 on the wire)
+	uint32_t orAll = 0;
+	for (size_t i = 0; i < nsamps; i++)
+		orAll |= (uint16_t)s[i * step] | (uint16_t)s[i * step + 1];
+	uint8_t* out = dst;
+	const int shift = orAll == 0 ? 16 : trailingZeros(orAll);
+	*out++ = (uint8_t)shift;
+	if (shift == 16)
+		return 1;
+
+	uint32_t r[3][IQZ_GROUP];
+	for (int comp = 0; comp < 2; comp++) {
+		const Ipp16s* x = s + comp;
+		int32_t p1 = 0, p2 = 0;
+		for (size_t g = 0; g < nsamps; g += IQZ_GROUP) {
+			const size_t count = std::min<size_t>(IQZ_GROUP, nsamps - g);
+			uint32_t o0 = 0, o1 = 0, o2 = 0;
+			for (size_t k = 0; k < count; k++) {
+				int32_t v = x[(g + k) * step] >> shift;
+				r[0][k] = zigzag(v);
+				r[1][k] = zigzag(v - p1);
+				r[2][k] = zigzag(v - 2 * p1 + p2);
+				o0 |= r[0][k];
+				o1 |= r[1][k];
+				o2 |= r[2][k];
+				p2 = p1;
+				p1 = v;
+			}
+			// Cheapest predictor, the simpler one on a tie
+			int w0 = bitWidth(o0), w1 = bitWidth(o1), w2 = bitWidth(o2);
+			int pred = 0, w = w0;
+			if (w1 < w) {
+				pred = 1;
+				w = w1;
+			}
+			if (w2 < w) {
+				pred = 2;
+				w = w2;
+			}
+			*out++ = (uint8_t)(w | (pred << 5));
+			out = pack(r[pred], count, w, out);
+		}
+	}
+	return out - dst;
+}
+
+size_t iqzDecodeChannel(const uint8_t* src, size_t srcBytes, Ipp16sc* dst, size_t nsamps, size_t stride)
+{
+	const uint8_t* in = src;
+	const uint8_t* end = src + srcBytes;
+	Ipp16s* d = reinterpret_cast<Ipp16s*>(dst);
+	const size_t step = 2 * stride;
+	if (srcBytes < 1)
+		return 0;
+	const int shift = *in++;
+	if (shift == 16) {
+		for (size_t i = 0; i < nsamps; i++)
+			d[i * step] = d[i * step + 1] = 0;
+		return 1;
+	}
+	if (shift > 16)
+		return 0;
+
+	uint32_t r[IQZ_GROUP];
+	for (int comp = 0; comp < 2; comp++) {
+		Ipp16s* x = d + comp;
+		int32_t p1 = 0, p2 = 0;
+		for (size_t g = 0; g < nsamps; g += IQZ_GROUP) {
+			const size_t count = std::min<size_t>(IQZ_GROUP, nsamps - g);
+			if (in >= end)
+				return 0;
+			const int w = *in & 0x1F, pred = *in >> 5;
+			in++;
+			if (w > 18 || pred > 2 || (in = unpack(in, end, r, count, w)) == nullptr)
+				return 0;
+			for (size_t k = 0; k < count; k++) {
+				int32_t guess = pred == 0 ? 0 : pred == 1 ? p1 : 2 * p1 - p2;
+				int32_t v = guess + unzigzag(r[k]);
+				x[(g + k) * step] = (Ipp16s)(uint16_t)((uint32_t)v << shift);
+				p2 = p1;
+				p1 = v;
+			}
+		}
+	}
+	return in - src;
+}
+
+void iqzEncodeFrame(const IqzFrameHeader& hdr, const Ipp16sc* src, size_t stride, size_t chanPitch,
+	std::vector<uint8_t>& out, IqzQuality* quality)
+{
+	const IqzCodec codec = iqzCodec(hdr);
+	const size_t start = out.size();
+	out.resize(start + sizeof(IqzFrameHeader) + hdr.numChans * (4 + iqzMaxChannelBytes(hdr.nsamps)));
+	uint8_t* payload = out.data() + start + sizeof(IqzFrameHeader);
+	uint8_t* p = payload;
+	for (size_t c = 0; c < hdr.numChans; c++) {
+		size_t n = codec == IQZ_LOSSLESS ? iqzEncodeChannel(src + c * chanPitch, hdr.nsamps, stride, p + 4)
+			: bfpEncodeChannel(src + c * chanPitch, hdr.nsamps, stride, codec == IQZ_BFP8 ? 8 : 4, p + 4, quality);
+		writeU32(p, (uint32_t)n);
+		p += 4 + n;
+	}
+	IqzFrameHeader h = hdr;
+	h.magic = IQZ_MAGIC;
+	h.payloadBytes = (uint32_t)(p - payload);
+	memcpy(out.data() + start, &h, sizeof(h));
+	out.resize(p - out.data());
+}
+
+// Channel payloads of a frame: calls decode(c, data, bytes) for each
+template <typename F>
+static bool forEachChannel(const IqzFrameHeader& hdr, const uint8_t* payload, F decode)
+{
+	const uint8_t* p = payload;
+	const uint8_t* end = payload + hdr.payloadBytes;
+	for (size_t c = 0; c < hdr.numChans; c++) {
+		if (end - p < 4)
+			return false;
+		size_t n = readU32(p);
+		p += 4;
+		if (n > (size_t)(end - p) || !decode(c, p, n))
+			return false;
+		p += n;
+	}
+	return true;
+}
+
+bool iqzDecodeFrame(const IqzFrameHeader& hdr, const uint8_t* payload, Ipp16sc* dst)
+{
+	const IqzCodec codec = iqzCodec(hdr);
+	if (codec > IQZ_BFP4)
+		return false;
+	return forEachChannel(hdr, payload, [&](size_t c, const uint8_t* p, size_t n) {
+		if (codec == IQZ_LOSSLESS)
+			return iqzDecodeChannel(p, n, dst + c, hdr.nsamps, hdr.numChans) == n;
+		return bfpDecodeChannel(p, n, codec == IQZ_BFP8 ? 8 : 4, hdr.nsamps, hdr.numChans, dst + c, nullptr);
+	});
+}
+
+bool iqzDecodeFrame32fc(const IqzFrameHeader& hdr, const uint8_t* payload, Ipp32fc* dst)
+{
+	const IqzCodec codec = iqzCodec(hdr);
+	if (codec == IQZ_LOSSLESS) {
+		std::vector<Ipp16sc> tmp((size_t)hdr.nsamps * hdr.numChans);
+		if (!iqzDecodeFrame(hdr, payload, tmp.data()))
+			return false;
+		widenSc16To32fc(tmp.data(), dst, tmp.size());
+		return true;
+	}
+	if (codec > IQZ_BFP4)
+		return false;
+	return forEachChannel(hdr, payload, [&](size_t c, const uint8_t* p, size_t n) {
+		return bfpDecodeChannel(p, n, codec == IQZ_BFP8 ? 8 : 4, hdr.nsamps, hdr.numChans, nullptr, dst + c);
+	});
+}
+
+bool IqzReader::open(const std::string& path)
+{
+	infile.close();
+	infile.clear();
+	frames.clear();
+	numSamps = 0;
+	infile.open(path, std::ios::in | std::ios::binary);
+	if (!infile.is_open()) {
+		std::cerr << boost::format("Could not open %s\n") % path;
+		return false;
+	}
+	infile.seekg(0, std::ios::end);
+	const uint64_t size = (uint64_t)infile.tellg();
+
+	// A torn last frame (capture killed mid-write) is left out
+	uint64_t offset = 0;
+	Frame f;
+	while (offset + sizeof(IqzFrameHeader) <= size) {
+		infile.seekg((std::streamoff)offset);
+		if (!infile.read(reinterpret_cast<char*>(&f.hdr), sizeof(f.hdr)) || f.hdr.magic != IQZ_MAGIC
+			|| offset + sizeof(IqzFrameHeader) + f.hdr.payloadBytes > size)
+			break;
+		f.fileOffset = offset;
+		frames.push_back(f);
+		numSamps += f.hdr.nsamps;
+		offset += sizeof(IqzFrameHeader) + f.hdr.payloadBytes;
+	}
+	infile.clear();
+	if (frames.empty()) {
+		std::cerr << boost::format("%s holds no .iqz frames\n") % path;
+		return false;
+	}
+	numChans = frames[0].hdr.numChans;
+	return true;
+}
+
+size_t IqzReader::findFrame(uint64_t s) const
+{
+	auto it = std::upper_bound(frames.begin(), frames.end(), s,
+		[](uint64_t v, const Frame& f) { return v < f.hdr.fileSample; });
+	return it == frames.begin() ? 0 : (size_t)(it - frames.begin()) - 1;
+}
+
+bool IqzReader::loadFrame(size_t i)
+{
+	const Frame& f = frames[i];
+	payload.resize(f.hdr.payloadBytes);
+	infile.seekg((std::streamoff)(f.fileOffset + sizeof(IqzFrameHeader)));
+	if (!infile.read(reinterpret_cast<char*>(payload.data()), payload.size())) {
+		infile.clear();
+		return false;
+	}
+	return true;
+}
+
+bool IqzReader::readFrame(size_t i, Ipp16sc* dst)
+{
+	return loadFrame(i) && iqzDecodeFrame(frames[i].hdr, payload.data(), dst);
+}
+
+bool IqzReader::readFrame(size_t i, Ipp32fc* dst)
+{
+	return loadFrame(i) && iqzDecodeFrame32fc(frames[i].hdr, payload.data(), dst);
+}
+
+template <typename T>
+size_t IqzReader::readSpan(uint64_t first, size_t n, T* dst, std::vector<T>& buf)
+{
+	size_t done = 0;
+	for (size_t i = findFrame(first); i < frames.size() && done < n; i++) {
+		const IqzFrameHeader& h = frames[i].hdr;
+		uint64_t pos = first + done;
+		if (pos < h.fileSample || pos >= h.fileSample + h.nsamps)
+			break;
+		buf.resize((size_t)h.nsamps * numChans);
+		if (!readFrame(i, buf.data()))
+			break;
+		size_t from = (size_t)(pos - h.fileSample);
+		size_t take = std::min<size_t>(n - done, h.nsamps - from);
+		memcpy(dst + done * numChans, buf.data() + from * numChans, take * numChans * sizeof(T));
+		done += take;
+	}
+	return done;
+}
+
+size_t IqzReader::read(uint64_t first, size_t n, Ipp16sc* dst)
+{
+	return readSpan(first, n, dst, scratch);
+}
+
+size_t IqzReader::read(uint64_t first, size_t n, Ipp32fc* dst)
+{
+	return readSpan(first, n, dst, scratch32);
+}
+
+bool iqzDecodeFile(const std::string& inPath, const std::string& outPath)
+{
+	IqzReader reader;
+	if (!reader.open(inPath))
+		return false;
+	std::ofstream out(outPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	std::vector<Ipp16sc> buf;
+	for (size_t i = 0; i < reader.getFrames().size(); i++) {
+		const IqzFrameHeader& h = reader.getFrames()[i].hdr;
+		buf.resize((size_t)h.nsamps * h.numChans);
+		if (!reader.readFrame(i, buf.data())) {
+			std::cerr << boost::format("%s: frame %d is corrupt\n") % inPath % i;
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(Ipp16sc));
+	}
+	return (bool)out;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ipp.h"
+#include "TimeMap.h"
+
+// Lossless sc16 IQ codec for recordings (.iqz).
+// Each channel's I and Q are coded as two integer sequences. Samples from
+// sc8/sc12 wire formats have zero low bits, which are shifted out for the
+// whole block first. The sequences are then cut into groups of 64 values;
+// each group picks the cheapest of three predictors (none, previous value,
+// linear extrapolation from the previous two) and stores its zigzagged
+// residuals bit-packed at the width of the largest one. Oversampled or
+// quiet signals shrink a lot, full-scale white noise hardly at all.
+// Every frame (one ring block) is self-contained, so any frame decodes on
+// its own: the file is a plain sequence of IqzFrameHeader + payload, and a
+// reader finds frame boundaries by hopping from header to header.
+// Frames can instead carry block floating point samples (IQZ_BFP8/4), a
+// lossy storage mode for captures that never use the top bits of sc16:
+// every channel of a block is scaled by its own factor, set by the block's
+// peak, and rounded to 8 or 4 bits, halving or quartering the data. The
+// scale is stored with the channel; readers get sc16 or float back without
+// knowing which coding a frame used.
+
+#define IQZ_MAGIC 0x315A5149u   // "IQZ1"
+#define IQZ_GROUP 64
+#define IQZ_FLAG_TIME 0x8000    // timeSecs/timeFrac are valid; the low bits are the block's BLOCK_FLAG_*
+#define IQZ_FLAG_CODEC 0x0F00   // IqzCodec of the payload
+
+enum IqzCodec
+{
+	IQZ_LOSSLESS = 0,
+	IQZ_BFP8 = 1,    // block floating point, 8-bit I and Q
+	IQZ_BFP4 = 2,    // block floating point, 4-bit I and Q
+};
+const char* iqzCodecName(IqzCodec codec);
+
+struct IqzFrameHeader
+{
+	uint32_t magic = IQZ_MAGIC;
+	uint32_t payloadBytes = 0;   // bytes after this header
+	uint64_t sampOffset = 0;     // stream index of the first sample (lost samples count)
+	uint64_t fileSample = 0;     // per-channel index of the first sample in the decoded file
+	uint32_t nsamps = 0;         // per channel
+	uint16_t numChans = 1;       // interleaved in the decoded file
+	uint16_t flags = 0;
+	int64_t timeSecs = 0;        // device time of the first sample
+	double timeFrac = 0;
+};
+static_assert(sizeof(IqzFrameHeader) == 48, "IqzFrameHeader is a file format");
+
+inline IqzCodec iqzCodec(const IqzFrameHeader& hdr) { return (IqzCodec)((hdr.flags & IQZ_FLAG_CODEC) >> 8); }
+inline uint16_t iqzCodecFlags(IqzCodec codec) { return (uint16_t)(codec << 8); }
+
+// Signal and quantization error energy of lossy frames, summed as they are coded
+struct IqzQuality
+{
+	double sigEnergy = 0;
+	double errEnergy = 0;
+
+	// SNR of the stored samples against the originals, 0 if nothing was lost
+	double snrDb() const;
+};
+
+// Worst-case coded size of one channel of nsamps samples
+size_t iqzMaxChannelBytes(size_t nsamps);
+
+// One channel, samples stride apart (1 = planar, numChans = interleaved).
+// Returns the bytes written to dst, at most iqzMaxChannelBytes(nsamps).
+size_t iqzEncodeChannel(const Ipp16sc* src, size_t nsamps, size_t stride, uint8_t* dst);
+// Inverse of iqzEncodeChannel(); returns the bytes consumed, 0 if src is malformed
+size_t iqzDecodeChannel(const uint8_t* src, size_t srcBytes, Ipp16sc* dst, size_t nsamps, size_t stride);
+
+// Complete frame of hdr.numChans channels in the codec of hdr.flags,
+// samples stride apart within a channel and chanPitch apart between
+// channels. Appended to out. Lossy codecs add their error to quality.
+void iqzEncodeFrame(const IqzFrameHeader& hdr, const Ipp16sc* src, size_t stride, size_t chanPitch,
+	std::vector<uint8_t>& out, IqzQuality* quality = nullptr);
+// Payload of one frame into interleaved dst (hdr.nsamps * hdr.numChans samples)
+bool iqzDecodeFrame(const IqzFrameHeader& hdr, const uint8_t* payload, Ipp16sc* dst);
+// The same as float, full scale 1.0 (lossy frames without the sc16 rounding)
+bool iqzDecodeFrame32fc(const IqzFrameHeader& hdr, const uint8_t* payload, Ipp32fc* dst);
+
+// Random access to one .iqz file. open() reads only the frame headers.
+class IqzReader
+{
+public:
+	struct Frame
+	{
+		uint64_t fileOffset;     // of the header
+		IqzFrameHeader hdr;
+	};
+
+private:
+	std::ifstream infile;
+	std::vector<Frame> frames;
+	std::vector<uint8_t> payload;
+	std::vector<Ipp16sc> scratch;
+	std::vector<Ipp32fc> scratch32;
+	size_t numChans = 1;
+	uint64_t numSamps = 0;
+
+	bool loadFrame(size_t i);
+	template <typename T> size_t readSpan(uint64_t first, size_t n, T* dst, std::vector<T>& buf);
+
+public:
+	bool open(const std::string& path);
+	size_t getNumChans() const { return numChans; }
+	uint64_t getNumSamps() const { return numSamps; }    // per channel
+	const std::vector<Frame>& getFrames() const { return frames; }
+	// Frame holding per-channel file sample s
+	size_t findFrame(uint64_t s) const;
+	// Frame i, interleaved
+	bool readFrame(size_t i, Ipp16sc* dst);
+	bool readFrame(size_t i, Ipp32fc* dst);
+	// Samples [first, first + n) of every channel, interleaved; returns the samples read
+	size_t read(uint64_t first, size_t n, Ipp16sc* dst);
+	size_t read(uint64_t first, size_t n, Ipp32fc* dst);
+};
+
+// Decode a whole .iqz into a raw interleaved sc16 file, as RecordWriter
+// would have written it uncompressed
+bool iqzDecodeFile(const std::string& inPath, const std::string& outPath);
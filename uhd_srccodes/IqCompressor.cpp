@@ -0,0 +1,167 @@
+#include "IqCompressor.h"
+
+bool IqCompressor::start(size_t numWorkers, size_t in_numChans, bool perChannelFiles, IqzCodec in_codec, Sink in_sink)
+{
+	stop();
+	if (numWorkers < 1)
+		return false;
+	numChans = in_numChans < 1 ? 1 : in_numChans;
+	numFiles = perChannelFiles ? numChans : 1;
+	codec = in_codec;
+	sink = in_sink;
+	jobs = std::vector<Job>(2 * numWorkers);
+	for (Job& job : jobs)
+		job.frames.resize(numFiles);
+	head = 0;
+	outstanding = 0;
+	Errorflag = false;
+	Stopflag = false;
+	queue.clear();
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		stats = Stats();
+	}
+	for (size_t w = 0; w < numWorkers; w++)
+		workers.emplace_back(&IqCompressor::workerLoop, this);
+	return true;
+}
+
+void IqCompressor::stop()
+{
+	if (workers.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		Stopflag = true;
+	}
+	queued.notify_all();
+	for (auto& t : workers)
+		t.join();
+	workers.clear();
+	for (Job& job : jobs)
+		ippsFree(job.buf);
+	jobs.clear();
+	outstanding = 0;
+}
+
+void IqCompressor::workerLoop()
+{
+	while (true) {
+		size_t idx;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			queued.wait(lock, [this] { return Stopflag || !queue.empty(); });
+			if (Stopflag)
+				return;
+			idx = queue.front();
+			queue.pop_front();
+		}
+		Job& job = jobs[idx];
+		auto t0 = std::chrono::steady_clock::now();
+		const size_t n = job.hdr.nsamps;
+		job.quality = IqzQuality();
+		for (size_t f = 0; f < numFiles; f++) {
+			job.frames[f].clear();
+			IqzFrameHeader hdr = job.hdr;
+			hdr.numChans = (uint16_t)(numFiles > 1 ? 1 : numChans);
+			// Straight from the pool block in either layout, else from the copy
+			const Ipp16sc* src = job.buf + f * n;
+			size_t stride = 1, pitch = n;
+			if (job.ref) {
+				const SampleBlock& blk = *job.ref;
+				stride = blk.interleaved() ? numChans : 1;
+				pitch = blk.interleaved() ? 1 : blk.stride;
+				src = blk.data + f * pitch;
+			}
+			iqzEncodeFrame(hdr, src, stride, pitch, job.frames[f], &job.quality);
+		}
+		job.busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			job.done = true;
+		}
+		finished.notify_all();
+	}
+}
+
+bool IqCompressor::drain(bool waitOldest)
+{
+	// Oldest first, so frames reach the sink in block order
+	while (outstanding > 0) {
+		const size_t idx = (head + jobs.size() - outstanding) % jobs.size();
+		Job& job = jobs[idx];
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			if (!job.done) {
+				if (!waitOldest)
+					break;
+				finished.wait(lock, [&job] { return job.done; });
+			}
+		}
+		waitOldest = false;
+		Stats add;
+		add.frames = numFiles;
+		add.rawBytes = (uint64_t)job.hdr.nsamps * numChans * sizeof(Ipp16sc);
+		add.busySeconds = job.busy;
+		for (size_t f = 0; f < numFiles; f++) {
+			add.packedBytes += job.frames[f].size();
+			if (!Errorflag && !sink(f, job.frames[f].data(), job.frames[f].size()))
+				Errorflag = true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(statMut);
+			stats.rawBytes += add.rawBytes;
+			stats.packedBytes += add.packedBytes;
+			stats.frames += add.frames;
+			stats.busySeconds += add.busySeconds;
+			stats.quality.sigEnergy += job.quality.sigEnergy;
+			stats.quality.errEnergy += job.quality.errEnergy;
+		}
+		job.ref.reset();
+		outstanding--;
+	}
+	return !Errorflag;
+}
+
+bool IqCompressor::submit(const SampleBlock& blk, uint64_t fileSample)
+{
+	if (workers.empty())
+		return false;
+	// Hand over whatever has finished; with no free slot, wait for the oldest
+	drain(outstanding == jobs.size());
+
+	Job& job = jobs[head];
+	job.ref = BlockRef(blk);
+	const size_t total = blk.nsamps * numChans;
+	if (!job.ref && total > job.capSamps) {
+		ippsFree(job.buf);
+		job.buf = ippsMalloc_16sc_L(total);
+		job.capSamps = total;
+	}
+	if (!job.ref)
+		blk.exportSamps(0, blk.nsamps, job.buf, blk.nsamps);
+	job.hdr = IqzFrameHeader();
+	job.hdr.sampOffset = blk.sampOffset;
+	job.hdr.fileSample = fileSample;
+	job.hdr.nsamps = (uint32_t)blk.nsamps;
+	job.hdr.flags = (uint16_t)((blk.flags & ~(IQZ_FLAG_TIME | IQZ_FLAG_CODEC)) | iqzCodecFlags(codec)
+		| (blk.hasTime ? IQZ_FLAG_TIME : 0));
+	job.hdr.timeSecs = blk.time.secs;
+	job.hdr.timeFrac = blk.time.frac;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		job.done = false;
+		queue.push_back(head);
+	}
+	queued.notify_one();
+	head = (head + 1) % jobs.size();
+	outstanding++;
+	return !Errorflag;
+}
+
+bool IqCompressor::flush()
+{
+	while (outstanding > 0)
+		drain(true);
+	return !Errorflag;
+}
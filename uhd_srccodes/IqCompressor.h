@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SampleRing.h"
+#include "IqCodec.h"
+
+// Pool of threads running IqCodec (lossless or block floating point) over
+// ring blocks for RecordWriter.
+// submit() takes a reference to a pool block (or copies any other block)
+// into a free job slot and returns; the workers
+// encode slots in parallel, and the frames of each file are handed to the
+// sink on the submitting thread strictly in block order, so the sink can
+// write straight to a DiskWriter. With every slot busy submit() waits for
+// the oldest one, which is the backpressure towards the ring.
+class IqCompressor
+{
+public:
+	// Frames for data file f, called on the submitting thread
+	typedef std::function<bool(size_t f, const uint8_t* data, size_t nbytes)> Sink;
+
+	struct Stats
+	{
+		uint64_t rawBytes = 0;
+		uint64_t packedBytes = 0;   // frame headers included
+		uint64_t frames = 0;
+		double busySeconds = 0;     // summed over the workers
+		IqzQuality quality;         // lossy codecs
+
+		double ratio() const { return packedBytes > 0 ? double(rawBytes) / packedBytes : 0; }
+		double mbpsPerCore() const { return busySeconds > 0 ? rawBytes / busySeconds / 1e6 : 0; }
+	};
+
+private:
+	struct Job
+	{
+		BlockRef ref;               // the block itself, when it is from a pool
+		Ipp16sc* buf = nullptr;     // else a planar copy of it, pitch nsamps
+		size_t capSamps = 0;
+		IqzFrameHeader hdr;
+		std::vector<std::vector<uint8_t>> frames;  // per data file
+		double busy = 0;
+		IqzQuality quality;
+		bool done = false;          // guarded by mut
+	};
+
+	std::vector<Job> jobs;
+	size_t numChans = 1;
+	size_t numFiles = 1;
+	IqzCodec codec = IQZ_LOSSLESS;
+	Sink sink;
+	size_t head = 0;                // next slot to fill
+	size_t outstanding = 0;         // slots submitted and not yet drained
+	bool Errorflag = false;
+
+	std::vector<std::thread> workers;
+	std::mutex mut;
+	std::condition_variable queued, finished;
+	std::deque<size_t> queue;       // guarded by mut
+	bool Stopflag = false;          // guarded by mut
+	Stats stats;                    // guarded by statMut
+	mutable std::mutex statMut;
+
+	void workerLoop();
+	bool drain(bool waitOldest);
+
+public:
+	IqCompressor() {}
+	~IqCompressor() { stop(); }
+
+	// numWorkers threads with two job slots each. perChannelFiles: one
+	// single-channel frame per channel per block, else one frame per block.
+	bool start(size_t numWorkers, size_t in_numChans, bool perChannelFiles, IqzCodec in_codec, Sink in_sink);
+	// Queue blk as per-channel file sample fileSample on. Returns false once a sink call has failed.
+	bool submit(const SampleBlock& blk, uint64_t fileSample);
+	// Wait for every submitted block to reach the sink
+	bool flush();
+	void stop();
+	bool isRunning() const { return !workers.empty(); }
+	// Submitting thread. Codec of the blocks submitted from now on; every
+	// frame names its own, so a file can switch between them.
+	void setCodec(IqzCodec in_codec) { codec = in_codec; }
+	IqzCodec getCodec() const { return codec; }
+	size_t getNumWorkers() const { return workers.size(); }
+	Stats getStats() const
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		return stats;
+	}
+};
@@ -0,0 +1,210 @@
+#include "MergeSource.h"
+#include <algorithm>
+#include <cmath>
+
+MergeSource::MergeSource(const std::vector<SampleSource::sptr>& in_sources, size_t in_ringSlots)
+	: rate(in_sources.empty() ? 0 : in_sources[0]->getRate())
+{
+	for (size_t i = 0; i < in_sources.size(); i++) {
+		std::unique_ptr<Board> b(new Board);
+		b->source = in_sources[i];
+		b->chanBase = numChans;
+		// A few packets per block keeps the per-block overhead low and the merge latency short
+		b->ring.init(in_ringSlots, 4 * b->source->getMaxNumSamps(), b->source->getNumChannels(), false);
+		if (b->source->getCpuFormat() == WIRE_SC8)
+			b->wire = (Ipp8sc*)ippsMalloc_8s_L(2 * b->ring.getBlockSamps() * b->source->getNumChannels());
+		numChans += b->source->getNumChannels();
+		boards.push_back(std::move(b));
+	}
+}
+
+MergeSource::~MergeSource()
+{
+	if (Streamingflag)
+		stopStream();
+	for (auto& b : boards)
+		ippsFree(b->wire);
+}
+
+void MergeSource::setBoardPolicy(size_t b, const ThreadPolicy& policy, const MemPolicy& mem)
+{
+	Board& bd = *boards[b];
+	bd.policy = policy;
+	MemPolicy placed = mem;
+	if (placed.numaNode < 0 && policy.cpu >= 0)
+		placed.numaNode = cpuNumaNode(policy.cpu);
+	bd.ring.init(bd.ring.getNumSlots(), bd.ring.getBlockSamps(), bd.ring.getNumChans(), false, placed);
+}
+
+void MergeSource::startStream()
+{
+	// A restart from the receive loop restarts every board; they realign by time
+	if (Streamingflag)
+		stopStream();
+	haveBase = false;
+	for (auto& b : boards) {
+		b->ring.reset();
+		b->blk = nullptr;
+		b->idx = 0;
+		b->overflowPending = false;
+	}
+	// Issue all (timed) start commands before any receive thread runs
+	Streamingflag = true;
+	for (auto& b : boards)
+		b->source->startStream();
+	for (auto& b : boards)
+		b->thrd = std::thread(&MergeSource::boardLoop, this, std::ref(*b));
+}
+
+void MergeSource::stopStream()
+{
+	Streamingflag = false;
+	for (auto& b : boards) {
+		if (b->thrd.joinable())
+			b->thrd.join();
+		b->source->stopStream();
+	}
+}
+
+double MergeSource::getStartLatency() const
+{
+	double latency = 0;
+	for (auto& b : boards)
+		latency = std::max(latency, b->source->getStartLatency());
+	return latency;
+}
+
+void MergeSource::boardLoop(Board& b)
+{
+	applyThreadPolicy(b.policy, "uhd_rx_board");
+	uhd::rx_metadata_t md;
+	std::vector<void*> buffs(b.source->getNumChannels());
+	const size_t blockSamps = b.ring.getBlockSamps();
+	DeviceTime expectTime;
+
+	while (Streamingflag) {
+		SampleBlock* blk = b.ring.beginWrite();
+		for (size_t c = 0; c < buffs.size(); c++)
+			buffs[c] = b.wire ? (void*)(b.wire + c * blockSamps) : blk->chan(c);
+
+		// One recv() per block, so every block is time-contiguous
+		size_t n = b.source->recv(buffs, blockSamps, md, 0.5 + b.source->getStartLatency());
+		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+			b.stats.overflows.fetch_add(1, std::memory_order_relaxed);
+			b.overflowPending = true;
+		}
+		if (n == 0)
+			continue; // slot is reused by the next beginWrite()
+
+		if (b.wire)
+			for (size_t c = 0; c < buffs.size(); c++)
+				widenSc8ToSc16(b.wire + c * blockSamps, blk->chan(c), n);
+		blk->nsamps = n;
+		if (md.has_time_spec) {
+			blk->time.secs = md.time_spec.get_full_secs();
+			blk->time.frac = md.time_spec.get_frac_secs();
+		}
+		else
+			blk->time = expectTime;
+		blk->hasTime = true;
+		expectTime = blk->time.plus(n / rate);
+		// A block that lands in the scratch block is an overrun of this board
+		const uint64_t overruns = b.ring.getOverruns();
+		b.ring.endWrite();
+		if (b.ring.getOverruns() != overruns)
+			b.stats.overruns.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool MergeSource::fetch(Board& b, const std::chrono::steady_clock::time_point& deadline)
+{
+	while (b.blk == nullptr || b.idx >= b.blk->nsamps) {
+		if (b.blk != nullptr) {
+			b.ring.endRead();
+			b.blk = nullptr;
+		}
+		b.blk = b.ring.beginRead();
+		b.idx = 0;
+		if (b.blk != nullptr)
+			continue;
+		if (!Streamingflag || std::chrono::steady_clock::now() > deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::microseconds(20));
+	}
+	return true;
+}
+
+int64_t MergeSource::tickOf(const Board& b) const
+{
+	return (int64_t)std::llround(b.blk->time.minus(baseTime) * rate) + (int64_t)b.idx;
+}
+
+void MergeSource::skip(Board& b, uint64_t n)
+{
+	size_t step = (size_t)std::min<uint64_t>(n, b.blk->nsamps - b.idx);
+	b.idx += step;
+	b.stats.skippedSamps.fetch_add(step, std::memory_order_relaxed);
+}
+
+size_t MergeSource::recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout)
+{
+	md.reset();
+	auto deadline = std::chrono::steady_clock::now()
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+	// Advance whichever boards are behind until all agree on the device time
+	// of their next sample
+	std::vector<char> realigned(boards.size(), 0);
+	int64_t tick = 0;
+	while (true) {
+		for (auto& b : boards)
+			if (!fetch(*b, deadline)) {
+				md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+				return 0;
+			}
+		if (!haveBase) {
+			baseTime = boards[0]->blk->time;
+			haveBase = true;
+		}
+
+		tick = tickOf(*boards[0]);
+		for (auto& b : boards)
+			tick = std::max(tick, tickOf(*b));
+
+		bool aligned = true;
+		const int64_t tick0 = tickOf(*boards[0]);
+		for (size_t i = 0; i < boards.size(); i++) {
+			Board& b = *boards[i];
+			int64_t t = tickOf(b);
+			if (t == tick)
+				continue;
+			if (!realigned[i]) {
+				realigned[i] = 1;
+				b.stats.misalignments.fetch_add(1, std::memory_order_relaxed);
+				b.stats.lastOffset.store(t - tick0, std::memory_order_relaxed);
+			}
+			skip(b, (uint64_t)(tick - t));
+			aligned = false;
+		}
+		if (aligned)
+			break;
+	}
+
+	// Aligned: copy the common span of every board's current block
+	size_t n = nsamps;
+	for (auto& b : boards)
+		n = std::min(n, b->blk->nsamps - b->idx);
+	bool overflow = false;
+	for (auto& b : boards) {
+		for (size_t c = 0; c < b->ring.getNumChans(); c++)
+			ippsCopy_16sc(b->blk->chan(c) + b->idx, (Ipp16sc*)buffs[b->chanBase + c], (int)n);
+		b->idx += n;
+		overflow |= b->overflowPending.exchange(false);
+	}
+
+	DeviceTime t = baseTime.plus(tick / rate);
+	md.has_time_spec = true;
+	md.time_spec = uhd::time_spec_t(t.secs, t.frac);
+	md.error_code = overflow ? uhd::rx_metadata_t::ERROR_CODE_OVERFLOW : uhd::rx_metadata_t::ERROR_CODE_NONE;
+	return n;
+}
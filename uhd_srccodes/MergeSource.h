@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "SampleSource.h"
+#include "SampleRing.h"
+#include "TimeMap.h"
+
+// Time-aligned merge of several per-board sources into one multi-channel
+// stream. Each board source (one rx_streamer per motherboard, or a
+// synthetic stand-in) is received on its own thread into its own
+// SampleRing, so the boards' recv() calls run in parallel and the merge in
+// recv() is only a copy per channel.
+// Every recv() checks the device time of the next sample of every board.
+// If they disagree (different start, an overflow on one board, a restarted
+// stream) the boards that are behind drop samples until all agree, and the
+// event is counted per board; the merged stream then simply shows a time
+// jump, which the receive loop handles like any other overflow.
+// Boards delivering sc8 are widened on their own thread; the merged stream
+// is always sc16.
+class MergeSource : public SampleSource
+{
+public:
+	struct BoardStats
+	{
+		std::atomic<uint64_t> misalignments{ 0 };  // times this board had to be realigned
+		std::atomic<uint64_t> skippedSamps{ 0 };   // samples dropped to realign it
+		std::atomic<uint64_t> overflows{ 0 };
+		std::atomic<uint64_t> overruns{ 0 };       // blocks dropped because the merge fell behind this board's ring
+		std::atomic<int64_t> lastOffset{ 0 };      // samples ahead of board 0 before the last realignment
+	};
+
+private:
+	struct Board
+	{
+		SampleSource::sptr source;
+		SampleRing ring;
+		std::thread thrd;
+		size_t chanBase = 0;          // first merged channel of this board
+		SampleBlock* blk = nullptr;   // block being merged, owned by the reader
+		Ipp8sc* wire = nullptr;       // recv() landing buffer for sc8 host samples
+		size_t idx = 0;               // next sample in blk
+		std::atomic<bool> overflowPending{ false };
+		BoardStats stats;
+		ThreadPolicy policy;
+	};
+	std::vector<std::unique_ptr<Board>> boards;
+	size_t numChans = 0;
+	double rate;
+	std::atomic<bool> Streamingflag{ false };
+	bool haveBase = false;
+	DeviceTime baseTime;              // tick 0 for alignment arithmetic
+
+	void boardLoop(Board& b);
+	bool fetch(Board& b, const std::chrono::steady_clock::time_point& deadline);
+	int64_t tickOf(const Board& b) const;
+	void skip(Board& b, uint64_t n);
+
+public:
+	// All sources must run at the same rate and share a time base (GPS/PPS)
+	MergeSource(const std::vector<SampleSource::sptr>& in_sources, size_t in_ringSlots = 256);
+	~MergeSource();
+
+	void startStream() override;
+	void stopStream() override;
+	size_t recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout) override;
+
+	double getRate() const override { return rate; }
+	size_t getNumChannels() const override { return numChans; }
+	size_t getMaxNumSamps() const override { return boards.empty() ? 0 : boards[0]->source->getMaxNumSamps(); }
+	double getStartLatency() const override;
+	WireFormat getWireFormat() const override { return boards.empty() ? WIRE_SC16 : boards[0]->source->getWireFormat(); }
+
+	// Scheduling of board b's receive thread; its ring is reallocated on the
+	// NUMA node of policy.cpu unless mem names a node. Call before startStream().
+	void setBoardPolicy(size_t b, const ThreadPolicy& policy, const MemPolicy& mem = MemPolicy());
+
+	size_t getNumBoards() const { return boards.size(); }
+	const BoardStats& getBoardStats(size_t b) const { return boards[b]->stats; }
+};
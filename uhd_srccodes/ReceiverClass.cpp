@@ -13,33 +13,39 @@ void ReceiverClass::initializeUSRP()
 }
 void ReceiverClass::configure()
 {
-	rx_usrp->set_rx_rate((double)rxrate, rx_ch);  // Set rxrate
-    samps_per_buff = static_cast<size_t>(0.1 * rx_usrp->get_rx_rate());
+	// Same rate, frequency and gain on every streamed channel
+	for (size_t ch : rx_chs)
+		rx_usrp->set_rx_rate((double)rxrate, ch);  // Set rxrate
+    maxPadSamps = static_cast<size_t>(rx_usrp->get_rx_rate());
 	
 	uhd::tune_request_t tune_request(rxfreq, lo_offset); // Set freq
-	rx_usrp->set_rx_freq(tune_request, rx_ch);
+	for (size_t ch : rx_chs)
+		rx_usrp->set_rx_freq(tune_request, ch);
 
-	rx_usrp->set_rx_gain(rxgain, rx_ch); // Set gain
+	for (size_t ch : rx_chs)
+		rx_usrp->set_rx_gain(rxgain, ch); // Set gain
 
     
 }
 
 bool ReceiverClass::checkConfig()
 {
-	if (rx_usrp->get_rx_gain(rx_ch) != rxgain) {
-		printf("Actual RX Gain: %f\n", rx_usrp->get_rx_gain(rx_ch));
-        return false;
-	}
+	for (size_t ch : rx_chs) {
+		if (rx_usrp->get_rx_gain(ch) != rxgain) {
+			printf("Actual RX Gain (ch %zd): %f\n", ch, rx_usrp->get_rx_gain(ch));
+			return false;
+		}
 
-	if (round(rx_usrp->get_rx_freq(rx_ch)) != rxfreq) {
-		printf("Intended RX Freq: %.4f\n", rxfreq);
-		printf("Actual RX Freq: %f\n", rx_usrp->get_rx_freq(rx_ch));
-        return false;
-	}
+		if (round(rx_usrp->get_rx_freq(ch)) != rxfreq) {
+			printf("Intended RX Freq: %.4f\n", rxfreq);
+			printf("Actual RX Freq (ch %zd): %f\n", ch, rx_usrp->get_rx_freq(ch));
+			return false;
+		}
 
-	if (round(rx_usrp->get_rx_rate(rx_ch)) != rxrate) {
-		printf("Actual RX Rate: %f Msps\n", rx_usrp->get_rx_rate(rx_ch));
-        return false;
+		if (round(rx_usrp->get_rx_rate(ch)) != rxrate) {
+			printf("Actual RX Rate (ch %zd): %f Msps\n", ch, rx_usrp->get_rx_rate(ch));
+			return false;
+		}
 	}
 
 	return true;
@@ -48,9 +54,8 @@ bool ReceiverClass::checkConfig()
 void ReceiverClass::start()
 {
 	// Get a streamer
-	uhd::stream_args_t stream_args("sc16", "sc16");
-	std::vector<size_t> channel_nums;
-	channel_nums.push_back(rx_ch); 
+	uhd::stream_args_t stream_args(wireFormatName(cpuFormat), wireFormatName(otwFormat));
+	std::vector<size_t> channel_nums = rx_chs;
 	
 	// Lock mboard clocks
     if (USRPgpsflag == 1){
@@ -62,77 +67,668 @@ void ReceiverClass::start()
 	std::cout << boost::format("Using RX Time Source: %s") % rx_usrp->get_time_source(0) << std::endl;
 	std::cout << boost::format("Using RX Device: %s") % rx_usrp->get_pp_string()
 		<< std::endl;
+	std::cout << boost::format("Using stream format: %s over the wire, %s on the host")
+		% wireFormatName(otwFormat) % wireFormatName(cpuFormat) << std::endl;
+
+	// Timed start: every board gets the same start time, so they begin on the
+	// same sample (boards must share a time base, see sync_to_gps()). The
+	// channels of one streamer are only aligned by a timed start too, so any
+	// multi-channel capture gets one.
+	const size_t num_mboards = rx_usrp->get_num_mboards();
+	double delay = startDelay > 0 ? startDelay : (num_mboards > 1 ? 1.0 : rx_chs.size() > 1 ? 0.1 : 0.0);
+	uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+	stream_cmd.stream_now = delay <= 0;
+	const double rate = rx_usrp->get_rx_rate(rx_ch);
+
+	// One streamer per board, received in parallel and merged by device time;
+	// merged channels are ordered by board
+	std::vector<std::vector<size_t>> boardChans(num_mboards);
+	for (size_t ch : channel_nums)
+		boardChans[boardOfChannel(ch)].push_back(ch);
+	std::vector<SampleSource::sptr> sources;
+	std::vector<std::shared_ptr<UhdSampleSource>> radios;
+	for (auto& chans : boardChans) {
+		if (chans.empty())
+			continue;
+		stream_args.channels = chans;
+		radios.push_back(std::make_shared<UhdSampleSource>(rx_usrp->get_rx_stream(stream_args), stream_cmd, rate, delay,
+			otwFormat, cpuFormat));
+		sources.push_back(radios.back());
+	}
+	// The start time is taken when the stream is actually started, after the
+	// capture is set up, so the setup does not eat into the delay
+	if (delay > 0)
+		armStart = [this, radios, delay] {
+			uhd::time_spec_t at = rx_usrp->get_time_now() + uhd::time_spec_t(delay);
+			for (auto& radio : radios)
+				radio->setStartTime(at);
+			std::cout << boost::format("Stream start at device time %.6f\n") % at.get_real_secs();
+		};
+	else
+		armStart = nullptr;
+
+	RecordWriter::RfState rf;
+	rf.frequency = rx_usrp->get_rx_freq(rx_ch);
+	rf.gain = rx_usrp->get_rx_gain(rx_ch);
+	rf.loOffset = lo_offset;
+	writer.setRfState(rf);
+	writer.setSigmf(sigmfOutput, rx_usrp->get_mboard_name(), gpsTime);
+	Monitorflag = true;
+	thrd_monitor = std::thread(&ReceiverClass::monitorLoop, this);
+
+	if (sources.size() > 1) {
+		std::cout << boost::format("Merging %d boards\n") % sources.size();
+		std::shared_ptr<MergeSource> merged = std::make_shared<MergeSource>(sources);
+		for (size_t b = 0; b < boardPolicies.size() && b < sources.size(); b++)
+			merged->setBoardPolicy(b, boardPolicies[b], memPolicy);
+		std::atomic_store(&merge, merged);
+		runReceiveThread(*merged);
+		for (size_t b = 0; b < merged->getNumBoards(); b++) {
+			const MergeSource::BoardStats& bs = merged->getBoardStats(b);
+			std::cout << boost::format("Board %d: %d overflows, %d ring overruns, %d realignments (%d samples skipped, last offset %d)\n")
+				% b % bs.overflows % bs.overruns % bs.misalignments % bs.skippedSamps % bs.lastOffset;
+		}
+	}
+	else {
+		std::atomic_store(&merge, std::shared_ptr<MergeSource>());
+		runReceiveThread(*sources[0]);
+	}
+	Monitorflag = false;
+	thrd_monitor.join();
+}
 
-	stream_args.channels = channel_nums;
-	uhd::rx_streamer::sptr rx_stream = rx_usrp->get_rx_stream(stream_args);
-	uhd::rx_metadata_t md;
+void ReceiverClass::retune(double in_rxfreq, double in_rxgain)
+{
+	rxfreq = in_rxfreq;
+	rxgain = in_rxgain;
+	// 50 ms ahead is plenty for the command to reach every board
+	const bool timed = Receivingflag;
+	uhd::time_spec_t at;
+	if (timed) {
+		at = rx_usrp->get_time_now() + uhd::time_spec_t(0.05);
+		rx_usrp->set_command_time(at);
+	}
+	uhd::tune_request_t tune_request(rxfreq, lo_offset);
+	for (size_t ch : rx_chs) {
+		rx_usrp->set_rx_freq(tune_request, ch);
+		rx_usrp->set_rx_gain(rxgain, ch);
+	}
+	if (!timed)
+		return;
+	rx_usrp->clear_command_time();
+
+	RecordWriter::RfState rf;
+	rf.frequency = rxfreq;
+	rf.gain = rxgain;
+	rf.loOffset = lo_offset;
+	DeviceTime t;
+	t.secs = at.get_full_secs();
+	t.frac = at.get_frac_secs();
+	writer.scheduleRfChange(rf, t);
+}
 
-	// Setup streaming
-	uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
-	stream_cmd.stream_now = true;
+void ReceiverClass::monitorLoop()
+{
+	// Boards without a GPSDO have no gps_locked sensor
+	const size_t num_mboards = rx_usrp->get_num_mboards();
+	std::vector<bool> hasSensor(num_mboards);
+	for (size_t mb = 0; mb < num_mboards; mb++) {
+		std::vector<std::string> names = rx_usrp->get_mboard_sensor_names(mb);
+		hasSensor[mb] = std::find(names.begin(), names.end(), "gps_locked") != names.end();
+	}
+
+	// Once a second; the first reading and every change are annotated
+	std::vector<int> locked(num_mboards, -1);
+	while (Monitorflag) {
+		for (size_t mb = 0; mb < num_mboards && Receivingflag; mb++) {
+			if (!hasSensor[mb])
+				continue;
+			try {
+				int now = rx_usrp->get_mboard_sensor("gps_locked", mb).to_bool() ? 1 : 0;
+				if (now != locked[mb])
+					writer.annotate(now ? "gps_locked" : "gps_unlocked", str(boost::format("mboard %d") % mb));
+				locked[mb] = now;
+			}
+			catch (const std::exception& e) {
+				std::cerr << boost::format("gps_locked sensor of mboard %d: %s\n") % mb % e.what();
+				hasSensor[mb] = false;
+			}
+		}
+		for (int i = 0; i < 10 && Monitorflag; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+size_t ReceiverClass::boardOfChannel(size_t ch)
+{
+	// multi_usrp numbers channels across boards in order, each board
+	// contributing one channel per entry of its subdev spec
+	const size_t num_mboards = rx_usrp->get_num_mboards();
+	for (size_t mb = 0; mb < num_mboards; mb++) {
+		size_t n = rx_usrp->get_rx_subdev_spec(mb).size();
+		if (ch < n)
+			return mb;
+		ch -= n;
+	}
+	return num_mboards - 1;
+}
+
+void ReceiverClass::startFromSource(SampleSource::sptr source)
+{
+	// What configure() sets up for a radio; buffers are sized in receiveLoop()
+	numChans = source->getNumChannels();
+	rxrate = (int)source->getRate();
+	maxPadSamps = static_cast<size_t>(source->getRate());
+	writer.setSigmf(sigmfOutput);
+	writer.setRfState(RecordWriter::RfState()); // not tuned: no core:frequency
+	armStart = nullptr;
+	runReceiveThread(*source);
+}
+
+void ReceiverClass::runReceiveThread(SampleSource& source)
+{
+	// A thread of its own, so its scheduling does not stick to the caller
+	thrd_receivethread = std::thread([this, &source] {
+		applyThreadPolicy(rxPolicy, "uhd_rx");
+		receiveLoop(source);
+	});
+	thrd_receivethread.join();
+}
+
+void ReceiverClass::receiveLoop(SampleSource& source)
+{
+	// Chunk and block sizes depend on the source (packet size, rate). Tuning
+	// needs the stream running, so it is started for that and stopped again:
+	// the capture's stream starts only once everything below is allocated
+	// and open, or the setup would show up as an overflow at its start.
+	const double rate = source.getRate();
+	streamRate = rate;
+	if (autotuneRecv)
+		startSource(source);
+	sizeBuffers(source);
+	if (autotuneRecv)
+		source.stopStream();
+	allocMem();
+
+	// One continuous capture per start()
+	char timestr[32];
+	std::time_t now = std::time(nullptr);
+	std::strftime(timestr, sizeof(timestr), "%Y%m%d_%H%M%S", std::localtime(&now));
+	filename = recordPrefix + "_" + timestr;
+	// With a DDC or channelizer the recording is its output: fewer channels at
+	// a lower rate, full sc16
+	bool opened;
+	if (chzConfig.enabled()) {
+		ddc.free();
+		// Its workers at the DSP priority, but not all on the DSP thread's CPU
+		ChannelizerConfig cfg = chzConfig;
+		cfg.workerPolicy = dspPolicy;
+		cfg.workerPolicy.cpu = -1;
+		opened = chz.init(cfg, rate, rxring.getNumChans(), rxring.getBlockSamps());
+		writer.setFrequencyShift(opened && chz.getNumChans() == 1 ? chz.getChannelOffset(chz.getChannelNumber(0)) : 0);
+		opened = opened && writer.open(filename, chz.getOutputRate(), chz.getNumChans(), perChannelFiles);
+		if (opened)
+			std::cout << boost::format("Channelizer: %d channel(s) at %.0f S/s, %.0f Hz apart, %s\n")
+				% chz.getNumChans() % chz.getOutputRate() % chz.getChannelSpacing() % cfg.describe();
+	}
+	else if (ddcConfig.enabled()) {
+		chz.free();
+		opened = ddc.init(ddcConfig, rate, rxring.getNumChans(), rxring.getBlockSamps());
+		writer.setFrequencyShift(ddc.getNumChans() == 1 ? ddcConfig.channels[0].offsetHz : 0);
+		opened = opened && writer.open(filename, ddc.getOutputRate(), ddc.getNumChans(), perChannelFiles);
+		if (opened)
+			std::cout << boost::format("DDC: %d band(s) at %.0f S/s, decimation %d, %s\n")
+				% ddc.getNumChans() % ddc.getOutputRate() % ddcConfig.decimation % ddc.getDesign().describe();
+	}
+	else {
+		ddc.free();
+		chz.free();
+		writer.setFrequencyShift(0);
+		opened = writer.open(filename, rate, rxring.getNumChans(), perChannelFiles, source.getWireFormat());
+	}
+	if (!opened)
+		return;
+	// Their output goes to the writer through a ring of its own, so the DSP
+	// cost stays off the disk path
+	dspStage = chz.isEnabled() || ddc.isEnabled();
+	if (dspStage) {
+		const double outRate = chz.isEnabled() ? chz.getOutputRate() : ddc.getOutputRate();
+		const size_t outChans = chz.isEnabled() ? chz.getNumChans() : ddc.getNumChans();
+		const size_t outSamps = (size_t)std::ceil(rxring.getBlockSamps() * outRate / rate) + 1;
+		dspring.init(rxring.getNumSlots(), outSamps, outChans, false, memPolicy,
+			writer.getMaxHeldBlocks(outChans, perChannelFiles) + 1);
+	}
+	else
+		dspring.free();
+	if (extractor.init(extractorConfig, rate, rxring.getNumChans(), rxring.getBlockSamps()) && extractor.isEnabled())
+		std::cout << boost::format("Extractor: %d channel(s) through a DFT of %d\n")
+			% extractor.getChannels().size() % extractor.getFftLen();
 
 	// Start receiving
-	uint8_t bufIdx = 0;
+	uhd::rx_metadata_t md;
 	double timeout = 0.5;
-	rx_stream->issue_stream_cmd(stream_cmd);
-
+	uint64_t sampCount = 0;
+	DeviceTime expectTime;      // device time the next received sample should have
+	bool haveExpect = false;
+	int consecTimeouts = 0;
+	rxring.reset();
+	dspring.reset();
+	ringPhase = 0;
+	rxstats.reset();
+	ringWaits = 0;
+	ringWaitSeconds = 0;
+	Receivingflag = true;
+	Dspingflag = dspStage;
+	extractSkipped = 0;
+	Extractingflag = extractor.isEnabled();
+
+	if (Extractingflag)
+		thrd_extractthread = std::thread(&ReceiverClass::extractLoop, this);
+	if (dspStage)
+		thrd_dspthread = std::thread(&ReceiverClass::dspLoop, this);
 	thrd_savethread = std::thread(&ReceiverClass::savefile, this);
-
+	startSource(source);
+
+	// Fill ring blocks; if the consumer is a full ring behind this is the scratch block
+	const size_t nch = rxring.getNumChans();
+	const bool narrow = source.getCpuFormat() == WIRE_SC8;
+	std::vector<void*> buffs(nch);
+	std::vector<Ipp16sc*> dsts(nch);
+	SampleBlock* blk = nextRingBlock();
+	blk->sampOffset = sampCount;
 	while (!Stopflag)
 	{
-		// Loop over usrp mini sample buffers
-		for (int rIdx = 0; rIdx < rxrate; rIdx += (int)samps_per_buff) {
-
-			size_t num_rx_samps =
-				rx_stream->recv(&rxbuffs[buffidx][rIdx], samps_per_buff, md, timeout);
+		// Planar blocks take recv() directly; interleaved ones go through rxplanar,
+		// sc8 samples through rxwire
+		size_t rIdx = blk->nsamps;
+		for (size_t c = 0; c < nch; c++) {
+			dsts[c] = blk->interleaved() ? rxplanar + c * samps_per_buff : blk->chan(c) + rIdx;
+			buffs[c] = narrow ? (void*)(rxwire + c * samps_per_buff) : dsts[c];
+		}
+		// A timed start adds its delay to the wait for the first samples
+		size_t num_rx_samps = source.recv(buffs, std::min(samps_per_buff, blockTarget() - rIdx), md,
+			timeout + source.getStartLatency());
+		rxstats.recordError(errorKind(md.error_code));
 
-			if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
-				std::cout << boost::format("Timeout while streaming") << std::endl;
+		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+			if (source.isFinished())
 				break;
+			// Keep waiting through short hiccups; kick the stream if it went quiet
+			if (++consecTimeouts >= maxTimeouts) {
+				std::cerr << boost::format("%d timeouts in a row, reissuing stream command\n") % consecTimeouts;
+				source.startStream();
+				rxstats.recordRestart();
+				consecTimeouts = 0;
 			}
-			if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
-				std::cerr << boost::format("Got an overflow indication\n");
-				break; // we want to ensure timing integrity, so if overflow let's end
+			continue;
+		}
+		consecTimeouts = 0;
+		if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE
+			&& md.error_code != uhd::rx_metadata_t::ERROR_CODE_OVERFLOW)
+			std::cerr << boost::format("Receiver error: %s\n") % md.strerror();
+
+		// On overflow the device keeps streaming; how much was lost shows up
+		// as a jump in the timestamp of the next samples
+		if (num_rx_samps == 0)
+			continue;
+		if (narrow)
+			for (size_t c = 0; c < nch; c++)
+				widenSc8ToSc16(rxwire + c * samps_per_buff, dsts[c], num_rx_samps);
+		if (blk->interleaved())
+			blk->importSamps(rIdx, num_rx_samps, rxplanar, samps_per_buff);
+		blk->nsamps = rIdx + num_rx_samps;
+
+		if (md.has_time_spec) {
+			DeviceTime t;
+			t.secs = md.time_spec.get_full_secs();
+			t.frac = md.time_spec.get_frac_secs();
+			if (rIdx == 0) {
+				blk->time = t;
+				blk->hasTime = true;
 			}
-			if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-				std::string error = str(boost::format("Receiver error: %s") % md.strerror());
-				break;
+			if (haveExpect) {
+				double drift = t.minus(expectTime) * rate;
+				if (std::fabs(drift) >= 0.5)
+					blk = recoverGap(blk, rIdx, num_rx_samps, t, drift, sampCount);
 			}
+			expectTime = t.plus(num_rx_samps / rate);
+			haveExpect = true;
 		}
 
-		buffidx = (buffidx + 1) % 2;
-		buffidx2save = buffidx;
-		cv.notify_one();
+		if (blk->nsamps >= blockTarget()) {
+			sampCount += blk->nsamps;
+			endRingBlock(blk);
+			blk = nextRingBlock();
+			blk->sampOffset = sampCount;
+		}
 	}
+	if (blk->nsamps > 0)
+		endRingBlock(blk);
 
 	// Issue stop command
-	stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-	rx_stream->issue_stream_cmd(stream_cmd);
+	source.stopStream();
 	Receivingflag = false;
 	
-	thrd_receivethread.join();
+	if (thrd_dspthread.joinable())
+		thrd_dspthread.join();
+	thrd_savethread.join();
+	if (thrd_extractthread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(extractMut);
+			Extractingflag = false;
+		}
+		extractCv.notify_one();
+		thrd_extractthread.join();
+		if (extractSkipped > 0)
+			std::cout << boost::format("Extractor: %d blocks skipped to keep up\n") % extractSkipped.load();
+	}
+	writer.close();
+
+	if (rxring.getOverruns() > 0)
+		std::cerr << boost::format("Ring overruns: %d blocks, %d samples dropped (high water %d/%d slots, "
+			"%d with every spare block held)\n") % rxring.getOverruns() % rxring.getDroppedSamps()
+			% rxring.getHighWater() % rxring.getNumSlots() % rxring.getStarved();
+	if (dspring.getOverruns() > 0)
+		std::cerr << boost::format("DSP output ring overruns: %d blocks, %d samples dropped (high water %d/%d slots)\n")
+			% dspring.getOverruns() % dspring.getDroppedSamps() % dspring.getHighWater() % dspring.getNumSlots();
+	std::cout << boost::format("Sample blocks: %d in the pool, at most %d in use, %.0f%% of the bytes written in place\n")
+		% rxring.getPool().getNumBlocks() % rxring.getPool().getPeakHeld()
+		% (writer.getBytesWritten() > 0 ? 100.0 * writer.getSharedBytes() / writer.getBytesWritten() : 0);
+	std::cout << "Receive errors: " << rxstats.summary() << std::endl;
+	std::cout << boost::format("Recorded %s: %d blocks, %.1f MB at %.1f MB/s, %d gaps (%d samples lost)\n")
+		% (writer.getNumDataFiles() > 0 ? writer.getDataFileName(0) : filename)
+		% writer.getBlocksWritten() % (writer.getBytesWritten() / 1e6) % writer.getMBps()
+		% writer.getGapCount() % writer.getLostSamps();
+	for (size_t f = 0; f < writer.getNumDataFiles(); f++) {
+		DiskWriter::Stats ds = writer.getDiskStats(f);
+		std::cout << boost::format("Disk file %d (%s): %d writes, latency p50 %.2f / p99 %.2f / max %.2f ms, queue depth max %d\n")
+			% f % writer.getDiskBackend() % ds.writes % (ds.p50 * 1e3) % (ds.p99 * 1e3) % (ds.max * 1e3) % ds.maxInFlight;
+	}
+	if (writer.isCompressed()) {
+		IqCompressor::Stats cs = writer.getCompressionStats();
+		std::cout << boost::format("Compressed (%s) %.1f MB to %.1f MB (ratio %.2f), %.0f MB/s per core\n")
+			% iqzCodecName(writer.getCompressionCodec()) % (cs.rawBytes / 1e6) % (cs.packedBytes / 1e6) % cs.ratio() % cs.mbpsPerCore();
+		if (cs.quality.errEnergy > 0)
+			std::cout << boost::format("Requantization SNR %.1f dB\n") % cs.quality.snrDb();
+	}
+	if (writer.getShedBlocks() > 0 || ringWaits > 0)
+		std::cout << boost::format("Backpressure: %d blocks (%d samples) left out, %d segments spilled, "
+			"receive stalled %d times for %.3f s\n") % writer.getShedBlocks() % writer.getShedSamps()
+			% writer.getSpilledSegments() % ringWaits % ringWaitSeconds;
+	RecordJournal::Stats js = writer.getJournalStats();
+	if (js.commits > 0)
+		std::cout << boost::format("Journal: %d commits, sync %.1f ms avg, %d sync errors\n")
+			% js.commits % (js.syncSeconds / js.commits * 1e3) % js.syncErrors;
+}
 
+void ReceiverClass::startSource(SampleSource& source)
+{
+	if (armStart)
+		armStart();
+	source.startStream();
 }
 
-void ReceiverClass::savefile()
+void ReceiverClass::sizeBuffers(SampleSource& source)
 {
-	std::unique_lock<std::mutex> lk(mut);
-	while (!Stopflag)
-	{
-		// wait for condition variable to be signalled
-		cv.wait(lk, [&] {return buffidx2save >= 0 || Stopflag; });
-		if (Stopflag)
+	const double rate = source.getRate();
+	const size_t packetSamps = std::max<size_t>(source.getMaxNumSamps(), 1);
+	const size_t targetSamps = std::max(packetSamps, (size_t)(latencyTarget * rate));
+
+	if (autotuneRecv)
+		samps_per_buff = tuneRecvSamps(source, packetSamps, targetSamps);
+	else
+		samps_per_buff = packetSamps * (targetSamps / packetSamps);
+	ringBlockSamps = samps_per_buff * (targetSamps / samps_per_buff);
+
+	std::cout << boost::format("recv() chunk %d samples (%d packets), ring block %d samples (%.3f ms)\n")
+		% samps_per_buff % (samps_per_buff / packetSamps) % ringBlockSamps % (ringBlockSamps / rate * 1e3);
+}
+
+size_t ReceiverClass::tuneRecvSamps(SampleSource& source, size_t packetSamps, size_t maxSamps)
+{
+	// Timing recv() on a live stream mostly measures waiting for samples.
+	// Instead let a short backlog build up, then time back-to-back calls
+	// that only take from it, so what is measured is the per-call and
+	// per-sample cost. Samples read here are discarded.
+	const double rate = source.getRate();
+	const size_t nch = source.getNumChannels();
+	const double backlog = 0.002;
+	std::vector<size_t> sizes;
+	for (size_t n = packetSamps; n <= maxSamps && sizes.size() < 8; n *= 2)
+		sizes.push_back(n);
+
+	Ipp16sc* scratch = ippsMalloc_16sc_L(sizes.back() * nch); // also fits sc8
+	std::vector<void*> buffs(nch);
+	for (size_t c = 0; c < nch; c++)
+		buffs[c] = scratch + c * sizes.back();
+	uhd::rx_metadata_t md;
+
+	// Wait out a timed start
+	for (int i = 0; i < maxTimeouts && !Stopflag; i++)
+		if (source.recv(buffs, packetSamps, md, 0.5 + source.getStartLatency()) > 0)
 			break;
 
-		filename = std::to_string(timetag[buffidx2save]) + ".bin";
-		std::ofstream outfile(filename, std::ios::out | std::ios::binary);
-		if (buffidx2save == 0)
+	std::vector<double> cost(sizes.size(), 1e9); // seconds per sample, best of 3
+	for (int round = 0; round < 3; round++) {
+		for (size_t i = 0; i < sizes.size(); i++) {
+			size_t n = sizes[i];
+			double wait = std::max(backlog, 4.0 * n / rate);
+			size_t calls = std::max<size_t>(1, (size_t)(wait * rate / 2) / n); // half the backlog
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+			size_t got = 0;
+			auto t0 = std::chrono::steady_clock::now();
+			for (size_t k = 0; k < calls; k++)
+				got += source.recv(buffs, n, md, 0.1);
+			double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			if (got > 0)
+				cost[i] = std::min(cost[i], dt / got);
+		}
+	}
+	ippsFree(scratch);
+
+	// Smallest chunk within 10% of the cheapest: lower latency for the same throughput
+	double best = *std::min_element(cost.begin(), cost.end());
+	size_t pick = 0;
+	while (cost[pick] > 1.1 * best)
+		pick++;
+	for (size_t i = 0; i < sizes.size(); i++)
+		std::cout << boost::format("recv() %6d samples: %.2f ns/sample%s\n")
+			% sizes[i] % (cost[i] * 1e9) % (i == pick ? " <-" : "");
+	return sizes[pick];
+}
+
+RxStats::ErrorKind ReceiverClass::errorKind(uhd::rx_metadata_t::error_code_t code)
+{
+	switch (code) {
+	case uhd::rx_metadata_t::ERROR_CODE_NONE: return RxStats::ERR_NONE;
+	case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT: return RxStats::ERR_TIMEOUT;
+	case uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND: return RxStats::ERR_LATE;
+	case uhd::rx_metadata_t::ERROR_CODE_BROKEN_CHAIN: return RxStats::ERR_BROKEN_CHAIN;
+	case uhd::rx_metadata_t::ERROR_CODE_OVERFLOW: return RxStats::ERR_OVERFLOW;
+	case uhd::rx_metadata_t::ERROR_CODE_ALIGNMENT: return RxStats::ERR_ALIGNMENT;
+	case uhd::rx_metadata_t::ERROR_CODE_BAD_PACKET: return RxStats::ERR_BAD_PACKET;
+	default: return RxStats::ERR_OTHER;
+	}
+}
+
+SampleBlock* ReceiverClass::nextRingBlock()
+{
+	// With blockWhenFull a full ring stalls the receive loop instead of
+	// dropping the block; the device then overflows and the loss comes back
+	// as a device gap
+	if (blockWhenFull && rxring.isFull()) {
+		auto t0 = std::chrono::steady_clock::now();
+		while (rxring.isFull() && !Stopflag)
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		ringWaits.fetch_add(1, std::memory_order_relaxed);
+		ringWaitSeconds = ringWaitSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+	return rxring.beginWrite();
+}
+
+void ReceiverClass::endRingBlock(const SampleBlock* blk)
+{
+	ringPhase = (ringPhase + blk->nsamps) % (RING_PAGE / sizeof(Ipp16sc));
+	rxring.endWrite();
+}
+
+SampleBlock* ReceiverClass::recoverGap(SampleBlock* blk, size_t rIdx, size_t num_rx_samps,
+	const DeviceTime& t, double drift, uint64_t& sampCount)
+{
+	// The samples just received belong after the gap: park them, close the
+	// block at rIdx, account for (or pad) the gap and restart them in a fresh block
+	int64_t lost = drift > 0 ? (int64_t)std::llround(drift) : 0;
+	const bool pad = gapPolicy == GAP_PAD && lost > 0 && (size_t)lost <= maxPadSamps;
+	if (drift < 0)
+		rxstats.recordTimeJump();
+	rxstats.recordGap(lost, pad);
+
+	blk->exportSamps(rIdx, num_rx_samps, rxcarry, samps_per_buff);
+	blk->nsamps = rIdx;
+	if (rIdx > 0) {
+		sampCount += rIdx;
+		endRingBlock(blk);
+		blk = nullptr;
+	}
+
+	if (pad) {
+		uint64_t remain = lost;
+		while (remain > 0) {
+			if (blk == nullptr)
+				blk = nextRingBlock();
+			size_t n = (size_t)std::min<uint64_t>(remain, blockTarget());
+			blk->zeroSamps(0, n);
+			blk->nsamps = n;
+			blk->sampOffset = sampCount;
+			blk->time = t.plus(-double(remain) / streamRate);
+			blk->hasTime = true;
+			blk->flags = BLOCK_FLAG_PADDED;
+			blk->lostBefore = remain == (uint64_t)lost ? lost : 0;
+			sampCount += n;
+			remain -= n;
+			endRingBlock(blk);
+			blk = nullptr;
+		}
+	}
+	else
+		sampCount += lost;
+
+	if (blk == nullptr)
+		blk = nextRingBlock();
+	blk->importSamps(0, num_rx_samps, rxcarry, samps_per_buff);
+	blk->nsamps = num_rx_samps;
+	blk->sampOffset = sampCount;
+	blk->time = t;
+	blk->hasTime = true;
+	if (!pad) {
+		blk->flags = BLOCK_FLAG_DISCONT;
+		blk->lostBefore = lost;
+	}
+	return blk;
+}
+
+void ReceiverClass::dspLoop()
+{
+	applyThreadPolicy(dspPolicy, "uhd_dsp");
+	while (true)
+	{
+		SampleBlock* blk = rxring.beginRead();
+		if (blk == nullptr) {
+			// Drain everything that was published before the receiver stopped
+			if (!Receivingflag)
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			continue;
+		}
+
+		// The output block is reused by the next process(), so it is copied
+		// into the writer's ring; if that is full the copy goes to its scratch
+		// block and the writer sees an overrun
+		const SampleBlock* out = chz.isEnabled() ? chz.process(*blk) : ddc.process(*blk);
+		if (out != nullptr) {
+			SampleBlock* dst = dspring.beginWrite();
+			dst->importSamps(0, out->nsamps, out->data, out->stride);
+			dst->nsamps = out->nsamps;
+			dst->sampOffset = out->sampOffset;
+			dst->time = out->time;
+			dst->hasTime = out->hasTime;
+			dst->flags = out->flags;
+			dst->lostBefore = out->lostBefore;
+			dspring.endWrite();
+		}
+		if (extractor.isEnabled())
+			feedExtractor(*blk);
 		{
-			outfile.write(reinterpret_cast<char*>(rxbuffs[buffidx2save]), rxrate * sizeof(Ipp16sc));
-			printf("Wrote from buffer 0, %zd samples\n", rxrate);
+			std::lock_guard<std::mutex> lock(snapMut);
+			snapshot = BlockRef(*blk);
+		}
+		rxring.endRead();
+	}
+	Dspingflag = false;
+}
+
+void ReceiverClass::feedExtractor(const SampleBlock& blk)
+{
+	{
+		std::lock_guard<std::mutex> lock(extractMut);
+		if (extractQueue.size() >= extractQueueBlocks) {
+			extractSkipped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		extractQueue.emplace_back(blk);
+	}
+	extractCv.notify_one();
+}
+
+void ReceiverClass::extractLoop()
+{
+	// At the DSP priority, but off the DSP thread's CPU
+	ThreadPolicy policy = dspPolicy;
+	policy.cpu = -1;
+	applyThreadPolicy(policy, "uhd_extract");
+	std::unique_lock<std::mutex> lock(extractMut);
+	while (true)
+	{
+		extractCv.wait(lock, [this] { return !extractQueue.empty() || !Extractingflag; });
+		if (extractQueue.empty())
+			break;
+		BlockRef blk = std::move(extractQueue.front());
+		extractQueue.pop_front();
+		lock.unlock();
+		extractor.process(*blk);
+		blk.reset();
+		lock.lock();
+	}
+}
+
+void ReceiverClass::savefile()
+{
+	applyThreadPolicy(writerPolicy, "uhd_writer");
+	// Full-rate blocks straight from the receiver, or what dspLoop() makes of them
+	SampleRing& ring = dspStage ? dspring : rxring;
+	const std::atomic<bool>& upstream = dspStage ? Dspingflag : Receivingflag;
+	while (true)
+	{
+		SampleBlock* blk = ring.beginRead();
+		if (blk == nullptr) {
+			// Drain everything that was published before the producer stopped
+			if (!upstream)
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			continue;
+		}
+
+		// The ring's fill is how far the writer is behind, which drives the backpressure policy
+		const double fill = (double)ring.getFill() / ring.getNumSlots();
+		if (!writer.writeBlock(*blk, fill))
+			std::cerr << boost::format("Write failed for block %d\n") % blk->seq;
+		if (!dspStage) {
+			if (extractor.isEnabled())
+				feedExtractor(*blk);
+			std::lock_guard<std::mutex> lock(snapMut);
+			snapshot = BlockRef(*blk);
 		}
-		outfile.close();
-		buffidx2save = -1;
+		ring.endRead();
 	}
 }
 
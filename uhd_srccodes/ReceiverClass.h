@@ -23,13 +23,32 @@
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <ctime>
+#include <cmath>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <string>
 #include "ipp.h"
+#include "SampleRing.h"
+#include "RecordWriter.h"
+#include "RxStats.h"
+#include "SampleSource.h"
+#include "MergeSource.h"
+#include "Ddc.h"
+#include "Channelizer.h"
+#include "FftExtractor.h"
 
 namespace po = boost::program_options;
 
+// What the receive loop does with samples lost at the device (overflows).
+// GAP_TAG marks the first block after a gap with the number of lost samples;
+// GAP_PAD instead inserts zero blocks so the recording stays sample-continuous
+// with device time, for gaps up to maxPadSamps.
+enum GapPolicy { GAP_TAG, GAP_PAD };
+
 class ReceiverClass
 {
 private:
@@ -45,25 +64,90 @@ private:
 	double rxfreq;
 	int rxrate;
 	double rxgain, lo_offset;
-	size_t samps_per_buff; 
-	size_t rx_ch = 0;
+	size_t samps_per_buff = 0;           // recv() chunk, sized per source in receiveLoop()
+	size_t rx_ch = 0;                    // first of rx_chs, used for device-wide queries
+	std::vector<size_t> rx_chs = { 0 };  // streamed channels, all configured alike
+	size_t numChans = 1;
+	bool interleavedLayout = false;      // ring block layout, see SampleBlock
+	bool perChannelFiles = false;        // <name>_ch<N>.bin per channel instead of one interleaved file
+	WireFormat otwFormat = WIRE_SC16;    // over-the-wire format
+	WireFormat cpuFormat = WIRE_SC16;    // recv() format; WIRE_SC8 only with sc8 on the wire
 
 	// File saving metric
-	int buffidx = 0, buffidx2save = -1;
-	std::vector<UINT64> timetag = { 0,0 };
 	std::string filename;
+	std::string recordPrefix = "rec"; // capture files are <prefix>_<local start time>.*
+	RecordWriter writer;
+	bool sigmfOutput = false;   // .sigmf-data/.sigmf-meta instead of .bin
+	bool gpsTime = false;       // device time set from the GPSDO, i.e. UTC
+
+	// GPSDO lock state is polled during a capture and annotated in the recording
+	std::thread thrd_monitor;
+	std::atomic<bool> Monitorflag{ false };
+	void monitorLoop();
+
+	// Overflow recovery, see GapPolicy
+	GapPolicy gapPolicy = GAP_TAG;
+	size_t maxPadSamps = 0;     // set to one second of samples in configure()
+	int maxTimeouts = 10;       // consecutive recv() timeouts before the stream command is reissued
+	double streamRate = 0;      // actual rate of the running stream
+	RxStats rxstats;
+	double startDelay = 0;      // seconds from now to the timed stream start; 0 = default, immediate for one channel
+	std::shared_ptr<MergeSource> merge; // per-board merge of the running multi-board capture
+	Ipp16sc* rxcarry = nullptr; // one recv() worth of samples moved across a gap, planar
+	Ipp16sc* rxplanar = nullptr; // recv() landing buffer for interleaved blocks
+	Ipp8sc* rxwire = nullptr;    // recv() landing buffer for sc8 host samples, widened into the block
+	static RxStats::ErrorKind errorKind(uhd::rx_metadata_t::error_code_t code);
+
+	// recv() chunk and ring block sizing. Both are whole device packets
+	// (get_max_num_samps()) and a block holds at most latencyTarget seconds,
+	// so a block is handed to the writer that long after its first sample.
+	double latencyTarget = 0.001;
+	bool autotuneRecv = false;  // measure recv() cost at several chunk sizes and pick one
+	size_t ringBlockSamps = 0;
+	void sizeBuffers(SampleSource& source);
+	size_t tuneRecvSamps(SampleSource& source, size_t packetSamps, size_t maxSamps);
+	void receiveLoop(SampleSource& source);
+	// Sets the timed start of a radio capture just before its stream starts; empty otherwise
+	std::function<void()> armStart;
+	void startSource(SampleSource& source);
+	// Backpressure: see BackpressurePolicy; the ring side is here
+	bool blockWhenFull = false;
+	std::atomic<uint64_t> ringWaits{ 0 };
+	std::atomic<double> ringWaitSeconds{ 0 };
+	SampleBlock* nextRingBlock();
+	// Blocks end on a page of samples where they can: the one after a short
+	// block (a gap) is cut so the next starts on a page again, which lets the
+	// writer keep handing whole blocks to direct I/O in place
+	size_t ringPhase = 0;       // samples in the blocks ended so far, modulo a page
+	size_t blockTarget() const { return rxring.getBlockSamps() - ringPhase; }
+	void endRingBlock(const SampleBlock* blk);
+	SampleBlock* recoverGap(SampleBlock* blk, size_t rIdx, size_t num_rx_samps,
+		const DeviceTime& t, double drift, uint64_t& sampCount);
+	size_t boardOfChannel(size_t ch);
 
 	// Signal Characteristics metric
 	std::vector<double> ampVec;
 
-	// DDC and Filters (CPU)
-	Ipp32f* pTaps = nullptr;
-	Ipp32fc* pTaps_c = nullptr;
-	Ipp32fc* pDlySrc[2] = { nullptr, nullptr };
-	IppsFIRSpec_32fc* pSpec = nullptr;
-	Ipp8u* SR_pBuffer = nullptr;
-	int numTaps = 2000; // refer to initFilter();
-	int DlyLen;
+	// DDC (CPU), run by dspLoop() between the ring and the writer
+	DdcConfig ddcConfig;
+	Ddc ddc;
+	// Filter-bank channelizer, the same place; takes the DDC's when both are set
+	ChannelizerConfig chzConfig;
+	Channelizer chz;
+	// Channel extractor on the full-rate blocks, alongside whatever is recorded.
+	// It runs on a thread of its own, fed references to ring blocks; when it
+	// is extractQueueBlocks behind, blocks are skipped and it restarts on the
+	// next one, so it never holds up the writer or the DSP stage.
+	ExtractorConfig extractorConfig;
+	FftExtractor extractor;
+	size_t extractQueueBlocks = 4;
+	std::deque<BlockRef> extractQueue;   // guarded by extractMut
+	std::mutex extractMut;
+	std::condition_variable extractCv;
+	bool Extractingflag = false;         // guarded by extractMut
+	std::atomic<uint64_t> extractSkipped{ 0 };
+	void feedExtractor(const SampleBlock& blk);
+	void extractLoop();
 
 	// FFT operation IPP variables
 	IppsDFTSpec_C_32fc* pDFTSpec = nullptr;
@@ -78,12 +162,7 @@ private:
 	{
 		freeFFTfn();
 
-		int sizeSpec = 0, sizeInit = 0, sizeBuf = 0;
-		ippsDFTGetSize_C_32fc(fftlen, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, &sizeSpec, &sizeInit, &sizeBuf);
-		pDFTSpec = (IppsDFTSpec_C_32fc*)ippMalloc(sizeSpec);
-		pDFTBuffer = (Ipp8u*)ippMalloc(sizeBuf);
-		pDFTMemInit = (Ipp8u*)ippMalloc(sizeInit);
-		ippsDFTInit_C_32fc(fftlen, IPP_FFT_NODIV_BY_ANY, ippAlgHintNone, pDFTSpec, pDFTMemInit);
+		initDft(fftlen, pDFTSpec, pDFTBuffer, pDFTMemInit);
 
 		dft_in = ippsMalloc_32fc_L(fftlen);
 		dft_out = ippsMalloc_32fc_L(fftlen);
@@ -91,9 +170,7 @@ private:
 	}
 	void freeFFTfn()
 	{
-		ippFree(pDFTSpec);
-		ippFree(pDFTBuffer);
-		ippFree(pDFTMemInit);
+		freeDft(pDFTSpec, pDFTBuffer, pDFTMemInit);
 
 		ippsFree(dft_in);
 		ippsFree(dft_out);
@@ -104,30 +181,61 @@ private:
 	}
 
 	// Thread control
-	bool Receivingflag = true;
-	bool Stopflag = false;
+	ThreadPolicy rxPolicy;       // receive thread, which also places the ring memory
+	ThreadPolicy writerPolicy;   // savefile()
+	ThreadPolicy dspPolicy;      // dspLoop(), and the channelizer's workers at its priority
+	std::vector<ThreadPolicy> boardPolicies; // per-board receive threads of a multi-board capture
+	MemPolicy memPolicy;         // ring blocks
+	void runReceiveThread(SampleSource& source);
+	std::atomic<bool> Receivingflag{ false };
+	std::atomic<bool> Stopflag{ false };
+	bool dspStage = false;       // this capture runs dspLoop()
+	std::atomic<bool> Dspingflag{ false };
 	std::thread thrd_startup;
 	std::thread thrd_receivethread;
+	std::thread thrd_dspthread;
+	std::thread thrd_extractthread;
 	std::thread thrd_savethread;
-	std::mutex mut;
-	std::condition_variable cv;
 
 	// Arrays
-	Ipp16sc* rxbuffs[2];
-	Ipp32fc* rx_32fc;
-	Ipp32fc* filtered;
-	Ipp32fc* downsampled;
+	SampleRing rxring; // recv loop -> dspLoop() or savefile() hand-off, ringBlockSamps per block
+	SampleRing dspring; // dspLoop() -> savefile() hand-off of the DDC's or channelizer's output
+	BlockRef snapshot;          // last block written, see getSnapshot(); guarded by snapMut
+	mutable std::mutex snapMut;
+	size_t ringSlots = 0;       // 0 = enough blocks for ringSeconds of samples
+	double ringSeconds = 1.0;
 	void allocMem()
 	{
-		rxbuffs[0] = ippsMalloc_16sc_L(rxrate);
-		rxbuffs[1] = ippsMalloc_16sc_L(rxrate);
-		rx_32fc = ippsMalloc_32fc_L(rxrate*2); 
+		freeMem();
+		size_t slots = ringSlots;
+		if (slots == 0)
+			slots = std::max<size_t>(16, (size_t)std::ceil(ringSeconds * rxrate / ringBlockSamps));
+		// Spare blocks for what the writer holds past endRead(), plus the snapshot,
+		// plus the extractor's queue and the block it is on
+		rxring.init(slots, ringBlockSamps, numChans, interleavedLayout, memPolicy,
+			writer.getMaxHeldBlocks(numChans, perChannelFiles) + 2
+			+ (extractorConfig.enabled ? extractQueueBlocks + 1 : 0));
+		rxcarry = ippsMalloc_16sc_L(samps_per_buff * numChans);
+		rxplanar = ippsMalloc_16sc_L(samps_per_buff * numChans);
+		rxwire = (Ipp8sc*)ippsMalloc_8s_L(2 * samps_per_buff * numChans);
 	}
 	void freeMem()
 	{
-		ippsFree(rxbuffs[0]);
-		ippsFree(rxbuffs[1]);
-		ippsFree(rx_32fc);
+		{
+			std::lock_guard<std::mutex> lock(snapMut);
+			snapshot.reset();
+		}
+		rxring.free();
+		dspring.free();
+		ippsFree(rxcarry);
+		ippsFree(rxplanar);
+		ippsFree(rxwire);
+		ddc.free();
+		chz.free();
+		extractor.free();
+		rxcarry = nullptr;
+		rxplanar = nullptr;
+		rxwire = nullptr;
 	}
 
 public:
@@ -148,8 +256,10 @@ public:
 		rxrate = in_rxrate;
 		rxgain = in_rxgain;
 		lo_offset = in_lo_offset;
+		numChans = rx_chs.size();
 		configure();
 		USRPconfiguredflag = true;
+		gpsTime = in_clocksource == 1 && USRPgpsflag != -1;
 		if (in_clocksource==1) //0:internal 1:GPSDO
 			sync_to_gps();
 	}
@@ -160,9 +270,94 @@ public:
 	bool checkConfig();
 	void sync_to_gps();
 	std::vector<double>& getAmpVec() { return ampVec;}
+	void setRingSlots(size_t in_slots) { ringSlots = in_slots; } // applied on next start(); 0 = automatic
+	const SampleRing& getRing() const { return rxring; }
+	// Thread safe. The block the writer took last, shared rather than copied:
+	// hold it only briefly, the ring is one block short meanwhile. Empty
+	// before the first block.
+	BlockRef getSnapshot() const
+	{
+		std::lock_guard<std::mutex> lock(snapMut);
+		return snapshot;
+	}
+	void setRecordPrefix(const std::string& in_prefix) { recordPrefix = in_prefix; }
+	const RecordWriter& getWriter() const { return writer; }
+	const TimeMap& getTimeMap() const { return writer.getTimeMap(); } // stream sample index <-> device time
+	bool getReceivingflag() const { return Receivingflag; }
+	void setGapPolicy(GapPolicy in_policy) { gapPolicy = in_policy; }
+	// Multi-channel receive; applied on next USRPconfigure()
+	void setChannels(const std::vector<size_t>& in_chs) { if (!in_chs.empty()) { rx_chs = in_chs; rx_ch = in_chs[0]; } }
+	void setLayout(bool in_interleaved, bool in_perChannelFiles) { interleavedLayout = in_interleaved; perChannelFiles = in_perChannelFiles; }
+	size_t getNumChans() const { return numChans; }
+	// Record narrow bands through a DDC instead of the full rate (none = full rate); next start()
+	void setDdc(const DdcConfig& in_cfg) { ddcConfig = in_cfg; }
+	const Ddc& getDdc() const { return ddc; }
+	// Record channels of a uniform filter bank instead (numChannels 0 = none); next start()
+	void setChannelizer(const ChannelizerConfig& in_cfg) { chzConfig = in_cfg; }
+	const Channelizer& getChannelizer() const { return chz; }
+	// Watch channels of any width and centre while recording; next start().
+	// Channels can be added to and removed from getExtractor() at any time.
+	void setExtractor(const ExtractorConfig& in_cfg) { extractorConfig = in_cfg; }
+	FftExtractor& getExtractor() { return extractor; }
+	uint64_t getExtractorSkipped() const { return extractSkipped.load(std::memory_order_relaxed); }
+	// Wire and host sample formats for the next start(); host sc8 needs sc8 on the
+	// wire and is widened to sc16 before the ring. Recordings note the wire format.
+	void setStreamFormat(WireFormat in_otw, bool in_narrowHost)
+	{
+		otwFormat = in_otw;
+		cpuFormat = in_narrowHost && in_otw == WIRE_SC8 ? WIRE_SC8 : WIRE_SC16;
+	}
+	const RxStats& getRxStats() const { return rxstats; }
+	// Seconds of samples per ring block and recv() chunk sizing, applied on next start()
+	void setLatencyTarget(double in_seconds) { latencyTarget = in_seconds; }
+	void setRecvAutotune(bool in_autotune) { autotuneRecv = in_autotune; }
+	size_t getRecvSamps() const { return samps_per_buff; }
+	// Scheduling of the pipeline threads and placement of the ring, applied on next start().
+	// The ring is allocated by the receive thread, so with memory.numaNode -1 it
+	// lands on the node of the receive CPU.
+	void setThreadPolicies(const ThreadPolicy& in_rx, const ThreadPolicy& in_writer, const ThreadPolicy& in_dsp)
+	{
+		rxPolicy = in_rx;
+		writerPolicy = in_writer;
+		dspPolicy = in_dsp;
+	}
+	void setBoardPolicies(const std::vector<ThreadPolicy>& in_policies) { boardPolicies = in_policies; }
+	void setMemPolicy(const MemPolicy& in_mem) { memPolicy = in_mem; }
+	// Direct/async disk writes of the recording, applied on next start()
+	void setDiskConfig(const DiskWriterConfig& in_cfg) { writer.setDiskConfig(in_cfg); }
+	// SigMF recordings (applied on next start())
+	void setSigmf(bool in_sigmf) { sigmfOutput = in_sigmf; }
+	// Raw recordings in preallocated segments of in_bytes or in_seconds, 0 = one file; next start()
+	void setSegments(uint64_t in_bytes, double in_seconds) { writer.setSegments(in_bytes, in_seconds); }
+	// .iqz recordings coded by in_workers threads, 0 = off; next start()
+	void setCompression(size_t in_workers, IqzCodec in_codec = IQZ_LOSSLESS) { writer.setCompression(in_workers, in_codec); }
+	// What to do when the disk falls behind, next start()
+	void setBackpressure(const BackpressureConfig& in_cfg)
+	{
+		writer.setBackpressure(in_cfg);
+		blockWhenFull = in_cfg.blockWhenFull;
+	}
+	uint64_t getRingWaits() const { return ringWaits.load(std::memory_order_relaxed); }
+	// Crash-consistent recordings committed every in_seconds, 0 = off; next start()
+	void setJournal(double in_seconds) { writer.setJournal(in_seconds); }
+	// New frequency and gain on all channels. During a capture the change is a
+	// timed command, so the recording's new SigMF capture segment starts on
+	// the first sample taken with the new settings.
+	void retune(double in_rxfreq, double in_rxgain);
+	const ThreadPolicy& getDspPolicy() const { return dspPolicy; }
+	// Timed start, needed for a common first sample across boards and channels
+	// (when this is 0, multi-board captures default to 1 s, multi-channel ones to 0.1 s)
+	void setStartDelay(double in_delay) { startDelay = in_delay; }
+	std::shared_ptr<const MergeSource> getMerge() const { return std::atomic_load(&merge); } // null unless several boards stream
 
+	// Arms a capture: call before spawning the thread that runs start() or
+	// startFromSource(), so that a cancel() from then on stops it
+	void prepare() { Stopflag = false; }
 	// Start the receiver and the process loop
 	void start();
+	// Run the same pipeline on a non-radio source (synthetic, replay); no USRP needed
+	void startFromSource(SampleSource::sptr source);
 	void cancel() { Stopflag = true; }
+	void dspLoop(); // Called as a worker thread when a DDC or channelizer is set
 	void savefile(); // Called as a worker thread
 };
\ No newline at end of file
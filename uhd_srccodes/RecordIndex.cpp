@@ -0,0 +1,215 @@
+#include "RecordIndex.h"
+#include "SigmfMeta.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+
+std::string recordDataName(const std::string& basename, const RecordLayout& layout, size_t f, size_t seg)
+{
+	if (layout.format == RECORD_SIGMF)
+		return SigmfMeta::dataName(basename, f, layout.perChannelFiles);
+	std::string name = layout.perChannelFiles ? str(boost::format("%s_ch%d") % basename % f) : basename;
+	if (layout.segmented)
+		name += str(boost::format("_%05d") % seg);
+	return name + (layout.format == RECORD_IQZ ? ".iqz" : ".bin");
+}
+
+bool RecordIndex::open(const std::string& path)
+{
+	infile.close();
+	infile.clear();
+	numBlocks = 0;
+	infile.open(path, std::ios::in | std::ios::binary);
+	if (!infile.is_open()) {
+		std::cerr << boost::format("Could not open %s\n") % path;
+		return false;
+	}
+	if (!infile.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != RIX_MAGIC
+		|| header.entryBytes != sizeof(RecordIndexEntry) || header.numChans < 1) {
+		std::cerr << boost::format("%s is not a recording index\n") % path;
+		return false;
+	}
+	layout = header.layout();
+
+	// Whole blocks only; a capture that died mid-entry leaves a torn tail
+	infile.seekg(0, std::ios::end);
+	const uint64_t size = (uint64_t)infile.tellg();
+	numBlocks = (size - sizeof(header)) / sizeof(RecordIndexEntry) / layout.numFiles();
+	if (numBlocks > 0 && !(entry(0, 0, first) && entry(numBlocks - 1, 0, last)))
+		numBlocks = 0;
+	return true;
+}
+
+bool RecordIndex::entry(uint64_t b, size_t f, RecordIndexEntry& out)
+{
+	const uint64_t at = sizeof(header) + (b * layout.numFiles() + f) * sizeof(RecordIndexEntry);
+	infile.seekg((std::streamoff)at);
+	if (!infile.read(reinterpret_cast<char*>(&out), sizeof(out))) {
+		infile.clear();
+		return false;
+	}
+	return true;
+}
+
+template <typename Key>
+uint64_t RecordIndex::search(double v, Key key)
+{
+	if (numBlocks == 0)
+		return 0;
+	uint64_t lo = 0, hi = numBlocks - 1;
+	double klo = key(first), khi = key(last);
+	if (v < klo)
+		return 0;
+	if (v >= khi)
+		return hi;
+
+	// key(lo) <= v < key(hi). Interpolating hits the block straight away when
+	// blocks are equal in length; after a few misses (a long gap skews the
+	// estimate) bisecting bounds the worst case.
+	RecordIndexEntry e;
+	for (int step = 0; hi - lo > 1; step++) {
+		uint64_t g = step < 4 ? lo + (uint64_t)((v - klo) / (khi - klo) * (double)(hi - lo)) : lo + (hi - lo) / 2;
+		g = std::min(std::max(g, lo + 1), hi - 1);
+		if (!entry(g, 0, e))
+			break;
+		double kg = key(e);
+		if (kg <= v) {
+			lo = g;
+			klo = kg;
+		}
+		else {
+			hi = g;
+			khi = kg;
+		}
+	}
+	return lo;
+}
+
+uint64_t RecordIndex::findFileSample(uint64_t s)
+{
+	return search((double)s, [](const RecordIndexEntry& e) { return (double)e.fileSample; });
+}
+
+uint64_t RecordIndex::findStreamSample(uint64_t s)
+{
+	return search((double)s, [](const RecordIndexEntry& e) { return (double)e.sampOffset; });
+}
+
+uint64_t RecordIndex::findTime(const DeviceTime& t)
+{
+	const DeviceTime t0 = first.time();
+	return search(t.minus(t0), [&t0](const RecordIndexEntry& e) { return e.time().minus(t0); });
+}
+
+uint64_t RecordIndex::findSegmentEnd(uint64_t seg)
+{
+	return search((double)seg + 0.5, [](const RecordIndexEntry& e) { return (double)e.segment; });
+}
+
+bool RecordIndex::fileSampleAt(const DeviceTime& t, uint64_t& s)
+{
+	RecordIndexEntry e;
+	if (!hasTime() || !entry(findTime(t), 0, e))
+		return false;
+	// A time in the gap after a block maps to the first sample after the gap
+	double d = std::round(t.minus(e.time()) * header.rate);
+	s = e.fileSample + (d <= 0 ? 0 : std::min<uint64_t>((uint64_t)d, e.nsamps));
+	return true;
+}
+
+bool RecordReader::open(const std::string& in_basename)
+{
+	basename = in_basename;
+	if (!index.open(basename + ".idx"))
+		return false;
+	layout = index.getLayout();
+	files = std::vector<DataFile>(layout.numFiles());
+	return true;
+}
+
+bool RecordReader::readBlock(const RecordIndexEntry& e, size_t from, size_t n, Ipp16sc* dst)
+{
+	if (e.file >= files.size())
+		return false;
+	DataFile& df = files[e.file];
+	if (df.segment != e.segment) {
+		std::string name = recordDataName(basename, layout, e.file, e.segment);
+		df.stream.close();
+		df.stream.clear();
+		df.stream.open(name, std::ios::in | std::ios::binary);
+		if (!df.stream.is_open()) {
+			std::cerr << boost::format("Could not open %s\n") % name;
+			df.segment = SIZE_MAX;
+			return false;
+		}
+		df.segment = e.segment;
+	}
+
+	// Raw blocks are read from the first wanted sample; frames whole
+	const size_t fileChans = layout.fileChans();
+	const Ipp16sc* src;
+	if (layout.format == RECORD_IQZ) {
+		IqzFrameHeader hdr;
+		df.stream.seekg((std::streamoff)e.byteOffset);
+		if (!df.stream.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) || hdr.magic != IQZ_MAGIC
+			|| hdr.fileSample != e.fileSample || hdr.nsamps != e.nsamps) {
+			df.stream.clear();
+			return false;
+		}
+		frame.resize(hdr.payloadBytes);
+		scratch.resize((size_t)hdr.nsamps * fileChans);
+		if (!df.stream.read(reinterpret_cast<char*>(frame.data()), frame.size())
+			|| !iqzDecodeFrame(hdr, frame.data(), scratch.data())) {
+			df.stream.clear();
+			return false;
+		}
+		src = scratch.data() + from * fileChans;
+	}
+	else {
+		scratch.resize(n * fileChans);
+		df.stream.seekg((std::streamoff)(e.byteOffset + from * fileChans * sizeof(Ipp16sc)));
+		if (!df.stream.read(reinterpret_cast<char*>(scratch.data()), n * fileChans * sizeof(Ipp16sc))) {
+			df.stream.clear();
+			return false;
+		}
+		src = scratch.data();
+	}
+	if (fileChans == layout.numChans)
+		memcpy(dst, src, n * fileChans * sizeof(Ipp16sc));
+	else {
+		for (size_t i = 0; i < n; i++)
+			dst[i * layout.numChans] = src[i];
+	}
+	return true;
+}
+
+size_t RecordReader::read(uint64_t first, size_t n, Ipp16sc* dst)
+{
+	size_t done = 0;
+	const uint64_t total = getNumSamps();
+	if (first >= total)
+		return 0;
+	n = (size_t)std::min<uint64_t>(n, total - first);
+	RecordIndexEntry e;
+	for (uint64_t b = index.findFileSample(first); b < index.getNumBlocks() && done < n; b++) {
+		size_t take = 0;
+		for (size_t f = 0; f < layout.numFiles(); f++) {
+			if (!index.entry(b, f, e))
+				return done;
+			const size_t from = (size_t)(first + done - e.fileSample);
+			take = std::min<size_t>(n - done, e.nsamps - from);
+			if (!readBlock(e, from, take, dst + done * layout.numChans + f * layout.fileChans()))
+				return done;
+		}
+		done += take;
+	}
+	return done;
+}
+
+size_t RecordReader::readTime(const DeviceTime& t, size_t n, Ipp16sc* dst)
+{
+	uint64_t s;
+	return index.fileSampleAt(t, s) ? read(s, n, dst) : 0;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ipp.h"
+#include "TimeMap.h"
+#include "IqCodec.h"
+
+// Binary block index of a recording, <basename>.idx, and a reader that
+// uses it to seek without scanning the data files.
+// The index is a RecordIndexHeader followed by one fixed-size entry per
+// block and data file, in the order they were written: block b of data
+// file f is entry b * numFiles + f. Each entry places the block in the
+// stream (sample offset, device time) and on disk (segment, data file,
+// byte offset), so a timestamp or sample index maps to a file position by
+// reading a handful of entries: blocks are nearly always the same length,
+// so an interpolation step lands on or next to the right one, and only a
+// capture full of gaps needs more than one or two reads.
+
+#define RIX_MAGIC 0x31584952u    // "RIX1"
+#define RIX_FLAG_TIME 0x8000     // timeSecs/timeFrac are valid; the low bits are the block's BLOCK_FLAG_*
+
+enum RecordFormat
+{
+	RECORD_RAW = 0,      // sc16 .bin
+	RECORD_IQZ = 1,      // .iqz frames, see IqCodec.h
+	RECORD_SIGMF = 2,    // sc16 .sigmf-data
+};
+
+// What a recording's data files look like; enough to name and read them
+struct RecordLayout
+{
+	RecordFormat format = RECORD_RAW;
+	IqzCodec codec = IQZ_LOSSLESS;
+	size_t numChans = 1;
+	bool perChannelFiles = false;
+	bool segmented = false;
+
+	size_t numFiles() const { return perChannelFiles ? numChans : 1; }
+	size_t fileChans() const { return perChannelFiles ? 1 : numChans; }
+};
+
+// Data file f of segment seg: <basename>[_ch<f>][_<seg>].bin/.iqz, or the
+// SigMF dataset name. Shared by RecordWriter and the readers.
+std::string recordDataName(const std::string& basename, const RecordLayout& layout, size_t f, size_t seg);
+
+struct RecordIndexHeader
+{
+	uint32_t magic = RIX_MAGIC;
+	uint32_t entryBytes = 56;    // sizeof(RecordIndexEntry)
+	double rate = 0;
+	uint32_t numChans = 1;
+	uint32_t format = RECORD_RAW;
+	uint32_t codec = IQZ_LOSSLESS;
+	uint8_t perChannelFiles = 0;
+	uint8_t segmented = 0;
+	uint16_t reserved = 0;
+
+	RecordLayout layout() const
+	{
+		RecordLayout l;
+		l.format = (RecordFormat)format;
+		l.codec = (IqzCodec)codec;
+		l.numChans = numChans;
+		l.perChannelFiles = perChannelFiles != 0;
+		l.segmented = segmented != 0;
+		return l;
+	}
+};
+static_assert(sizeof(RecordIndexHeader) == 32, "RecordIndexHeader is a file format");
+
+struct RecordIndexEntry
+{
+	uint64_t sampOffset = 0;     // stream index of the block's first sample
+	uint64_t fileSample = 0;     // per-channel index of that sample in the recording
+	int64_t timeSecs = 0;        // its device time
+	double timeFrac = 0;
+	uint64_t byteOffset = 0;     // of the block (.iqz: of its frame header) in the data file
+	uint32_t nsamps = 0;         // per channel
+	uint32_t segment = 0;
+	uint16_t file = 0;           // data file within the segment (channel, with per-channel files)
+	uint16_t flags = 0;
+	uint32_t bytes = 0;          // of the block (frame) in the data file
+
+	bool hasTime() const { return (flags & RIX_FLAG_TIME) != 0; }
+	DeviceTime time() const
+	{
+		DeviceTime t;
+		t.secs = timeSecs;
+		t.frac = timeFrac;
+		return t;
+	}
+};
+static_assert(sizeof(RecordIndexEntry) == 56, "RecordIndexEntry is a file format");
+
+// Index reader. Entries are read on demand, so opening a multi-terabyte
+// recording costs the same as opening a short one.
+class RecordIndex
+{
+private:
+	std::ifstream infile;
+	RecordIndexHeader header;
+	RecordLayout layout;
+	uint64_t numBlocks = 0;
+	RecordIndexEntry first, last;
+
+	// Last block whose key(entry) <= v, for a key that grows with the block index
+	template <typename Key> uint64_t search(double v, Key key);
+
+public:
+	bool open(const std::string& path);
+	const RecordLayout& getLayout() const { return layout; }
+	double getRate() const { return header.rate; }
+	uint64_t getNumBlocks() const { return numBlocks; }
+	// Per channel, up to the end of the last indexed block
+	uint64_t getNumSamps() const { return numBlocks > 0 ? last.fileSample + last.nsamps : 0; }
+	bool hasTime() const { return numBlocks > 0 && first.hasTime(); }
+
+	// Entry of data file f for block b
+	bool entry(uint64_t b, size_t f, RecordIndexEntry& out);
+	// Block holding recording sample s, stream sample s, or the last block
+	// starting at or before device time t
+	uint64_t findFileSample(uint64_t s);
+	uint64_t findStreamSample(uint64_t s);
+	uint64_t findTime(const DeviceTime& t);
+	// Last block written to segment seg (or an earlier one, if it has none)
+	uint64_t findSegmentEnd(uint64_t seg);
+	// Recording sample at device time t (the nearest one in its block), false
+	// without timestamps
+	bool fileSampleAt(const DeviceTime& t, uint64_t& s);
+};
+
+// Sample reader for recordings of any layout and format, seeking through
+// the index: read() touches only the blocks it returns.
+class RecordReader
+{
+private:
+	std::string basename;
+	RecordIndex index;
+	RecordLayout layout;
+	struct DataFile
+	{
+		std::ifstream stream;
+		size_t segment = SIZE_MAX;
+	};
+	std::vector<DataFile> files;
+	std::vector<uint8_t> frame;
+	std::vector<Ipp16sc> scratch;
+
+	bool readBlock(const RecordIndexEntry& e, size_t from, size_t n, Ipp16sc* dst);
+
+public:
+	bool open(const std::string& in_basename);
+	RecordIndex& getIndex() { return index; }
+	const RecordLayout& getLayout() const { return layout; }
+	size_t getNumChans() const { return layout.numChans; }
+	uint64_t getNumSamps() const { return index.getNumSamps(); }
+
+	// Samples [first, first + n) of every channel, interleaved; returns the
+	// samples read. Lost samples are not in the recording, so a range across
+	// a gap continues after it.
+	size_t read(uint64_t first, size_t n, Ipp16sc* dst);
+	// n samples from device time t on
+	size_t readTime(const DeviceTime& t, size_t n, Ipp16sc* dst);
+};
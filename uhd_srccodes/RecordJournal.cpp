@@ -0,0 +1,346 @@
+#include "RecordJournal.h"
+#include "SigmfMeta.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static bool syncFile(FILE* fp)
+{
+	if (fflush(fp) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+// New files (segments) are only found again after a crash once their
+// directory entries are durable too. NTFS journals those itself.
+static void syncDir(const std::string& basename)
+{
+#ifndef _WIN32
+	std::string dir = boost::filesystem::path(basename).parent_path().string();
+	int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		::close(fd);
+	}
+#endif
+}
+
+static uint32_t commitCrc(const RecordJournalCommit& c)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(&c.seq, sizeof(c) - offsetof(RecordJournalCommit, seq));
+	return crc.checksum();
+}
+
+bool RecordJournal::open(const std::string& basename, const RecordIndexHeader& in_header, double in_syncInterval,
+	SyncFn in_sync)
+{
+	close();
+	header = in_header;
+	numFiles = header.layout().numFiles();
+	syncInterval = in_syncInterval > 0 ? in_syncInterval : 0;
+	syncFiles = in_sync;
+	indexfile = fopen((basename + ".idx").c_str(), "wb");
+	if (!indexfile) {
+		std::cerr << boost::format("Could not create %s.idx\n") % basename;
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, indexfile);
+	if (syncInterval > 0) {
+		journalfile = fopen((basename + ".journal").c_str(), "wb");
+		RecordJournalHeader jh;
+		jh.index = header;
+		if (!journalfile || fwrite(&jh, sizeof(jh), 1, journalfile) != 1 || !syncFile(journalfile)
+			|| !syncFile(indexfile)) {
+			std::cerr << boost::format("Could not create %s.journal\n") % basename;
+			if (journalfile)
+				fclose(journalfile);
+			journalfile = nullptr;
+			fclose(indexfile);
+			indexfile = nullptr;
+			return false;
+		}
+		syncDir(basename);
+	}
+	journalName = basename;
+	pending.clear();
+	last = RecordJournalCommit();
+	Errorflag = false;
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		stats = Stats();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		queue.clear();
+		Stopflag = false;
+	}
+	thrd = std::thread(&RecordJournal::journalLoop, this);
+	Openflag = true;
+	return true;
+}
+
+void RecordJournal::post(const RecordIndexEntry& e)
+{
+	// No notify: the journal thread picks entries up on its own schedule
+	std::lock_guard<std::mutex> lock(mut);
+	queue.push_back(e);
+}
+
+bool RecordJournal::writeEntries(std::vector<RecordIndexEntry>& batch)
+{
+	if (batch.empty())
+		return true;
+	if (fwrite(batch.data(), sizeof(RecordIndexEntry), batch.size(), indexfile) != batch.size()
+		|| fflush(indexfile) != 0) {
+		Errorflag = true;
+		return false;
+	}
+	if (journalfile)
+		pending.insert(pending.end(), batch.begin(), batch.end());
+	return true;
+}
+
+bool RecordJournal::commit()
+{
+	auto t0 = std::chrono::steady_clock::now();
+	Durable d;
+	bool ok = syncFiles && syncFiles(d) && syncFile(indexfile);
+	syncDir(journalName);
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		stats.syncSeconds += secs;
+		stats.lastSyncSeconds = secs;
+		if (!ok)
+			stats.syncErrors++;
+	}
+	if (!ok)
+		return false;
+
+	// Longest run of whole blocks with all their data durable. pending
+	// always starts on a block boundary.
+	size_t n = 0;
+	for (size_t i = 0; i < pending.size(); i++) {
+		const RecordIndexEntry& e = pending[i];
+		const bool durable = e.segment < d.segmentsDone
+			|| (e.segment == d.segment && e.file < d.bytes.size() && e.byteOffset + e.bytes <= d.bytes[e.file]);
+		if (!durable)
+			break;
+		if ((i + 1) % numFiles == 0)
+			n = i + 1;
+	}
+	if (n == 0)
+		return true;
+
+	RecordJournalCommit c;
+	c.seq = last.seq + 1;
+	c.entries = last.entries + n;
+	c.fileSamps = pending[n - 1].fileSample + pending[n - 1].nsamps;
+	c.segments = pending[n - 1].segment + 1;
+	c.crc = commitCrc(c);
+	if (fwrite(&c, sizeof(c), 1, journalfile) != 1 || !syncFile(journalfile)) {
+		Errorflag = true;
+		return false;
+	}
+	pending.erase(pending.begin(), pending.begin() + n);
+	last = c;
+	std::lock_guard<std::mutex> lock(statMut);
+	stats.commits++;
+	stats.committedEntries = c.entries;
+	stats.committedSamps = c.fileSamps;
+	return true;
+}
+
+void RecordJournal::journalLoop()
+{
+	// Index entries go out a few times a second whether or not journaling;
+	// commits every syncInterval
+	const double tick = syncInterval > 0 && syncInterval < 0.25 ? syncInterval : 0.25;
+	auto nextCommit = std::chrono::steady_clock::now() + std::chrono::duration<double>(syncInterval);
+	std::vector<RecordIndexEntry> batch;
+	while (true) {
+		bool stop;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			posted.wait_for(lock, std::chrono::duration<double>(tick), [this] { return Stopflag; });
+			batch.swap(queue);
+			stop = Stopflag;
+		}
+		writeEntries(batch);
+		batch.clear();
+		if (stop)
+			return;
+		if (journalfile && std::chrono::steady_clock::now() >= nextCommit) {
+			commit();
+			nextCommit = std::chrono::steady_clock::now() + std::chrono::duration<double>(syncInterval);
+		}
+	}
+}
+
+bool RecordJournal::close()
+{
+	if (!Openflag)
+		return true;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		Stopflag = true;
+	}
+	posted.notify_one();
+	thrd.join();
+	bool ok = !Errorflag;
+	if (journalfile) {
+		ok = commit() && pending.empty() && ok;
+		fclose(journalfile);
+		journalfile = nullptr;
+	}
+	fclose(indexfile);
+	indexfile = nullptr;
+	Openflag = false;
+	return ok;
+}
+
+bool RecordJournal::recover(const std::string& basename, RecoveryReport& report)
+{
+	namespace fs = boost::filesystem;
+	report = RecoveryReport();
+
+	// Last intact commit; a torn one fails its CRC
+	std::ifstream jf(basename + ".journal", std::ios::in | std::ios::binary);
+	RecordJournalHeader jh;
+	if (!jf.read(reinterpret_cast<char*>(&jh), sizeof(jh)) || jh.magic != RJN_MAGIC
+		|| jh.commitBytes != sizeof(RecordJournalCommit) || jh.index.magic != RIX_MAGIC
+		|| jh.index.numChans < 1) {
+		report.message = str(boost::format("%s.journal is missing or not a recording journal") % basename);
+		return false;
+	}
+	RecordJournalCommit c, last;
+	while (jf.read(reinterpret_cast<char*>(&c), sizeof(c)) && c.magic == RJN_COMMIT && c.crc == commitCrc(c)
+		&& c.seq == last.seq + 1)
+		last = c;
+	jf.close();
+	const RecordLayout layout = jh.index.layout();
+
+	// The .idx was synced before each commit, so it holds at least the
+	// committed entries
+	const std::string idxName = basename + ".idx";
+	std::vector<RecordIndexEntry> entries((size_t)last.entries);
+	uint64_t idxEntries = 0;
+	{
+		std::ifstream idx(idxName, std::ios::in | std::ios::binary);
+		RecordIndexHeader ih;
+		if (!idx.read(reinterpret_cast<char*>(&ih), sizeof(ih)) || ih.magic != RIX_MAGIC
+			|| !idx.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(RecordIndexEntry))) {
+			report.message = str(boost::format("%s is shorter than its journal, cannot recover") % idxName);
+			return false;
+		}
+		idx.seekg(0, std::ios::end);
+		idxEntries = ((uint64_t)idx.tellg() - sizeof(ih)) / sizeof(RecordIndexEntry);
+	}
+
+	// Every data file ends with its last committed block; segments after
+	// the last commit go
+	std::map<std::pair<uint32_t, uint16_t>, uint64_t> ends;
+	for (const RecordIndexEntry& e : entries) {
+		uint64_t& end = ends[{ e.segment, e.file }];
+		end = std::max(end, e.byteOffset + e.bytes);
+	}
+	const uint64_t keepSegs = std::max<uint64_t>(last.segments, 1);
+	for (uint64_t seg = 0; ; seg++) {
+		bool any = false;
+		for (size_t f = 0; f < layout.numFiles(); f++) {
+			const std::string name = recordDataName(basename, layout, f, (size_t)seg);
+			boost::system::error_code ec;
+			if (!fs::exists(name, ec))
+				continue;
+			any = true;
+			if (seg >= keepSegs) {
+				// Spilled segments are links to the secondary volume
+				if (fs::is_symlink(name, ec))
+					fs::remove(fs::read_symlink(name, ec), ec);
+				if (fs::remove(name, ec))
+					report.removedFiles++;
+				continue;
+			}
+			auto it = ends.find({ (uint32_t)seg, (uint16_t)f });
+			const uint64_t end = it != ends.end() ? it->second : 0;
+			const uint64_t size = fs::file_size(name, ec);
+			if (ec || size < end) {
+				report.message = str(boost::format("%s is shorter than its committed blocks, cannot recover") % name);
+				return false;
+			}
+			if (size > end) {
+				fs::resize_file(name, end, ec);
+				if (ec) {
+					report.message = str(boost::format("Could not truncate %s: %s") % name % ec.message());
+					return false;
+				}
+				report.trimmedBytes += size - end;
+				report.trimmedFiles++;
+			}
+		}
+		if (!layout.segmented || (!any && seg >= keepSegs))
+			break;
+	}
+
+	boost::system::error_code ec;
+	fs::resize_file(idxName, sizeof(RecordIndexHeader) + last.entries * sizeof(RecordIndexEntry), ec);
+	if (ec) {
+		report.message = str(boost::format("Could not truncate %s: %s") % idxName % ec.message());
+		return false;
+	}
+
+	// segments.csv as close() would have written it
+	if (layout.segmented) {
+		std::ofstream segfile(basename + ".segments.csv", std::ios::out | std::ios::trunc);
+		segfile << "segment,first_sample,num_samples,samp_offset,time_secs,time_frac,files\n";
+		for (size_t i = 0; i < entries.size();) {
+			const RecordIndexEntry& first = entries[i];
+			uint64_t nsamps = 0;
+			for (; i < entries.size() && entries[i].segment == first.segment; i++)
+				if (entries[i].file == 0)
+					nsamps += entries[i].nsamps;
+			std::string names;
+			for (size_t f = 0; f < layout.numFiles(); f++)
+				names += (f > 0 ? ";" : "") + fs::path(recordDataName(basename, layout, f, first.segment)).filename().string();
+			segfile << first.segment << ',' << first.fileSample << ',' << nsamps << ',' << first.sampOffset << ',';
+			if (first.hasTime()) {
+				char frac[32];
+				snprintf(frac, sizeof(frac), "%.12f", first.timeFrac);
+				segfile << first.timeSecs << ',' << frac;
+			}
+			else
+				segfile << ',';
+			segfile << ',' << names << '\n';
+		}
+	}
+	if (layout.format == RECORD_SIGMF && fs::exists(basename + ".sigmf-meta.part", ec))
+		SigmfMeta::assemble(basename);
+
+	report.blocks = last.entries / layout.numFiles();
+	report.samples = last.fileSamps;
+	report.segments = last.segments;
+	report.droppedEntries = idxEntries > last.entries ? idxEntries - last.entries : 0;
+	report.message = str(boost::format("Recovered %s: %d blocks, %d samples per channel in %d segment(s); "
+		"%d uncommitted index entries dropped, %d bytes trimmed from %d file(s), %d file(s) removed")
+		% basename % report.blocks % report.samples % report.segments % report.droppedEntries
+		% report.trimmedBytes % report.trimmedFiles % report.removedFiles);
+	return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RecordIndex.h"
+
+// Writer of a recording's .idx, and its crash-consistency journal.
+// RecordWriter posts an index entry per block and data file; a thread of
+// its own appends them to the .idx, so the writer thread never waits on it.
+// With a sync interval, that thread also makes the recording durable every
+// so often: it syncs the data files and the .idx, then appends a commit
+// record to <basename>.journal saying how many index entries are on stable
+// storage together with every data byte they point to. The data files are
+// only synced, never written, from here; the journal is a few dozen bytes
+// per commit. After a crash or power loss, recover() cuts the recording
+// back to the last commit: the .idx to the committed entries, every data
+// file to the end of its last committed block (which also drops the rest
+// of a preallocated segment), later segments removed, and segments.csv and
+// the SigMF metadata rebuilt to match. A capture loses at most the last
+// sync interval plus what was still in the DiskWriter staging buffers, and
+// what is left reads back intact.
+// <basename>.journal is a RecordJournalHeader with a copy of the index
+// header, then a fixed-size RecordJournalCommit per commit.
+
+#define RJN_MAGIC 0x314E4A52u    // "RJN1"
+#define RJN_COMMIT 0x4D4D4F43u   // "COMM"
+
+struct RecordJournalHeader
+{
+	uint32_t magic = RJN_MAGIC;
+	uint32_t commitBytes = 40;   // sizeof(RecordJournalCommit)
+	RecordIndexHeader index;
+};
+static_assert(sizeof(RecordJournalHeader) == 40, "RecordJournalHeader is a file format");
+
+struct RecordJournalCommit
+{
+	uint32_t magic = RJN_COMMIT;
+	uint32_t crc = 0;            // CRC-32 of the rest of the record
+	uint64_t seq = 0;
+	uint64_t entries = 0;        // index entries durable, whole blocks
+	uint64_t fileSamps = 0;      // per channel, up to the end of the last of them
+	uint64_t segments = 0;       // segments holding them
+};
+static_assert(sizeof(RecordJournalCommit) == 40, "RecordJournalCommit is a file format");
+
+class RecordJournal
+{
+public:
+	// What the data files have on stable storage right after a sync: all of
+	// segments before segmentsDone, and of the current segment the first
+	// bytes[f] bytes of data file f
+	struct Durable
+	{
+		uint64_t segmentsDone = 0;
+		uint64_t segment = 0;
+		std::vector<uint64_t> bytes;
+	};
+	// Syncs the data files, called on the journal thread
+	typedef std::function<bool(Durable& out)> SyncFn;
+
+	struct Stats
+	{
+		uint64_t commits = 0;
+		uint64_t committedEntries = 0;
+		uint64_t committedSamps = 0;  // per channel
+		double syncSeconds = 0;       // spent in syncs, on the journal thread
+		double lastSyncSeconds = 0;
+		uint64_t syncErrors = 0;
+	};
+
+	struct RecoveryReport
+	{
+		uint64_t blocks = 0;          // kept
+		uint64_t samples = 0;         // per channel, kept
+		uint64_t segments = 0;
+		uint64_t droppedEntries = 0;  // indexed past the last commit
+		uint64_t trimmedBytes = 0;    // cut from the ends of data files
+		size_t trimmedFiles = 0;
+		size_t removedFiles = 0;
+		std::string message;
+	};
+
+private:
+	std::string journalName;         // basename
+	FILE* indexfile = nullptr;
+	FILE* journalfile = nullptr;
+	RecordIndexHeader header;
+	size_t numFiles = 1;
+	double syncInterval = 0;
+	SyncFn syncFiles;
+
+	std::thread thrd;
+	std::mutex mut;
+	std::condition_variable posted;
+	std::vector<RecordIndexEntry> queue;   // guarded by mut
+	bool Stopflag = false;                 // guarded by mut
+	bool Openflag = false;
+
+	// Journal thread only
+	std::vector<RecordIndexEntry> pending; // in the .idx, not yet committed
+	RecordJournalCommit last;
+	bool Errorflag = false;
+	Stats stats;                           // guarded by statMut
+	mutable std::mutex statMut;
+
+	void journalLoop();
+	bool writeEntries(std::vector<RecordIndexEntry>& batch);
+	bool commit();
+
+public:
+	RecordJournal() {}
+	~RecordJournal() { close(); }
+
+	// Creates <basename>.idx and, for in_syncInterval > 0 seconds, the
+	// .journal. in_sync is called every interval and by close().
+	bool open(const std::string& basename, const RecordIndexHeader& in_header, double in_syncInterval, SyncFn in_sync);
+	// Writer thread. Entry of one block in one data file; bytes is its length there.
+	void post(const RecordIndexEntry& e);
+	// Writes the rest of the index and, journaling, commits everything: call
+	// with the data files closed, so in_sync reports all of them durable
+	bool close();
+	bool isOpen() const { return Openflag; }
+	bool isJournaled() const { return journalfile != nullptr; }
+	Stats getStats() const
+	{
+		std::lock_guard<std::mutex> lock(statMut);
+		return stats;
+	}
+
+	// Cut the recording at basename back to its last commit, see above
+	static bool recover(const std::string& basename, RecoveryReport& report);
+};
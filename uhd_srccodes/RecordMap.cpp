@@ -0,0 +1,225 @@
+#include "RecordMap.h"
+#include "SampleConvert.h"
+#include <algorithm>
+#include <iostream>
+#include <boost/format.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Interleaved files are gathered a channel at a time through this many
+// samples: 8 kB in, 16 kB out, well inside L1
+static const size_t MAP_CHUNK = 2048;
+static const uint64_t MAP_PAGE = 4096;
+
+bool RecordMap::open(const std::string& in_basename)
+{
+	close();
+	basename = in_basename;
+	if (!index.open(basename + ".idx"))
+		return false;
+	layout = index.getLayout();
+	if (layout.format == RECORD_IQZ) {
+		std::cerr << boost::format("%s is compressed and cannot be mapped, read it with RecordReader\n") % basename;
+		return false;
+	}
+	return true;
+}
+
+void RecordMap::close()
+{
+	for (Mapping& m : maps)
+		unmap(m);
+	maps.clear();
+}
+
+void RecordMap::unmap(Mapping& m)
+{
+#ifdef _WIN32
+	if (m.base != nullptr)
+		UnmapViewOfFile(m.base);
+	if (m.map != nullptr)
+		CloseHandle((HANDLE)m.map);
+	if (m.file != nullptr)
+		CloseHandle((HANDLE)m.file);
+	m.map = m.file = nullptr;
+#else
+	if (m.base != nullptr)
+		munmap((void*)m.base, (size_t)m.bytes);
+#endif
+	m.base = nullptr;
+	m.bytes = 0;
+	m.prefetchedTo = 0;
+}
+
+RecordMap::Mapping* RecordMap::mapFile(size_t f, size_t seg)
+{
+	const size_t k = seg * layout.numFiles() + f;
+	if (k >= maps.size())
+		maps.resize(k + 1);
+	Mapping& m = maps[k];
+	if (m.base != nullptr)
+		return &m;
+
+	std::string name = recordDataName(basename, layout, f, seg);
+#ifdef _WIN32
+	HANDLE h = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | (Sequentialflag ? FILE_FLAG_SEQUENTIAL_SCAN : 0), NULL);
+	LARGE_INTEGER size;
+	if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size) || size.QuadPart == 0) {
+		std::cerr << boost::format("Could not map %s\n") % name;
+		if (h != INVALID_HANDLE_VALUE)
+			CloseHandle(h);
+		return nullptr;
+	}
+	m.file = h;
+	m.map = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+	m.base = m.map != nullptr ? (const uint8_t*)MapViewOfFile((HANDLE)m.map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	m.bytes = (uint64_t)size.QuadPart;
+#else
+	int fd = ::open(name.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+		std::cerr << boost::format("Could not map %s\n") % name;
+		if (fd >= 0)
+			::close(fd);
+		return nullptr;
+	}
+	void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p != MAP_FAILED) {
+		m.base = (const uint8_t*)p;
+		m.bytes = (uint64_t)st.st_size;
+		madvise(p, (size_t)m.bytes, Sequentialflag ? MADV_SEQUENTIAL : MADV_NORMAL);
+	}
+#endif
+	if (m.base == nullptr) {
+		std::cerr << boost::format("Could not map %s\n") % name;
+		unmap(m);
+		return nullptr;
+	}
+	return &m;
+}
+
+void RecordMap::advise(Mapping& m, uint64_t from, uint64_t bytes)
+{
+	from -= from % MAP_PAGE;
+	bytes = std::min(bytes + MAP_PAGE, m.bytes - from);
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = (PVOID)(m.base + from);
+	range.NumberOfBytes = (SIZE_T)bytes;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	madvise((void*)(m.base + from), (size_t)bytes, MADV_WILLNEED);
+#endif
+}
+
+RecordMap::Mapping* RecordMap::locate(size_t f, uint64_t first, uint64_t& byte, uint64_t& avail)
+{
+	RecordIndexEntry e, end;
+	if (first >= getNumSamps() || !index.entry(index.findFileSample(first), f, e) || first < e.fileSample
+		|| !index.entry(index.findSegmentEnd(e.segment), f, end))
+		return nullptr;
+	Mapping* m = mapFile(f, e.segment);
+	if (m == nullptr)
+		return nullptr;
+
+	// Raw blocks follow each other in a data file, so the sample sits at a
+	// fixed distance from its block's start; what follows runs to the last
+	// block of the segment, or the end of the file if that was cut short
+	const size_t frameBytes = layout.fileChans() * sizeof(Ipp16sc);
+	byte = e.byteOffset + (first - e.fileSample) * frameBytes;
+	if (byte >= m->bytes)
+		return nullptr;
+	avail = std::min(end.fileSample + end.nsamps - first, (m->bytes - byte) / frameBytes);
+	return m;
+}
+
+SampleSpan RecordMap::span(size_t ch, uint64_t first, size_t n)
+{
+	SampleSpan sp;
+	uint64_t byte, avail;
+	Mapping* m = ch < layout.numChans && n > 0 ? locate(layout.perChannelFiles ? ch : 0, first, byte, avail) : nullptr;
+	if (m == nullptr)
+		return sp;
+	const size_t frameBytes = layout.fileChans() * sizeof(Ipp16sc);
+	sp.nsamps = (size_t)std::min<uint64_t>(n, avail);
+	sp.data = (const Ipp16sc*)(m->base + byte) + (layout.perChannelFiles ? 0 : ch);
+	sp.stride = layout.fileChans();
+	sp.first = first;
+
+	// Keep the readahead half a window in front of the reader
+	const uint64_t spanEnd = byte + sp.nsamps * frameBytes;
+	if (Sequentialflag && spanEnd + prefetchBytes / 2 > m->prefetchedTo && m->prefetchedTo < m->bytes) {
+		const uint64_t from = std::max(byte, m->prefetchedTo);
+		advise(*m, from, spanEnd + prefetchBytes - from);
+		m->prefetchedTo = std::min(spanEnd + prefetchBytes, m->bytes);
+	}
+	return sp;
+}
+
+SampleSpan RecordMap::spanTime(size_t ch, const DeviceTime& t, size_t n)
+{
+	uint64_t s;
+	return index.fileSampleAt(t, s) ? span(ch, s, n) : SampleSpan();
+}
+
+size_t RecordMap::readFloat(size_t ch, uint64_t first, size_t n, Ipp32fc* dst)
+{
+	size_t done = 0;
+	while (done < n) {
+		SampleSpan sp = span(ch, first + done, n - done);
+		if (sp.empty())
+			break;
+		if (sp.stride == 1)
+			widenSc16To32fc(sp.data, dst + done, sp.nsamps);
+		else {
+			gather.resize(MAP_CHUNK);
+			for (size_t i = 0; i < sp.nsamps; i += MAP_CHUNK) {
+				const size_t k = std::min(MAP_CHUNK, sp.nsamps - i);
+				for (size_t j = 0; j < k; j++)
+					gather[j] = sp[i + j];
+				widenSc16To32fc(gather.data(), dst + done + i, k);
+			}
+		}
+		done += sp.nsamps;
+	}
+	return done;
+}
+
+void RecordMap::setSequential(bool enable, uint64_t in_prefetchBytes)
+{
+	Sequentialflag = enable;
+	prefetchBytes = in_prefetchBytes;
+#ifndef _WIN32
+	for (Mapping& m : maps) {
+		if (m.base != nullptr)
+			madvise((void*)m.base, (size_t)m.bytes, enable ? MADV_SEQUENTIAL : MADV_NORMAL);
+	}
+#endif
+}
+
+void RecordMap::prefetch(uint64_t first, size_t n)
+{
+	const size_t frameBytes = layout.fileChans() * sizeof(Ipp16sc);
+	for (size_t f = 0; f < layout.numFiles(); f++) {
+		uint64_t byte, avail;
+		for (size_t done = 0; done < n; done += (size_t)avail) {
+			Mapping* m = locate(f, first + done, byte, avail);
+			if (m == nullptr)
+				break;
+			avail = std::min<uint64_t>(avail, n - done);
+			advise(*m, byte, avail * frameBytes);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ipp.h"
+#include "RecordIndex.h"
+
+// Random access to a recording's samples through memory maps, for offline
+// analysis of captures far larger than RAM. The data files of a raw or
+// SigMF recording, segmented or not, are mapped read-only on first use and
+// samples are handed out in place: span() returns a pointer into the page
+// cache, so nothing is read that is not touched and nothing is copied.
+// Data files are found and laid out by the recording's .idx (RecordIndex.h,
+// recordDataName()), the same definitions RecordWriter writes them by.
+// Lost samples are not in a recording, so the recording sample index runs
+// on across gaps; a span only ends where a data file (segment) does.
+// Compressed (.iqz) recordings have no samples to map; use RecordReader.
+//
+// readFloat() converts to fc32 on demand, a cache-sized chunk at a time
+// straight from the mapped pages. With sequential access on, the kernel
+// reads ahead aggressively and every span also asks for the next
+// prefetchBytes of each data file (madvise WILLNEED / PrefetchVirtualMemory),
+// so a front-to-back pass streams at disk speed without blocking on faults.
+
+// Samples of one channel: sample i is data[i * stride]
+struct SampleSpan
+{
+	const Ipp16sc* data = nullptr;
+	size_t nsamps = 0;
+	size_t stride = 1;      // channels in the data file
+	uint64_t first = 0;     // recording sample of data[0]
+
+	bool empty() const { return nsamps == 0; }
+	const Ipp16sc& operator[](size_t i) const { return data[i * stride]; }
+};
+
+class RecordMap
+{
+private:
+	struct Mapping
+	{
+		const uint8_t* base = nullptr;
+		uint64_t bytes = 0;
+		uint64_t prefetchedTo = 0;   // readahead asked for up to here
+#ifdef _WIN32
+		void* file = nullptr;
+		void* map = nullptr;
+#endif
+	};
+
+	std::string basename;
+	RecordIndex index;
+	RecordLayout layout;
+	std::vector<Mapping> maps;       // segment * numFiles + file, mapped on first use
+	bool Sequentialflag = false;
+	uint64_t prefetchBytes = 64ull << 20;
+	std::vector<Ipp16sc> gather;     // readFloat() of an interleaved file
+
+	Mapping* mapFile(size_t f, size_t seg);
+	// Data file f mapped where recording sample first is, its byte offset
+	// there and the samples that follow it in the same file
+	Mapping* locate(size_t f, uint64_t first, uint64_t& byte, uint64_t& avail);
+	void unmap(Mapping& m);
+	void advise(Mapping& m, uint64_t from, uint64_t bytes);
+
+public:
+	RecordMap() {}
+	~RecordMap() { close(); }
+	RecordMap(const RecordMap&) = delete;
+	RecordMap& operator=(const RecordMap&) = delete;
+
+	// in_basename as given to RecordWriter, without extension
+	bool open(const std::string& in_basename);
+	void close();
+	RecordIndex& getIndex() { return index; }
+	const RecordLayout& getLayout() const { return layout; }
+	size_t getNumChans() const { return layout.numChans; }
+	double getRate() const { return index.getRate(); }
+	uint64_t getNumSamps() const { return index.getNumSamps(); }
+
+	// Channel ch from recording sample first: at most n samples, fewer at the
+	// end of a data file (call again from first + nsamps) or of the recording
+	SampleSpan span(size_t ch, uint64_t first, size_t n);
+	// From device time t on (the first sample at or after it)
+	SampleSpan spanTime(size_t ch, const DeviceTime& t, size_t n);
+	// Samples [first, first + n) of channel ch as fc32, full scale (32768)
+	// -> 1.0, across data files; returns the samples converted
+	size_t readFloat(size_t ch, uint64_t first, size_t n, Ipp32fc* dst);
+
+	// Sequential front-to-back access: readahead as above. Off, the kernel
+	// reads around each fault only, which suits scattered seeks.
+	void setSequential(bool enable, uint64_t in_prefetchBytes = 64ull << 20);
+	// Ask for samples [first, first + n) of every channel to be read in now
+	void prefetch(uint64_t first, size_t n);
+};
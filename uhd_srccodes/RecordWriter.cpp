@@ -0,0 +1,770 @@
+#include "RecordWriter.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+bool RecordWriter::open(const std::string& in_basename, double in_rate, size_t in_numChans, bool in_perChannelFiles,
+	WireFormat in_wire)
+{
+	close();
+	basename = in_basename;
+	wireFormat = in_wire;
+	numChans = in_numChans < 1 ? 1 : in_numChans;
+	perChannelFiles = in_perChannelFiles && numChans > 1;
+	chanStats = std::vector<ChannelStats>(numChans);
+
+	// Whole segments of whole samples
+	const uint64_t fileSampBytes = sizeof(Ipp16sc) * (perChannelFiles ? 1 : numChans);
+	segLimitSamps = 0;
+	if (segBytes > 0)
+		segLimitSamps = std::max<uint64_t>(1, segBytes / fileSampBytes);
+	if (segSeconds > 0) {
+		uint64_t n = std::max<uint64_t>(1, (uint64_t)std::llround(segSeconds * in_rate));
+		segLimitSamps = segLimitSamps > 0 ? std::min(segLimitSamps, n) : n;
+	}
+	segmented = segLimitSamps > 0;
+	if (segmented && sigmfEnabled) {
+		std::cerr << "Segment rotation is not available with SigMF output, recording one dataset\n";
+		segmented = false;
+	}
+	compressed = compressWorkers > 0;
+	if (compressed && sigmfEnabled) {
+		std::cerr << "Compression is not available with SigMF output, recording uncompressed\n";
+		compressed = false;
+	}
+	segIndex = 0;
+	segFirstSamp = 0;
+	rotations = 0;
+	rotationStalls = 0;
+
+	segmentsClosed = 0;
+
+	std::vector<std::shared_ptr<DiskWriter>> files;
+	if (!openFiles(files, 0))
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(segMut);
+		datafiles.swap(files);
+		fileSegment = 0;
+	}
+	files.clear();
+	if (compressed) {
+		// Frames come back in block order on this thread, so they go straight to the files
+		compressor.start(compressWorkers, numChans, perChannelFiles, codec,
+			[this](size_t f, const uint8_t* data, size_t nbytes) {
+				IqzFrameHeader hdr;
+				memcpy(&hdr, data, sizeof(hdr));
+				RecordIndexEntry e;
+				e.sampOffset = hdr.sampOffset;
+				e.fileSample = hdr.fileSample;
+				e.nsamps = hdr.nsamps;
+				e.timeSecs = hdr.timeSecs;
+				e.timeFrac = hdr.timeFrac;
+				e.flags = (uint16_t)(hdr.flags & ~IQZ_FLAG_CODEC);   // same time flag and block flags
+				if (!datafiles[f]->write(data, nbytes)) {
+					writeErrors.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				logIndex(e, f, nbytes);
+				return true;
+			});
+	}
+	RecordIndexHeader ixhdr;
+	ixhdr.rate = in_rate;
+	ixhdr.numChans = (uint32_t)numChans;
+	ixhdr.format = getLayout().format;
+	ixhdr.codec = codec;
+	ixhdr.perChannelFiles = perChannelFiles;
+	ixhdr.segmented = segmented;
+	if (!journal.open(basename, ixhdr, journalInterval, [this](RecordJournal::Durable& d) { return syncFiles(d); })) {
+		compressor.stop();
+		datafiles.clear();
+		return false;
+	}
+	if (sigmfEnabled) {
+		sigmfInfo.sampleRate = in_rate;
+		sigmfInfo.numChannels = numChans;
+		sigmfInfo.perChannelFiles = perChannelFiles;
+		sigmfInfo.wireFormat = wireFormatName(wireFormat);
+		if (!sigmf.open(basename, sigmfInfo)) {
+			journal.close();
+			compressor.stop();
+			datafiles.clear();
+			return false;
+		}
+	}
+	// Nothing below can fail: the sidecars are only opened for a recording
+	// that close() will see through
+	gapfile.open(basename + ".gaps.csv", std::ios::out | std::ios::trunc);
+	gapfile << "seq,samp_offset,lost_blocks,lost_samps,cause\n";
+	gapfile.flush();
+	timefile.open(basename + ".time.csv", std::ios::out | std::ios::trunc);
+	timefile << "samp_offset,time_secs,time_frac\n";
+	timefile.flush();
+	timemap.reset(in_rate);
+
+	std::ofstream infofile(basename + ".info.csv", std::ios::out | std::ios::trunc);
+	infofile << "key,value\n"
+		<< "sample_format,sc16\n"
+		<< "wire_format," << wireFormatName(wireFormat) << "\n"
+		<< boost::format("sample_rate,%.17g\n") % in_rate
+		<< "num_channels," << numChans << "\n"
+		<< "file_layout," << (perChannelFiles ? "per_channel" : "interleaved") << "\n"
+		<< "file_format," << (sigmfEnabled ? "sigmf" : compressed ? "iqz" : "raw") << "\n";
+	if (compressed)
+		infofile << "codec," << iqzCodecName(codec) << "\n";
+	if (segmented)
+		infofile << "segment_samples," << segLimitSamps << "\n";
+	if (journalInterval > 0)
+		infofile << "journal_interval," << journalInterval << "\n";
+
+	// Backpressure stages this recording can carry out
+	unsigned bpAvailable = (1u << BP_DECIMATE) | (1u << BP_SHED);
+	if (compressed)
+		bpAvailable |= 1u << BP_COMPRESS;
+	if (segmented && !bpConfig.spillDir.empty()) {
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(bpConfig.spillDir, ec);
+		if (!ec)
+			bpAvailable |= 1u << BP_SPILL;
+	}
+	backpressure.open(basename, bpConfig, bpAvailable);
+	spillActive = false;
+	spillReady = false;
+	spillRotate = false;
+	currentSpilled = false;
+	decimCount = 0;
+	skipRun = SkipRun();
+	shedBlocks = 0;
+	shedSamps = 0;
+	spilledSegments = 0;
+
+	if (segmented) {
+		segfile.open(basename + ".segments.csv", std::ios::out | std::ios::trunc);
+		segfile << "segment,first_sample,num_samples,samp_offset,time_secs,time_frac,files\n";
+		segfile.flush();
+		{
+			std::lock_guard<std::mutex> lock(segMut);
+			nextfiles.clear();
+			retired.clear();
+			prepIndex = 1;
+			nextReady = false;
+			nextSpilled = false;
+			SegStopflag = false;
+		}
+		thrd_segments = std::thread(&RecordWriter::segmentLoop, this);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(eventMut);
+		pendingRf.clear();
+		pendingNotes.clear();
+		eventsPending = false;
+	}
+	haveCapture = false;
+	fileSamps = 0;
+	hostOpenTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	expectSeq = 0;
+	expectOffset = 0;
+	blocksWritten = 0;
+	bytesWritten = 0;
+	sharedBytes = 0;
+	gapCount = 0;
+	lostBlocks = 0;
+	lostSamps = 0;
+	writeErrors = 0;
+	tOpen = std::chrono::steady_clock::now();
+	Openflag = true;
+	return true;
+}
+
+void RecordWriter::close()
+{
+	if (!Openflag)
+		return;
+	logSkipRun();
+	backpressure.close();
+	if (compressor.isRunning()) {
+		if (!compressor.flush())
+			writeErrors.fetch_add(1, std::memory_order_relaxed);
+		compressor.stop();
+	}
+	if (thrd_segments.joinable()) {
+		// Drains the retired segment; the one prepared next was never written
+		{
+			std::lock_guard<std::mutex> lock(segMut);
+			SegStopflag = true;
+		}
+		segCv.notify_all();
+		thrd_segments.join();
+		discardFiles(nextfiles, prepIndex);
+		logSegment();
+		segfile.close();
+	}
+	for (auto& file : datafiles)
+		if (!file->close())
+			writeErrors.fetch_add(1, std::memory_order_relaxed);
+	// Everything is closed, and with a journal synced: the last commit covers it all
+	segmentsClosed = segIndex + 1;
+	if (!journal.close())
+		writeErrors.fetch_add(1, std::memory_order_relaxed);
+	gapfile.close();
+	timefile.close();
+	if (!sigmf.close())
+		writeErrors.fetch_add(1, std::memory_order_relaxed);
+	tClose = std::chrono::steady_clock::now();
+	Openflag = false;
+}
+
+RecordLayout RecordWriter::getLayout() const
+{
+	RecordLayout layout;
+	layout.format = sigmfEnabled ? RECORD_SIGMF : compressed ? RECORD_IQZ : RECORD_RAW;
+	layout.codec = codec;
+	layout.numChans = numChans;
+	layout.perChannelFiles = perChannelFiles;
+	layout.segmented = segmented;
+	return layout;
+}
+
+std::string RecordWriter::dataName(size_t f, size_t seg) const
+{
+	return recordDataName(basename, getLayout(), f, seg);
+}
+
+bool RecordWriter::openFiles(std::vector<std::shared_ptr<DiskWriter>>& files, size_t seg, bool spill)
+{
+	DiskWriterConfig cfg = diskConfig;
+	// Compressed segments have no known length
+	if (segmented && !compressed)
+		cfg.preallocBytes = segLimitSamps * sizeof(Ipp16sc) * (perChannelFiles ? 1 : numChans);
+	cfg.syncOnClose = journalInterval > 0;
+	files.clear();
+	for (size_t f = 0; f < (perChannelFiles ? numChans : 1); f++) {
+		// A spilled file is linked in under its usual name, so readers and
+		// recovery find every segment in the same place
+		std::string name = dataName(f, seg), path = name;
+		if (spill)
+			path = (boost::filesystem::path(bpConfig.spillDir) / boost::filesystem::path(name).filename()).string();
+		files.emplace_back(new DiskWriter);
+		bool ok = files[f]->open(path, cfg);
+		if (ok && spill) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(name, ec);
+			boost::filesystem::create_symlink(boost::filesystem::absolute(path), name, ec);
+			ok = !ec;
+		}
+		if (!ok) {
+			discardFiles(files, seg);
+			return false;
+		}
+	}
+	return true;
+}
+
+void RecordWriter::discardFiles(std::vector<std::shared_ptr<DiskWriter>>& files, size_t seg)
+{
+	// Prepared and never written
+	for (size_t f = 0; f < files.size(); f++) {
+		boost::system::error_code ec;
+		files[f]->close();
+		boost::filesystem::remove(files[f]->getPath(), ec);
+		if (boost::filesystem::is_symlink(dataName(f, seg), ec))
+			boost::filesystem::remove(dataName(f, seg), ec);
+	}
+	files.clear();
+}
+
+void RecordWriter::segmentLoop()
+{
+	// Setup and teardown of segment files, off the writer thread. Opening
+	// allocates the staging pool and the disk space; closing waits for the
+	// last writes and truncates.
+	// A spill request replaces a segment prepared on the primary volume.
+	while (true) {
+		std::vector<std::shared_ptr<DiskWriter>> done, unused;
+		size_t seg = 0, doneSeg = 0;
+		bool prepare, stop;
+		{
+			std::unique_lock<std::mutex> lock(segMut);
+			segCv.wait(lock, [this] {
+				return SegStopflag || !retired.empty() || !nextReady || (spillActive && !nextSpilled);
+			});
+			done.swap(retired);
+			stop = SegStopflag;
+			if (!stop && nextReady && spillActive && !nextSpilled) {
+				unused.swap(nextfiles);
+				nextReady = false;
+			}
+			prepare = !nextReady && !stop;
+			seg = prepIndex;
+			doneSeg = retiredSegment;
+		}
+		for (auto& file : done)
+			if (!file->close())
+				writeErrors.fetch_add(1, std::memory_order_relaxed);
+		if (!done.empty())
+			segmentsClosed = doneSeg + 1;
+		done.clear();
+		discardFiles(unused, seg);
+		if (stop)
+			return;
+		if (prepare) {
+			std::vector<std::shared_ptr<DiskWriter>> files;
+			bool spill = spillActive;
+			if (spill && !openFiles(files, seg, true)) {
+				std::cerr << boost::format("Could not spill segment %d to %s, staying on the primary volume\n")
+					% seg % bpConfig.spillDir;
+				spill = false;
+			}
+			if (!spill)
+				openFiles(files, seg); // empty on failure, which stops rotation
+			{
+				std::lock_guard<std::mutex> lock(segMut);
+				nextfiles.swap(files);
+				nextReady = true;
+				// A failed spill is not retried for this segment
+				nextSpilled = spill || spillActive;
+			}
+			spillReady = spill;
+			segCv.notify_all();
+		}
+	}
+}
+
+void RecordWriter::rotate()
+{
+	// Blocks still being compressed belong to the old segment
+	if (compressed && !compressor.flush())
+		return;
+	std::unique_lock<std::mutex> lock(segMut);
+	if (!nextReady) {
+		// Preparing a segment takes far less than filling one; only a disk
+		// that is already falling behind gets here
+		rotationStalls.fetch_add(1, std::memory_order_relaxed);
+		segCv.wait(lock, [this] { return nextReady; });
+	}
+	if (nextfiles.empty()) {
+		lock.unlock();
+		std::cerr << boost::format("Could not open segment %d, continuing in segment %d\n") % (segIndex + 1) % segIndex;
+		segLimitSamps = UINT64_MAX;
+		return;
+	}
+	datafiles.swap(nextfiles);
+	for (auto& file : nextfiles)
+		retired.push_back(std::move(file));
+	nextfiles.clear();
+	retiredSegment = segIndex;
+	fileSegment = segIndex + 1;
+	nextReady = false;
+	nextSpilled = false;
+	currentSpilled = spillReady;
+	spillReady = false;
+	if (currentSpilled)
+		spilledSegments.fetch_add(1, std::memory_order_relaxed);
+	prepIndex = segIndex + 2;
+	lock.unlock();
+	segCv.notify_all();
+
+	// Index row of the finished segment; the new one starts at this block
+	logSegment();
+	segIndex++;
+	segFirstSamp = fileSamps;
+	rotations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecordWriter::logSegment()
+{
+	std::string names;
+	for (size_t f = 0; f < (perChannelFiles ? numChans : 1); f++) {
+		std::string name = boost::filesystem::path(dataName(f, segIndex)).filename().string();
+		names += (f > 0 ? ";" : "") + name;
+	}
+	segfile << segIndex << ',' << segFirstSamp << ',' << (fileSamps - segFirstSamp) << ',' << segFirstOffset << ',';
+	if (segHasTime) {
+		char frac[32];
+		snprintf(frac, sizeof(frac), "%.12f", segFirstTime.frac);
+		segfile << segFirstTime.secs << ',' << frac;
+	}
+	else
+		segfile << ',';
+	segfile << ',' << names << '\n';
+	segfile.flush();
+}
+
+void RecordWriter::logGap(const SampleBlock& blk)
+{
+	// Blocks dropped in the ring show up as a sequence jump; samples lost at
+	// the device only as a jump in sample offset
+	uint64_t nblocks = blk.seq - expectSeq;
+	uint64_t nsamps = blk.sampOffset - expectOffset;
+	const char* cause = nblocks > 0 ? "overrun" : "device";
+	gapCount.fetch_add(1, std::memory_order_relaxed);
+	lostBlocks.fetch_add(nblocks, std::memory_order_relaxed);
+	lostSamps.fetch_add(nsamps, std::memory_order_relaxed);
+
+	// Gaps are rare, so flushing each line keeps the log current without
+	// costing anything on the sample path
+	gapfile << blk.seq << ',' << expectOffset << ',' << nblocks << ',' << nsamps << ',' << cause << '\n';
+	gapfile.flush();
+
+	if (sigmf.isOpen()) {
+		SigmfAnnotation note;
+		note.sampleStart = fileSamps;
+		note.label = cause[0] == 'o' ? "ring_overrun" : "overflow";
+		note.comment = str(boost::format("%d samples lost before this sample") % nsamps);
+		note.lostSamps = nsamps;
+		sigmf.addAnnotation(note);
+	}
+}
+
+void RecordWriter::logPadding(const SampleBlock& blk)
+{
+	// Samples lost at the device but replaced by zeros in the file
+	gapfile << blk.seq << ',' << blk.sampOffset << ",0," << blk.lostBefore << ",padded\n";
+	gapfile.flush();
+
+	if (sigmf.isOpen()) {
+		SigmfAnnotation note;
+		note.sampleStart = fileSamps;
+		note.sampleCount = blk.lostBefore;
+		note.label = "overflow";
+		note.comment = "zeros in place of samples lost at the device";
+		note.lostSamps = blk.lostBefore;
+		sigmf.addAnnotation(note);
+	}
+}
+
+void RecordWriter::addCapture(const SampleBlock& blk, size_t at, double hostTime)
+{
+	SigmfCapture cap;
+	cap.sampleStart = fileSamps + at;
+	cap.globalIndex = blk.sampOffset + at;
+	cap.frequency = rf.frequency != 0 ? rf.frequency + freqShift : 0;
+	cap.gain = rf.gain;
+	cap.loOffset = rf.loOffset;
+	cap.hasTime = blk.hasTime;
+	if (blk.hasTime)
+		cap.time = blk.time.plus(at / timemap.getRate());
+	cap.timeIsUtc = timeIsUtc;
+	cap.hostTime = hostTime;
+	sigmf.addCapture(cap);
+	haveCapture = true;
+}
+
+void RecordWriter::applyEvents(const SampleBlock& blk, bool newCapture)
+{
+	// Take the retunes that land in this block and the posted annotations.
+	// Never wait for the posting thread: if it holds the lock, the events go
+	// with the next block.
+	const double rate = timemap.getRate();
+	std::vector<std::pair<size_t, RfState>> due;
+	std::vector<std::pair<std::string, std::string>> notes;
+	if (eventsPending.load(std::memory_order_acquire)) {
+		std::unique_lock<std::mutex> lock(eventMut, std::try_to_lock);
+		if (lock.owns_lock()) {
+			notes.swap(pendingNotes);
+			for (auto it = pendingRf.begin(); it != pendingRf.end();) {
+				double d = blk.hasTime ? std::ceil(it->at.minus(blk.time) * rate) : 0;
+				if (d < (double)blk.nsamps) {
+					due.emplace_back(d > 0 ? (size_t)d : 0, it->rf);
+					it = pendingRf.erase(it);
+				}
+				else
+					++it;
+			}
+			eventsPending = !pendingRf.empty();
+		}
+	}
+
+	// One capture segment per distinct start; a retune right at the block
+	// start merges with the segment a discontinuity starts there
+	size_t capAt = newCapture ? 0 : SIZE_MAX;
+	for (const auto& change : due) {
+		if (capAt != SIZE_MAX && change.first != capAt)
+			addCapture(blk, capAt, haveCapture ? 0 : hostOpenTime);
+		rf = change.second;
+		capAt = change.first;
+	}
+	if (capAt != SIZE_MAX)
+		addCapture(blk, capAt, haveCapture ? 0 : hostOpenTime);
+
+	for (const auto& n : notes) {
+		SigmfAnnotation note;
+		note.sampleStart = fileSamps;
+		note.label = n.first;
+		note.comment = n.second;
+		sigmf.addAnnotation(note);
+	}
+}
+
+void RecordWriter::scheduleRfChange(const RfState& in_rf, const DeviceTime& at)
+{
+	if (!sigmfEnabled)
+		return;
+	std::lock_guard<std::mutex> lock(eventMut);
+	pendingRf.push_back({ in_rf, at });
+	eventsPending = true;
+}
+
+void RecordWriter::annotate(const std::string& label, const std::string& comment)
+{
+	if (!sigmfEnabled)
+		return;
+	std::lock_guard<std::mutex> lock(eventMut);
+	pendingNotes.emplace_back(label, comment);
+	eventsPending = true;
+}
+
+void RecordWriter::logIndex(RecordIndexEntry& e, size_t f, size_t nbytes)
+{
+	// Called once data file f has taken the block, so the block ends at its
+	// current length. A block whose write failed is never indexed.
+	e.segment = (uint32_t)segIndex;
+	e.file = (uint16_t)f;
+	e.byteOffset = datafiles[f]->getLogicalSize() - nbytes;
+	e.bytes = (uint32_t)nbytes;
+	journal.post(e);
+}
+
+bool RecordWriter::syncFiles(RecordJournal::Durable& out)
+{
+	// Journal thread. The files are shared, so a rotation or close() meanwhile
+	// cannot pull them away; a file closed meanwhile was synced by close().
+	// Only what had completed before the sync is reported durable.
+	std::vector<std::shared_ptr<DiskWriter>> files;
+	{
+		std::lock_guard<std::mutex> lock(segMut);
+		files = datafiles;
+		out.segment = fileSegment;
+	}
+	out.segmentsDone = segmentsClosed.load();
+	out.bytes.resize(files.size());
+	for (size_t f = 0; f < files.size(); f++)
+		out.bytes[f] = files[f]->getCompletedBytes();
+	bool ok = true;
+	for (auto& file : files)
+		ok = file->sync() && ok;
+	return ok;
+}
+
+void RecordWriter::logAnchor(const SampleBlock& blk)
+{
+	char frac[32];
+	snprintf(frac, sizeof(frac), "%.12f", blk.time.frac);
+	timefile << blk.sampOffset << ',' << blk.time.secs << ',' << frac << '\n';
+	timefile.flush();
+}
+
+bool RecordWriter::applyBackpressure(const SampleBlock& blk, double queueFill, float loudestDbfs)
+{
+	// Returns false for a block to leave out
+	const unsigned act = backpressure.update(queueFill, blk);
+	if (compressed)
+		compressor.setCodec((act & (1u << BP_COMPRESS)) ? bpConfig.fallbackCodec : codec);
+	if (segmented && spillActive != ((act & (1u << BP_SPILL)) != 0)) {
+		// Later segments go to the spill volume, and the current one ends as
+		// soon as the first of them is ready
+		{
+			std::lock_guard<std::mutex> lock(segMut);
+			spillActive = !spillActive;
+		}
+		spillRotate = spillActive && !currentSpilled;
+		segCv.notify_all();
+	}
+
+	// Loud blocks have priority; of the rest, shedding leaves out every one
+	// and decimation all but one in N
+	const char* cause = nullptr;
+	if (loudestDbfs < bpConfig.keepDbfs) {
+		if (act & (1u << BP_SHED))
+			cause = "shed";
+		else if ((act & (1u << BP_DECIMATE)) && bpConfig.decimation > 1 && decimCount++ % bpConfig.decimation != 0)
+			cause = "decimated";
+	}
+	if (!(act & (1u << BP_DECIMATE)))
+		decimCount = 0;
+	if (cause == nullptr)
+		return true;
+
+	if (skipRun.blocks > 0 && skipRun.cause != cause)
+		logSkipRun();
+	if (skipRun.blocks == 0) {
+		skipRun.seq = blk.seq;
+		skipRun.sampOffset = blk.sampOffset;
+		skipRun.cause = cause;
+	}
+	skipRun.blocks++;
+	skipRun.samps += blk.nsamps;
+	shedBlocks.fetch_add(1, std::memory_order_relaxed);
+	shedSamps.fetch_add(blk.nsamps, std::memory_order_relaxed);
+	return false;
+}
+
+void RecordWriter::logSkipRun()
+{
+	// One gap log line per run of skipped blocks, written when the run ends
+	if (skipRun.blocks == 0)
+		return;
+	gapfile << skipRun.seq << ',' << skipRun.sampOffset << ',' << skipRun.blocks << ',' << skipRun.samps << ','
+		<< skipRun.cause << '\n';
+	gapfile.flush();
+	if (sigmf.isOpen()) {
+		SigmfAnnotation note;
+		note.sampleStart = fileSamps;
+		note.label = "backpressure";
+		note.comment = str(boost::format("%d samples not recorded (%s) before this sample") % skipRun.samps % skipRun.cause);
+		note.lostSamps = skipRun.samps;
+		sigmf.addAnnotation(note);
+	}
+	skipRun = SkipRun();
+}
+
+bool RecordWriter::writeBlock(const SampleBlock& blk, double queueFill)
+{
+	if (!Openflag)
+		return false;
+
+	const bool gap = blk.seq != expectSeq || blk.sampOffset != expectOffset;
+	if (gap)
+		logGap(blk);
+	if ((blk.flags & BLOCK_FLAG_PADDED) && blk.lostBefore > 0)
+		logPadding(blk);
+	const bool anchor = blk.hasTime && timemap.update(blk.sampOffset, blk.time);
+	if (anchor)
+		logAnchor(blk);
+	expectSeq = blk.seq + 1;
+	expectOffset = blk.sampOffset + blk.nsamps;
+	const float loudest = updateStats(blk);
+	if (backpressure.isEnabled() && !applyBackpressure(blk, queueFill, loudest))
+		return true;
+	// Samples missing from the file or a time jump start a new SigMF capture segment
+	const bool skipped = skipRun.blocks > 0;
+	logSkipRun();
+	if (sigmf.isOpen())
+		applyEvents(blk, !haveCapture || gap || anchor || skipped);
+
+	// A block that would overrun the segment starts the next one
+	const size_t n = blk.nsamps;
+	if (segmented && fileSamps > segFirstSamp
+		&& (fileSamps - segFirstSamp + n > segLimitSamps || (spillRotate && spillReady))) {
+		rotate();
+		spillRotate = false;
+	}
+	if (fileSamps == segFirstSamp) {
+		segFirstOffset = blk.sampOffset;
+		segFirstTime = blk.time;
+		segHasTime = blk.hasTime;
+	}
+
+	// Files and block agree on layout: straight from the ring slot.
+	// Otherwise convert through convbuf first.
+	// Ring blocks are shared with the disk writes and the compressor rather
+	// than copied, where the layout allows
+	const BlockRef hold(blk);
+	bool ok = true;
+	if (compressed) {
+		ok = compressor.submit(blk, fileSamps);
+		if (ok) {
+			bytesWritten.fetch_add(n * numChans * sizeof(Ipp16sc), std::memory_order_relaxed);
+			if (hold)
+				sharedBytes.fetch_add(n * numChans * sizeof(Ipp16sc), std::memory_order_relaxed);
+		}
+	}
+	else if (!perChannelFiles) {
+		if (blk.interleaved() || numChans == 1)
+			ok = writeData(*datafiles[0], blk.data, n * numChans, hold);
+		else {
+			blk.interleaveSamps(0, n, getConvbuf(n * numChans));
+			ok = writeData(*datafiles[0], convbuf, n * numChans);
+		}
+	}
+	else if (!blk.interleaved()) {
+		for (size_t c = 0; c < numChans && ok; c++)
+			ok = writeData(*datafiles[c], blk.chan(c), n, hold);
+	}
+	else {
+		blk.exportSamps(0, n, getConvbuf(n * numChans), n);
+		for (size_t c = 0; c < numChans && ok; c++)
+			ok = writeData(*datafiles[c], convbuf + c * n, n);
+	}
+	if (!ok)
+		return false;
+	// Compressed frames are indexed as the compressor hands them to the files
+	if (!compressed) {
+		RecordIndexEntry e;
+		e.sampOffset = blk.sampOffset;
+		e.fileSample = fileSamps;
+		e.nsamps = (uint32_t)n;
+		e.timeSecs = blk.time.secs;
+		e.timeFrac = blk.time.frac;
+		e.flags = (uint16_t)((blk.flags & ~RIX_FLAG_TIME) | (blk.hasTime ? RIX_FLAG_TIME : 0));
+		for (size_t f = 0; f < datafiles.size(); f++)
+			logIndex(e, f, n * (perChannelFiles ? 1 : numChans) * sizeof(Ipp16sc));
+	}
+	fileSamps += n;
+	blocksWritten.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+Ipp16sc* RecordWriter::getConvbuf(size_t nsamps)
+{
+	if (nsamps > convbufSamps) {
+		ippsFree(convbuf);
+		convbuf = ippsMalloc_16sc_L(nsamps);
+		convbufSamps = nsamps;
+	}
+	return convbuf;
+}
+
+bool RecordWriter::writeData(DiskWriter& file, const Ipp16sc* src, size_t nsamps, const BlockRef& hold)
+{
+	size_t nbytes = nsamps * sizeof(Ipp16sc);
+	const uint64_t shared = file.getSharedBytes();
+	if (!file.writeShared(hold, src, nbytes)) {
+		writeErrors.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	bytesWritten.fetch_add(nbytes, std::memory_order_relaxed);
+	sharedBytes.fetch_add(file.getSharedBytes() - shared, std::memory_order_relaxed);
+	return true;
+}
+
+float RecordWriter::updateStats(const SampleBlock& blk)
+{
+	// Returns the loudest channel's level
+	float loudest = -200.0f;
+	if (blk.nsamps == 0)
+		return loudest;
+	// Strided so both layouts are read in place. The head of each block is
+	// enough for a level meter and keeps this off the write bandwidth budget.
+	const size_t step = blk.interleaved() ? numChans : 1;
+	const size_t n = std::min<size_t>(blk.nsamps, 1 << 14);
+	for (size_t c = 0; c < numChans; c++) {
+		const Ipp16s* p = reinterpret_cast<const Ipp16s*>(blk.interleaved() ? blk.data + c : blk.chan(c));
+		int peak = 0;
+		int64_t sumsq = 0;
+		for (size_t i = 0; i < n; i++) {
+			int re = p[2 * i * step], im = p[2 * i * step + 1];
+			peak = std::max(peak, std::max(std::abs(re), std::abs(im)));
+			sumsq += (int64_t)re * re + (int64_t)im * im;
+		}
+		double ms = double(sumsq) / n / (32768.0 * 32768.0);
+		chanStats[c].samples.fetch_add(blk.nsamps, std::memory_order_relaxed);
+		chanStats[c].peak.store(peak, std::memory_order_relaxed);
+		const float db = ms > 0 ? (float)(10.0 * std::log10(ms)) : -200.0f;
+		chanStats[c].rmsDBFS.store(db, std::memory_order_relaxed);
+		loudest = std::max(loudest, db);
+	}
+	return loudest;
+}
+
+double RecordWriter::getMBps() const
+{
+	auto tEnd = Openflag ? std::chrono::steady_clock::now() : tClose;
+	double secs = std::chrono::duration<double>(tEnd - tOpen).count();
+	return secs > 0 ? getBytesWritten() / secs / 1e6 : 0;
+}
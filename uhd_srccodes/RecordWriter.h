@@ -0,0 +1,313 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SampleRing.h"
+#include "TimeMap.h"
+#include "SampleConvert.h"
+#include "DiskWriter.h"
+#include "SigmfMeta.h"
+#include "IqCompressor.h"
+#include "RecordIndex.h"
+#include "RecordJournal.h"
+#include "Backpressure.h"
+
+// Continuous recorder for ring blocks.
+// All blocks of one capture go, in order, into files that stay open for the
+// whole capture: one interleaved <basename>.bin, or with per-channel files
+// <basename>_ch<N>.bin for each channel (a single channel is always
+// <basename>.bin). Either file layout can be written from either block
+// layout. Sample data goes through one DiskWriter per file, so writeBlock()
+// only copies into a staging buffer while earlier blocks are still on their
+// way to the disk. Sidecar files record gaps, time anchors and an index of
+// every block; SigMF output, segment rotation, compression, journaling and
+// backpressure are optional, see their setters.
+class RecordWriter
+{
+public:
+	// Per-channel signal statistics of the most recent block
+	struct ChannelStats
+	{
+		std::atomic<uint64_t> samples{ 0 };
+		std::atomic<int> peak{ 0 };          // max |I| or |Q|, in sc16 counts
+		std::atomic<float> rmsDBFS{ -200.0f };
+	};
+
+	// Tuning that goes into SigMF capture segments
+	struct RfState
+	{
+		double frequency = 0;
+		double gain = 0;
+		double loOffset = 0;
+	};
+
+private:
+	std::vector<std::shared_ptr<DiskWriter>> datafiles;
+	DiskWriterConfig diskConfig;
+	size_t numChans = 1;
+	bool perChannelFiles = false;
+	Ipp16sc* convbuf = nullptr;      // layout conversion scratch
+	size_t convbufSamps = 0;
+	std::vector<ChannelStats> chanStats;
+
+	// Every continuity break is appended to <basename>.gaps.csv, so a capture
+	// can be trusted (or its holes located) without rescanning the samples.
+	std::ofstream gapfile;
+	// TimeMap anchors, keyed by stream sample offset. That runs ahead of the
+	// .bin sample index by every sample lost (and not padded) or shed so far,
+	// so turning a .bin index into device time takes the .gaps.csv (or the
+	// .idx) as well.
+	std::ofstream timefile;
+	TimeMap timemap;
+	std::string basename;
+	WireFormat wireFormat = WIRE_SC16;
+	std::atomic<bool> Openflag{ false };
+
+	// Continuity tracking, against the previous block's seq and sample offset
+	uint64_t expectSeq = 0;
+	uint64_t expectOffset = 0;
+	std::chrono::steady_clock::time_point tOpen, tClose;
+
+	// Counters; written by the writer thread, read by the GUI
+	std::atomic<uint64_t> blocksWritten{ 0 };
+	std::atomic<uint64_t> bytesWritten{ 0 };
+	std::atomic<uint64_t> sharedBytes{ 0 };
+	std::atomic<uint64_t> gapCount{ 0 };
+	std::atomic<uint64_t> lostBlocks{ 0 };
+	std::atomic<uint64_t> lostSamps{ 0 };
+	std::atomic<uint64_t> writeErrors{ 0 };
+
+	// SigMF metadata; everything but the event queue belongs to the writer thread
+	bool sigmfEnabled = false;
+	SigmfGlobal sigmfInfo;
+	bool timeIsUtc = false;
+	SigmfMeta sigmf;
+	RfState rf;
+	double freqShift = 0;            // added to the tuned frequency, see setFrequencyShift()
+	uint64_t fileSamps = 0;          // per channel, as written
+	bool haveCapture = false;
+	double hostOpenTime = 0;         // UTC seconds at open(), core:datetime of the first segment without GPS time
+	struct RfChange
+	{
+		RfState rf;
+		DeviceTime at;
+	};
+	std::mutex eventMut;
+	std::vector<RfChange> pendingRf;                               // guarded by eventMut
+	std::vector<std::pair<std::string, std::string>> pendingNotes; // guarded by eventMut
+	std::atomic<bool> eventsPending{ false };
+	void addCapture(const SampleBlock& blk, size_t at, double hostTime = 0);
+	void applyEvents(const SampleBlock& blk, bool newCapture);
+
+	// Segment rotation, see setSegments()
+	uint64_t segBytes = 0;
+	double segSeconds = 0;
+	bool segmented = false;          // this capture
+	uint64_t segLimitSamps = 0;      // per channel
+	size_t segIndex = 0;
+	uint64_t segFirstSamp = 0;       // file sample index of the segment's first sample
+	uint64_t segFirstOffset = 0;     // and its stream index and device time
+	DeviceTime segFirstTime;
+	bool segHasTime = false;
+	std::ofstream segfile;
+	mutable std::mutex segMut;
+	std::condition_variable segCv;
+	std::vector<std::shared_ptr<DiskWriter>> nextfiles;  // guarded by segMut
+	std::vector<std::shared_ptr<DiskWriter>> retired;    // guarded by segMut
+	bool nextSpilled = false;                            // nextfiles are on the spill volume, guarded by segMut
+	size_t prepIndex = 0;                                // guarded by segMut
+	bool nextReady = false;                              // guarded by segMut
+	bool SegStopflag = false;                            // guarded by segMut
+	size_t fileSegment = 0;                              // of datafiles, guarded by segMut
+	size_t retiredSegment = 0;                           // of retired, guarded by segMut
+	std::atomic<uint64_t> segmentsClosed{ 0 };           // all segments before this one are closed
+	std::thread thrd_segments;
+	std::atomic<uint64_t> rotations{ 0 };
+	std::atomic<uint64_t> rotationStalls{ 0 };
+	std::string dataName(size_t f, size_t seg) const;
+	bool openFiles(std::vector<std::shared_ptr<DiskWriter>>& files, size_t seg, bool spill = false);
+	void discardFiles(std::vector<std::shared_ptr<DiskWriter>>& files, size_t seg);
+	void rotate();
+	void logSegment();
+	void segmentLoop();
+
+	// Compression, see setCompression()
+	size_t compressWorkers = 0;
+	IqzCodec codec = IQZ_LOSSLESS;
+	bool compressed = false;         // this capture
+	IqCompressor compressor;
+
+	// Every block written is entered in the binary <basename>.idx
+	// (RecordIndex.h) with its stream position, device time and place on
+	// disk, which is what RecordReader seeks with. The journal thread writes
+	// it; see setJournal()
+	double journalInterval = 0;
+	RecordJournal journal;
+	bool syncFiles(RecordJournal::Durable& out);
+
+	// Backpressure, see setBackpressure()
+	BackpressureConfig bpConfig;
+	BackpressurePolicy backpressure;
+	std::atomic<bool> spillActive{ false };  // segments are prepared on bpConfig.spillDir
+	std::atomic<bool> spillReady{ false };   // and the next one is
+	bool spillRotate = false;                // rotate as soon as it is
+	bool currentSpilled = false;             // datafiles are on the spill volume
+	size_t decimCount = 0;
+	struct SkipRun                           // blocks skipped since the last one written
+	{
+		uint64_t seq = 0;
+		uint64_t sampOffset = 0;
+		uint64_t blocks = 0;
+		uint64_t samps = 0;
+		const char* cause = nullptr;
+	} skipRun;
+	std::atomic<uint64_t> shedBlocks{ 0 };
+	std::atomic<uint64_t> shedSamps{ 0 };
+	std::atomic<uint64_t> spilledSegments{ 0 };
+	bool applyBackpressure(const SampleBlock& blk, double queueFill, float loudestDbfs);
+	void logSkipRun();
+
+	void logGap(const SampleBlock& blk);
+	void logPadding(const SampleBlock& blk);
+	void logAnchor(const SampleBlock& blk);
+	void logIndex(RecordIndexEntry& e, size_t f, size_t nbytes);
+	RecordLayout getLayout() const;
+	float updateStats(const SampleBlock& blk);
+	Ipp16sc* getConvbuf(size_t nsamps);
+	bool writeData(DiskWriter& file, const Ipp16sc* src, size_t nsamps, const BlockRef& hold = BlockRef());
+
+public:
+	RecordWriter() {}
+	~RecordWriter() { close(); ippsFree(convbuf); }
+
+	// Opens the data file(s) and the .gaps.csv/.time.csv sidecars, truncating
+	// all of them, and writes .info.csv: file sample format (always sc16), the
+	// wire format the samples came over (sc8/sc12 captures are sc16 files with
+	// the low bits zero), rate, channel count and file layout. in_rate is the
+	// stream sample rate used for the time map.
+	bool open(const std::string& in_basename, double in_rate, size_t in_numChans = 1, bool in_perChannelFiles = false,
+		WireFormat in_wire = WIRE_SC16);
+	void close();
+	bool isOpen() const { return Openflag; }
+	// Used by the next open(); the staging pool is per data file
+	void setDiskConfig(const DiskWriterConfig& in_cfg) { diskConfig = in_cfg; }
+	// SigMF output for the next open(): the data files are
+	// <basename>[_ch<N>].sigmf-data and a .sigmf-meta describes them, with a
+	// new capture segment wherever the file stops being sample- or
+	// time-continuous or the RF settings change, and an annotation for every
+	// overflow and for events posted with annotate(). timeIsUtc: device time
+	// is GPS time, so capture segments get core:datetime from it (else from
+	// the host clock).
+	void setSigmf(bool enable, const std::string& hw = "", bool in_timeIsUtc = false)
+	{
+		sigmfEnabled = enable;
+		sigmfInfo.hw = hw;
+		timeIsUtc = in_timeIsUtc;
+	}
+	bool isSigmf() const { return sigmfEnabled; }
+	// Segment rotation for the next open(): a new segment every in_bytes bytes
+	// (per data file) or in_seconds of samples, whichever comes first; 0 and 0
+	// = one file. Segments break at block boundaries. Raw output only.
+	// Segments are <basename>[_ch<N>]_<k>.bin, each preallocated at its full
+	// length on the segment thread, which also drains and closes the finished
+	// one, so a rotation in writeBlock() is only a swap. <basename>.segments.csv
+	// indexes which samples are in which segment.
+	void setSegments(uint64_t in_bytes, double in_seconds) { segBytes = in_bytes; segSeconds = in_seconds; }
+	uint64_t getRotations() const { return rotations.load(std::memory_order_relaxed); }
+	// Rotations that had to wait for the next segment to be prepared
+	uint64_t getRotationStalls() const { return rotationStalls.load(std::memory_order_relaxed); }
+	// .iqz data files coded by in_workers threads for the next open(), 0 =
+	// raw .bin. One self-contained frame per block and file (IqCodec.h);
+	// iqzDecodeFile() gives back the .bin. Lossless, or 8/4-bit block floating
+	// point with in_codec, trading a measured SNR loss for a half or a quarter
+	// of the disk bandwidth. Raw output only. Segment limits count samples
+	// before compression.
+	void setCompression(size_t in_workers, IqzCodec in_codec = IQZ_LOSSLESS)
+	{
+		compressWorkers = in_workers;
+		codec = in_codec;
+	}
+	bool isCompressed() const { return compressed; }
+	IqzCodec getCompressionCodec() const { return codec; }
+	// Compression ratio, per-core rate and, for lossy codecs, SNR so far
+	IqCompressor::Stats getCompressionStats() const { return compressor.getStats(); }
+	// Commit the recording to stable storage every in_seconds, for the next
+	// open(); 0 = no journal. Data files are synced from the journal thread,
+	// never the writer thread, and a commit recorded that
+	// RecordJournal::recover() can cut a crashed capture back to.
+	void setJournal(double in_seconds) { journalInterval = in_seconds; }
+	bool isJournaled() const { return journal.isJournaled(); }
+	RecordJournal::Stats getJournalStats() const { return journal.getStats(); }
+	// Backpressure policy for the next open(); no stages = none. When the disk
+	// falls behind, it degrades the recording step by step instead of letting
+	// the ring overflow.
+	void setBackpressure(const BackpressureConfig& in_cfg) { bpConfig = in_cfg; }
+	BackpressurePolicy::Stats getBackpressureStats() const { return backpressure.getStats(); }
+	// Blocks and samples per channel left out by BP_DECIMATE and BP_SHED
+	uint64_t getShedBlocks() const { return shedBlocks.load(std::memory_order_relaxed); }
+	uint64_t getShedSamps() const { return shedSamps.load(std::memory_order_relaxed); }
+	uint64_t getSpilledSegments() const { return spilledSegments.load(std::memory_order_relaxed); }
+	// Tuning at the start of the next open()
+	void setRfState(const RfState& in_rf) { rf = in_rf; }
+	// Centre of the recorded band relative to the tuned frequency, e.g. a DDC's offset
+	void setFrequencyShift(double hz) { freqShift = hz; }
+	// Thread safe. A retune taking effect at device time at: the capture
+	// segment starts on the first sample at or after it.
+	void scheduleRfChange(const RfState& in_rf, const DeviceTime& at);
+	// Thread safe. Annotation at the next sample written.
+	void annotate(const std::string& label, const std::string& comment = "");
+
+	// Append one block. queueFill: how full the queue feeding the writer is
+	// (0..1), for the backpressure policy. Returns false if the write failed;
+	// a block left out by the policy counts as written.
+	bool writeBlock(const SampleBlock& blk, double queueFill = 0);
+
+	const std::string& getBasename() const { return basename; }
+	const TimeMap& getTimeMap() const { return timemap; }
+	uint64_t getBlocksWritten() const { return blocksWritten.load(std::memory_order_relaxed); }
+	// Sample bytes before compression
+	uint64_t getBytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+	// Of those, the bytes the disk or the compressor took straight from the ring block
+	uint64_t getSharedBytes() const { return sharedBytes.load(std::memory_order_relaxed); }
+	// Ring blocks writeBlock() may still hold after it returns (writes in
+	// flight, blocks queued for compression), for sizing the ring's spare blocks
+	size_t getMaxHeldBlocks(size_t in_numChans, bool in_perChannelFiles) const
+	{
+		if (compressWorkers > 0)
+			return 2 * compressWorkers;
+		return diskConfig.zeroCopy ? (in_perChannelFiles ? in_numChans : 1) * diskConfig.numBufs : 0;
+	}
+	uint64_t getGapCount() const { return gapCount.load(std::memory_order_relaxed); }
+	uint64_t getLostBlocks() const { return lostBlocks.load(std::memory_order_relaxed); }
+	uint64_t getLostSamps() const { return lostSamps.load(std::memory_order_relaxed); }
+	uint64_t getWriteErrors() const { return writeErrors.load(std::memory_order_relaxed); }
+	double getMBps() const; // average over the capture so far
+	size_t getNumChans() const { return numChans; }
+	WireFormat getWireFormat() const { return wireFormat; }
+	const ChannelStats& getChannelStats(size_t c) const { return chanStats[c]; }
+	// Data file f's write queue (current segment); valid while open
+	size_t getNumDataFiles() const { return datafiles.size(); }
+	std::string getDataFileName(size_t f) const
+	{
+		std::lock_guard<std::mutex> lock(segMut);
+		return datafiles[f]->getPath();
+	}
+	DiskWriter::Stats getDiskStats(size_t f) const
+	{
+		std::lock_guard<std::mutex> lock(segMut);
+		return datafiles[f]->getStats();
+	}
+	std::string getDiskBackend() const
+	{
+		std::lock_guard<std::mutex> lock(segMut);
+		return datafiles.empty() ? std::string() : datafiles[0]->getBackend();
+	}
+};
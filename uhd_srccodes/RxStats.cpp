@@ -0,0 +1,50 @@
+#include "RxStats.h"
+#include <boost/format.hpp>
+
+void RxStats::reset()
+{
+	for (int k = 0; k < NUM_ERR_KINDS; k++)
+		errors[k].store(0, std::memory_order_relaxed);
+	for (int b = 0; b < NUM_GAP_BUCKETS; b++)
+		gapHist[b].store(0, std::memory_order_relaxed);
+	gaps = 0;
+	lostSamps = 0;
+	paddedSamps = 0;
+	timeJumps = 0;
+	restarts = 0;
+}
+
+void RxStats::recordGap(int64_t lost, bool padded)
+{
+	if (lost <= 0)
+		return;
+	int b = 0;
+	while (b < NUM_GAP_BUCKETS - 1 && (int64_t(1) << (b + 1)) <= lost)
+		b++;
+	gapHist[b].fetch_add(1, std::memory_order_relaxed);
+	gaps.fetch_add(1, std::memory_order_relaxed);
+	lostSamps.fetch_add(lost, std::memory_order_relaxed);
+	if (padded)
+		paddedSamps.fetch_add(lost, std::memory_order_relaxed);
+}
+
+const char* RxStats::kindName(ErrorKind kind)
+{
+	static const char* names[NUM_ERR_KINDS] = { "none", "timeout", "late", "broken chain", "overflow", "alignment", "bad packet", "other" };
+	return names[kind];
+}
+
+std::string RxStats::summary() const
+{
+	std::string s;
+	for (int k = ERR_TIMEOUT; k < NUM_ERR_KINDS; k++)
+		if (getErrors((ErrorKind)k) > 0)
+			s += str(boost::format("%s: %d, ") % kindName((ErrorKind)k) % getErrors((ErrorKind)k));
+	s += str(boost::format("gaps: %d (%d samples lost, %d padded), time jumps: %d, restarts: %d")
+		% getGaps() % getLostSamps() % getPaddedSamps() % getTimeJumps() % getRestarts());
+
+	for (int b = 0; b < NUM_GAP_BUCKETS; b++)
+		if (getGapBucket(b) > 0)
+			s += str(boost::format("\n  gap [%d, %d) samples: %d") % (int64_t(1) << b) % (int64_t(1) << (b + 1)) % getGapBucket(b));
+	return s;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Running receive error histogram. Updated by the receive loop only; the
+// counters are atomics so the GUI can read them while streaming.
+class RxStats
+{
+public:
+	// Mirrors the uhd::rx_metadata_t error codes we care about, so this header
+	// can be used without UHD (benchmarks, replay)
+	enum ErrorKind { ERR_NONE, ERR_TIMEOUT, ERR_LATE, ERR_BROKEN_CHAIN, ERR_OVERFLOW, ERR_ALIGNMENT, ERR_BAD_PACKET, ERR_OTHER, NUM_ERR_KINDS };
+	static const int NUM_GAP_BUCKETS = 32; // bucket b counts gaps of [2^b, 2^(b+1)) samples
+
+private:
+	std::atomic<uint64_t> errors[NUM_ERR_KINDS];
+	std::atomic<uint64_t> gapHist[NUM_GAP_BUCKETS];
+	std::atomic<uint64_t> gaps{ 0 };
+	std::atomic<uint64_t> lostSamps{ 0 };
+	std::atomic<uint64_t> paddedSamps{ 0 };
+	std::atomic<uint64_t> timeJumps{ 0 };   // device time went backwards
+	std::atomic<uint64_t> restarts{ 0 };    // stream commands reissued after timeouts
+
+public:
+	RxStats() { reset(); }
+
+	void reset();
+	void recordError(ErrorKind kind) { errors[kind].fetch_add(1, std::memory_order_relaxed); }
+	void recordGap(int64_t lost, bool padded);
+	void recordTimeJump() { timeJumps.fetch_add(1, std::memory_order_relaxed); }
+	void recordRestart() { restarts.fetch_add(1, std::memory_order_relaxed); }
+
+	uint64_t getErrors(ErrorKind kind) const { return errors[kind].load(std::memory_order_relaxed); }
+	uint64_t getGapBucket(int b) const { return gapHist[b].load(std::memory_order_relaxed); }
+	uint64_t getGaps() const { return gaps.load(std::memory_order_relaxed); }
+	uint64_t getLostSamps() const { return lostSamps.load(std::memory_order_relaxed); }
+	uint64_t getPaddedSamps() const { return paddedSamps.load(std::memory_order_relaxed); }
+	uint64_t getTimeJumps() const { return timeJumps.load(std::memory_order_relaxed); }
+	uint64_t getRestarts() const { return restarts.load(std::memory_order_relaxed); }
+	static const char* kindName(ErrorKind kind);
+	std::string summary() const;
+};
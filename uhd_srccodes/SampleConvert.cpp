@@ -0,0 +1,67 @@
+#include "SampleConvert.h"
+#include <algorithm>
+
+// 1024 samples: 2 kB in, 4-8 kB out, well inside L1
+static const size_t CONVERT_CHUNK = 1024;
+
+const char* wireFormatName(WireFormat fmt)
+{
+	switch (fmt) {
+	case WIRE_SC12: return "sc12";
+	case WIRE_SC8: return "sc8";
+	default: return "sc16";
+	}
+}
+
+bool parseWireFormat(const std::string& name, WireFormat& fmt)
+{
+	if (name == "sc16")
+		fmt = WIRE_SC16;
+	else if (name == "sc12")
+		fmt = WIRE_SC12;
+	else if (name == "sc8")
+		fmt = WIRE_SC8;
+	else
+		return false;
+	return true;
+}
+
+int wireBits(WireFormat fmt)
+{
+	switch (fmt) {
+	case WIRE_SC12: return 12;
+	case WIRE_SC8: return 8;
+	default: return 16;
+	}
+}
+
+size_t wireBytesPerSamp(WireFormat fmt)
+{
+	return 2 * wireBits(fmt) / 8;
+}
+
+void widenSc8ToSc16(const Ipp8sc* src, Ipp16sc* dst, size_t nsamps)
+{
+	for (size_t i = 0; i < nsamps; i += CONVERT_CHUNK) {
+		int n = (int)(2 * std::min(CONVERT_CHUNK, nsamps - i));
+		Ipp16s* d = (Ipp16s*)(dst + i);
+		ippsConvert_8s16s((const Ipp8s*)(src + i), d, n);
+		ippsLShiftC_16s_I(8, d, n);
+	}
+}
+
+void widenSc8To32fc(const Ipp8sc* src, Ipp32fc* dst, size_t nsamps)
+{
+	for (size_t i = 0; i < nsamps; i += CONVERT_CHUNK) {
+		int n = (int)(2 * std::min(CONVERT_CHUNK, nsamps - i));
+		Ipp32f* d = (Ipp32f*)(dst + i);
+		ippsConvert_8s32f((const Ipp8s*)(src + i), d, n);
+		ippsMulC_32f_I(1.0f / 128, d, n);
+	}
+}
+
+void widenSc16To32fc(const Ipp16sc* src, Ipp32fc* dst, size_t nsamps)
+{
+	// Single pass: the scale factor is a power of two
+	ippsConvert_16s32f_Sfs((const Ipp16s*)src, (Ipp32f*)dst, (int)(2 * nsamps), 15);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "ipp.h"
+
+// Over-the-wire sample formats. UHD hands sc12 and sc16 wire samples to the
+// host as sc16; sc8 can also stay 8 bit on the host (cpu format "sc8"),
+// which halves the recv() memory traffic as well, and is then widened here.
+enum WireFormat { WIRE_SC16, WIRE_SC12, WIRE_SC8 };
+
+const char* wireFormatName(WireFormat fmt);          // UHD format string
+bool parseWireFormat(const std::string& name, WireFormat& fmt);
+int wireBits(WireFormat fmt);                        // bits per I or Q
+size_t wireBytesPerSamp(WireFormat fmt);             // bytes per complex sample on the wire
+
+// Conversion kernels. The two-step ones (widen, then shift or scale) run in
+// L1-sized chunks so the second IPP pass reads what the first just wrote
+// while it is still in cache, costing about as much as one fused pass.
+
+// sc8 -> sc16 scaled by 256, so both have the same full scale
+void widenSc8ToSc16(const Ipp8sc* src, Ipp16sc* dst, size_t nsamps);
+// sc8 -> fc32, full scale (128) -> 1.0
+void widenSc8To32fc(const Ipp8sc* src, Ipp32fc* dst, size_t nsamps);
+// sc16 -> fc32, full scale (32768) -> 1.0
+void widenSc16To32fc(const Ipp16sc* src, Ipp32fc* dst, size_t nsamps);
@@ -0,0 +1,252 @@
+#include "SampleRing.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <boost/format.hpp>
+
+void SampleBlock::exportSamps(size_t from, size_t n, Ipp16sc* dst, size_t pitch) const
+{
+	if (!interleaved()) {
+		for (size_t c = 0; c < numChans; c++)
+			ippsCopy_16sc(chan(c) + from, dst + c * pitch, (int)n);
+		return;
+	}
+	// sc16 samples are moved as whole 32-bit words
+	const uint32_t* src = reinterpret_cast<const uint32_t*>(data) + from * numChans;
+	for (size_t c = 0; c < numChans; c++) {
+		uint32_t* out = reinterpret_cast<uint32_t*>(dst + c * pitch);
+		for (size_t i = 0; i < n; i++)
+			out[i] = src[i * numChans + c];
+	}
+}
+
+void SampleBlock::importSamps(size_t to, size_t n, const Ipp16sc* src, size_t pitch)
+{
+	if (!interleaved()) {
+		for (size_t c = 0; c < numChans; c++)
+			ippsCopy_16sc(src + c * pitch, chan(c) + to, (int)n);
+		return;
+	}
+	uint32_t* dst = reinterpret_cast<uint32_t*>(data) + to * numChans;
+	for (size_t c = 0; c < numChans; c++) {
+		const uint32_t* in = reinterpret_cast<const uint32_t*>(src + c * pitch);
+		for (size_t i = 0; i < n; i++)
+			dst[i * numChans + c] = in[i];
+	}
+}
+
+void SampleBlock::zeroSamps(size_t from, size_t n)
+{
+	if (interleaved())
+		ippsZero_16sc(data + from * numChans, (int)(n * numChans));
+	else
+		for (size_t c = 0; c < numChans; c++)
+			ippsZero_16sc(chan(c) + from, (int)n);
+}
+
+void SampleBlock::interleaveSamps(size_t from, size_t n, Ipp16sc* dst) const
+{
+	if (interleaved() || numChans == 1) {
+		ippsCopy_16sc(data + from * numChans, dst, (int)(n * numChans));
+		return;
+	}
+	uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+	for (size_t c = 0; c < numChans; c++) {
+		const uint32_t* in = reinterpret_cast<const uint32_t*>(chan(c) + from);
+		for (size_t i = 0; i < n; i++)
+			out[i * numChans + c] = in[i];
+	}
+}
+
+void BlockPool::init(Ipp16sc* base, size_t in_numBlocks, size_t in_blockSamps, size_t in_numChans, bool in_interleaved)
+{
+	clear();
+	const size_t blockLen = in_blockSamps * in_numChans;
+	blocks.resize(in_numBlocks);
+	refs.reset(new std::atomic<uint32_t>[in_numBlocks]);
+	for (size_t i = 0; i < in_numBlocks; i++) {
+		SampleBlock& blk = blocks[i];
+		blk.data = base + i * blockLen;
+		blk.numChans = in_numChans;
+		blk.stride = in_interleaved ? 0 : in_blockSamps;
+		blk.pool = this;
+		blk.poolIdx = (uint32_t)i;
+		refs[i].store(0, std::memory_order_relaxed);
+	}
+	next = 0;
+	held = 0;
+	peakHeld = 0;
+}
+
+void BlockPool::clear()
+{
+	blocks.clear();
+	refs.reset();
+	held = 0;
+}
+
+SampleBlock* BlockPool::acquire()
+{
+	// Blocks mostly come back in the order they went out, so the search
+	// rarely gets past the cursor
+	const size_t n = blocks.size();
+	for (size_t k = 0; k < n; k++) {
+		size_t i = (next + k) % n;
+		if (refs[i].load(std::memory_order_acquire) != 0)
+			continue;
+		// Only this thread takes a free block, so nobody races the store
+		refs[i].store(1, std::memory_order_relaxed);
+		next = (i + 1) % n;
+		size_t h = held.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (h > peakHeld.load(std::memory_order_relaxed))
+			peakHeld.store(h, std::memory_order_relaxed);
+		return &blocks[i];
+	}
+	return nullptr;
+}
+
+void BlockPool::release(const SampleBlock& blk)
+{
+	if (refs[blk.poolIdx].fetch_sub(1, std::memory_order_acq_rel) == 1)
+		held.fetch_sub(1, std::memory_order_release);
+}
+
+void BlockPool::waitIdle()
+{
+	auto t0 = std::chrono::steady_clock::now();
+	bool warned = false;
+	while (getHeld() > 0) {
+		if (!warned && std::chrono::steady_clock::now() - t0 > std::chrono::seconds(1)) {
+			std::cerr << boost::format("Waiting for %d sample blocks still referenced\n") % getHeld();
+			warned = true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void SampleRing::init(size_t in_numSlots, size_t in_blockSamps, size_t in_numChans, bool in_interleaved,
+	const MemPolicy& in_mem, size_t in_spare)
+{
+	free();
+
+	const size_t sampsPerPage = RING_PAGE / sizeof(Ipp16sc);
+	numSlots = in_numSlots < 2 ? 2 : in_numSlots;
+	blockSamps = (in_blockSamps + sampsPerPage - 1) / sampsPerPage * sampsPerPage;
+	numChans = in_numChans < 1 ? 1 : in_numChans;
+	interleaved = in_interleaved;
+
+	// All blocks, scratch included, in one placed and prefaulted region
+	const size_t numBlocks = numSlots + in_spare;
+	const size_t blockLen = blockSamps * numChans;
+	if (!mem.alloc((numBlocks + 1) * blockLen * sizeof(Ipp16sc), in_mem)) {
+		numSlots = 0;
+		blockSamps = 0;
+		return;
+	}
+	Ipp16sc* base = static_cast<Ipp16sc*>(mem.get());
+	pool.init(base, numBlocks, blockSamps, numChans, interleaved);
+	slots.assign(numSlots, nullptr);
+	scratchBlock.data = base + numBlocks * blockLen;
+	scratchBlock.numChans = numChans;
+	scratchBlock.stride = interleaved ? 0 : blockSamps;
+
+	reset();
+}
+
+void SampleRing::releaseAll()
+{
+	// The producer's unpublished block and the ring's references to unread ones
+	if (writeBlk != nullptr)
+		pool.release(*writeBlk);
+	writeBlk = nullptr;
+	for (uint64_t t = tail.load(std::memory_order_acquire); t < head.load(std::memory_order_acquire); t++)
+		pool.release(*slots[t % numSlots]);
+	tail.store(head.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+void SampleRing::free()
+{
+	if (numSlots > 0) {
+		releaseAll();
+		pool.waitIdle();
+	}
+	slots.clear();
+	pool.clear();
+	mem.free();
+	scratchBlock.data = nullptr;
+	numSlots = 0;
+	blockSamps = 0;
+}
+
+void SampleRing::reset()
+{
+	if (numSlots > 0) {
+		releaseAll();
+		pool.waitIdle();
+	}
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+	overruns.store(0, std::memory_order_relaxed);
+	droppedSamps.store(0, std::memory_order_relaxed);
+	starved.store(0, std::memory_order_relaxed);
+	highWater.store(0, std::memory_order_relaxed);
+	nextSeq = 0;
+	writingScratch = false;
+	writingStarved = false;
+}
+
+SampleBlock* SampleRing::beginWrite()
+{
+	uint64_t h = head.load(std::memory_order_relaxed);
+	uint64_t t = tail.load(std::memory_order_acquire);
+
+	// Consumer has fallen a full ring behind, or holds every spare block
+	writingStarved = false;
+	if (h - t < numSlots && writeBlk == nullptr) {
+		writeBlk = pool.acquire();
+		writingStarved = writeBlk == nullptr;
+	}
+	writingScratch = h - t >= numSlots || writeBlk == nullptr;
+	SampleBlock* blk = writingScratch ? &scratchBlock : writeBlk;
+	blk->nsamps = 0;
+	blk->seq = nextSeq++;
+	blk->hasTime = false;
+	blk->flags = 0;
+	blk->lostBefore = 0;
+	return blk;
+}
+
+void SampleRing::endWrite()
+{
+	if (writingScratch) {
+		overruns.fetch_add(1, std::memory_order_relaxed);
+		if (writingStarved)
+			starved.fetch_add(1, std::memory_order_relaxed);
+		droppedSamps.fetch_add(scratchBlock.nsamps, std::memory_order_relaxed);
+		return;
+	}
+
+	uint64_t h = head.load(std::memory_order_relaxed);
+	slots[h % numSlots] = writeBlk;
+	writeBlk = nullptr;
+	head.store(h + 1, std::memory_order_release);
+
+	size_t fill = (size_t)(h + 1 - tail.load(std::memory_order_relaxed));
+	if (fill > highWater.load(std::memory_order_relaxed))
+		highWater.store(fill, std::memory_order_relaxed);
+}
+
+SampleBlock* SampleRing::beginRead()
+{
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	if (t == head.load(std::memory_order_acquire))
+		return nullptr;
+	return slots[t % numSlots];
+}
+
+void SampleRing::endRead()
+{
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	pool.release(*slots[t % numSlots]);
+	tail.store(t + 1, std::memory_order_release);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "ipp.h"
+#include "TimeMap.h"
+#include "ThreadPolicy.h"
+
+// Cache line size used for slot and index padding
+#define RING_CACHELINE 64
+// Block payloads start on a page and are whole pages long (per channel when
+// planar), so a block can go to a direct I/O write as it is
+#define RING_PAGE 4096
+// Pool blocks beyond the ring's slots by default: one DiskWriter's write-behind
+// of blocks written in place, plus a snapshot and one block of slack
+#define RING_SPARE_BLOCKS 18
+
+class BlockPool;
+
+// SampleBlock::flags
+#define BLOCK_FLAG_DISCONT 0x1  // samples (lostBefore of them) or time are missing before data[0]
+#define BLOCK_FLAG_PADDED  0x2  // zeros standing in for samples lost at the device
+
+// One slot of the ring. The producer fills data[0..nsamps) and stamps the
+// sequence number; the consumer reads it back after the slot is published.
+// A block holds numChans channels of nsamps samples each, either planar
+// (channel c starts at data + c * stride) or interleaved (sample i of
+// channel c at data[i * numChans + c]).
+struct alignas(RING_CACHELINE) SampleBlock
+{
+	Ipp16sc* data = nullptr;
+	size_t nsamps = 0;      // valid samples in data, per channel
+	size_t numChans = 1;
+	size_t stride = 0;      // planar channel pitch in samples, 0 when interleaved
+	uint64_t seq = 0;       // monotonically increasing block number
+	uint64_t sampOffset = 0; // stream index of data[0]; samples lost at the device still count
+	DeviceTime time;         // device time of data[0], valid if hasTime
+	bool hasTime = false;
+	uint32_t flags = 0;      // BLOCK_FLAG_*
+	uint64_t lostBefore = 0; // device samples lost right before this block
+	BlockPool* pool = nullptr; // owner of data, see BlockRef; null for blocks not from a pool
+	uint32_t poolIdx = 0;
+
+	bool interleaved() const { return stride == 0; }
+	Ipp16sc* chan(size_t c) const { return data + c * stride; } // planar only
+
+	// Move samples [from, from + n) of every channel out of / into planar
+	// buffers that are pitch samples apart, whatever the block layout
+	void exportSamps(size_t from, size_t n, Ipp16sc* dst, size_t pitch) const;
+	void importSamps(size_t to, size_t n, const Ipp16sc* src, size_t pitch);
+	void zeroSamps(size_t from, size_t n);
+	// All channels of samples [from, from + n), interleaved
+	void interleaveSamps(size_t from, size_t n, Ipp16sc* dst) const;
+};
+
+// Fixed set of sample blocks shared by reference count. One thread (the
+// ring's producer) acquires free blocks; any thread holding a reference can
+// add one, and the block is free again once the last is dropped. A consumer
+// that keeps a block past its turn in the ring (a disk write in flight, a
+// display) takes a BlockRef instead of copying the samples out.
+class BlockPool
+{
+private:
+	std::vector<SampleBlock> blocks;
+	std::unique_ptr<std::atomic<uint32_t>[]> refs;
+	size_t next = 0;                // acquire() cursor, producer-local
+	alignas(RING_CACHELINE) std::atomic<size_t> held{ 0 };
+	std::atomic<size_t> peakHeld{ 0 };
+
+public:
+	BlockPool() {}
+	BlockPool(const BlockPool&) = delete;
+	BlockPool& operator=(const BlockPool&) = delete;
+
+	// in_numBlocks blocks of in_blockSamps samples per channel, back to back from base
+	void init(Ipp16sc* base, size_t in_numBlocks, size_t in_blockSamps, size_t in_numChans, bool in_interleaved);
+	void clear();
+	// Producer only. A free block with one reference, nullptr if every block is held.
+	SampleBlock* acquire();
+	// Any thread that holds a reference to blk
+	void retain(const SampleBlock& blk) { refs[blk.poolIdx].fetch_add(1, std::memory_order_relaxed); }
+	void release(const SampleBlock& blk);
+	// Wait until no block is held; warns once if that takes long
+	void waitIdle();
+
+	size_t getNumBlocks() const { return blocks.size(); }
+	size_t getHeld() const { return held.load(std::memory_order_acquire); }
+	size_t getPeakHeld() const { return peakHeld.load(std::memory_order_relaxed); }
+	const SampleBlock& getBlock(size_t idx) const { return blocks[idx]; }
+};
+
+// Counted reference to a pool block: while it is held the block's samples
+// and header stay as they are. Empty for blocks that are not from a pool,
+// which a holder has to copy instead.
+class BlockRef
+{
+private:
+	const SampleBlock* blk = nullptr;
+
+public:
+	BlockRef() {}
+	explicit BlockRef(const SampleBlock& in_blk)
+		: blk(in_blk.pool != nullptr ? &in_blk.pool->getBlock(in_blk.poolIdx) : nullptr)
+	{
+		if (blk != nullptr)
+			blk->pool->retain(*blk);
+	}
+	BlockRef(const BlockRef& other) : blk(other.blk)
+	{
+		if (blk != nullptr)
+			blk->pool->retain(*blk);
+	}
+	BlockRef(BlockRef&& other) noexcept : blk(other.blk) { other.blk = nullptr; }
+	BlockRef& operator=(BlockRef other)
+	{
+		std::swap(blk, other.blk);
+		return *this;
+	}
+	~BlockRef() { reset(); }
+
+	void reset()
+	{
+		if (blk != nullptr)
+			blk->pool->release(*blk);
+		blk = nullptr;
+	}
+	const SampleBlock* get() const { return blk; }
+	const SampleBlock& operator*() const { return *blk; }
+	const SampleBlock* operator->() const { return blk; }
+	explicit operator bool() const { return blk != nullptr; }
+};
+
+// Single-producer/single-consumer ring of sample blocks from a BlockPool.
+// The receive loop is the only producer and one worker thread is the only
+// consumer. No locks are taken on either side: head is only written by the
+// producer, tail only by the consumer, and slots are published with
+// release/acquire ordering on those two indices. recv() lands in the pool
+// block itself, and the ring's reference to it is dropped at endRead(), so
+// consumers that hold a BlockRef share the samples without a copy.
+// When the ring is full, or every spare block is still held, the producer
+// does not overwrite unread data; the block is counted as an overrun and the
+// caller keeps receiving into a scratch block so the device is still drained.
+class SampleRing
+{
+private:
+	std::vector<SampleBlock*> slots; // published blocks, one reference each
+	size_t numSlots = 0;
+	size_t blockSamps = 0;
+	size_t numChans = 1;
+	bool interleaved = false;
+	SampleMem mem;                  // every pool block, then the scratch block
+	BlockPool pool;
+	SampleBlock scratchBlock;       // landing block used while the ring is full
+	SampleBlock* writeBlk = nullptr; // acquired and not yet published, producer-local
+	void releaseAll();
+
+	// Producer and consumer indices live on separate cache lines
+	alignas(RING_CACHELINE) std::atomic<uint64_t> head{ 0 };  // next slot to write
+	alignas(RING_CACHELINE) std::atomic<uint64_t> tail{ 0 };  // next slot to read
+	alignas(RING_CACHELINE) std::atomic<uint64_t> overruns{ 0 };
+	std::atomic<uint64_t> droppedSamps{ 0 };
+	std::atomic<uint64_t> starved{ 0 };
+	std::atomic<size_t> highWater{ 0 };
+	uint64_t nextSeq = 0;           // producer-local
+	bool writingScratch = false;    // producer-local
+	bool writingStarved = false;    // producer-local
+
+public:
+	SampleRing() {}
+	~SampleRing() { free(); }
+	SampleRing(const SampleRing&) = delete;
+	SampleRing& operator=(const SampleRing&) = delete;
+
+	// Allocate in_numSlots ring slots over a pool of in_numSlots + in_spare
+	// blocks of in_blockSamps samples per channel. The block length is
+	// rounded up to a whole number of pages, so every block and every planar
+	// channel starts page aligned. The memory is placed and prefaulted per
+	// in_mem by the calling thread, which should be the producer.
+	void init(size_t in_numSlots, size_t in_blockSamps, size_t in_numChans = 1, bool in_interleaved = false,
+		const MemPolicy& in_mem = MemPolicy(), size_t in_spare = RING_SPARE_BLOCKS);
+	// Both wait for consumers to drop their BlockRefs
+	void free();
+	void reset();
+
+	// Producer side. beginWrite() never returns nullptr: if every slot is
+	// still owned by the consumer it hands out the scratch block, whose
+	// contents are discarded (and counted) by endWrite(). Called again
+	// without endWrite(), it hands out the same block.
+	SampleBlock* beginWrite();
+	void endWrite();
+	// The next beginWrite() would get the scratch block
+	bool isFull() const { return getFill() >= numSlots || pool.getHeld() >= pool.getNumBlocks(); }
+
+	// Consumer side. beginRead() returns nullptr when the ring is empty.
+	// Take a BlockRef before endRead() to keep the block.
+	SampleBlock* beginRead();
+	void endRead();
+
+	size_t getNumSlots() const { return numSlots; }
+	size_t getBlockSamps() const { return blockSamps; }
+	size_t getNumChans() const { return numChans; }
+	size_t getFill() const { return (size_t)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)); }
+	size_t getHighWater() const { return highWater.load(std::memory_order_relaxed); }
+	uint64_t getOverruns() const { return overruns.load(std::memory_order_relaxed); }
+	// Overruns with free slots, because consumers held every spare block
+	uint64_t getStarved() const { return starved.load(std::memory_order_relaxed); }
+	uint64_t getDroppedSamps() const { return droppedSamps.load(std::memory_order_relaxed); }
+	uint64_t getWritten() const { return head.load(std::memory_order_relaxed); }
+	const BlockPool& getPool() const { return pool; }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <uhd/usrp/multi_usrp.hpp>
+#include <memory>
+#include <vector>
+#include "ipp.h"
+#include "SampleConvert.h"
+
+// Where the receive loop gets its samples from. The interface follows
+// uhd::rx_streamer so that the UHD backend is a thin wrapper and the other
+// backends (synthetic generator, file replay) can stand in for a radio when
+// load-testing the pipeline. Metadata uses uhd::rx_metadata_t as-is, so the
+// overflow/timestamp handling in the receive loop is the same for all of them.
+class SampleSource
+{
+public:
+	typedef std::shared_ptr<SampleSource> sptr;
+	virtual ~SampleSource() {}
+
+	virtual void startStream() = 0;
+	virtual void stopStream() = 0;
+
+	// Receive up to nsamps samples into one buffer per channel
+	virtual size_t recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout) = 0;
+
+	virtual double getRate() const = 0;
+	virtual size_t getNumChannels() const = 0;
+	virtual size_t getMaxNumSamps() const = 0;
+
+	// True once a finite source (file replay) has nothing more to give
+	virtual bool isFinished() const { return false; }
+
+	// Seconds between startStream() and the first sample (timed starts), to
+	// be added to the first recv() timeout
+	virtual double getStartLatency() const { return 0; }
+
+	// Sample format on the wire, and of what recv() writes: WIRE_SC16 (Ipp16sc)
+	// or WIRE_SC8 (Ipp8sc, to be widened by the caller)
+	virtual WireFormat getWireFormat() const { return WIRE_SC16; }
+	virtual WireFormat getCpuFormat() const { return WIRE_SC16; }
+};
+
+// Live radio: forwards to a uhd::rx_streamer. in_cmd may carry a timed start
+// (stream_now = false, time_spec in the future), in_startLatency being how
+// far in the future that is; setStartTime() re-arms one. stopStream() drains
+// the streamer, so a later start begins on fresh samples.
+class UhdSampleSource : public SampleSource
+{
+private:
+	uhd::rx_streamer::sptr rx_stream;
+	uhd::stream_cmd_t stream_cmd;
+	double rate;
+	double startLatency;
+	double pendingLatency = 0;  // startLatency until the first samples arrive
+	WireFormat otw, cpu;
+
+public:
+	UhdSampleSource(uhd::rx_streamer::sptr in_stream, const uhd::stream_cmd_t& in_cmd, double in_rate, double in_startLatency = 0,
+		WireFormat in_otw = WIRE_SC16, WireFormat in_cpu = WIRE_SC16)
+		: rx_stream(in_stream), stream_cmd(in_cmd), rate(in_rate), startLatency(in_startLatency), otw(in_otw), cpu(in_cpu) {}
+
+	void startStream() override
+	{
+		stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS;
+		rx_stream->issue_stream_cmd(stream_cmd);
+		pendingLatency = stream_cmd.stream_now ? 0 : startLatency;
+		stream_cmd.stream_now = true; // restarts after the first one are immediate
+	}
+	double getStartLatency() const override { return pendingLatency; }
+	// Makes the next startStream() a timed one at in_time
+	void setStartTime(const uhd::time_spec_t& in_time)
+	{
+		stream_cmd.stream_now = false;
+		stream_cmd.time_spec = in_time;
+	}
+	void stopStream() override
+	{
+		stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+		rx_stream->issue_stream_cmd(stream_cmd);
+		// Samples already on their way would otherwise be the first ones of a restart
+		const size_t maxSamps = rx_stream->get_max_num_samps();
+		std::vector<uint32_t> scratch(maxSamps * rx_stream->get_num_channels()); // fits sc16 and sc8
+		std::vector<void*> buffs(rx_stream->get_num_channels());
+		for (size_t c = 0; c < buffs.size(); c++)
+			buffs[c] = scratch.data() + c * maxSamps;
+		uhd::rx_metadata_t md;
+		do
+			rx_stream->recv(buffs, maxSamps, md, 0.1);
+		while (md.error_code != uhd::rx_metadata_t::ERROR_CODE_TIMEOUT);
+	}
+	size_t recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout) override
+	{
+		size_t n = rx_stream->recv(buffs, nsamps, md, timeout);
+		if (n > 0)
+			pendingLatency = 0;
+		return n;
+	}
+
+	double getRate() const override { return rate; }
+	size_t getNumChannels() const override { return rx_stream->get_num_channels(); }
+	size_t getMaxNumSamps() const override { return rx_stream->get_max_num_samps(); }
+	WireFormat getWireFormat() const override { return otw; }
+	WireFormat getCpuFormat() const override { return cpu; }
+	uhd::rx_streamer::sptr getStreamer() { return rx_stream; }
+};
@@ -0,0 +1,225 @@
+#include "SigmfMeta.h"
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+static std::string jsonString(const std::string& s)
+{
+	std::string out = "\"";
+	for (char ch : s) {
+		if (ch == '"' || ch == '\\') {
+			out += '\\';
+			out += ch;
+		}
+		else if ((unsigned char)ch < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)ch);
+			out += esc;
+		}
+		else
+			out += ch;
+	}
+	return out + "\"";
+}
+
+// ISO 8601 UTC with nanoseconds, as core:datetime wants it
+static std::string isoTime(int64_t secs, double frac)
+{
+	int64_t ns = (int64_t)(frac * 1e9 + 0.5);
+	if (ns >= 1000000000) {
+		secs++;
+		ns -= 1000000000;
+	}
+	std::time_t t = (std::time_t)secs;
+	std::tm tm;
+#ifdef _WIN32
+	gmtime_s(&tm, &t);
+#else
+	gmtime_r(&t, &tm);
+#endif
+	char buf[48];
+	size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buf + n, sizeof(buf) - n, ".%09lldZ", (long long)ns);
+	return buf;
+}
+
+std::string SigmfMeta::dataName(const std::string& basename, size_t f, bool perChannel)
+{
+	return perChannel ? str(boost::format("%s_ch%d.sigmf-data") % basename % f) : basename + ".sigmf-data";
+}
+
+bool SigmfMeta::open(const std::string& in_basename, const SigmfGlobal& global)
+{
+	close();
+	basename = in_basename;
+	journal.open(basename + ".sigmf-meta.part", std::ios::out | std::ios::trunc);
+	if (!journal.is_open()) {
+		std::cerr << boost::format("Could not open %s.sigmf-meta.part for writing\n") % basename;
+		return false;
+	}
+
+	// Header: dataset count, channels per dataset, then the global members
+	// that are the same for every dataset
+	const size_t files = global.perChannelFiles ? global.numChannels : 1;
+	journal << "G " << files << ' ' << (global.perChannelFiles ? 1 : global.numChannels) << ' '
+		<< "\"core:datatype\": " << jsonString(global.datatype)
+		<< boost::format(", \"core:sample_rate\": %.17g") % global.sampleRate
+		<< ", \"core:version\": \"1.2.0\""
+		<< ", \"core:recorder\": \"uhd_srccodes\"";
+	if (!global.hw.empty())
+		journal << ", \"core:hw\": " << jsonString(global.hw);
+	if (!global.description.empty())
+		journal << ", \"core:description\": " << jsonString(global.description);
+	journal << ", \"core:extensions\": [{\"name\": \"uhd\", \"version\": \"1.0.0\", \"optional\": true}]";
+	if (!global.wireFormat.empty())
+		journal << ", \"uhd:wire_format\": " << jsonString(global.wireFormat);
+	journal << '\n';
+	journal.flush();
+
+	Stopflag = false;
+	queue.clear();
+	thrd = std::thread(&SigmfMeta::metaLoop, this);
+	Openflag = true;
+	return true;
+}
+
+void SigmfMeta::addCapture(const SigmfCapture& cap)
+{
+	if (!Openflag)
+		return;
+	std::string line = str(boost::format("C {\"core:sample_start\": %d, \"core:global_index\": %d")
+		% cap.sampleStart % cap.globalIndex);
+	if (cap.frequency != 0)
+		line += str(boost::format(", \"core:frequency\": %.17g, \"uhd:gain\": %.17g, \"uhd:lo_offset\": %.17g")
+			% cap.frequency % cap.gain % cap.loOffset);
+	if (cap.hasTime && cap.timeIsUtc)
+		line += ", \"core:datetime\": \"" + isoTime(cap.time.secs, cap.time.frac) + "\"";
+	else if (cap.hostTime > 0)
+		line += ", \"core:datetime\": \"" + isoTime((int64_t)cap.hostTime, cap.hostTime - (int64_t)cap.hostTime) + "\"";
+	if (cap.hasTime)
+		line += str(boost::format(", \"uhd:time_secs\": %d, \"uhd:time_frac\": %.12f") % cap.time.secs % cap.time.frac);
+	post(line + "}");
+}
+
+void SigmfMeta::addAnnotation(const SigmfAnnotation& note)
+{
+	if (!Openflag)
+		return;
+	std::string line = str(boost::format("A {\"core:sample_start\": %d") % note.sampleStart);
+	if (note.sampleCount > 0)
+		line += str(boost::format(", \"core:sample_count\": %d") % note.sampleCount);
+	line += ", \"core:label\": " + jsonString(note.label);
+	if (!note.comment.empty())
+		line += ", \"core:comment\": " + jsonString(note.comment);
+	if (note.lostSamps > 0)
+		line += str(boost::format(", \"uhd:lost_samples\": %d") % note.lostSamps);
+	post(line + "}");
+}
+
+void SigmfMeta::post(std::string line)
+{
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		queue.push_back(std::move(line));
+	}
+	posted.notify_one();
+}
+
+void SigmfMeta::metaLoop()
+{
+	std::vector<std::string> batch;
+	while (true) {
+		bool stop;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			posted.wait(lock, [this] { return Stopflag || !queue.empty(); });
+			batch.swap(queue);
+			stop = Stopflag;
+		}
+		// Whole lines per flush, so a crash leaves at most a torn last line
+		for (const std::string& line : batch)
+			journal << line << '\n';
+		journal.flush();
+		batch.clear();
+		if (stop)
+			return;
+	}
+}
+
+bool SigmfMeta::close()
+{
+	if (!Openflag)
+		return true;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		Stopflag = true;
+	}
+	posted.notify_one();
+	thrd.join();
+	bool ok = !journal.fail();
+	journal.close();
+	Openflag = false;
+	return assemble(basename) && ok;
+}
+
+bool SigmfMeta::assemble(const std::string& basename)
+{
+	const std::string partName = basename + ".sigmf-meta.part";
+	std::ifstream part(partName);
+	std::string header;
+	size_t files = 0, chans = 0;
+	int bodyAt = 0;
+	if (!std::getline(part, header) || sscanf(header.c_str(), "G %zu %zu %n", &files, &chans, &bodyAt) < 2 || bodyAt == 0) {
+		std::cerr << boost::format("%s is missing or not a SigMF journal\n") % partName;
+		return false;
+	}
+	const std::string body = header.substr(bodyAt);
+	const std::streampos entries = part.tellg();
+
+	for (size_t f = 0; f < files; f++) {
+		std::string data = dataName(basename, f, files > 1);
+		std::string metaName = data.substr(0, data.size() - 4) + "meta";
+		std::ofstream meta(metaName + ".tmp", std::ios::out | std::ios::trunc);
+		meta << "{\n  \"global\": {\"core:num_channels\": " << chans << ", " << body;
+		if (files > 1)
+			meta << ", \"uhd:channel\": " << f;
+		meta << "},\n";
+
+		// Captures, then annotations, each in the order they were logged.
+		// A torn last line (capture killed mid-write) is skipped.
+		const char kinds[2] = { 'C', 'A' };
+		const char* names[2] = { "captures", "annotations" };
+		for (int k = 0; k < 2; k++) {
+			meta << "  \"" << names[k] << "\": [";
+			part.clear();
+			part.seekg(entries);
+			std::string line;
+			bool first = true;
+			while (std::getline(part, line)) {
+				if (line.size() < 4 || line[0] != kinds[k] || line.back() != '}')
+					continue;
+				meta << (first ? "\n    " : ",\n    ") << line.substr(2);
+				first = false;
+			}
+			meta << (first ? "]" : "\n  ]") << (k == 0 ? ",\n" : "\n");
+		}
+		meta << "}\n";
+		meta.close();
+		if (!meta) {
+			std::cerr << boost::format("Could not write %s\n") % metaName;
+			return false;
+		}
+		boost::system::error_code ec;
+		boost::filesystem::rename(metaName + ".tmp", metaName, ec);
+		if (ec) {
+			std::cerr << boost::format("Could not write %s: %s\n") % metaName % ec.message();
+			return false;
+		}
+	}
+	part.close();
+	boost::system::error_code ec;
+	boost::filesystem::remove(partName, ec);
+	return true;
+}
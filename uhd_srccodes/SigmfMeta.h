@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TimeMap.h"
+
+// SigMF dataset description (https://sigmf.org), core namespace plus a small
+// "uhd" extension for what core has no key for (gain, device time, wire
+// format, lost samples).
+struct SigmfGlobal
+{
+	double sampleRate = 0;
+	size_t numChannels = 1;
+	bool perChannelFiles = false;   // one dataset per channel instead of one interleaved dataset
+	std::string datatype = "ci16_le";
+	std::string wireFormat;         // uhd:wire_format
+	std::string hw;                 // core:hw
+	std::string description;        // core:description
+};
+
+// One capture segment: the file samples from sampleStart on were taken
+// contiguously with these RF settings
+struct SigmfCapture
+{
+	uint64_t sampleStart = 0;   // file sample index
+	uint64_t globalIndex = 0;   // stream sample index (core:global_index)
+	double frequency = 0;       // 0 = not a tuned source: no core:frequency, uhd:gain, uhd:lo_offset
+	double gain = 0;
+	double loOffset = 0;
+	bool hasTime = false;
+	DeviceTime time;            // device time of sampleStart
+	bool timeIsUtc = false;     // device time is GPS/UTC, so it gives core:datetime
+	double hostTime = 0;        // UTC seconds from the host clock for core:datetime, 0 = none
+};
+
+struct SigmfAnnotation
+{
+	uint64_t sampleStart = 0;
+	uint64_t sampleCount = 0;   // 0 = a point event, no core:sample_count
+	std::string label;
+	std::string comment;
+	uint64_t lostSamps = 0;     // uhd:lost_samples, 0 = not written
+};
+
+// Streaming writer of the .sigmf-meta for a capture in progress.
+// A .sigmf-meta is one JSON document with two growing arrays, so it cannot
+// be appended to in place. Captures and annotations instead go, one JSON
+// object per line, to the append-only journal <basename>.sigmf-meta.part,
+// and close() assembles the final .sigmf-meta from it in one streaming pass.
+// A capture that ended without close() is recovered with assemble().
+// addCapture()/addAnnotation() only format a line and queue it; a thread of
+// its own does the file I/O, so they never wait on the disk.
+class SigmfMeta
+{
+private:
+	std::string basename;
+	std::ofstream journal;
+	std::thread thrd;
+	std::mutex mut;
+	std::condition_variable posted;
+	std::vector<std::string> queue;   // guarded by mut
+	bool Stopflag = false;            // guarded by mut
+	bool Openflag = false;
+
+	void post(std::string line);
+	void metaLoop();
+
+public:
+	SigmfMeta() {}
+	~SigmfMeta() { close(); }
+
+	bool open(const std::string& in_basename, const SigmfGlobal& global);
+	void addCapture(const SigmfCapture& cap);
+	void addAnnotation(const SigmfAnnotation& note);
+	// Flushes the journal and assembles the .sigmf-meta file(s)
+	bool close();
+	bool isOpen() const { return Openflag; }
+
+	// Data file of dataset f: <basename>.sigmf-data, or <basename>_ch<f>.sigmf-data
+	// for per-channel datasets
+	static std::string dataName(const std::string& basename, size_t f, bool perChannel);
+	// Write the .sigmf-meta file(s) from <basename>.sigmf-meta.part and remove it
+	static bool assemble(const std::string& basename);
+};
@@ -0,0 +1,151 @@
+#include "SyntheticSource.h"
+#include <cmath>
+#include <thread>
+
+SyntheticSource::SyntheticSource(const SyntheticConfig& in_cfg)
+	: cfg(in_cfg)
+{
+	if (cfg.cpuFormat == WIRE_SC8)
+		cfg.wireFormat = WIRE_SC8; // no converter narrows on the host
+	quietTable = ippsMalloc_16sc_L(TABLE_LEN);
+	burstTable = ippsMalloc_16sc_L(TABLE_LEN);
+	renderTable(quietTable, false);
+	renderTable(burstTable, cfg.burstPeriod > 0);
+	if (cfg.cpuFormat == WIRE_SC8) {
+		quietTable8 = (Ipp8sc*)ippsMalloc_8s_L(2 * TABLE_LEN);
+		burstTable8 = (Ipp8sc*)ippsMalloc_8s_L(2 * TABLE_LEN);
+		ippsConvert_16s8s_Sfs((Ipp16s*)quietTable, (Ipp8s*)quietTable8, (int)(2 * TABLE_LEN), ippRndNear, 8);
+		ippsConvert_16s8s_Sfs((Ipp16s*)burstTable, (Ipp8s*)burstTable8, (int)(2 * TABLE_LEN), ippRndNear, 8);
+	}
+
+	chanStride = TABLE_LEN / (cfg.numChannels + 1);
+	burstPeriodSamps = (uint64_t)std::llround(cfg.burstPeriod * cfg.rate);
+	burstLenSamps = (uint64_t)std::llround(cfg.burstLen * cfg.rate);
+}
+
+SyntheticSource::~SyntheticSource()
+{
+	ippsFree(quietTable);
+	ippsFree(burstTable);
+	ippsFree(quietTable8);
+	ippsFree(burstTable8);
+}
+
+void SyntheticSource::renderTable(Ipp16sc* dst, bool withBurst)
+{
+	Ipp32fc* acc = ippsMalloc_32fc_L(TABLE_LEN);
+	Ipp32fc* tmp = ippsMalloc_32fc_L(TABLE_LEN);
+	Ipp32f* re = ippsMalloc_32f_L(TABLE_LEN);
+	Ipp32f* im = ippsMalloc_32f_L(TABLE_LEN);
+
+	// Gaussian noise floor
+	int sizeState = 0;
+	ippsRandGaussGetSize_32f(&sizeState);
+	IppsRandGaussState_32f* pState = (IppsRandGaussState_32f*)ippMalloc(sizeState);
+	ippsRandGaussInit_32f(pState, 0.0f, cfg.noiseAmp, 12345u);
+	ippsRandGauss_32f(re, (int)TABLE_LEN, pState);
+	ippsRandGauss_32f(im, (int)TABLE_LEN, pState);
+	ippsRealToCplx_32f(re, im, acc, (int)TABLE_LEN);
+	ippFree(pState);
+
+	// Tones, rounded to a whole number of cycles per table so the table wraps seamlessly
+	std::vector<SyntheticConfig::Tone> tones = cfg.tones;
+	if (withBurst)
+		tones.push_back({ cfg.burstFreq, cfg.burstAmp });
+	for (size_t i = 0; i < tones.size(); i++) {
+		double cycles = std::round(tones[i].freq / cfg.rate * TABLE_LEN);
+		float relFreq = (float)(cycles / TABLE_LEN);
+		if (relFreq < 0)
+			relFreq += 1.0f; // ippsTone wants [0, 1)
+		float phase = 0;
+		ippsTone_32fc(tmp, (int)TABLE_LEN, tones[i].amp, relFreq, &phase, ippAlgHintAccurate);
+		ippsAdd_32fc_I(tmp, acc, (int)TABLE_LEN);
+	}
+
+	// Full scale, saturating to sc16
+	ippsMulC_32f_I(32767.0f, (Ipp32f*)acc, (int)(2 * TABLE_LEN));
+	ippsConvert_32f16s_Sfs((Ipp32f*)acc, (Ipp16s*)dst, (int)(2 * TABLE_LEN), ippRndNear, 0);
+	// Drop the bits the wire format does not carry
+	int bits = wireBits(cfg.wireFormat);
+	if (bits < 16)
+		ippsAndC_16u_I((Ipp16u)(0xFFFF << (16 - bits)), (Ipp16u*)dst, (int)(2 * TABLE_LEN));
+
+	ippsFree(acc);
+	ippsFree(tmp);
+	ippsFree(re);
+	ippsFree(im);
+}
+
+void SyntheticSource::startStream()
+{
+	devSamp = 0;
+	nextOverflow = cfg.overflowEvery;
+	tStart = std::chrono::steady_clock::now();
+	Streamingflag = true;
+}
+
+void SyntheticSource::copyOut(void* dst, uint64_t from, size_t n, size_t ch)
+{
+	const bool narrow = cfg.cpuFormat == WIRE_SC8;
+	while (n > 0) {
+		// Stop at the end of the table and at burst edges
+		size_t tIdx = (size_t)((from + ch * chanStride) % TABLE_LEN);
+		size_t seg = std::min(n, TABLE_LEN - tIdx);
+		const Ipp16sc* table = quietTable;
+		if (burstPeriodSamps > 0) {
+			uint64_t phase = from % burstPeriodSamps;
+			if (phase < burstLenSamps) {
+				table = burstTable;
+				seg = (size_t)std::min<uint64_t>(seg, burstLenSamps - phase);
+			}
+			else
+				seg = (size_t)std::min<uint64_t>(seg, burstPeriodSamps - phase);
+		}
+		if (narrow) {
+			const Ipp8sc* table8 = table == burstTable ? burstTable8 : quietTable8;
+			ippsCopy_8u((const Ipp8u*)&table8[tIdx], (Ipp8u*)dst, (int)(seg * sizeof(Ipp8sc)));
+			dst = (Ipp8sc*)dst + seg;
+		}
+		else {
+			ippsCopy_16sc(&table[tIdx], (Ipp16sc*)dst, (int)seg);
+			dst = (Ipp16sc*)dst + seg;
+		}
+		from += seg;
+		n -= seg;
+	}
+}
+
+size_t SyntheticSource::recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout)
+{
+	md.reset();
+	if (!Streamingflag) {
+		std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+		md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+		return 0;
+	}
+
+	// Injected overflow: samples vanish, the next recv() reports a later time
+	if (cfg.overflowEvery > 0 && devSamp >= nextOverflow) {
+		devSamp += cfg.overflowSamps;
+		nextOverflow += cfg.overflowEvery;
+		md.error_code = uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+		return 0;
+	}
+	if (cfg.overflowEvery > 0)
+		nsamps = (size_t)std::min<uint64_t>(nsamps, nextOverflow - devSamp);
+
+	if (cfg.paced) {
+		auto due = tStart + std::chrono::duration<double>((devSamp + nsamps) / cfg.rate);
+		std::this_thread::sleep_until(due);
+	}
+
+	for (size_t ch = 0; ch < buffs.size() && ch < cfg.numChannels; ch++)
+		copyOut(buffs[ch], devSamp, nsamps, ch);
+
+	DeviceTime t = cfg.startTime.plus(devSamp / cfg.rate);
+	md.has_time_spec = true;
+	md.time_spec = uhd::time_spec_t(t.secs, t.frac);
+	md.error_code = uhd::rx_metadata_t::ERROR_CODE_NONE;
+	devSamp += nsamps;
+	return nsamps;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "SampleSource.h"
+#include "TimeMap.h"
+
+struct SyntheticConfig
+{
+	double rate = 50e6;
+	size_t numChannels = 1;
+
+	struct Tone { double freq; float amp; }; // Hz, fraction of full scale
+	std::vector<Tone> tones = { { 1e6, 0.5f } };
+	float noiseAmp = 0.01f;                  // gaussian sigma, fraction of full scale
+
+	// Periodic burst of an extra tone on top of the background
+	double burstPeriod = 0;                  // seconds, 0 = no bursts
+	double burstLen = 0;                     // seconds
+	double burstFreq = 0;
+	float burstAmp = 0.3f;
+
+	bool paced = false;                      // deliver at rate in wall-clock time
+	uint64_t overflowEvery = 0;              // inject a device overflow every this many samples (0 = never)
+	size_t overflowSamps = 0;                // samples lost per injected overflow
+	DeviceTime startTime;                    // device time of sample 0
+
+	// Samples are quantized to the wire format; with cpuFormat WIRE_SC8
+	// (wireFormat must be WIRE_SC8 too) recv() delivers Ipp8sc
+	WireFormat wireFormat = WIRE_SC16;
+	WireFormat cpuFormat = WIRE_SC16;
+};
+
+// Synthetic signal generator in place of a radio.
+// Tones, noise and the burst tone are rendered once with IPP into two
+// sc16 tables (background, background + burst) whose length is a whole
+// number of periods of every tone (frequencies are rounded to table bins).
+// recv() then only copies from the tables, which is what lets it run far
+// above any real device rate. The noise repeats with the table period,
+// which does not matter for load testing.
+class SyntheticSource : public SampleSource
+{
+private:
+	SyntheticConfig cfg;
+	static const size_t TABLE_LEN = 1 << 18;
+	Ipp16sc* quietTable = nullptr;
+	Ipp16sc* burstTable = nullptr;
+	Ipp8sc* quietTable8 = nullptr;  // sc8 copies for cpuFormat WIRE_SC8
+	Ipp8sc* burstTable8 = nullptr;
+	size_t chanStride = 0;          // table offset between channels so they differ
+
+	bool Streamingflag = false;
+	uint64_t devSamp = 0;           // device sample counter, includes injected losses
+	uint64_t nextOverflow = 0;
+	uint64_t burstPeriodSamps = 0, burstLenSamps = 0;
+	std::chrono::steady_clock::time_point tStart;
+
+	void renderTable(Ipp16sc* dst, bool withBurst);
+	void copyOut(void* dst, uint64_t from, size_t n, size_t ch);
+
+public:
+	SyntheticSource(const SyntheticConfig& in_cfg);
+	~SyntheticSource();
+
+	void startStream() override;
+	void stopStream() override { Streamingflag = false; }
+	size_t recv(const std::vector<void*>& buffs, size_t nsamps, uhd::rx_metadata_t& md, double timeout) override;
+
+	double getRate() const override { return cfg.rate; }
+	size_t getNumChannels() const override { return cfg.numChannels; }
+	size_t getMaxNumSamps() const override { return 2000; } // about one 10GbE jumbo frame of sc16
+	WireFormat getWireFormat() const override { return cfg.wireFormat; }
+	WireFormat getCpuFormat() const override { return cfg.cpuFormat; }
+};
@@ -0,0 +1,272 @@
+#include "ThreadPolicy.h"
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <boost/filesystem.hpp>
+#endif
+
+std::string ThreadPolicy::describe() const
+{
+	std::string s = cpu >= 0 ? str(boost::format("cpu %d") % cpu) : "any cpu";
+	if (rtPriority > 0)
+		s += str(boost::format(", fifo %d") % rtPriority);
+	else if (nice != 0)
+		s += str(boost::format(", nice %d") % nice);
+	return s;
+}
+
+std::string MemPolicy::describe() const
+{
+	std::string s = numaNode >= 0 ? str(boost::format("node %d") % numaNode) : "local node";
+	if (lock)
+		s += ", locked";
+	if (hugePages)
+		s += ", huge pages";
+	return s;
+}
+
+#ifdef _WIN32
+
+bool applyThreadPolicy(const ThreadPolicy& policy, const char* name)
+{
+	bool ok = true;
+	HANDLE self = GetCurrentThread();
+	if (policy.cpu >= 0 && SetThreadAffinityMask(self, DWORD_PTR(1) << policy.cpu) == 0) {
+		std::cerr << boost::format("%s thread: could not pin to cpu %d\n") % name % policy.cpu;
+		ok = false;
+	}
+	int prio = THREAD_PRIORITY_NORMAL;
+	if (policy.rtPriority > 0)
+		prio = THREAD_PRIORITY_TIME_CRITICAL;
+	else if (policy.nice <= -10)
+		prio = THREAD_PRIORITY_HIGHEST;
+	else if (policy.nice < 0)
+		prio = THREAD_PRIORITY_ABOVE_NORMAL;
+	else if (policy.nice > 0)
+		prio = THREAD_PRIORITY_BELOW_NORMAL;
+	if (prio != THREAD_PRIORITY_NORMAL && !SetThreadPriority(self, prio)) {
+		std::cerr << boost::format("%s thread: could not set priority\n") % name;
+		ok = false;
+	}
+	return ok;
+}
+
+int cpuNumaNode(int cpu)
+{
+	UCHAR node = 0;
+	if (cpu < 0 || cpu > 255 || !GetNumaProcessorNode((UCHAR)cpu, &node) || node == 0xFF)
+		return -1;
+	return node;
+}
+
+double threadCpuSeconds()
+{
+	FILETIME created, exited, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+}
+
+bool SampleMem::alloc(size_t in_bytes, const MemPolicy& policy)
+{
+	free();
+	const SIZE_T large = GetLargePageMinimum();
+
+	// Large pages need SeLockMemoryPrivilege; fall back to normal pages
+	for (int attempt = policy.hugePages && large > 0 ? 0 : 1; attempt < 2 && ptr == nullptr; attempt++) {
+		huge = attempt == 0;
+		SIZE_T page = huge ? large : 4096;
+		bytes = (in_bytes + page - 1) / page * page;
+		DWORD flags = MEM_RESERVE | MEM_COMMIT | (huge ? MEM_LARGE_PAGES : 0);
+		if (policy.numaNode >= 0)
+			ptr = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, flags, PAGE_READWRITE, (DWORD)policy.numaNode);
+		else
+			ptr = VirtualAlloc(NULL, bytes, flags, PAGE_READWRITE);
+	}
+	if (ptr == nullptr) {
+		std::cerr << boost::format("Could not allocate %.1f MB of sample memory\n") % (in_bytes / 1e6);
+		bytes = 0;
+		return false;
+	}
+	if (policy.hugePages && !huge)
+		std::cerr << "Large pages unavailable (needs the Lock pages in memory privilege), using normal pages\n";
+
+	memset(ptr, 0, bytes); // first touch
+
+	if (policy.lock) {
+		SIZE_T wsMin = 0, wsMax = 0;
+		GetProcessWorkingSetSize(GetCurrentProcess(), &wsMin, &wsMax);
+		SetProcessWorkingSetSize(GetCurrentProcess(), wsMin + bytes, wsMax + bytes);
+		locked = VirtualLock(ptr, bytes) != 0;
+		if (!locked)
+			std::cerr << boost::format("VirtualLock of %.1f MB failed, sample memory may be paged\n") % (bytes / 1e6);
+	}
+	return true;
+}
+
+void SampleMem::free()
+{
+	if (ptr == nullptr)
+		return;
+	if (locked)
+		VirtualUnlock(ptr, bytes);
+	VirtualFree(ptr, 0, MEM_RELEASE);
+	ptr = nullptr;
+	bytes = 0;
+	locked = false;
+	huge = false;
+}
+
+#else
+
+bool applyThreadPolicy(const ThreadPolicy& policy, const char* name)
+{
+	bool ok = true;
+#ifdef __linux__
+	pthread_setname_np(pthread_self(), std::string(name).substr(0, 15).c_str());
+	if (policy.cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(policy.cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			std::cerr << boost::format("%s thread: could not pin to cpu %d\n") % name % policy.cpu;
+			ok = false;
+		}
+	}
+#else
+	if (policy.cpu >= 0) {
+		std::cerr << boost::format("%s thread: cpu pinning not supported on this platform\n") % name;
+		ok = false;
+	}
+#endif
+	if (policy.rtPriority > 0) {
+		sched_param sp;
+		sp.sched_priority = policy.rtPriority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+			std::cerr << boost::format("%s thread: SCHED_FIFO %d refused (needs CAP_SYS_NICE or an rtprio limit)\n")
+				% name % policy.rtPriority;
+			ok = false;
+		}
+	}
+	else if (policy.nice != 0) {
+#ifdef __linux__
+		// On Linux nice is per thread when given the thread id
+		if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), policy.nice) != 0) {
+#else
+		if (setpriority(PRIO_PROCESS, 0, policy.nice) != 0) {
+#endif
+			std::cerr << boost::format("%s thread: nice %d refused\n") % name % policy.nice;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int cpuNumaNode(int cpu)
+{
+#ifdef __linux__
+	// /sys/devices/system/cpu/cpuN/ has a nodeM link on NUMA systems
+	boost::system::error_code ec;
+	boost::filesystem::path dir(str(boost::format("/sys/devices/system/cpu/cpu%d") % cpu));
+	for (boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+		std::string leaf = it->path().filename().string();
+		if (leaf.size() > 4 && leaf.compare(0, 4, "node") == 0)
+			return atoi(leaf.c_str() + 4);
+	}
+#endif
+	return -1;
+}
+
+double threadCpuSeconds()
+{
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+bool SampleMem::alloc(size_t in_bytes, const MemPolicy& policy)
+{
+	free();
+	const size_t hugeSize = 2 << 20;
+	huge = false;
+#ifdef MAP_HUGETLB
+	if (policy.hugePages) {
+		// Explicit huge pages need a reserved pool (vm.nr_hugepages)
+		bytes = (in_bytes + hugeSize - 1) / hugeSize * hugeSize;
+		void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			ptr = p;
+			huge = true;
+		}
+	}
+#endif
+	if (ptr == nullptr) {
+		bytes = (in_bytes + 4095) / 4096 * 4096;
+		void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			std::cerr << boost::format("Could not allocate %.1f MB of sample memory\n") % (in_bytes / 1e6);
+			bytes = 0;
+			return false;
+		}
+		ptr = p;
+#ifdef MADV_HUGEPAGE
+		// No reserved pool: ask for transparent huge pages instead
+		if (policy.hugePages)
+			madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+	}
+
+#ifdef __linux__
+	if (policy.numaNode >= 0 && policy.numaNode < 64) {
+		// mbind(MPOL_BIND) without a libnuma dependency
+		unsigned long mask = 1ul << policy.numaNode;
+		if (syscall(SYS_mbind, ptr, bytes, 2 /* MPOL_BIND */, &mask, sizeof(mask) * 8, 0) != 0)
+			std::cerr << boost::format("Could not bind sample memory to node %d\n") % policy.numaNode;
+	}
+#endif
+
+	memset(ptr, 0, bytes); // first touch
+
+	if (policy.lock) {
+		locked = mlock(ptr, bytes) == 0;
+		if (!locked)
+			std::cerr << boost::format("mlock of %.1f MB failed (raise ulimit -l), sample memory may be paged\n")
+				% (bytes / 1e6);
+	}
+	return true;
+}
+
+void SampleMem::free()
+{
+	if (ptr == nullptr)
+		return;
+	if (locked)
+		munlock(ptr, bytes);
+	munmap(ptr, bytes);
+	ptr = nullptr;
+	bytes = 0;
+	locked = false;
+	huge = false;
+}
+
+#endif
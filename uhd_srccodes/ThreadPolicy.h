@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Scheduling of one pipeline thread (receive, writer, DSP). Applied by the
+// thread itself when it starts, so the defaults leave everything to the OS.
+struct ThreadPolicy
+{
+	int cpu = -1;          // pin to this CPU, -1 = any
+	int rtPriority = 0;    // SCHED_FIFO priority 1..99 (Windows: time critical), 0 = normal scheduling
+	int nice = 0;          // with rtPriority 0: -20..19 (Windows: above/below normal)
+
+	bool isDefault() const { return cpu < 0 && rtPriority == 0 && nice == 0; }
+	std::string describe() const;
+};
+
+// Apply to the calling thread. Failures (usually missing CAP_SYS_NICE or
+// administrator rights) are reported and the thread carries on as it was.
+bool applyThreadPolicy(const ThreadPolicy& policy, const char* name);
+
+// NUMA node of a CPU, -1 if unknown or not NUMA
+int cpuNumaNode(int cpu);
+
+// CPU time the calling thread has used, seconds
+double threadCpuSeconds();
+
+// Placement of large sample buffers
+struct MemPolicy
+{
+	bool lock = false;       // mlock/VirtualLock, so the pages never fault or swap
+	bool hugePages = false;  // 2 MB pages where available (fewer TLB misses)
+	int numaNode = -1;       // bind to this node; -1 = node of the allocating thread (first touch)
+
+	std::string describe() const;
+};
+
+// Page-aligned buffer placed per MemPolicy. Every page is touched by the
+// allocating thread before alloc() returns, so there are no page faults in
+// the receive loop and, with first-touch placement, the pages sit on the
+// allocating thread's node. Allocate from the thread that will write the
+// buffer, after applyThreadPolicy() has pinned it.
+class SampleMem
+{
+private:
+	void* ptr = nullptr;
+	size_t bytes = 0;
+	bool locked = false;
+	bool huge = false;
+
+public:
+	SampleMem() {}
+	~SampleMem() { free(); }
+	SampleMem(const SampleMem&) = delete;
+	SampleMem& operator=(const SampleMem&) = delete;
+
+	bool alloc(size_t in_bytes, const MemPolicy& policy);
+	void free();
+
+	void* get() const { return ptr; }
+	size_t size() const { return bytes; }
+	bool isLocked() const { return locked; }
+	bool isHuge() const { return huge; }
+};
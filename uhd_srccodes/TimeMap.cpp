@@ -0,0 +1,102 @@
+#include "TimeMap.h"
+#include <cmath>
+
+DeviceTime DeviceTime::plus(double dt) const
+{
+	DeviceTime t;
+	double whole = std::floor(dt);
+	t.secs = secs + (int64_t)whole;
+	t.frac = frac + (dt - whole);
+	if (t.frac >= 1.0) {
+		t.secs += 1;
+		t.frac -= 1.0;
+	}
+	return t;
+}
+
+void TimeMap::reset(double in_rate)
+{
+	std::lock_guard<std::mutex> lk(mut);
+	anchors.clear();
+	rate = in_rate;
+}
+
+size_t TimeMap::findAnchor(uint64_t sampOffset) const
+{
+	// Anchors are appended in stream order, so this is a plain upper_bound
+	size_t lo = 0, hi = anchors.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (anchors[mid].sampOffset <= sampOffset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo == 0 ? 0 : lo - 1;
+}
+
+double TimeMap::driftSamps(uint64_t sampOffset, const DeviceTime& time) const
+{
+	std::lock_guard<std::mutex> lk(mut);
+	if (anchors.empty())
+		return 0;
+	const Anchor& a = anchors.back();
+	return time.minus(a.time) * rate - double(int64_t(sampOffset - a.sampOffset));
+}
+
+bool TimeMap::update(uint64_t sampOffset, const DeviceTime& time)
+{
+	// Half a sample of disagreement means the two cannot be the same stream
+	if (!anchors.empty() && std::fabs(driftSamps(sampOffset, time)) < 0.5)
+		return false;
+
+	std::lock_guard<std::mutex> lk(mut);
+	anchors.push_back({ sampOffset, time });
+	return true;
+}
+
+bool TimeMap::empty() const
+{
+	std::lock_guard<std::mutex> lk(mut);
+	return anchors.empty();
+}
+
+DeviceTime TimeMap::timeAt(uint64_t sampOffset) const
+{
+	std::lock_guard<std::mutex> lk(mut);
+	if (anchors.empty())
+		return DeviceTime();
+	const Anchor& a = anchors[findAnchor(sampOffset)];
+	return a.time.plus(double(int64_t(sampOffset - a.sampOffset)) / rate);
+}
+
+uint64_t TimeMap::sampleAt(const DeviceTime& time) const
+{
+	std::lock_guard<std::mutex> lk(mut);
+	if (anchors.empty())
+		return 0;
+
+	// Last anchor whose time is not after the requested time
+	size_t lo = 0, hi = anchors.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (anchors[mid].time.minus(time) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	const Anchor& a = anchors[lo == 0 ? 0 : lo - 1];
+	double ds = std::round(time.minus(a.time) * rate);
+	uint64_t idx = ds <= 0 ? a.sampOffset : a.sampOffset + (uint64_t)ds;
+
+	// Times that fall in a gap map to the first sample after it
+	if (lo < anchors.size() && idx > anchors[lo].sampOffset)
+		idx = anchors[lo].sampOffset;
+	return idx;
+}
+
+std::vector<TimeMap::Anchor> TimeMap::getAnchors() const
+{
+	std::lock_guard<std::mutex> lk(mut);
+	return anchors;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Device time of one stream sample, split like uhd::time_spec_t so that
+// sub-sample precision survives absolute GPS times.
+struct DeviceTime
+{
+	int64_t secs = 0;
+	double frac = 0;    // [0, 1)
+
+	double minus(const DeviceTime& other) const { return double(secs - other.secs) + (frac - other.frac); }
+	DeviceTime plus(double dt) const;
+};
+
+// Piecewise-linear map between stream sample index and device time.
+// An anchor is stored for the first timestamped block and again whenever a
+// block's device time disagrees with the time extrapolated from the
+// previous anchor (overflow, stream restart), so between anchors
+// time = anchor.time + (index - anchor.index) / rate holds exactly.
+// Anchors are rare, so a mutex is enough to share the map with readers on
+// other threads.
+class TimeMap
+{
+public:
+	struct Anchor
+	{
+		uint64_t sampOffset;
+		DeviceTime time;
+	};
+
+private:
+	std::vector<Anchor> anchors;
+	double rate = 0;
+	mutable std::mutex mut;
+
+	size_t findAnchor(uint64_t sampOffset) const; // last anchor at or before sampOffset
+
+public:
+	void reset(double in_rate);
+	double getRate() const { return rate; }
+
+	// Feed the timestamp of the sample at sampOffset. Returns true if it
+	// started a new anchor, i.e. the stream was not time-continuous.
+	bool update(uint64_t sampOffset, const DeviceTime& time);
+
+	// Offset of time from its extrapolated value, in samples. Zero before
+	// the first anchor.
+	double driftSamps(uint64_t sampOffset, const DeviceTime& time) const;
+
+	bool empty() const;
+	DeviceTime timeAt(uint64_t sampOffset) const;
+	uint64_t sampleAt(const DeviceTime& time) const;
+	std::vector<Anchor> getAnchors() const;
+};